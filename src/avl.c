@@ -17,13 +17,15 @@
  * @author Anoop Saldanha
  */
 
+#define HP_LOG_MODULE HP_LOG_MODULE_AVL
+
 #include "honeyprocs-common.h"
 #include "avl.h"
+#include "util-arena.h"
 #include "status.h"
 
-/* Max 32 bit comparison values supported and hence the height should be no
- * longer than 32 */
-#define HP_AVL_MAX_HEIGHT 32
+/* Nodes carved out of a slab in arena mode */
+#define HP_AVL_ARENA_SLAB_NODES 256
 
 typedef struct hp_avl_node_t {
     /* node_leg[0] < node value ; node_leg[1] > node value */
@@ -42,14 +44,21 @@ typedef struct hp_avl_t {
     hp_avl_free_user_data_func_t free_func;
     /* Total no of entries in the tree */
     uint32_t count;
+    uint32_t flags;
+    /* Node storage with HP_AVL_FLAG_ARENA */
+    hp_arena_t arena;
 } hp_avl_t;
 
-hp_avl_node_t *hp_avl_node_alloc(void *data)
+static hp_avl_node_t *hp_avl_node_alloc(hp_avl_t *tree, void *data)
 {
     hp_avl_node_t *node;
     hp_status_t status;
 
-    if ((node = (hp_avl_node_t *)malloc(sizeof(*node))) == NULL) {
+    if (tree->flags & HP_AVL_FLAG_ARENA)
+        node = (hp_avl_node_t *)hp_arena_alloc(&tree->arena);
+    else
+        node = (hp_avl_node_t *)malloc(sizeof(*node));
+    if (node == NULL) {
         status = HP_STATUS_ERROR;
         goto return_status;
     }
@@ -101,7 +110,7 @@ hp_status_t hp_avl_add_entry(hp_avl_t *tree,
     *data_existing = NULL;
 
     if (tree->root == NULL) {
-        tree->root = hp_avl_node_alloc(data);
+        tree->root = hp_avl_node_alloc(tree, data);
         if (tree->root == NULL) {
             status = HP_STATUS_ERROR;
             goto return_status;
@@ -140,7 +149,7 @@ hp_status_t hp_avl_add_entry(hp_avl_t *tree,
         node = node->node_leg[dir];
     }
 
-    if ((node_parent->node_leg[dir] = hp_avl_node_alloc(data)) == NULL) {
+    if ((node_parent->node_leg[dir] = hp_avl_node_alloc(tree, data)) == NULL) {
         status = HP_STATUS_ERROR;
         goto return_status;
     }
@@ -248,9 +257,199 @@ hp_status_t hp_avl_add_entry(hp_avl_t *tree,
     return status;
 }
 
+void *hp_avl_remove(hp_avl_t *tree, void *key)
+{
+    /* The path down to the node removed, starting at a stand-in for the
+     * root's parent, and the leg taken out of each node on it */
+    hp_avl_node_t *path[HP_AVL_MAX_HEIGHT + 1];
+    int jmp[HP_AVL_MAX_HEIGHT + 1];
+    int path_idx;
+    int j;
+    hp_avl_node_t head;
+    hp_avl_node_t *node;
+    hp_avl_node_t *r, *s;
+    hp_avl_node_t *x, *y, *w;
+    void *data;
+    int dir;
+    int cmp;
+
+    data = NULL;
+
+    memset(&head, 0, sizeof(head));
+    head.node_leg[0] = tree->root;
+    path[0] = &head;
+    jmp[0] = 0;
+    path_idx = 1;
+    node = tree->root;
+    while (node != NULL) {
+        cmp = tree->compare_func(key, node->data);
+        if (cmp == 0)
+            break;
+        dir = cmp > 0;
+        BUG_ON(path_idx > HP_AVL_MAX_HEIGHT);
+        path[path_idx] = node;
+        jmp[path_idx++] = dir;
+        node = node->node_leg[dir];
+    }
+    if (node == NULL)
+        goto return_status;
+    data = node->data;
+
+    /* Unlink node, replacing it with its in-order successor if it has two
+     * children. */
+    if (node->node_leg[1] == NULL) {
+        path[path_idx - 1]->node_leg[jmp[path_idx - 1]] = node->node_leg[0];
+    } else {
+        r = node->node_leg[1];
+        if (r->node_leg[0] == NULL) {
+            r->node_leg[0] = node->node_leg[0];
+            r->balance = node->balance;
+            path[path_idx - 1]->node_leg[jmp[path_idx - 1]] = r;
+            jmp[path_idx] = 1;
+            path[path_idx++] = r;
+        } else {
+            j = path_idx++;
+            while (1) {
+                BUG_ON(path_idx > HP_AVL_MAX_HEIGHT);
+                jmp[path_idx] = 0;
+                path[path_idx++] = r;
+                s = r->node_leg[0];
+                if (s->node_leg[0] == NULL)
+                    break;
+                r = s;
+            }
+            s->node_leg[0] = node->node_leg[0];
+            r->node_leg[0] = s->node_leg[1];
+            s->node_leg[1] = node->node_leg[1];
+            s->balance = node->balance;
+            path[j - 1]->node_leg[jmp[j - 1]] = s;
+            jmp[j] = 1;
+            path[j] = s;
+        }
+    }
+
+    if (tree->flags & HP_AVL_FLAG_ARENA)
+        hp_arena_free(&tree->arena, node);
+    else
+        free(node);
+    tree->count--;
+
+    /* Walk back up, fixing balances and rotating, till a subtree keeps
+     * its height. */
+    while (--path_idx > 0) {
+        y = path[path_idx];
+        if (jmp[path_idx] == 0) {
+            y->balance++;
+            if (y->balance == +1)
+                break;
+            if (y->balance == +2) {
+                x = y->node_leg[1];
+                if (x->balance == -1) {
+                    w = x->node_leg[0];
+                    x->node_leg[0] = w->node_leg[1];
+                    w->node_leg[1] = x;
+                    y->node_leg[1] = w->node_leg[0];
+                    w->node_leg[0] = y;
+                    if (w->balance == +1) {
+                        x->balance = 0;
+                        y->balance = -1;
+                    } else if (w->balance == 0) {
+                        x->balance = 0;
+                        y->balance = 0;
+                    } else { /* w->balance == -1 */
+                        x->balance = +1;
+                        y->balance = 0;
+                    }
+                    w->balance = 0;
+                    path[path_idx - 1]->node_leg[jmp[path_idx - 1]] = w;
+                } else {
+                    y->node_leg[1] = x->node_leg[0];
+                    x->node_leg[0] = y;
+                    path[path_idx - 1]->node_leg[jmp[path_idx - 1]] = x;
+                    if (x->balance == 0) {
+                        x->balance = -1;
+                        y->balance = +1;
+                        break;
+                    }
+                    x->balance = 0;
+                    y->balance = 0;
+                }
+            }
+        } else {
+            y->balance--;
+            if (y->balance == -1)
+                break;
+            if (y->balance == -2) {
+                x = y->node_leg[0];
+                if (x->balance == +1) {
+                    w = x->node_leg[1];
+                    x->node_leg[1] = w->node_leg[0];
+                    w->node_leg[0] = x;
+                    y->node_leg[0] = w->node_leg[1];
+                    w->node_leg[1] = y;
+                    if (w->balance == -1) {
+                        x->balance = 0;
+                        y->balance = +1;
+                    } else if (w->balance == 0) {
+                        x->balance = 0;
+                        y->balance = 0;
+                    } else { /* w->balance == +1 */
+                        x->balance = -1;
+                        y->balance = 0;
+                    }
+                    w->balance = 0;
+                    path[path_idx - 1]->node_leg[jmp[path_idx - 1]] = w;
+                } else {
+                    y->node_leg[0] = x->node_leg[1];
+                    x->node_leg[1] = y;
+                    path[path_idx - 1]->node_leg[jmp[path_idx - 1]] = x;
+                    if (x->balance == 0) {
+                        x->balance = +1;
+                        y->balance = -1;
+                        break;
+                    }
+                    x->balance = 0;
+                    y->balance = 0;
+                }
+            }
+        }
+    }
+
+    tree->root = head.node_leg[0];
+
+ return_status:
+    return data;
+}
+
+uint32_t hp_avl_erase_range(hp_avl_t *tree, void *lo, void *hi,
+                            hp_avl_touch_user_data_func_t touch_func,
+                            void *arg)
+{
+    hp_avl_iter_t iter;
+    void *data;
+    uint32_t count;
+
+    /* A removal rebalances the tree under the iterator, so every entry is
+     * looked up afresh. */
+    count = 0;
+    while (1) {
+        hp_avl_iter_seek(tree, &iter, lo);
+        data = hp_avl_iter_next(&iter);
+        if (data == NULL || tree->compare_func(hi, data) <= 0)
+            break;
+        hp_avl_remove(tree, data);
+        if (touch_func != NULL)
+            (*touch_func)(data, arg);
+        count++;
+    }
+
+    return count;
+}
+
 hp_status_t hp_avl_init(hp_avl_t **tree,
                           hp_avl_compare_func_t compare_func,
-                          hp_avl_free_user_data_func_t free_func)
+                          hp_avl_free_user_data_func_t free_func,
+                          uint32_t flags)
 {
     hp_status_t status;
 
@@ -261,6 +460,11 @@ hp_status_t hp_avl_init(hp_avl_t **tree,
     memset(*tree, 0, sizeof(**tree));
     (*tree)->compare_func = compare_func;
     (*tree)->free_func = free_func;
+    (*tree)->flags = flags;
+    if (flags & HP_AVL_FLAG_ARENA) {
+        hp_arena_init(&(*tree)->arena, sizeof(hp_avl_node_t),
+                      HP_AVL_ARENA_SLAB_NODES);
+    }
 
     status = HP_STATUS_OK;
  return_status:
@@ -295,20 +499,141 @@ uint32_t hp_avl_count(hp_avl_t *tree)
     return tree->count;
 }
 
-static void hp_avl_user_data_free_stub(void *data, void *tree_)
+/* The height of a subtree, or -1 if it breaks an invariant.  prev is the
+ * data of the last node visited in order. */
+static int hp_avl_verify_node(hp_avl_t *tree, hp_avl_node_t *node,
+                              void **prev, uint32_t *count)
 {
-    hp_avl_t *tree = (hp_avl_t *)tree_;
+    int height[2];
+
+    if (node == NULL)
+        return 0;
 
-    tree->free_func(data);
+    if ((height[0] = hp_avl_verify_node(tree, node->node_leg[0],
+                                        prev, count)) < 0)
+    {
+        return -1;
+    }
+    if (*prev != NULL && tree->compare_func(*prev, node->data) >= 0)
+        return -1;
+    *prev = node->data;
+    (*count)++;
+    if ((height[1] = hp_avl_verify_node(tree, node->node_leg[1],
+                                        prev, count)) < 0)
+    {
+        return -1;
+    }
+
+    if (node->balance != height[1] - height[0] ||
+        node->balance < -1 || node->balance > 1)
+    {
+        return -1;
+    }
+
+    return 1 + ((height[0] > height[1]) ? height[0] : height[1]);
 }
 
-hp_status_t hp_avl_deinit(hp_avl_t *tree)
+hp_status_t hp_avl_verify(hp_avl_t *tree)
 {
-    if (tree->free_func != NULL) {
-        hp_avl_parse(tree, hp_avl_user_data_free_stub, tree);
+    void *prev = NULL;
+    uint32_t count = 0;
+
+    if (hp_avl_verify_node(tree, tree->root, &prev, &count) < 0 ||
+        count != tree->count)
+    {
+        return HP_STATUS_ERROR;
     }
-    free(tree);
 
     return HP_STATUS_OK;
 }
 
+static void hp_avl_iter_push_left(hp_avl_iter_t *iter, hp_avl_node_t *node)
+{
+    while (node != NULL) {
+        BUG_ON(iter->top == HP_AVL_MAX_HEIGHT);
+        iter->stack[iter->top++] = node;
+        node = node->node_leg[0];
+    }
+
+    return;
+}
+
+void hp_avl_iter_init(hp_avl_t *tree, hp_avl_iter_t *iter)
+{
+    iter->top = 0;
+    hp_avl_iter_push_left(iter, tree->root);
+
+    return;
+}
+
+void hp_avl_iter_seek(hp_avl_t *tree, hp_avl_iter_t *iter, void *key)
+{
+    hp_avl_node_t *node;
+
+    /* Only the nodes not below key are stacked.  Those are exactly the
+     * ones still to be visited along the path. */
+    iter->top = 0;
+    node = tree->root;
+    while (node != NULL) {
+        if (tree->compare_func(key, node->data) <= 0) {
+            BUG_ON(iter->top == HP_AVL_MAX_HEIGHT);
+            iter->stack[iter->top++] = node;
+            node = node->node_leg[0];
+        } else {
+            node = node->node_leg[1];
+        }
+    }
+
+    return;
+}
+
+void *hp_avl_iter_next(hp_avl_iter_t *iter)
+{
+    hp_avl_node_t *node;
+
+    if (iter->top == 0)
+        return NULL;
+
+    node = iter->stack[--iter->top];
+    hp_avl_iter_push_left(iter, node->node_leg[1]);
+
+    return node->data;
+}
+
+static void hp_avl_node_free_all(hp_avl_t *tree, hp_avl_node_t *node)
+{
+    if (node == NULL)
+        return;
+
+    hp_avl_node_free_all(tree, node->node_leg[0]);
+    hp_avl_node_free_all(tree, node->node_leg[1]);
+    if (tree->free_func != NULL)
+        tree->free_func(node->data);
+    if (!(tree->flags & HP_AVL_FLAG_ARENA))
+        free(node);
+
+    return;
+}
+
+void hp_avl_reset(hp_avl_t *tree)
+{
+    /* In arena mode the walk is only needed for the user data. */
+    if (!(tree->flags & HP_AVL_FLAG_ARENA) || tree->free_func != NULL)
+        hp_avl_node_free_all(tree, tree->root);
+    if (tree->flags & HP_AVL_FLAG_ARENA)
+        hp_arena_reset(&tree->arena);
+    tree->root = NULL;
+    tree->count = 0;
+
+    return;
+}
+
+hp_status_t hp_avl_deinit(hp_avl_t *tree)
+{
+    hp_avl_reset(tree);
+    if (tree->flags & HP_AVL_FLAG_ARENA)
+        hp_arena_deinit(&tree->arena);
+    free(tree);
+
+    return HP_STATUS_OK;
+}
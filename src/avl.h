@@ -23,26 +23,83 @@
 #include "honeyprocs-common.h"
 #include "status.h"
 
+/* Nodes come from a per tree arena instead of malloc().  Deinit and reset
+ * then release every node in one go instead of walking the tree. */
+#define HP_AVL_FLAG_ARENA 0x01
+
+/* Max 32 bit comparison values supported and hence the height should be no
+ * longer than 32 */
+#define HP_AVL_MAX_HEIGHT 32
+
 typedef struct hp_avl_t hp_avl_t;
+typedef struct hp_avl_node_t hp_avl_node_t;
+
+/* In-order iterator.  Holds the path to the current node, so walking the
+ * tree needs neither recursion nor allocation. */
+typedef struct hp_avl_iter_t {
+    hp_avl_node_t *stack[HP_AVL_MAX_HEIGHT];
+    int top;
+} hp_avl_iter_t;
+
 typedef void (*hp_avl_touch_user_data_func_t)(void *data, void *arg);
 typedef void (*hp_avl_free_user_data_func_t)(void *data);
 typedef int (*hp_avl_compare_func_t)(void *a, void *b);
 
 hp_status_t hp_avl_init(hp_avl_t **tree,
                           hp_avl_compare_func_t compare_func,
-                          hp_avl_free_user_data_func_t free_func);
+                          hp_avl_free_user_data_func_t free_func,
+                          uint32_t flags);
 
 hp_status_t hp_avl_deinit(hp_avl_t *tree);
 
+/* Drop every entry, leaving an empty tree. */
+void hp_avl_reset(hp_avl_t *tree);
+
 hp_status_t hp_avl_add_entry(hp_avl_t *tree,
                                void *data, void **data_existing);
 
 void *hp_avl_get(hp_avl_t *tree, void *data);
 
+/**
+ * Remove the entry matching key.  The entry's data is handed back and not
+ * freed.
+ *
+ * @retval The removed data, or NULL if no entry matches.
+ */
+void *hp_avl_remove(hp_avl_t *tree, void *key);
+
+/**
+ * Remove every entry not below lo and below hi, i.e. the ones
+ * compare_func(lo, entry) is <= 0 and compare_func(hi, entry) is > 0 for.
+ *
+ * @touch_func Handed the data of each removed entry, say to free it.  Can
+ *             be NULL.
+ * @retval The no of entries removed.
+ */
+uint32_t hp_avl_erase_range(hp_avl_t *tree, void *lo, void *hi,
+                            hp_avl_touch_user_data_func_t touch_func,
+                            void *arg);
+
 void hp_avl_parse(hp_avl_t *tree,
                    hp_avl_touch_user_data_func_t touch_func,
                    void *arg);
 
 uint32_t hp_avl_count(hp_avl_t *tree);
 
+/**
+ * Walk the whole tree checking that it is ordered and balanced, and that
+ * every balance factor and the count are right.  For tests.
+ *
+ * @retval HP_STATUS_ERROR If it isn't.
+ */
+hp_status_t hp_avl_verify(hp_avl_t *tree);
+
+/* Position the iterator before the smallest entry. */
+void hp_avl_iter_init(hp_avl_t *tree, hp_avl_iter_t *iter);
+/* Position the iterator before the smallest entry not below key, i.e. the
+ * first entry compare_func(key, entry) is <= 0 for. */
+void hp_avl_iter_seek(hp_avl_t *tree, hp_avl_iter_t *iter, void *key);
+/* The next entry in order, or NULL past the last one. */
+void *hp_avl_iter_next(hp_avl_iter_t *iter);
+
 #endif /* __AVL__H__ */
@@ -0,0 +1,333 @@
+/**
+ * Copyright(C) 2018, Juniper Networks, Inc.
+ * All rights reserved
+ *
+ * This SOFTWARE is licensed under the license provided in the LICENSE.txt
+ * file.  By downloading, installing, copying, or otherwise using the
+ * SOFTWARE, you agree to be bound by the terms of that license.  This
+ * SOFTWARE is not an official Juniper product.
+ *
+ * Third-Party Code: This SOFTWARE may depend on other components under
+ * separate copyright notice and license terms.  Your use of the source
+ * code for those components is subject to the term and conditions of
+ * the respective license as noted in the Third-Party source code.
+ */
+
+/**
+ * @author Anoop Saldanha
+ */
+
+/* Logs as part of the scanner */
+#define HP_LOG_MODULE HP_LOG_MODULE_SCANNER
+
+#include "honeyprocs-common.h"
+#include "baseline-cache.h"
+#include "mmap.h"
+#include "status.h"
+#include "util-hash.h"
+#include "util-log.h"
+
+struct hp_baseline_image_t {
+    /* Of the intervals, see hp_baseline_gather_() */
+    uint64_t hash;
+    uint32_t count;
+    /* The intervals, relative to where the run starts */
+    hp_mmap_tree_t *mmap_tree;
+    hp_baseline_image_t *next;
+};
+
+struct hp_baseline_interval_t {
+    hp_mmap_addr_t start_addr;
+    hp_mmap_addr_t end_addr;
+    uint32_t state;
+    uint32_t protect;
+    uint32_t type;
+};
+
+#define HP_BASELINE_CACHE_SEED          0x62617365
+/* Image backed intervals further apart are taken as loaded apart, e.g.
+ * an executable and its libraries, which ASLR moves independently. */
+#define HP_BASELINE_CACHE_RUN_GAP       0x40000000ULL
+#define HP_BASELINE_CACHE_INTERVALS_MIN 64
+
+/* A run of image backed intervals, shared at base */
+typedef struct hp_baseline_run_t {
+    hp_mmap_addr_t base;
+    uint64_t hash;
+    /* Its intervals in the cache's */
+    uint32_t first;
+    uint32_t count;
+} hp_baseline_run_t;
+
+/* Gathers the runs of a baseline */
+typedef struct hp_baseline_walk_t {
+    hp_baseline_cache_t *cache;
+    hp_baseline_run_t runs[HP_MMAP_SHARED_MAX];
+    uint32_t run_count;
+    uint32_t count;
+} hp_baseline_walk_t;
+
+static hp_status_t hp_baseline_gather_(hp_mmap_addr_t start_addr,
+                                       hp_mmap_addr_t end_addr,
+                                       uint32_t state,
+                                       uint32_t protect,
+                                       uint32_t type,
+                                       void *walk_)
+{
+    hp_baseline_walk_t *walk = (hp_baseline_walk_t *)walk_;
+    hp_baseline_cache_t *cache = walk->cache;
+    hp_baseline_interval_t *interval;
+    hp_baseline_run_t *run;
+    uint64_t relative[5];
+    uint32_t size;
+
+    if (type != HP_MMAP_TYPE_IMAGE)
+        return HP_STATUS_OK;
+
+    if (walk->count == cache->intervals_size) {
+        size = (cache->intervals_size != 0) ? cache->intervals_size * 2 :
+            HP_BASELINE_CACHE_INTERVALS_MIN;
+        if ((interval = (hp_baseline_interval_t *)
+             realloc(cache->intervals, size * sizeof(*interval))) == NULL)
+        {
+            hp_log_error("realloc() failure.");
+            return HP_STATUS_ERROR;
+        }
+        cache->intervals = interval;
+        cache->intervals_size = size;
+    }
+
+    /* Once there are as many runs as a baseline can share, the last takes
+     * in the rest. */
+    if (walk->run_count == 0 ||
+        (walk->run_count < HP_MMAP_SHARED_MAX &&
+         start_addr - cache->intervals[walk->count - 1].end_addr >
+         HP_BASELINE_CACHE_RUN_GAP))
+    {
+        run = &walk->runs[walk->run_count++];
+        run->base = start_addr;
+        run->hash = HP_BASELINE_CACHE_SEED;
+        run->first = walk->count;
+        run->count = 0;
+    } else {
+        run = &walk->runs[walk->run_count - 1];
+    }
+
+    interval = &cache->intervals[walk->count++];
+    interval->start_addr = start_addr;
+    interval->end_addr = end_addr;
+    interval->state = state;
+    interval->protect = protect;
+    interval->type = type;
+
+    /* Chained, one interval at a time, wherever the run is loaded */
+    relative[0] = start_addr - run->base;
+    relative[1] = end_addr - run->base;
+    relative[2] = state;
+    relative[3] = protect;
+    relative[4] = type;
+    run->hash = hp_hash64((const uint8_t *)relative, sizeof(relative),
+                          run->hash);
+    run->count++;
+
+    return HP_STATUS_OK;
+}
+
+static void hp_baseline_image_free(hp_baseline_image_t *image)
+{
+    if (image->mmap_tree != NULL)
+        hp_mmap_deinit(image->mmap_tree);
+    free(image);
+
+    return;
+}
+
+/* The image of a run, built from its intervals the first time it's seen */
+static hp_status_t hp_baseline_image_get(hp_baseline_cache_t *cache,
+                                         hp_baseline_run_t *run,
+                                         hp_baseline_image_t **image_,
+                                         bool *image_new)
+{
+    hp_baseline_image_t *image;
+    hp_baseline_interval_t *interval;
+    uint32_t i;
+    hp_status_t status;
+
+    *image_new = false;
+    for (image = cache->images; image != NULL; image = image->next) {
+        if (image->hash == run->hash && image->count == run->count) {
+            *image_ = image;
+            status = HP_STATUS_OK;
+            goto return_status;
+        }
+    }
+
+    if ((image = (hp_baseline_image_t *)malloc(sizeof(*image))) == NULL) {
+        hp_log_error("malloc() failure.");
+        status = HP_STATUS_ERROR;
+        goto return_status;
+    }
+    memset(image, 0, sizeof(*image));
+    image->hash = run->hash;
+    image->count = run->count;
+    if (hp_mmap_init(&image->mmap_tree) != HP_STATUS_OK) {
+        hp_baseline_image_free(image);
+        status = HP_STATUS_ERROR;
+        goto return_status;
+    }
+    for (i = 0; i < run->count; i++) {
+        interval = &cache->intervals[run->first + i];
+        if (hp_mmap_track_memory_range(image->mmap_tree,
+                                       interval->start_addr - run->base,
+                                       interval->end_addr -
+                                       interval->start_addr,
+                                       interval->state, interval->protect,
+                                       interval->type) != HP_STATUS_OK)
+        {
+            hp_baseline_image_free(image);
+            status = HP_STATUS_ERROR;
+            goto return_status;
+        }
+    }
+    *image_ = image;
+    *image_new = true;
+
+    status = HP_STATUS_OK;
+ return_status:
+    return status;
+}
+
+/* Swap the intervals of a run in the baseline for its image, shared under
+ * it at the run's base. */
+static hp_status_t hp_baseline_run_share(hp_baseline_cache_t *cache,
+                                         hp_mmap_tree_t *mmap_tree,
+                                         hp_baseline_run_t *run)
+{
+    hp_baseline_image_t *image;
+    hp_baseline_interval_t *interval;
+    bool image_new;
+    uint32_t i;
+    hp_status_t status;
+
+    /* A hit is taken as the same memory, with no walk to confirm it.  The
+     * hash covers the layout and attributes of every interval, and the
+     * count has to match too. */
+    if (hp_baseline_image_get(cache, run, &image,
+                              &image_new) != HP_STATUS_OK)
+    {
+        status = HP_STATUS_ERROR;
+        goto return_status;
+    }
+
+    for (i = 0; i < run->count; i++) {
+        interval = &cache->intervals[run->first + i];
+        hp_mmap_untrack_memory_range(mmap_tree, interval->start_addr,
+                                     interval->end_addr -
+                                     interval->start_addr);
+    }
+    if (hp_mmap_share(mmap_tree, image->mmap_tree,
+                      run->base) != HP_STATUS_OK)
+    {
+        /* Back as they were, in the intervals just freed */
+        for (i = 0; i < run->count; i++) {
+            interval = &cache->intervals[run->first + i];
+            hp_mmap_track_memory_range(mmap_tree, interval->start_addr,
+                                       interval->end_addr -
+                                       interval->start_addr,
+                                       interval->state, interval->protect,
+                                       interval->type);
+        }
+        if (image_new)
+            hp_baseline_image_free(image);
+        status = HP_STATUS_ERROR;
+        goto return_status;
+    }
+
+    if (image_new) {
+        image->next = cache->images;
+        cache->images = image;
+        cache->image_count++;
+    }
+
+    status = HP_STATUS_OK;
+ return_status:
+    return status;
+}
+
+hp_status_t hp_baseline_cache_share(hp_baseline_cache_t *cache,
+                                    hp_mmap_tree_t *mmap_tree)
+{
+    hp_baseline_walk_t walk;
+    uint32_t i;
+    hp_status_t status;
+
+    /* One walk gathers the runs, hashing them as it goes. */
+    memset(&walk, 0, sizeof(walk));
+    walk.cache = cache;
+    if (hp_mmap_parse(mmap_tree, hp_baseline_gather_,
+                      &walk) != HP_STATUS_OK)
+    {
+        status = HP_STATUS_ERROR;
+        goto return_status;
+    }
+
+    status = HP_STATUS_OK;
+    for (i = 0; i < walk.run_count; i++) {
+        if (hp_baseline_run_share(cache, mmap_tree,
+                                  &walk.runs[i]) != HP_STATUS_OK)
+        {
+            hp_log_warning("Unable to share the image run at %" PRIx64
+                           " of a baseline.",
+                           (uint64_t)walk.runs[i].base);
+            status = HP_STATUS_ERROR;
+        }
+    }
+    hp_log_debug("Baseline shares %u image interval(s) in %u run(s), "
+                 "keeping %u of its own.", walk.count, walk.run_count,
+                 hp_mmap_count(mmap_tree) - walk.count);
+
+ return_status:
+    return status;
+}
+
+void hp_baseline_cache_trim(hp_baseline_cache_t *cache)
+{
+    hp_baseline_image_t **prev;
+    hp_baseline_image_t *image;
+
+    prev = &cache->images;
+    while ((image = *prev) != NULL) {
+        if (hp_mmap_is_shared(image->mmap_tree)) {
+            prev = &image->next;
+            continue;
+        }
+        *prev = image->next;
+        cache->image_count--;
+        hp_baseline_image_free(image);
+    }
+
+    return;
+}
+
+void hp_baseline_cache_init(hp_baseline_cache_t *cache)
+{
+    memset(cache, 0, sizeof(*cache));
+
+    return;
+}
+
+void hp_baseline_cache_deinit(hp_baseline_cache_t *cache)
+{
+    hp_baseline_image_t *image;
+
+    while ((image = cache->images) != NULL) {
+        cache->images = image->next;
+        hp_baseline_image_free(image);
+    }
+    cache->image_count = 0;
+    free(cache->intervals);
+    cache->intervals = NULL;
+    cache->intervals_size = 0;
+
+    return;
+}
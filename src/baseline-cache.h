@@ -0,0 +1,69 @@
+/**
+ * Copyright(C) 2018, Juniper Networks, Inc.
+ * All rights reserved
+ *
+ * This SOFTWARE is licensed under the license provided in the LICENSE.txt
+ * file.  By downloading, installing, copying, or otherwise using the
+ * SOFTWARE, you agree to be bound by the terms of that license.  This
+ * SOFTWARE is not an official Juniper product.
+ *
+ * Third-Party Code: This SOFTWARE may depend on other components under
+ * separate copyright notice and license terms.  Your use of the source
+ * code for those components is subject to the term and conditions of
+ * the respective license as noted in the Third-Party source code.
+ */
+
+/**
+ * @author Anoop Saldanha
+ */
+
+/* Baselines of honeyprocs running the same build share the memory their
+ * images are mapped at.  The image backed intervals of a baseline are
+ * kept once per distinct layout, relative to where the images are
+ * loaded, in maps shared under the baseline of each process having them
+ * wherever ASLR put them, and a baseline holds only what is private to
+ * its process. */
+
+#ifndef __BASELINE_CACHE__H__
+#define __BASELINE_CACHE__H__
+
+#include "honeyprocs-common.h"
+#include "mmap.h"
+#include "status.h"
+
+typedef struct hp_baseline_image_t hp_baseline_image_t;
+typedef struct hp_baseline_interval_t hp_baseline_interval_t;
+
+typedef struct hp_baseline_cache_t {
+    /* There are only a few per build, so a list will do. */
+    hp_baseline_image_t *images;
+    uint32_t image_count;
+    /* The image backed intervals of the baseline being shared, kept for
+     * the next one */
+    hp_baseline_interval_t *intervals;
+    uint32_t intervals_size;
+} hp_baseline_cache_t;
+
+void hp_baseline_cache_init(hp_baseline_cache_t *cache);
+void hp_baseline_cache_deinit(hp_baseline_cache_t *cache);
+
+/**
+ * Share the image backed intervals of a fresh baseline, leaving it only
+ * its private ones.  The image backed intervals are taken in runs apart
+ * from each other, e.g. the executable and the libraries, and each run is
+ * looked up by a hash of its intervals relative to where it starts.  So
+ * any two baselines with the same images laid out the same way share
+ * them, wherever they are loaded and whatever binary they come from.
+ *
+ * @mmap_tree The baseline, taken afresh rather than loaded.
+ *
+ * @retval HP_STATUS_ERROR If some run can't be shared, in which case the
+ *         baseline is still good to use, holding that run itself.
+ */
+hp_status_t hp_baseline_cache_share(hp_baseline_cache_t *cache,
+                                    hp_mmap_tree_t *mmap_tree);
+
+/* Free the images no baseline shares any more. */
+void hp_baseline_cache_trim(hp_baseline_cache_t *cache);
+
+#endif /* __BASELINE_CACHE__H__ */
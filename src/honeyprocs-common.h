@@ -30,6 +30,17 @@
 
 #ifdef WINDOWS
 #include <windows.h>
+
+#define hp_sleep_ms(ms) Sleep(ms)
+#else
+#include <unistd.h>
+
+#define hp_sleep_ms(ms) usleep((ms) * 1000)
+
+#define _TRUNCATE ((size_t)-1)
+#define _snprintf_s(buf, size, count, ...) snprintf(buf, size, __VA_ARGS__)
+#define _vsnprintf_s(buf, size, count, format, ap) \
+    vsnprintf(buf, size, format, ap)
 #endif
 
 #define BUG_ON(x) (assert(!(x)))
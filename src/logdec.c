@@ -0,0 +1,550 @@
+/**
+ * Copyright(C) 2018, Juniper Networks, Inc.
+ * All rights reserved
+ *
+ * This SOFTWARE is licensed under the license provided in the LICENSE.txt
+ * file.  By downloading, installing, copying, or otherwise using the
+ * SOFTWARE, you agree to be bound by the terms of that license.  This
+ * SOFTWARE is not an official Juniper product.
+ *
+ * Third-Party Code: This SOFTWARE may depend on other components under
+ * separate copyright notice and license terms.  Your use of the source
+ * code for those components is subject to the term and conditions of
+ * the respective license as noted in the Third-Party source code.
+ */
+
+/**
+ * @author Anoop Saldanha
+ */
+
+/* Offline decoder of binary logs.  Renders each record of a log written
+ * by hp_log_binary_open() as the text line hp_log() would have written,
+ * with a UTC timestamp, or as a JSON object per line with the arguments
+ * alongside. */
+
+#define _CRT_SECURE_NO_WARNINGS
+
+#include <stdarg.h>
+#include <time.h>
+
+#include "honeyprocs-common.h"
+#include "status.h"
+#include "util-log.h"
+#include "util-log-binary.h"
+
+/* Room for a rendered message, or its JSON */
+#define HP_LOGDEC_BUF_SIZE (8 * HP_LOG_RECORD_SIZE)
+
+typedef struct hp_logdec_site_t {
+    bool defined;
+    hp_log_level_t level;
+    uint32_t line;
+    uint32_t arg_count;
+    const uint8_t *arg_kinds;
+    const char *file;
+    const char *function;
+    const char *format;
+} hp_logdec_site_t;
+
+typedef struct hp_logdec_buf_t {
+    char data[HP_LOGDEC_BUF_SIZE];
+    size_t len;
+} hp_logdec_buf_t;
+
+typedef struct hp_logdec_t {
+    bool json;
+    /* Sites by id */
+    hp_logdec_site_t *sites;
+    uint32_t site_max;
+    hp_logdec_buf_t message;
+    hp_logdec_buf_t args;
+    hp_logdec_buf_t line;
+} hp_logdec_t;
+
+static void hp_logdec_printf(hp_logdec_buf_t *buf, const char *format, ...)
+    HP_LOG_FORMAT_CHECK(2);
+
+/* Append to buf, cutting off what doesn't fit. */
+static void hp_logdec_printf(hp_logdec_buf_t *buf, const char *format, ...)
+{
+    va_list ap;
+
+    if (buf->len >= sizeof(buf->data) - 1)
+        return;
+
+    va_start(ap, format);
+    _vsnprintf_s(buf->data + buf->len, sizeof(buf->data) - buf->len,
+                 _TRUNCATE, format, ap);
+    va_end(ap);
+    buf->len += strlen(buf->data + buf->len);
+
+    return;
+}
+
+static void hp_logdec_json_string(hp_logdec_buf_t *buf,
+                                  const char *s, size_t len)
+{
+    size_t i;
+
+    hp_logdec_printf(buf, "\"");
+    for (i = 0; i < len; i++) {
+        if (s[i] == '"' || s[i] == '\\')
+            hp_logdec_printf(buf, "\\%c", s[i]);
+        else if ((uint8_t)s[i] < 0x20)
+            hp_logdec_printf(buf, "\\u%04x", (uint8_t)s[i]);
+        else
+            hp_logdec_printf(buf, "%c", s[i]);
+    }
+    hp_logdec_printf(buf, "\"");
+
+    return;
+}
+
+static const char *hp_logdec_basename(const char *path)
+{
+    const char *p;
+
+    for (p = path; *p != '\0'; p++) {
+        if (*p == '/' || *p == '\\')
+            path = p + 1;
+    }
+
+    return path;
+}
+
+static hp_status_t hp_logdec_define(hp_logdec_t *dec, const uint8_t *payload,
+                                    uint32_t len)
+{
+    const hp_log_bin_site_t *bin_site = (const hp_log_bin_site_t *)payload;
+    hp_logdec_site_t *sites;
+    hp_logdec_site_t *site;
+    const char *strings[3];
+    uint32_t off;
+    uint32_t max;
+    uint32_t i;
+    hp_status_t status;
+
+    if (len < sizeof(*bin_site) ||
+        bin_site->arg_count > HP_LOG_BIN_ARGS_MAX ||
+        len - sizeof(*bin_site) < bin_site->arg_count ||
+        bin_site->level <= HP_LOG_LEVEL_NONE ||
+        bin_site->level >= HP_LOG_LEVEL_MAX ||
+        bin_site->id == 0 || bin_site->id == HP_LOG_BIN_SITE_DEFINE)
+    {
+        goto return_error;
+    }
+    off = sizeof(*bin_site) + bin_site->arg_count;
+    for (i = 0; i < 3; i++) {
+        strings[i] = (const char *)payload + off;
+        while (off < len && payload[off] != '\0')
+            off++;
+        if (off == len)
+            goto return_error;
+        off++;
+    }
+
+    if (bin_site->id >= dec->site_max) {
+        max = (bin_site->id < 64) ? 128 : bin_site->id * 2;
+        if ((sites = (hp_logdec_site_t *)
+             realloc(dec->sites, sizeof(*sites) * max)) == NULL)
+        {
+            hp_log_error("realloc() failure.");
+            status = HP_STATUS_ERROR;
+            goto return_status;
+        }
+        memset(sites + dec->site_max, 0,
+               sizeof(*sites) * (max - dec->site_max));
+        dec->sites = sites;
+        dec->site_max = max;
+    }
+
+    site = &dec->sites[bin_site->id];
+    site->defined = true;
+    site->level = (hp_log_level_t)bin_site->level;
+    site->line = bin_site->line;
+    site->arg_count = bin_site->arg_count;
+    site->arg_kinds = payload + sizeof(*bin_site);
+    site->file = hp_logdec_basename(strings[0]);
+    site->function = strings[1];
+    site->format = strings[2];
+
+    status = HP_STATUS_OK;
+    goto return_status;
+ return_error:
+    hp_log_error("Malformed site definition.");
+    status = HP_STATUS_ERROR;
+ return_status:
+    return status;
+}
+
+/* Take the next argument off a record's payload. */
+static bool hp_logdec_arg(const hp_logdec_site_t *site, uint32_t *arg,
+                          const uint8_t *payload, uint32_t len,
+                          uint32_t *off, uint64_t *v,
+                          const char **s, uint32_t *s_len)
+{
+    uint32_t n;
+
+    if (*arg >= site->arg_count)
+        return false;
+
+    if (site->arg_kinds[(*arg)++] == HP_LOG_ARG_STRING) {
+        if (len - *off < sizeof(n))
+            return false;
+        memcpy(&n, payload + *off, sizeof(n));
+        if (len - *off - sizeof(n) < n)
+            return false;
+        *s = (const char *)payload + *off + sizeof(n);
+        *s_len = n;
+        n += sizeof(n);
+        n = (n + 7) & ~7;
+        *off = (len - *off < n) ? len : *off + n;
+        return true;
+    }
+
+    if (len - *off < sizeof(*v))
+        return false;
+    memcpy(v, payload + *off, sizeof(*v));
+    *off += sizeof(*v);
+
+    return true;
+}
+
+/* Render a record's message, and with JSON, list its arguments. */
+static hp_status_t hp_logdec_render(hp_logdec_t *dec,
+                                    const hp_logdec_site_t *site,
+                                    const uint8_t *payload, uint32_t len)
+{
+    char spec[64];
+    char string[HP_LOG_RECORD_SIZE + 1];
+    const char *format = site->format;
+    hp_log_conv_t conv;
+    const char *s = NULL;
+    uint32_t s_len = 0;
+    uint32_t arg = 0;
+    uint32_t off = 0;
+    uint64_t v = 0;
+    int64_t star;
+    int width;
+    int precision;
+    double d;
+    bool first = true;
+    hp_status_t status;
+
+    dec->message.len = 0;
+    dec->args.len = 0;
+    dec->message.data[0] = '\0';
+    dec->args.data[0] = '\0';
+
+    for (;;) {
+        if (hp_log_conv_next(&format, &conv) != HP_STATUS_OK)
+            goto return_error;
+        hp_logdec_printf(&dec->message, "%.*s",
+                         (int)conv.text_len, conv.text);
+        if (conv.conv == '\0')
+            break;
+        if (conv.conv == '%') {
+            hp_logdec_printf(&dec->message, "%%");
+            continue;
+        }
+
+        width = conv.width;
+        precision = conv.precision;
+        if (conv.width_arg) {
+            if (!hp_logdec_arg(site, &arg, payload, len, &off, &v, &s, &s_len))
+                goto return_error;
+            star = (int64_t)v;
+            width = (star < 0) ? (int)-star : (int)star;
+            if (star < 0 && strlen(conv.flags) < sizeof(conv.flags) - 1)
+                strcat(conv.flags, "-");
+        }
+        if (conv.precision_arg) {
+            if (!hp_logdec_arg(site, &arg, payload, len, &off, &v, &s, &s_len))
+                goto return_error;
+            star = (int64_t)v;
+            precision = (star < 0) ? -1 : (int)star;
+        }
+        if (!hp_logdec_arg(site, &arg, payload, len, &off, &v, &s, &s_len))
+            goto return_error;
+
+        _snprintf_s(spec, sizeof(spec), _TRUNCATE, "%%%s", conv.flags);
+        if (width >= 0)
+            _snprintf_s(spec + strlen(spec), sizeof(spec) - strlen(spec),
+                        _TRUNCATE, "%d", width);
+        if (precision >= 0)
+            _snprintf_s(spec + strlen(spec), sizeof(spec) - strlen(spec),
+                        _TRUNCATE, ".%d", precision);
+
+        if (!first)
+            hp_logdec_printf(&dec->args, ",");
+        first = false;
+
+        switch (conv.conv) {
+            case 'd':
+            case 'i':
+                _snprintf_s(spec + strlen(spec), sizeof(spec) - strlen(spec),
+                            _TRUNCATE, "ll%c", conv.conv);
+                hp_logdec_printf(&dec->message, spec, (long long)v);
+                hp_logdec_printf(&dec->args, "%lld", (long long)v);
+                break;
+            case 'o':
+            case 'u':
+            case 'x':
+            case 'X':
+                _snprintf_s(spec + strlen(spec), sizeof(spec) - strlen(spec),
+                            _TRUNCATE, "ll%c", conv.conv);
+                hp_logdec_printf(&dec->message, spec, (unsigned long long)v);
+                hp_logdec_printf(&dec->args, "%llu", (unsigned long long)v);
+                break;
+            case 'c':
+                strcat(spec, "c");
+                hp_logdec_printf(&dec->message, spec, (int)v);
+                hp_logdec_printf(&dec->args, "%lld", (long long)v);
+                break;
+            case 'p':
+                strcat(spec, "llx");
+                hp_logdec_printf(&dec->message, "0x");
+                hp_logdec_printf(&dec->message, spec, (unsigned long long)v);
+                hp_logdec_printf(&dec->args, "\"0x%llx\"",
+                                 (unsigned long long)v);
+                break;
+            case 's':
+                memcpy(string, s, s_len);
+                string[s_len] = '\0';
+                strcat(spec, "s");
+                hp_logdec_printf(&dec->message, spec, string);
+                hp_logdec_json_string(&dec->args, s, s_len);
+                break;
+            default:
+                memcpy(&d, &v, sizeof(d));
+                _snprintf_s(spec + strlen(spec), sizeof(spec) - strlen(spec),
+                            _TRUNCATE, "%c", conv.conv);
+                hp_logdec_printf(&dec->message, spec, d);
+                /* JSON has no infinities or NaNs */
+                if (d - d == 0)
+                    hp_logdec_printf(&dec->args, "%.17g", d);
+                else
+                    hp_logdec_printf(&dec->args, "null");
+                break;
+        }
+    }
+
+    status = HP_STATUS_OK;
+    goto return_status;
+ return_error:
+    hp_logdec_printf(&dec->message, " <arguments don't match the format>");
+    status = HP_STATUS_ERROR;
+ return_status:
+    return status;
+}
+
+static void hp_logdec_record(hp_logdec_t *dec, const hp_log_bin_record_t *record,
+                             const hp_logdec_site_t *site,
+                             const uint8_t *payload, uint32_t len)
+{
+    char when[64];
+    time_t secs = (time_t)(record->time / 1000000000);
+    uint32_t ns = (uint32_t)(record->time % 1000000000);
+    struct tm *tm;
+
+    hp_logdec_render(dec, site, payload, len);
+
+    if ((tm = gmtime(&secs)) == NULL ||
+        strftime(when, sizeof(when), "%Y-%m-%dT%H:%M:%S", tm) == 0)
+    {
+        strcpy(when, "?");
+    }
+
+    dec->line.len = 0;
+    if (!dec->json) {
+        hp_logdec_printf(&dec->line, "%s.%09uZ (%s:%u)(%s) <%s> - %s\n",
+                         when, ns, site->file, site->line, site->function,
+                         hp_log_level_to_string(site->level),
+                         dec->message.data);
+    } else {
+        hp_logdec_printf(&dec->line, "{\"time\":\"%s.%09uZ\","
+                         "\"time_ns\":%" PRIu64 ",\"level\":\"%s\","
+                         "\"file\":", when, ns, record->time,
+                         hp_log_level_to_string(site->level));
+        hp_logdec_json_string(&dec->line, site->file, strlen(site->file));
+        hp_logdec_printf(&dec->line, ",\"line\":%u,\"function\":", site->line);
+        hp_logdec_json_string(&dec->line, site->function,
+                              strlen(site->function));
+        hp_logdec_printf(&dec->line, ",\"format\":");
+        hp_logdec_json_string(&dec->line, site->format, strlen(site->format));
+        hp_logdec_printf(&dec->line, ",\"message\":");
+        hp_logdec_json_string(&dec->line, dec->message.data,
+                              dec->message.len);
+        hp_logdec_printf(&dec->line, ",\"args\":[%s]}\n", dec->args.data);
+    }
+    fwrite(dec->line.data, 1, dec->line.len, stdout);
+
+    return;
+}
+
+static hp_status_t hp_logdec_read(const char *path, uint8_t **data,
+                                  size_t *len)
+{
+    FILE *fp;
+    long size;
+    hp_status_t status;
+
+    *data = NULL;
+
+    if ((fp = fopen(path, "rb")) == NULL) {
+        hp_log_error("Error opening binary log \"%s\".", path);
+        status = HP_STATUS_ERROR;
+        goto return_status;
+    }
+    if (fseek(fp, 0, SEEK_END) != 0 || (size = ftell(fp)) < 0 ||
+        fseek(fp, 0, SEEK_SET) != 0)
+    {
+        hp_log_error("Error reading binary log \"%s\".", path);
+        status = HP_STATUS_ERROR;
+        goto return_status;
+    }
+    /* 8 byte aligned, for the records */
+    if ((*data = (uint8_t *)malloc((size_t)size + 8)) == NULL) {
+        hp_log_error("malloc() failure.");
+        status = HP_STATUS_ERROR;
+        goto return_status;
+    }
+    *len = fread(*data, 1, (size_t)size, fp);
+
+    status = HP_STATUS_OK;
+ return_status:
+    if (fp != NULL)
+        fclose(fp);
+    return status;
+}
+
+static hp_status_t hp_logdec_decode(hp_logdec_t *dec, const uint8_t *data,
+                                    size_t data_len)
+{
+    const hp_log_bin_header_t *header = (const hp_log_bin_header_t *)data;
+    const hp_log_bin_record_t *record;
+    const hp_logdec_site_t *site;
+    uint64_t end;
+    uint64_t off;
+    uint32_t site_id;
+    uint64_t skipped = 0;
+    hp_status_t status;
+
+    if (data_len < sizeof(*header) ||
+        memcmp(header->magic, HP_LOG_BIN_MAGIC, sizeof(header->magic)) != 0)
+    {
+        hp_log_error("Not a binary log.");
+        status = HP_STATUS_ERROR;
+        goto return_status;
+    }
+    if (header->version != HP_LOG_BIN_VERSION) {
+        hp_log_error("Binary log version %u isn't supported.",
+                     header->version);
+        status = HP_STATUS_ERROR;
+        goto return_status;
+    }
+
+    end = header->tail;
+    if (end > header->size)
+        end = header->size;
+    if (end > data_len)
+        end = data_len;
+
+    for (off = header->header_size;
+         off + sizeof(*record) <= end;
+         off += record->len)
+    {
+        record = (const hp_log_bin_record_t *)(data + off);
+        /* The zeroes left at the end of a full log, that the record
+         * reserved past the end didn't fit in */
+        if (record->len == 0 && header->tail > header->size)
+            break;
+        if (record->len < sizeof(*record) || (record->len & 7) != 0 ||
+            record->len > end - off)
+        {
+            hp_log_error("Malformed record at %" PRIu64 ".", off);
+            status = HP_STATUS_ERROR;
+            goto return_status;
+        }
+        site_id = record->site;
+        if (site_id == 0) {
+            /* Never finished */
+            skipped++;
+            continue;
+        }
+        if (site_id == HP_LOG_BIN_SITE_DEFINE) {
+            if (hp_logdec_define(dec, (const uint8_t *)(record + 1),
+                                 record->len - sizeof(*record)) !=
+                HP_STATUS_OK)
+            {
+                status = HP_STATUS_ERROR;
+                goto return_status;
+            }
+            continue;
+        }
+        if (site_id >= dec->site_max || !dec->sites[site_id].defined) {
+            hp_log_error("Record at %" PRIu64 " of undefined site %u.",
+                         off, site_id);
+            status = HP_STATUS_ERROR;
+            goto return_status;
+        }
+        site = &dec->sites[site_id];
+        hp_logdec_record(dec, record, site, (const uint8_t *)(record + 1),
+                         record->len - sizeof(*record));
+    }
+
+    if (skipped != 0) {
+        fprintf(stderr, "%" PRIu64 " record(s) left unfinished.\n",
+                skipped);
+    }
+    if (header->dropped != 0) {
+        fprintf(stderr, "%" PRIu64 " record(s) dropped, the log being "
+                "full.\n", (uint64_t)header->dropped);
+    }
+
+    status = HP_STATUS_OK;
+ return_status:
+    return status;
+}
+
+int main(int argc, char *argv[])
+{
+    hp_logdec_t *dec = NULL;
+    uint8_t *data = NULL;
+    size_t data_len;
+    int argi = 1;
+    int ret = EXIT_FAILURE;
+
+    hp_log_init(HP_LOG_LEVEL_ERROR, NULL);
+
+    if ((dec = (hp_logdec_t *)malloc(sizeof(*dec))) == NULL) {
+        hp_log_error("malloc() failure.");
+        goto return_status;
+    }
+    memset(dec, 0, sizeof(*dec));
+
+    if (argi < argc && strcmp(argv[argi], "-j") == 0) {
+        dec->json = true;
+        argi++;
+    }
+    if (argi + 1 != argc) {
+        printf("logdec.exe [-j] <binary_log_file>\n");
+        printf("  -j  One JSON object per record, rather than text.\n");
+        goto return_status;
+    }
+
+    if (hp_logdec_read(argv[argi], &data, &data_len) != HP_STATUS_OK ||
+        hp_logdec_decode(dec, data, data_len) != HP_STATUS_OK)
+    {
+        goto return_status;
+    }
+
+    ret = EXIT_SUCCESS;
+ return_status:
+    fflush(stdout);
+    free(data);
+    if (dec != NULL)
+        free(dec->sites);
+    free(dec);
+    return ret;
+}
@@ -17,107 +17,555 @@
  * @author Anoop Saldanha
  */
 
+#define HP_LOG_MODULE HP_LOG_MODULE_MMAP
+
 #include "honeyprocs-common.h"
 #include "avl.h"
 #include "util-log.h"
 #include "mmap.h"
+#include "util-arena.h"
+#include "util-file-map.h"
+#include "util-hash.h"
 #include "align.h"
 #include "status.h"
 
+/* A tracked region of memory.  Adjacent pages sharing the same state,
+ * protect and type are coalesced into a single [start_addr, end_addr)
+ * interval, so the tree grows with the no of regions and not pages. */
 typedef struct hp_mmap_t {
-    uint32_t page_start_addr;
-    uint32_t page_end_addr;
+    hp_mmap_addr_t start_addr;
+    hp_mmap_addr_t end_addr;
     uint32_t state;
     uint32_t protect;
     uint32_t type;
+    /* Always 0.  Saved maps hold intervals as they are, so the layout is
+     * spelt out. */
+    uint32_t reserved;
+    /* Resident bytes, when the backend reports it.  Not compared. */
+    uint64_t rss;
 } hp_mmap_t;
 
+/* A walk over the intervals a map holds itself, in the tree or the file
+ * it was loaded from */
+typedef struct hp_mmap_source_t {
+    struct hp_mmap_tree_t *mmap_tree;
+    hp_avl_iter_t avl_iter;
+    /* Set when walking a loaded map */
+    const hp_mmap_t *next;
+    const hp_mmap_t *end;
+    /* Added to the addresses of the intervals, for a shared map */
+    hp_mmap_addr_t base;
+    /* The next interval, when merging with other sources */
+    hp_mmap_t *head;
+    /* The intervals are in a tree of the map being walked */
+    bool writable;
+} hp_mmap_source_t;
+
+/* A walk over all the intervals of a map, merging in those of the maps
+ * shared under it */
+typedef struct hp_mmap_iter_t {
+    /* The map's own intervals first, then one per shared map */
+    hp_mmap_source_t sources[1 + HP_MMAP_SHARED_MAX];
+    uint32_t source_count;
+    /* An interval of a map shared at a base, moved to where it shows up.
+     * Good till the next step. */
+    hp_mmap_t rebased;
+    /* Whether the interval last handed out can be written to */
+    bool writable;
+} hp_mmap_iter_t;
+
+/* A map shared under another, at base */
+typedef struct hp_mmap_layer_t {
+    struct hp_mmap_tree_t *mmap_tree;
+    hp_mmap_addr_t base;
+} hp_mmap_layer_t;
+
 typedef struct hp_mmap_tree_t {
     hp_avl_t *mmap_tree_avl;
+    /* The interval last added or extended.  Regions are almost always
+     * tracked in ascending order, so this lets us coalesce without a
+     * tree lookup. */
+    hp_mmap_t *mmap_last;
+    /* Storage for the intervals.  The avl nodes come from the tree's own
+     * arena, so dropping the whole map is two arena resets. */
+    hp_arena_t mmap_arena;
+    /* A map loaded by hp_mmap_load() is read straight out of the file,
+     * as intervals in address order, and the tree is left empty.  The
+     * first change to the map copies them into the tree. */
+    hp_file_map_t frozen_map;
+    const hp_mmap_t *frozen;
+    uint32_t frozen_count;
+    /* Intervals held by other maps, layered under this one's.  See
+     * hp_mmap_share(). */
+    hp_mmap_layer_t shared[HP_MMAP_SHARED_MAX];
+    uint32_t shared_count;
+    /* Maps this one is shared under, plus one for its owner */
+    uint32_t refs;
+    /* The walk of hp_mmap_update_begin(), allocated by the first */
+    hp_mmap_iter_t *update_iter;
 } hp_mmap_tree_t;
 
-typedef struct hp_mmap_list_t {
-    uint32_t size;
-    uint32_t idx_insert;
-    hp_mmap_t *list[];
-} hp_mmap_list_t;
+/* Intervals carved out of a slab */
+#define HP_MMAP_ARENA_SLAB_ENTRIES 256
+
+/* A saved map - this header, followed by its intervals in address order,
+ * all in the byte order of the host that saved it. */
+typedef struct hp_mmap_file_header_t {
+    char magic[8];
+    uint32_t version;
+    /* HP_MMAP_FILE_BYTE_ORDER as written */
+    uint32_t byte_order;
+    /* Where the intervals start, a multiple of 8 */
+    uint32_t header_size;
+    /* sizeof(hp_mmap_t) */
+    uint32_t entry_size;
+    uint32_t count;
+    uint32_t reserved;
+    /* hp_hash64() of the intervals */
+    uint64_t checksum;
+    uint64_t tag;
+    uint8_t reserved2[16];
+} hp_mmap_file_header_t;
+
+#define HP_MMAP_FILE_MAGIC      "HPMMAP\0\0"
+#define HP_MMAP_FILE_VERSION    1
+#define HP_MMAP_FILE_BYTE_ORDER 0x01020304
+#define HP_MMAP_FILE_SEED       0x6d6d6170
+
+static void hp_mmap_source_init(hp_mmap_tree_t *mmap_tree,
+                                hp_mmap_source_t *source,
+                                hp_mmap_addr_t base)
+{
+    source->mmap_tree = mmap_tree;
+    source->base = base;
+    source->head = NULL;
+    source->writable = false;
+    if (mmap_tree->frozen != NULL) {
+        source->next = mmap_tree->frozen;
+        source->end = mmap_tree->frozen + mmap_tree->frozen_count;
+    } else {
+        source->next = source->end = NULL;
+        hp_avl_iter_init(mmap_tree->mmap_tree_avl, &source->avl_iter);
+    }
 
-static hp_mmap_list_t *hp_mmap_list_alloc(uint32_t size)
+    return;
+}
+
+/* Start the walk from the first interval not wholly below key, which is
+ * where the intervals show up, base and all. */
+static void hp_mmap_source_seek(hp_mmap_source_t *source, hp_mmap_t *key)
 {
-    hp_mmap_list_t *mmap_list;
-    uint32_t alloc_size;
+    hp_mmap_tree_t *mmap_tree = source->mmap_tree;
+    const hp_mmap_t *lo;
+    const hp_mmap_t *mid;
+    hp_mmap_t key_own;
+    uint32_t count;
 
-    alloc_size = sizeof(*mmap_list) + (sizeof(hp_mmap_t *) * size);
+    /* From the first, if base is past key */
+    key_own.start_addr = (key->start_addr > source->base) ?
+        key->start_addr - source->base : 0;
+    key_own.end_addr = key_own.start_addr + 1;
+    key = &key_own;
 
-    if ((mmap_list = malloc(alloc_size)) == NULL) {
-        hp_log_error("malloc() failure.");
-        goto return_status;
+    if (mmap_tree->frozen == NULL) {
+        source->next = source->end = NULL;
+        hp_avl_iter_seek(mmap_tree->mmap_tree_avl, &source->avl_iter, key);
+        return;
     }
-    memset(mmap_list, 0, alloc_size);
-    mmap_list->size = size;
-    mmap_list->idx_insert = 0;
 
- return_status:
-    return mmap_list;
+    lo = mmap_tree->frozen;
+    count = mmap_tree->frozen_count;
+    while (count != 0) {
+        mid = lo + count / 2;
+        if (mid->end_addr <= key->start_addr) {
+            lo = mid + 1;
+            count -= count / 2 + 1;
+        } else {
+            count /= 2;
+        }
+    }
+    source->next = lo;
+    source->end = mmap_tree->frozen + mmap_tree->frozen_count;
+
+    return;
 }
 
-static void hp_mmap_list_free(hp_mmap_list_t *mmap_list)
+/* A loaded map's intervals are read only, and must not be written to. */
+static hp_mmap_t *hp_mmap_source_next(hp_mmap_source_t *source)
 {
-    free(mmap_list);
+    if (source->end != NULL) {
+        return (source->next < source->end) ?
+            (hp_mmap_t *)source->next++ : NULL;
+    }
+
+    return (hp_mmap_t *)hp_avl_iter_next(&source->avl_iter);
 }
 
-static hp_mmap_t *hp_mmap_alloc(uint32_t page_start_addr,
-                                uint32_t page_end_addr,
+/* Point the sources at the start of the map and those shared under it. */
+static void hp_mmap_iter_sources(hp_mmap_tree_t *mmap_tree,
+                                 hp_mmap_iter_t *iter)
+{
+    uint32_t i;
+
+    hp_mmap_source_init(mmap_tree, &iter->sources[0], 0);
+    iter->sources[0].writable = (mmap_tree->frozen == NULL);
+    iter->writable = iter->sources[0].writable;
+    for (i = 0; i < mmap_tree->shared_count; i++) {
+        hp_mmap_source_init(mmap_tree->shared[i].mmap_tree,
+                            &iter->sources[i + 1],
+                            mmap_tree->shared[i].base);
+    }
+    iter->source_count = mmap_tree->shared_count + 1;
+
+    return;
+}
+
+/* Take the first interval of each source, to merge them by. */
+static void hp_mmap_iter_heads(hp_mmap_iter_t *iter)
+{
+    uint32_t i;
+
+    if (iter->source_count == 1)
+        return;
+    for (i = 0; i < iter->source_count; i++)
+        iter->sources[i].head = hp_mmap_source_next(&iter->sources[i]);
+
+    return;
+}
+
+static void hp_mmap_iter_init(hp_mmap_tree_t *mmap_tree,
+                              hp_mmap_iter_t *iter)
+{
+    hp_mmap_iter_sources(mmap_tree, iter);
+    hp_mmap_iter_heads(iter);
+
+    return;
+}
+
+static void hp_mmap_iter_seek(hp_mmap_tree_t *mmap_tree,
+                              hp_mmap_iter_t *iter,
+                              hp_mmap_t *key)
+{
+    uint32_t i;
+
+    hp_mmap_iter_sources(mmap_tree, iter);
+    for (i = 0; i < iter->source_count; i++)
+        hp_mmap_source_seek(&iter->sources[i], key);
+    hp_mmap_iter_heads(iter);
+
+    return;
+}
+
+/* The intervals of a loaded or shared map must not be written to. */
+static hp_mmap_t *hp_mmap_iter_next(hp_mmap_iter_t *iter)
+{
+    hp_mmap_source_t *source;
+    hp_mmap_source_t *first = NULL;
+    hp_mmap_t *mmap;
+    uint32_t i;
+
+    if (iter->source_count == 1)
+        return hp_mmap_source_next(&iter->sources[0]);
+
+    /* None of them overlap, so the lowest start comes first. */
+    for (i = 0; i < iter->source_count; i++) {
+        source = &iter->sources[i];
+        if (source->head != NULL &&
+            (first == NULL ||
+             source->head->start_addr + source->base <
+             first->head->start_addr + first->base))
+        {
+            first = source;
+        }
+    }
+    if (first == NULL)
+        return NULL;
+
+    mmap = first->head;
+    first->head = hp_mmap_source_next(first);
+    iter->writable = first->writable;
+    if (first->base == 0)
+        return mmap;
+
+    iter->rebased = *mmap;
+    iter->rebased.start_addr += first->base;
+    iter->rebased.end_addr += first->base;
+    return &iter->rebased;
+}
+
+static hp_mmap_t *hp_mmap_alloc(hp_mmap_tree_t *mmap_tree,
+                                hp_mmap_addr_t start_addr,
+                                hp_mmap_addr_t end_addr,
                                 uint32_t state,
                                 uint32_t protect,
                                 uint32_t type)
 {
     hp_mmap_t *mmap;
 
-    mmap = (hp_mmap_t *)malloc(sizeof(*mmap));
-    if (mmap == NULL) {
-        hp_log_error("malloc() failure.");
+    if ((mmap = (hp_mmap_t *)hp_arena_alloc(&mmap_tree->mmap_arena)) == NULL)
         goto return_status;
-    }
     memset(mmap, 0, sizeof(*mmap));
-    mmap->page_start_addr = page_start_addr;
-    mmap->page_end_addr = page_end_addr;
+    mmap->start_addr = start_addr;
+    mmap->end_addr = end_addr;
+    mmap->state = state;
+    mmap->protect = protect;
+    mmap->type = type;
 
  return_status:
     return mmap;
 }
 
-static void hp_mmap_free(hp_mmap_t *mmap)
+static void hp_mmap_free(hp_mmap_tree_t *mmap_tree, hp_mmap_t *mmap)
 {
-    free(mmap);
+    hp_arena_free(&mmap_tree->mmap_arena, mmap);
     return;
 }
 
+/* Overlapping intervals compare equal.  This keeps the intervals in the
+ * tree disjoint and lets hp_avl_get() find the interval holding an
+ * address. */
 static int hp_mmap_cmp(void *mmap1_, void *mmap2_)
 {
     hp_mmap_t *mmap1 = (hp_mmap_t *)mmap1_;
     hp_mmap_t *mmap2 = (hp_mmap_t *)mmap2_;
 
-    return (mmap1->page_start_addr - mmap2->page_start_addr);
+    if (mmap1->end_addr <= mmap2->start_addr)
+        return -1;
+    if (mmap1->start_addr >= mmap2->end_addr)
+        return 1;
+
+    return 0;
 }
 
-hp_status_t hp_mmap_track_memory(hp_mmap_tree_t *mmap_tree,
-                                 uint32_t addr,
-                                 uint32_t state,
-                                 uint32_t protect,
-                                 uint32_t type)
+static bool hp_mmap_attrs_same(hp_mmap_t *mmap,
+                               uint32_t state,
+                               uint32_t protect,
+                               uint32_t type)
 {
+    return (mmap->state == state &&
+            mmap->protect == protect &&
+            mmap->type == type);
+}
+
+/* Absorb the interval starting where mmap ends, if it has the same
+ * attributes.  Keeps the map coalesced when a range fills the gap between
+ * two matching intervals. */
+static void hp_mmap_merge_next(hp_mmap_tree_t *mmap_tree, hp_mmap_t *mmap)
+{
+    hp_mmap_t *mmap_next;
+    hp_mmap_t key;
+
+    key.start_addr = mmap->end_addr;
+    key.end_addr = mmap->end_addr + 1;
+    mmap_next = (hp_mmap_t *)hp_avl_get(mmap_tree->mmap_tree_avl, &key);
+    if (mmap_next == NULL ||
+        !hp_mmap_attrs_same(mmap_next, mmap->state,
+                            mmap->protect, mmap->type))
+    {
+        return;
+    }
+
+    hp_avl_remove(mmap_tree->mmap_tree_avl, mmap_next);
+    mmap->end_addr = mmap_next->end_addr;
+    mmap->rss += mmap_next->rss;
+    hp_mmap_free(mmap_tree, mmap_next);
+
+    return;
+}
+
+/* Copy the intervals of a source into the tree.  On failure those copied
+ * are taken out again, leaving the tree as it was. */
+static hp_status_t hp_mmap_thaw_source(hp_mmap_tree_t *mmap_tree,
+                                       hp_mmap_tree_t *src,
+                                       hp_mmap_addr_t base)
+{
+    hp_mmap_source_t source;
+    hp_mmap_t *from;
     hp_mmap_t *mmap;
     hp_mmap_t *mmap_existing;
-    uint32_t page_start_addr;
-    uint32_t page_end_addr;
+    hp_mmap_t key;
+    uint32_t count;
     hp_status_t status;
 
-    page_start_addr = addr;
-    ALIGN_DOWN(page_start_addr, HP_MMAP_PAGE_SIZE);
-    page_end_addr = page_start_addr + (HP_MMAP_PAGE_SIZE - 1);
+    count = 0;
+    hp_mmap_source_init(src, &source, base);
+    while ((from = hp_mmap_source_next(&source)) != NULL) {
+        mmap = hp_mmap_alloc(mmap_tree, from->start_addr + base,
+                             from->end_addr + base,
+                             from->state, from->protect, from->type);
+        if (mmap == NULL) {
+            status = HP_STATUS_ERROR;
+            goto return_status;
+        }
+        mmap->rss = from->rss;
+        if (hp_avl_add_entry(mmap_tree->mmap_tree_avl, mmap,
+                             (void **)&mmap_existing) != HP_STATUS_OK)
+        {
+            hp_mmap_free(mmap_tree, mmap);
+            status = HP_STATUS_ERROR;
+            goto return_status;
+        }
+        count++;
+    }
+
+    status = HP_STATUS_OK;
+ return_status:
+    if (status != HP_STATUS_OK) {
+        hp_log_error("Unable to copy the intervals of a map into its tree.");
+        hp_mmap_source_init(src, &source, base);
+        for (; count > 0; count--) {
+            from = hp_mmap_source_next(&source);
+            key.start_addr = from->start_addr + base;
+            key.end_addr = from->end_addr + base;
+            mmap = (hp_mmap_t *)hp_avl_get(mmap_tree->mmap_tree_avl, &key);
+            hp_avl_remove(mmap_tree->mmap_tree_avl, mmap);
+            hp_mmap_free(mmap_tree, mmap);
+        }
+    }
+    return status;
+}
 
-    mmap = hp_mmap_alloc(page_start_addr, page_end_addr,
+/* Whether a shared map holds anything in [start_addr, end_addr) */
+static bool hp_mmap_layer_reaches(hp_mmap_layer_t *layer,
+                                  hp_mmap_addr_t start_addr,
+                                  hp_mmap_addr_t end_addr)
+{
+    hp_mmap_source_t source;
+    hp_mmap_t *mmap;
+    hp_mmap_t key;
+
+    key.start_addr = start_addr;
+    key.end_addr = start_addr + 1;
+    hp_mmap_source_init(layer->mmap_tree, &source, layer->base);
+    hp_mmap_source_seek(&source, &key);
+    mmap = hp_mmap_source_next(&source);
+
+    return (mmap != NULL && mmap->start_addr + layer->base < end_addr);
+}
+
+/* Copy the intervals of a loaded map into the tree, ahead of changing
+ * [start_addr, end_addr) of it, along with those of the shared maps the
+ * range reaches into.  The rest stay shared. */
+static hp_status_t hp_mmap_thaw_range(hp_mmap_tree_t *mmap_tree,
+                                      hp_mmap_addr_t start_addr,
+                                      hp_mmap_addr_t end_addr)
+{
+    hp_mmap_layer_t *layer;
+    uint32_t i;
+    hp_status_t status;
+
+    if (mmap_tree->frozen != NULL) {
+        if (hp_mmap_thaw_source(mmap_tree, mmap_tree, 0) != HP_STATUS_OK) {
+            status = HP_STATUS_ERROR;
+            goto return_status;
+        }
+        hp_file_map_close(&mmap_tree->frozen_map);
+        mmap_tree->frozen = NULL;
+        mmap_tree->frozen_count = 0;
+    }
+
+    /* One at a time, so that the map is whole if one can't be copied. */
+    for (i = mmap_tree->shared_count; i-- > 0;) {
+        layer = &mmap_tree->shared[i];
+        if (!hp_mmap_layer_reaches(layer, start_addr, end_addr))
+            continue;
+        if (hp_mmap_thaw_source(mmap_tree, layer->mmap_tree,
+                                layer->base) != HP_STATUS_OK)
+        {
+            status = HP_STATUS_ERROR;
+            goto return_status;
+        }
+        hp_mmap_deinit(layer->mmap_tree);
+        memmove(layer, layer + 1,
+                (mmap_tree->shared_count - i - 1) * sizeof(*layer));
+        mmap_tree->shared_count--;
+    }
+
+    status = HP_STATUS_OK;
+ return_status:
+    return status;
+}
+
+hp_status_t hp_mmap_track_memory_range(hp_mmap_tree_t *mmap_tree,
+                                       hp_mmap_addr_t addr,
+                                       hp_mmap_addr_t size,
+                                       uint32_t state,
+                                       uint32_t protect,
+                                       uint32_t type)
+{
+    hp_mmap_t *mmap;
+    hp_mmap_t *mmap_existing;
+    hp_mmap_t key;
+    hp_mmap_addr_t start_addr;
+    hp_mmap_addr_t end_addr;
+    hp_status_t status;
+
+    start_addr = addr;
+    ALIGN_DOWN(start_addr, HP_MMAP_PAGE_SIZE);
+    end_addr = addr + size;
+    ALIGN_UP(end_addr, HP_MMAP_PAGE_SIZE);
+    if (end_addr <= start_addr) {
+        status = HP_STATUS_OK;
+        goto return_status;
+    }
+
+    if (hp_mmap_thaw_range(mmap_tree, start_addr,
+                           end_addr) != HP_STATUS_OK)
+    {
+        status = HP_STATUS_ERROR;
+        goto return_status;
+    }
+
+    /* Fast path - the range continues the interval we last touched. */
+    mmap = mmap_tree->mmap_last;
+    if (mmap != NULL && mmap->end_addr == start_addr &&
+        hp_mmap_attrs_same(mmap, state, protect, type))
+    {
+        key.start_addr = start_addr;
+        key.end_addr = end_addr;
+        if (hp_avl_get(mmap_tree->mmap_tree_avl, &key) == NULL) {
+            mmap->end_addr = end_addr;
+            hp_mmap_merge_next(mmap_tree, mmap);
+            status = HP_STATUS_OK;
+            goto return_status;
+        }
+    }
+
+    /* Extend the interval that ends where this range starts. */
+    if (start_addr != 0) {
+        key.start_addr = start_addr - 1;
+        key.end_addr = start_addr;
+        mmap = (hp_mmap_t *)hp_avl_get(mmap_tree->mmap_tree_avl, &key);
+        if (mmap != NULL && hp_mmap_attrs_same(mmap, state, protect, type)) {
+            key.start_addr = start_addr;
+            key.end_addr = end_addr;
+            if (hp_avl_get(mmap_tree->mmap_tree_avl, &key) == NULL) {
+                mmap->end_addr = end_addr;
+                hp_mmap_merge_next(mmap_tree, mmap);
+                mmap_tree->mmap_last = mmap;
+                status = HP_STATUS_OK;
+                goto return_status;
+            }
+        }
+    }
+
+    /* Or the interval that starts where this range ends.  The one before
+     * did not match, so there is nothing else to merge. */
+    key.start_addr = end_addr;
+    key.end_addr = end_addr + 1;
+    mmap = (hp_mmap_t *)hp_avl_get(mmap_tree->mmap_tree_avl, &key);
+    if (mmap != NULL && hp_mmap_attrs_same(mmap, state, protect, type)) {
+        key.start_addr = start_addr;
+        key.end_addr = end_addr;
+        if (hp_avl_get(mmap_tree->mmap_tree_avl, &key) == NULL) {
+            mmap->start_addr = start_addr;
+            mmap_tree->mmap_last = mmap;
+            status = HP_STATUS_OK;
+            goto return_status;
+        }
+    }
+
+    mmap = hp_mmap_alloc(mmap_tree, start_addr, end_addr,
                          state, protect, type);
     if (mmap == NULL) {
         status = HP_STATUS_ERROR;
@@ -127,12 +575,99 @@ hp_status_t hp_mmap_track_memory(hp_mmap_tree_t *mmap_tree,
     if (hp_avl_add_entry(mmap_tree->mmap_tree_avl, mmap,
                           (void **)&mmap_existing) != HP_STATUS_OK)
     {
-        hp_mmap_free(mmap);
+        hp_mmap_free(mmap_tree, mmap);
 
+        /* Memory already tracked is left as is. */
         if (mmap_existing == NULL) {
             status = HP_STATUS_ERROR;
             goto return_status;
         }
+    } else {
+        mmap_tree->mmap_last = mmap;
+    }
+
+    status = HP_STATUS_OK;
+ return_status:
+    return status;
+}
+
+hp_status_t hp_mmap_track_memory(hp_mmap_tree_t *mmap_tree,
+                                 hp_mmap_addr_t addr,
+                                 uint32_t state,
+                                 uint32_t protect,
+                                 uint32_t type)
+{
+    return hp_mmap_track_memory_range(mmap_tree, addr, 1,
+                                      state, protect, type);
+}
+
+hp_status_t hp_mmap_add_rss(hp_mmap_tree_t *mmap_tree,
+                            hp_mmap_addr_t addr,
+                            uint64_t rss)
+{
+    hp_mmap_t *mmap;
+    hp_mmap_t key;
+    hp_status_t status;
+
+    /* Not worth copying the intervals in for */
+    if (mmap_tree->frozen != NULL) {
+        status = HP_STATUS_OK;
+        goto return_status;
+    }
+
+    key.start_addr = addr;
+    key.end_addr = addr + 1;
+    mmap = (hp_mmap_t *)hp_avl_get(mmap_tree->mmap_tree_avl, &key);
+    if (mmap == NULL) {
+        status = (mmap_tree->shared_count != 0) ? HP_STATUS_OK :
+            HP_STATUS_ERROR;
+        goto return_status;
+    }
+    mmap->rss += rss;
+
+    status = HP_STATUS_OK;
+ return_status:
+    return status;
+}
+
+hp_status_t hp_mmap_copy_range(hp_mmap_tree_t *mmap_tree_dst,
+                               hp_mmap_tree_t *mmap_tree_src,
+                               hp_mmap_addr_t start_addr,
+                               hp_mmap_addr_t end_addr)
+{
+    hp_mmap_iter_t iter;
+    hp_mmap_t *mmap;
+    hp_mmap_t key;
+    hp_mmap_addr_t copy_start;
+    hp_mmap_addr_t copy_end;
+    hp_status_t status;
+
+    /* Start from the interval holding start_addr, if any. */
+    key.start_addr = start_addr;
+    key.end_addr = start_addr + 1;
+    hp_mmap_iter_seek(mmap_tree_src, &iter, &key);
+    while ((mmap = hp_mmap_iter_next(&iter)) != NULL &&
+           mmap->start_addr < end_addr)
+    {
+        copy_start = (mmap->start_addr > start_addr) ?
+            mmap->start_addr : start_addr;
+        copy_end = (mmap->end_addr < end_addr) ? mmap->end_addr : end_addr;
+        if (hp_mmap_track_memory_range(mmap_tree_dst,
+                                       copy_start, copy_end - copy_start,
+                                       mmap->state,
+                                       mmap->protect,
+                                       mmap->type) != HP_STATUS_OK)
+        {
+            status = HP_STATUS_ERROR;
+            goto return_status;
+        }
+        /* The resident bytes can't be split, so only whole intervals
+         * carry them. */
+        if (mmap->rss != 0 && copy_start == mmap->start_addr &&
+            copy_end == mmap->end_addr)
+        {
+            hp_mmap_add_rss(mmap_tree_dst, copy_start, mmap->rss);
+        }
     }
 
     status = HP_STATUS_OK;
@@ -140,107 +675,510 @@ hp_status_t hp_mmap_track_memory(hp_mmap_tree_t *mmap_tree,
     return status;
 }
 
-static void hp_mmap_track_memory_range_(void *mmap_, void *mmap_tree_dst)
+hp_status_t hp_mmap_copy(hp_mmap_tree_t *mmap_tree_dst,
+                         hp_mmap_tree_t *mmap_tree_src)
 {
-    hp_mmap_t *mmap = (hp_mmap_t *)mmap_;
+    hp_mmap_source_t source;
+    hp_mmap_t *mmap;
+    uint32_t i;
+    hp_status_t status;
 
-    hp_mmap_track_memory((hp_mmap_tree_t *)mmap_tree_dst,
-                         mmap->page_start_addr,
-                         mmap->state,
-                         mmap->protect,
-                         mmap->type);
+    if (mmap_tree_src->shared_count == 0 ||
+        hp_mmap_count(mmap_tree_dst) != 0 ||
+        hp_mmap_is_shared(mmap_tree_dst))
+    {
+        return hp_mmap_copy_range(mmap_tree_dst, mmap_tree_src,
+                                  0, HP_MMAP_ADDR_MAX);
+    }
+
+    for (i = 0; i < mmap_tree_src->shared_count; i++) {
+        if (hp_mmap_share(mmap_tree_dst, mmap_tree_src->shared[i].mmap_tree,
+                          mmap_tree_src->shared[i].base) != HP_STATUS_OK)
+        {
+            status = HP_STATUS_ERROR;
+            goto return_status;
+        }
+    }
+
+    hp_mmap_source_init(mmap_tree_src, &source, 0);
+    while ((mmap = hp_mmap_source_next(&source)) != NULL) {
+        if (hp_mmap_track_memory_range(mmap_tree_dst, mmap->start_addr,
+                                       mmap->end_addr - mmap->start_addr,
+                                       mmap->state, mmap->protect,
+                                       mmap->type) != HP_STATUS_OK)
+        {
+            status = HP_STATUS_ERROR;
+            goto return_status;
+        }
+        if (mmap->rss != 0)
+            hp_mmap_add_rss(mmap_tree_dst, mmap->start_addr, mmap->rss);
+    }
+
+    status = HP_STATUS_OK;
+ return_status:
+    if (status != HP_STATUS_OK)
+        hp_mmap_reset(mmap_tree_dst);
+    return status;
+}
+
+static void hp_mmap_erase_(void *mmap, void *mmap_tree)
+{
+    hp_mmap_free((hp_mmap_tree_t *)mmap_tree, (hp_mmap_t *)mmap);
 
     return;
 }
 
-hp_status_t hp_mmap_track_memory_range(hp_mmap_tree_t *mmap_tree_dst,
-                                         hp_mmap_tree_t *mmap_tree_src)
+/* Stop tracking [start_addr, end_addr).  Intervals straddling the bounds
+ * are clipped, and one straddling both is split in two. */
+static hp_status_t hp_mmap_erase(hp_mmap_tree_t *mmap_tree,
+                                 hp_mmap_addr_t start_addr,
+                                 hp_mmap_addr_t end_addr)
 {
-    hp_avl_parse(mmap_tree_src->mmap_tree_avl,
-                  hp_mmap_track_memory_range_, mmap_tree_dst);
+    hp_mmap_t *mmap;
+    hp_mmap_t *mmap_new;
+    hp_mmap_t *mmap_existing;
+    hp_mmap_t key;
+    hp_mmap_t key_hi;
+    hp_status_t status;
 
-    return HP_STATUS_OK;
+    if (end_addr <= start_addr) {
+        status = HP_STATUS_OK;
+        goto return_status;
+    }
+
+    if (hp_mmap_thaw_range(mmap_tree, start_addr,
+                           end_addr) != HP_STATUS_OK)
+    {
+        status = HP_STATUS_ERROR;
+        goto return_status;
+    }
+    mmap_tree->mmap_last = NULL;
+
+    key.start_addr = start_addr;
+    key.end_addr = start_addr + 1;
+    mmap = (hp_mmap_t *)hp_avl_get(mmap_tree->mmap_tree_avl, &key);
+    if (mmap != NULL && mmap->start_addr < start_addr) {
+        if (mmap->end_addr > end_addr) {
+            mmap_new = hp_mmap_alloc(mmap_tree, end_addr, mmap->end_addr,
+                                     mmap->state, mmap->protect, mmap->type);
+            if (mmap_new == NULL) {
+                status = HP_STATUS_ERROR;
+                goto return_status;
+            }
+            /* Intervals are keyed by overlap, so the tail can only go in
+             * once the interval no longer covers it.  It is given back
+             * if the tail can't go in. */
+            mmap->end_addr = start_addr;
+            if (hp_avl_add_entry(mmap_tree->mmap_tree_avl, mmap_new,
+                                 (void **)&mmap_existing) != HP_STATUS_OK)
+            {
+                mmap->end_addr = mmap_new->end_addr;
+                hp_mmap_free(mmap_tree, mmap_new);
+                status = HP_STATUS_ERROR;
+                goto return_status;
+            }
+            status = HP_STATUS_OK;
+            goto return_status;
+        }
+        mmap->end_addr = start_addr;
+    }
+
+    key.start_addr = end_addr - 1;
+    key.end_addr = end_addr;
+    mmap = (hp_mmap_t *)hp_avl_get(mmap_tree->mmap_tree_avl, &key);
+    if (mmap != NULL && mmap->end_addr > end_addr)
+        mmap->start_addr = end_addr;
+
+    /* What is left in between lies wholly within the range. */
+    key.start_addr = start_addr;
+    key.end_addr = start_addr;
+    key_hi.start_addr = end_addr;
+    key_hi.end_addr = end_addr;
+    hp_avl_erase_range(mmap_tree->mmap_tree_avl, &key, &key_hi,
+                       hp_mmap_erase_, mmap_tree);
+
+    status = HP_STATUS_OK;
+ return_status:
+    return status;
 }
 
-uint32_t hp_mmap_count(hp_mmap_tree_t *mmap_tree)
+hp_status_t hp_mmap_untrack_memory_range(hp_mmap_tree_t *mmap_tree,
+                                         hp_mmap_addr_t addr,
+                                         hp_mmap_addr_t size)
 {
-    return hp_avl_count(mmap_tree->mmap_tree_avl);
+    hp_mmap_addr_t start_addr;
+    hp_mmap_addr_t end_addr;
+
+    start_addr = addr;
+    ALIGN_DOWN(start_addr, HP_MMAP_PAGE_SIZE);
+    end_addr = addr + size;
+    ALIGN_UP(end_addr, HP_MMAP_PAGE_SIZE);
+
+    return hp_mmap_erase(mmap_tree, start_addr, end_addr);
 }
 
-static void hp_mmap_print_page(void *mmap_, void *arg)
+/* Point the update at the first interval not wholly below pos. */
+static void hp_mmap_update_seek(hp_mmap_update_t *update)
 {
-    hp_mmap_t *mmap = (hp_mmap_t *)mmap_;
+    hp_mmap_tree_t *mmap_tree = update->mmap_tree;
+    hp_mmap_t *mmap;
+    hp_mmap_t key;
 
-    hp_log_debug("Page: %x %x", mmap->page_start_addr, mmap->page_end_addr);
+    key.start_addr = update->pos;
+    key.end_addr = update->pos + 1;
+    hp_mmap_iter_seek(mmap_tree, mmap_tree->update_iter, &key);
+    mmap = hp_mmap_iter_next(mmap_tree->update_iter);
+    update->mmap_cur = mmap;
+    if (mmap != NULL && mmap->start_addr > update->pos)
+        update->pos = mmap->start_addr;
 
     return;
 }
 
-static void hp_mmap_create_list(void *mmap_, void *mmap_list_)
+hp_status_t hp_mmap_update_begin(hp_mmap_tree_t *mmap_tree,
+                                 hp_mmap_update_t *update)
 {
-    hp_mmap_t *mmap = (hp_mmap_t *)mmap_;
-    hp_mmap_list_t *mmap_list = (hp_mmap_list_t *)mmap_list_;
+    hp_mmap_t *mmap;
+    hp_status_t status;
 
-    mmap_list->list[mmap_list->idx_insert++] = mmap;
+    if (mmap_tree->update_iter == NULL &&
+        (mmap_tree->update_iter = (hp_mmap_iter_t *)
+         malloc(sizeof(*mmap_tree->update_iter))) == NULL)
+    {
+        hp_log_error("malloc() failure.");
+        status = HP_STATUS_ERROR;
+        goto return_status;
+    }
 
-    return;
+    /* Loaded and shared intervals are walked where they are, and only
+     * copied in by the change that reaches them. */
+    update->mmap_tree = mmap_tree;
+    update->changed = false;
+    hp_mmap_iter_init(mmap_tree, mmap_tree->update_iter);
+    mmap = hp_mmap_iter_next(mmap_tree->update_iter);
+    update->mmap_cur = mmap;
+    update->pos = (mmap != NULL) ? mmap->start_addr : 0;
+
+    status = HP_STATUS_OK;
+ return_status:
+    return status;
 }
 
-bool hp_are_mmaps_same(hp_mmap_tree_t *mmap1_tree, hp_mmap_tree_t *mmap2_tree)
+hp_status_t hp_mmap_update_region(hp_mmap_update_t *update,
+                                  hp_mmap_addr_t addr,
+                                  hp_mmap_addr_t size,
+                                  uint32_t state,
+                                  uint32_t protect,
+                                  uint32_t type)
 {
-    uint32_t mmap1_count;
-    uint32_t mmap2_count;
-    hp_mmap_list_t *mmap1_list;
-    hp_mmap_list_t *mmap2_list;
-    hp_mmap_t *mmap1;
-    hp_mmap_t *mmap2;
-    uint32_t i;
-    bool is_same;
+    hp_mmap_tree_t *mmap_tree = update->mmap_tree;
+    hp_mmap_iter_t *iter = mmap_tree->update_iter;
+    hp_mmap_t *mmap = (hp_mmap_t *)update->mmap_cur;
+    hp_mmap_t *mmap_next;
+    hp_mmap_t key;
+    hp_mmap_addr_t mmap_end;
+    hp_mmap_addr_t start_addr;
+    hp_mmap_addr_t end_addr;
+    hp_status_t status;
 
-    mmap1_count = hp_mmap_count(mmap1_tree);
-    mmap2_count = hp_mmap_count(mmap2_tree);
+    start_addr = addr;
+    ALIGN_DOWN(start_addr, HP_MMAP_PAGE_SIZE);
+    end_addr = addr + size;
+    ALIGN_UP(end_addr, HP_MMAP_PAGE_SIZE);
+    if (end_addr <= start_addr) {
+        status = HP_STATUS_OK;
+        goto return_status;
+    }
 
-    if  (mmap1_count != mmap2_count) {
-        printf("mmap1_count(%u) != mmap2_count(%u)",
-                     mmap1_count, mmap2_count);
-        fflush(stdout);
-        is_same = false;
+    /* The region is the next piece of the interval we are in.  An interval
+     * can span several regions, as they are coalesced when tracked, and a
+     * region several intervals, as those of a shared or loaded map aren't
+     * coalesced with the map's own.  Only the resident bytes of the map's
+     * own are taken afresh. */
+    if (mmap != NULL && start_addr == update->pos &&
+        hp_mmap_attrs_same(mmap, state, protect, type))
+    {
+        if (start_addr == mmap->start_addr && iter->writable)
+            mmap->rss = 0;
+        while (end_addr > mmap->end_addr) {
+            /* The next step may reuse the interval for the rebased one */
+            mmap_end = mmap->end_addr;
+            mmap_next = hp_mmap_iter_next(iter);
+            if (mmap_next == NULL ||
+                mmap_next->start_addr != mmap_end ||
+                !hp_mmap_attrs_same(mmap_next, state, protect, type))
+            {
+                goto retrack;
+            }
+            mmap = mmap_next;
+            if (iter->writable)
+                mmap->rss = 0;
+            update->mmap_cur = mmap;
+        }
+        update->pos = end_addr;
+        if (end_addr == mmap->end_addr) {
+            mmap = hp_mmap_iter_next(iter);
+            update->mmap_cur = mmap;
+            if (mmap != NULL)
+                update->pos = mmap->start_addr;
+        }
+        status = HP_STATUS_OK;
         goto return_status;
     }
 
-    mmap1_list = hp_mmap_list_alloc(mmap1_count);
-    mmap2_list = hp_mmap_list_alloc(mmap2_count);
+    /* Whatever is tracked from pos up to the end of the region is stale.
+     * Replace just that, and carry on matching from there. */
+ retrack:
+    update->changed = true;
+    if (hp_mmap_erase(mmap_tree,
+                      (start_addr < update->pos) ? start_addr : update->pos,
+                      end_addr) != HP_STATUS_OK ||
+        hp_mmap_track_memory_range(mmap_tree, start_addr,
+                                   end_addr - start_addr,
+                                   state, protect, type) != HP_STATUS_OK)
+    {
+        status = HP_STATUS_ERROR;
+        goto return_status;
+    }
 
-    hp_avl_parse(mmap1_tree->mmap_tree_avl,
-                 hp_mmap_create_list, mmap1_list);
-    hp_avl_parse(mmap2_tree->mmap_tree_avl,
-                 hp_mmap_create_list, mmap2_list);
+    /* An interval the region was merged into the front of still holds
+     * the resident bytes of the last walk. */
+    key.start_addr = start_addr;
+    key.end_addr = start_addr + 1;
+    mmap = (hp_mmap_t *)hp_avl_get(mmap_tree->mmap_tree_avl, &key);
+    if (mmap != NULL && mmap->start_addr == start_addr)
+        mmap->rss = 0;
 
-    for (i = 0; i < mmap1_count; i++) {
-        mmap1 = mmap1_list->list[i];
-        mmap2 = mmap2_list->list[i];
+    /* The map changed under the walk. */
+    update->pos = end_addr;
+    hp_mmap_update_seek(update);
 
-        if (mmap1->page_start_addr != mmap2->page_start_addr ||
-            mmap1->page_end_addr != mmap2->page_end_addr ||
-            mmap1->state != mmap2->state ||
-            mmap1->protect != mmap2->protect ||
-            mmap1->type != mmap2->type)
+    status = HP_STATUS_OK;
+ return_status:
+    return status;
+}
+
+hp_status_t hp_mmap_update_end(hp_mmap_update_t *update, bool *changed)
+{
+    hp_status_t status;
+
+    /* Intervals the walk never reached are gone. */
+    if (update->mmap_cur != NULL) {
+        update->changed = true;
+        if (hp_mmap_erase(update->mmap_tree, update->pos,
+                          HP_MMAP_ADDR_MAX) != HP_STATUS_OK)
         {
-            is_same = false;
+            *changed = true;
+            status = HP_STATUS_ERROR;
             goto return_status;
         }
     }
+    *changed = update->changed;
 
-    is_same = true;
+    status = HP_STATUS_OK;
  return_status:
-    return is_same;
+    return status;
+}
+
+uint32_t hp_mmap_count(hp_mmap_tree_t *mmap_tree)
+{
+    uint32_t count;
+    uint32_t i;
+
+    count = (mmap_tree->frozen != NULL) ? mmap_tree->frozen_count :
+        hp_avl_count(mmap_tree->mmap_tree_avl);
+    for (i = 0; i < mmap_tree->shared_count; i++)
+        count += hp_mmap_count(mmap_tree->shared[i].mmap_tree);
+
+    return count;
+}
+
+const char *hp_mmap_diff_kind_to_string(hp_mmap_diff_kind_t kind)
+{
+    switch (kind) {
+        case HP_MMAP_DIFF_ADDED:
+            return "Added";
+        case HP_MMAP_DIFF_REMOVED:
+            return "Removed";
+        case HP_MMAP_DIFF_CHANGED:
+            return "Changed";
+        case HP_MMAP_DIFF_MODIFIED:
+            return "Modified";
+        default:
+            return "Unknown";
+    }
+}
+
+/* Record a differing range, merging it into the previous one if it
+ * continues it.  The previous one is kept in last whether or not it fit
+ * in diffs, so the count doesn't depend on the size of diffs. */
+static void hp_mmap_diff_emit(hp_mmap_diff_t *diffs,
+                              uint32_t diffs_size,
+                              uint32_t *diff_count,
+                              hp_mmap_diff_t *last,
+                              hp_mmap_diff_kind_t kind,
+                              hp_mmap_addr_t start_addr,
+                              hp_mmap_addr_t end_addr,
+                              hp_mmap_t *mmap_old,
+                              hp_mmap_t *mmap_new)
+{
+    hp_mmap_diff_t diff;
+
+    memset(&diff, 0, sizeof(diff));
+    diff.kind = kind;
+    diff.start_addr = start_addr;
+    diff.end_addr = end_addr;
+    if (mmap_old != NULL) {
+        diff.old_state = mmap_old->state;
+        diff.old_protect = mmap_old->protect;
+        diff.old_type = mmap_old->type;
+    }
+    if (mmap_new != NULL) {
+        diff.new_state = mmap_new->state;
+        diff.new_protect = mmap_new->protect;
+        diff.new_type = mmap_new->type;
+    }
+
+    if (*diff_count != 0 && last->end_addr == start_addr &&
+        last->kind == kind &&
+        last->old_state == diff.old_state &&
+        last->old_protect == diff.old_protect &&
+        last->old_type == diff.old_type &&
+        last->new_state == diff.new_state &&
+        last->new_protect == diff.new_protect &&
+        last->new_type == diff.new_type)
+    {
+        last->end_addr = end_addr;
+        if (*diff_count <= diffs_size)
+            diffs[*diff_count - 1].end_addr = end_addr;
+        return;
+    }
+
+    *last = diff;
+    if (*diff_count < diffs_size)
+        diffs[*diff_count] = diff;
+    (*diff_count)++;
+
+    return;
+}
+
+uint32_t hp_mmap_diff(hp_mmap_tree_t *mmap_old_tree,
+                      hp_mmap_tree_t *mmap_new_tree,
+                      hp_mmap_diff_t *diffs,
+                      uint32_t diffs_size,
+                      uint32_t flags)
+{
+    hp_mmap_iter_t iter_old;
+    hp_mmap_iter_t iter_new;
+    hp_mmap_t *mmap_old;
+    hp_mmap_t *mmap_new;
+    hp_mmap_addr_t pos;
+    hp_mmap_addr_t old_start;
+    hp_mmap_addr_t new_start;
+    hp_mmap_addr_t end_addr;
+    hp_mmap_diff_t last;
+    uint32_t diff_count;
+
+    hp_mmap_iter_init(mmap_old_tree, &iter_old);
+    hp_mmap_iter_init(mmap_new_tree, &iter_new);
+    mmap_old = hp_mmap_iter_next(&iter_old);
+    mmap_new = hp_mmap_iter_next(&iter_new);
+
+    /* Sweep the address space with pos, everything below which has been
+     * compared. */
+    pos = 0;
+    diff_count = 0;
+    while (mmap_old != NULL || mmap_new != NULL) {
+        if ((flags & HP_MMAP_DIFF_FLAG_FIRST_ONLY) && diff_count != 0)
+            break;
+
+        old_start = (mmap_old != NULL && mmap_old->start_addr > pos) ?
+            mmap_old->start_addr : pos;
+        new_start = (mmap_new != NULL && mmap_new->start_addr > pos) ?
+            mmap_new->start_addr : pos;
+
+        if (mmap_old != NULL && mmap_new != NULL && old_start == new_start) {
+            end_addr = (mmap_old->end_addr < mmap_new->end_addr) ?
+                mmap_old->end_addr : mmap_new->end_addr;
+            if (!hp_mmap_attrs_same(mmap_old, mmap_new->state,
+                                    mmap_new->protect, mmap_new->type))
+            {
+                hp_mmap_diff_emit(diffs, diffs_size, &diff_count, &last,
+                                  HP_MMAP_DIFF_CHANGED,
+                                  old_start, end_addr, mmap_old, mmap_new);
+            }
+        } else if (mmap_new == NULL ||
+                   (mmap_old != NULL && old_start < new_start)) {
+            end_addr = mmap_old->end_addr;
+            if (mmap_new != NULL && new_start < end_addr)
+                end_addr = new_start;
+            hp_mmap_diff_emit(diffs, diffs_size, &diff_count, &last,
+                              HP_MMAP_DIFF_REMOVED,
+                              old_start, end_addr, mmap_old, NULL);
+        } else {
+            end_addr = mmap_new->end_addr;
+            if (mmap_old != NULL && old_start < end_addr)
+                end_addr = old_start;
+            hp_mmap_diff_emit(diffs, diffs_size, &diff_count, &last,
+                              HP_MMAP_DIFF_ADDED,
+                              new_start, end_addr, NULL, mmap_new);
+        }
+
+        pos = end_addr;
+        if (mmap_old != NULL && mmap_old->end_addr <= pos)
+            mmap_old = hp_mmap_iter_next(&iter_old);
+        if (mmap_new != NULL && mmap_new->end_addr <= pos)
+            mmap_new = hp_mmap_iter_next(&iter_new);
+    }
+
+    return diff_count;
+}
+
+/* A walk over both maps that stops at the first differing range.  Maps
+ * coalesced differently still compare equal if they cover the same memory
+ * with the same attributes. */
+bool hp_are_mmaps_same(hp_mmap_tree_t *mmap1_tree, hp_mmap_tree_t *mmap2_tree)
+{
+    return (hp_mmap_diff(mmap1_tree, mmap2_tree, NULL, 0,
+                         HP_MMAP_DIFF_FLAG_FIRST_ONLY) == 0);
+}
+
+hp_status_t hp_mmap_parse(hp_mmap_tree_t *mmap_tree,
+                          hp_mmap_parse_func_t func,
+                          void *arg)
+{
+    hp_mmap_iter_t iter;
+    hp_mmap_t *mmap;
+    hp_status_t status;
+
+    hp_mmap_iter_init(mmap_tree, &iter);
+    while ((mmap = hp_mmap_iter_next(&iter)) != NULL) {
+        if ((status = func(mmap->start_addr, mmap->end_addr,
+                           mmap->state, mmap->protect, mmap->type,
+                           arg)) != HP_STATUS_OK)
+        {
+            goto return_status;
+        }
+    }
+
+    status = HP_STATUS_OK;
+ return_status:
+    return status;
 }
 
 void hp_mmap_print(hp_mmap_tree_t *mmap_tree)
 {
+    hp_mmap_iter_t iter;
+    hp_mmap_t *mmap;
+
     hp_log_debug("Mmap:");
 
-    hp_avl_parse(mmap_tree->mmap_tree_avl, hp_mmap_print_page, NULL);
+    hp_mmap_iter_init(mmap_tree, &iter);
+    while ((mmap = hp_mmap_iter_next(&iter)) != NULL) {
+        hp_log_debug("Region: %" PRIx64 " %" PRIx64 " %x %x %x %" PRIu64,
+                     (uint64_t)mmap->start_addr, (uint64_t)mmap->end_addr,
+                     mmap->state, mmap->protect, mmap->type, mmap->rss);
+    }
 
     return;
 }
@@ -257,12 +1195,17 @@ hp_status_t hp_mmap_init(hp_mmap_tree_t **mmap_tree_)
         status = HP_STATUS_ERROR;
         goto return_status;
     }
+    memset(mmap_tree, 0, sizeof(*mmap_tree));
+    hp_file_map_init(&mmap_tree->frozen_map);
+    mmap_tree->refs = 1;
+    hp_arena_init(&mmap_tree->mmap_arena, sizeof(hp_mmap_t),
+                  HP_MMAP_ARENA_SLAB_ENTRIES);
 
-    if (hp_avl_init(&mmap_tree->mmap_tree_avl,
-             hp_mmap_cmp,
-             (hp_avl_free_user_data_func_t)hp_mmap_free) != HP_STATUS_OK)
+    if (hp_avl_init(&mmap_tree->mmap_tree_avl, hp_mmap_cmp, NULL,
+                    HP_AVL_FLAG_ARENA) != HP_STATUS_OK)
     {
         hp_log_error("Error initializing avl tree for mmap.");
+        free(mmap_tree);
         status = HP_STATUS_ERROR;
         goto return_status;
     }
@@ -276,8 +1219,261 @@ hp_status_t hp_mmap_init(hp_mmap_tree_t **mmap_tree_)
 
 hp_status_t hp_mmap_deinit(hp_mmap_tree_t *mmap_tree)
 {
+    uint32_t i;
+
+    BUG_ON(mmap_tree->refs == 0);
+    if (--mmap_tree->refs != 0)
+        return HP_STATUS_OK;
+
+    for (i = 0; i < mmap_tree->shared_count; i++)
+        hp_mmap_deinit(mmap_tree->shared[i].mmap_tree);
+    free(mmap_tree->update_iter);
+    hp_file_map_close(&mmap_tree->frozen_map);
     hp_avl_deinit(mmap_tree->mmap_tree_avl);
+    hp_arena_deinit(&mmap_tree->mmap_arena);
     free(mmap_tree);
 
     return HP_STATUS_OK;
 }
+
+hp_status_t hp_mmap_reset(hp_mmap_tree_t *mmap_tree)
+{
+    uint32_t i;
+
+    hp_avl_reset(mmap_tree->mmap_tree_avl);
+    hp_arena_reset(&mmap_tree->mmap_arena);
+    mmap_tree->mmap_last = NULL;
+    hp_file_map_close(&mmap_tree->frozen_map);
+    mmap_tree->frozen = NULL;
+    mmap_tree->frozen_count = 0;
+    for (i = 0; i < mmap_tree->shared_count; i++)
+        hp_mmap_deinit(mmap_tree->shared[i].mmap_tree);
+    mmap_tree->shared_count = 0;
+
+    return HP_STATUS_OK;
+}
+
+hp_status_t hp_mmap_share(hp_mmap_tree_t *mmap_tree, hp_mmap_tree_t *shared,
+                          hp_mmap_addr_t base)
+{
+    hp_mmap_source_t source;
+    hp_mmap_iter_t iter;
+    hp_mmap_t *mmap;
+    hp_mmap_t key;
+    hp_mmap_addr_t start_addr = 0;
+    hp_mmap_addr_t end_addr = 0;
+    hp_status_t status;
+
+    if (shared->shared_count != 0 || hp_mmap_is_shared(mmap_tree) ||
+        mmap_tree == shared)
+    {
+        hp_log_error("A map can only be shared one level deep.");
+        status = HP_STATUS_ERROR;
+        goto return_status;
+    }
+    if (mmap_tree->shared_count == HP_MMAP_SHARED_MAX) {
+        hp_log_error("A map can only have %u maps shared under it.",
+                     HP_MMAP_SHARED_MAX);
+        status = HP_STATUS_ERROR;
+        goto return_status;
+    }
+
+    /* The span it covers at base */
+    hp_mmap_source_init(shared, &source, base);
+    while ((mmap = hp_mmap_source_next(&source)) != NULL) {
+        if (mmap->end_addr > HP_MMAP_ADDR_MAX - base) {
+            hp_log_error("Unable to share a map past the top of the "
+                         "address space, at %" PRIx64 ".", (uint64_t)base);
+            status = HP_STATUS_ERROR;
+            goto return_status;
+        }
+        if (end_addr == 0)
+            start_addr = mmap->start_addr + base;
+        end_addr = mmap->end_addr + base;
+    }
+
+    /* Walks rely on none of them overlapping, which can only be broken
+     * within that span. */
+    mmap_tree->shared[mmap_tree->shared_count].mmap_tree = shared;
+    mmap_tree->shared[mmap_tree->shared_count].base = base;
+    mmap_tree->shared_count++;
+    key.start_addr = start_addr;
+    key.end_addr = start_addr + 1;
+    hp_mmap_iter_seek(mmap_tree, &iter, &key);
+    start_addr = 0;
+    while ((mmap = hp_mmap_iter_next(&iter)) != NULL &&
+           mmap->start_addr < end_addr)
+    {
+        if (mmap->start_addr < start_addr) {
+            hp_log_error("Unable to share a map under one it overlaps.");
+            mmap_tree->shared_count--;
+            status = HP_STATUS_ERROR;
+            goto return_status;
+        }
+        start_addr = mmap->end_addr;
+    }
+    shared->refs++;
+
+    status = HP_STATUS_OK;
+ return_status:
+    return status;
+}
+
+bool hp_mmap_is_shared(hp_mmap_tree_t *mmap_tree)
+{
+    return (mmap_tree->refs > 1);
+}
+
+hp_status_t hp_mmap_save(hp_mmap_tree_t *mmap_tree, const char *path,
+                         uint64_t tag)
+{
+    hp_mmap_file_header_t header;
+    hp_mmap_iter_t iter;
+    hp_mmap_t *mmaps = NULL;
+    hp_mmap_t *mmap;
+    char path_tmp[1024];
+    FILE *fp;
+    bool written;
+    uint32_t count;
+    size_t len;
+    int r;
+    hp_status_t status;
+
+    count = hp_mmap_count(mmap_tree);
+    len = (size_t)count * sizeof(*mmaps);
+    if (count != 0 && (mmaps = (hp_mmap_t *)malloc(len)) == NULL) {
+        hp_log_error("malloc() failure.");
+        status = HP_STATUS_ERROR;
+        goto return_status;
+    }
+    count = 0;
+    hp_mmap_iter_init(mmap_tree, &iter);
+    while ((mmap = hp_mmap_iter_next(&iter)) != NULL)
+        mmaps[count++] = *mmap;
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, HP_MMAP_FILE_MAGIC, sizeof(header.magic));
+    header.version = HP_MMAP_FILE_VERSION;
+    header.byte_order = HP_MMAP_FILE_BYTE_ORDER;
+    header.header_size = sizeof(header);
+    header.entry_size = sizeof(hp_mmap_t);
+    header.count = count;
+    header.checksum = hp_hash64((const uint8_t *)mmaps, len,
+                                HP_MMAP_FILE_SEED);
+    header.tag = tag;
+
+    /* Written aside and renamed over the old file, so a reader only ever
+     * sees a whole map. */
+    r = _snprintf_s(path_tmp, sizeof(path_tmp), _TRUNCATE, "%s.tmp", path);
+    if (r <= 0 || (size_t)r >= sizeof(path_tmp)) {
+        hp_log_error("Map file path \"%s\" is too long.", path);
+        status = HP_STATUS_ERROR;
+        goto return_status;
+    }
+    if ((fp = fopen(path_tmp, "wb")) == NULL) {
+        hp_log_error("Unable to create map file \"%s\".", path_tmp);
+        status = HP_STATUS_ERROR;
+        goto return_status;
+    }
+    written = (fwrite(&header, sizeof(header), 1, fp) == 1 &&
+               (len == 0 || fwrite(mmaps, len, 1, fp) == 1));
+    if (fclose(fp) != 0 || !written) {
+        hp_log_error("Unable to write map file \"%s\".", path_tmp);
+        remove(path_tmp);
+        status = HP_STATUS_ERROR;
+        goto return_status;
+    }
+#ifdef WINDOWS
+    if (!MoveFileExA(path_tmp, path, MOVEFILE_REPLACE_EXISTING))
+#else
+    if (rename(path_tmp, path) != 0)
+#endif
+    {
+        hp_log_error("Unable to rename \"%s\" to \"%s\".", path_tmp, path);
+        remove(path_tmp);
+        status = HP_STATUS_ERROR;
+        goto return_status;
+    }
+    hp_log_debug("Saved %u intervals to \"%s\".", count, path);
+
+    status = HP_STATUS_OK;
+ return_status:
+    free(mmaps);
+    return status;
+}
+
+hp_status_t hp_mmap_load(hp_mmap_tree_t **mmap_tree_, const char *path,
+                         uint64_t *tag)
+{
+    hp_mmap_tree_t *mmap_tree = NULL;
+    const hp_mmap_file_header_t *header;
+    const hp_mmap_t *mmaps;
+    uint64_t len;
+    uint32_t i;
+    hp_status_t status;
+
+    *mmap_tree_ = NULL;
+
+    if (hp_mmap_init(&mmap_tree) != HP_STATUS_OK ||
+        hp_file_map_open(&mmap_tree->frozen_map, path) != HP_STATUS_OK)
+    {
+        status = HP_STATUS_ERROR;
+        goto return_status;
+    }
+
+    header = (const hp_mmap_file_header_t *)mmap_tree->frozen_map.base;
+    if (mmap_tree->frozen_map.size < sizeof(*header) ||
+        memcmp(header->magic, HP_MMAP_FILE_MAGIC,
+               sizeof(header->magic)) != 0 ||
+        header->version != HP_MMAP_FILE_VERSION ||
+        header->byte_order != HP_MMAP_FILE_BYTE_ORDER ||
+        header->header_size < sizeof(*header) ||
+        (header->header_size % 8) != 0 ||
+        header->entry_size != sizeof(hp_mmap_t))
+    {
+        hp_log_error("\"%s\" is not a map file this build can load.", path);
+        status = HP_STATUS_ERROR;
+        goto return_status;
+    }
+
+    len = (uint64_t)header->count * sizeof(hp_mmap_t);
+    if (mmap_tree->frozen_map.size - header->header_size != len) {
+        hp_log_error("Map file \"%s\" is truncated.", path);
+        status = HP_STATUS_ERROR;
+        goto return_status;
+    }
+    mmaps = (const hp_mmap_t *)(mmap_tree->frozen_map.base +
+                                header->header_size);
+    if (hp_hash64((const uint8_t *)mmaps, (size_t)len,
+                  HP_MMAP_FILE_SEED) != header->checksum)
+    {
+        hp_log_error("Map file \"%s\" fails its checksum.", path);
+        status = HP_STATUS_ERROR;
+        goto return_status;
+    }
+
+    /* Walks and lookups rely on the intervals being in order and apart. */
+    for (i = 0; i < header->count; i++) {
+        if (mmaps[i].start_addr >= mmaps[i].end_addr ||
+            (i != 0 && mmaps[i - 1].end_addr > mmaps[i].start_addr))
+        {
+            hp_log_error("Map file \"%s\" holds overlapping intervals.",
+                         path);
+            status = HP_STATUS_ERROR;
+            goto return_status;
+        }
+    }
+
+    mmap_tree->frozen = mmaps;
+    mmap_tree->frozen_count = header->count;
+    if (tag != NULL)
+        *tag = header->tag;
+    *mmap_tree_ = mmap_tree;
+    hp_log_debug("Loaded %u intervals from \"%s\".", header->count, path);
+
+    status = HP_STATUS_OK;
+ return_status:
+    if (status != HP_STATUS_OK && mmap_tree != NULL)
+        hp_mmap_deinit(mmap_tree);
+    return status;
+}
@@ -21,25 +21,240 @@
 #define __MMAP__H__
 
 #include "honeyprocs-common.h"
+#include "avl.h"
 #include "status.h"
 
 #define HP_MMAP_PAGE_SIZE 4096
 
+/* Wide enough for the address space of a 64 bit target. */
+typedef uint64_t hp_mmap_addr_t;
+#define HP_MMAP_ADDR_MAX UINT64_MAX
+
+/* Region attributes.  These hold the values of their Windows MEM_* and
+ * PAGE_* counterparts, so what VirtualQueryEx() reports is stored as is
+ * and the other backends translate into them. */
+#define HP_MMAP_STATE_COMMIT            0x1000
+#define HP_MMAP_STATE_RESERVE           0x2000
+
+#define HP_MMAP_TYPE_PRIVATE            0x20000
+#define HP_MMAP_TYPE_MAPPED             0x40000
+#define HP_MMAP_TYPE_IMAGE              0x1000000
+
+#define HP_MMAP_PROT_NOACCESS           0x01
+#define HP_MMAP_PROT_READONLY           0x02
+#define HP_MMAP_PROT_READWRITE          0x04
+#define HP_MMAP_PROT_WRITECOPY          0x08
+#define HP_MMAP_PROT_EXECUTE            0x10
+#define HP_MMAP_PROT_EXECUTE_READ       0x20
+#define HP_MMAP_PROT_EXECUTE_READWRITE  0x40
+#define HP_MMAP_PROT_EXECUTE_WRITECOPY  0x80
+/* Any of the executable protections */
+#define HP_MMAP_PROT_EXECUTE_ANY        0xF0
+
 typedef struct hp_mmap_tree_t hp_mmap_tree_t;
 
+/* Most maps shared under any one map.  See hp_mmap_share(). */
+#define HP_MMAP_SHARED_MAX 4
+
+typedef enum hp_mmap_diff_kind_t {
+    /* Tracked only in the new map */
+    HP_MMAP_DIFF_ADDED = 1,
+    /* Tracked only in the old map */
+    HP_MMAP_DIFF_REMOVED,
+    /* Tracked in both, with different attributes */
+    HP_MMAP_DIFF_CHANGED,
+    /* Tracked in both with the same attributes, but the contents changed.
+     * Only found by comparing page hashes, never by hp_mmap_diff(). */
+    HP_MMAP_DIFF_MODIFIED,
+} hp_mmap_diff_kind_t;
+
+/* A range of memory that differs between two maps.  The attributes of
+ * the side not tracking the range are 0. */
+typedef struct hp_mmap_diff_t {
+    hp_mmap_diff_kind_t kind;
+    hp_mmap_addr_t start_addr;
+    hp_mmap_addr_t end_addr;
+    uint32_t old_state;
+    uint32_t old_protect;
+    uint32_t old_type;
+    uint32_t new_state;
+    uint32_t new_protect;
+    uint32_t new_type;
+} hp_mmap_diff_t;
+
+/* Stop at the first difference */
+#define HP_MMAP_DIFF_FLAG_FIRST_ONLY 0x01
+
+/* State of an in place update of a map from a fresh, ascending walk over
+ * the regions of a process.  See hp_mmap_update_begin(). */
+typedef struct hp_mmap_update_t {
+    hp_mmap_tree_t *mmap_tree;
+    /* The interval the next region is expected in.  The walk over those
+     * not confirmed yet is kept by the map, as it has one update at a
+     * time. */
+    void *mmap_cur;
+    /* Everything below pos is confirmed */
+    hp_mmap_addr_t pos;
+    bool changed;
+} hp_mmap_update_t;
+
 hp_status_t hp_mmap_init(hp_mmap_tree_t **mmap_tree);
+/* Free a map, or only drop the owner's hold on it while it is still
+ * shared under other maps. */
 hp_status_t hp_mmap_deinit(hp_mmap_tree_t *mmap_tree);
+/* Drop all the tracked memory, keeping the tree for reuse. */
+hp_status_t hp_mmap_reset(hp_mmap_tree_t *mmap_tree);
+
+/**
+ * Layer the intervals of one map under those of another, without copying
+ * them.  Walks, diffs and saves of the map see both, so any no of maps
+ * can hold the memory they have in common once, in a map shared under
+ * each.  The shared map must not change from then on, and is freed with
+ * the last map it is shared under, or its owner, whichever is later.
+ *
+ * The shared map is laid at base, its intervals showing up at their
+ * address plus base.  So a map of what an image maps, relative to where
+ * it is loaded, is shared by all the processes loading it, wherever ASLR
+ * puts it.  A map can have up to HP_MMAP_SHARED_MAX maps shared under it.
+ *
+ * A change to a map copies in the intervals of only the shared maps it
+ * reaches into, which are then no longer shared under it.
+ *
+ * Maps are shared and freed from one thread.  Others may only walk them.
+ *
+ * @retval HP_STATUS_ERROR If the maps overlap, the shared map doesn't fit
+ *         below the top of the address space at base, the map is itself
+ *         shared or has as many maps shared under it as it can, or the
+ *         shared map has maps shared under it.
+ */
+hp_status_t hp_mmap_share(hp_mmap_tree_t *mmap_tree, hp_mmap_tree_t *shared,
+                          hp_mmap_addr_t base);
+/* Whether a map is shared under another */
+bool hp_mmap_is_shared(hp_mmap_tree_t *mmap_tree);
 hp_status_t hp_mmap_track_memory(hp_mmap_tree_t *mmap_tree,
-                                 uint32_t addr,
+                                 hp_mmap_addr_t addr,
                                  uint32_t state,
                                  uint32_t protect,
                                  uint32_t type);
-hp_status_t hp_mmap_track_memory_range(hp_mmap_tree_t *mmap_tree_dst,
-                                         hp_mmap_tree_t *mmap_tree_src);
+/* Track all the pages in [addr, addr + size) in one go.  The range is
+ * coalesced with the neighbouring intervals holding the same attributes. */
+hp_status_t hp_mmap_track_memory_range(hp_mmap_tree_t *mmap_tree,
+                                       hp_mmap_addr_t addr,
+                                       hp_mmap_addr_t size,
+                                       uint32_t state,
+                                       uint32_t protect,
+                                       uint32_t type);
+/* Stop tracking the pages in [addr, addr + size).  Intervals straddling
+ * the bounds are clipped. */
+hp_status_t hp_mmap_untrack_memory_range(hp_mmap_tree_t *mmap_tree,
+                                         hp_mmap_addr_t addr,
+                                         hp_mmap_addr_t size);
+/* Account resident bytes to the interval holding addr.  Those of a loaded
+ * map, or of a map shared under this one, keep what they had. */
+hp_status_t hp_mmap_add_rss(hp_mmap_tree_t *mmap_tree,
+                            hp_mmap_addr_t addr,
+                            uint64_t rss);
+/* Copy one map into another.  An empty map takes on the maps shared
+ * under src, at the same bases, and only copies what src holds itself. */
+hp_status_t hp_mmap_copy(hp_mmap_tree_t *mmap_tree_dst,
+                         hp_mmap_tree_t *mmap_tree_src);
+/* Copy the memory tracked within [start_addr, end_addr).  Intervals
+ * straddling the bounds are clipped. */
+hp_status_t hp_mmap_copy_range(hp_mmap_tree_t *mmap_tree_dst,
+                               hp_mmap_tree_t *mmap_tree_src,
+                               hp_mmap_addr_t start_addr,
+                               hp_mmap_addr_t end_addr);
 uint32_t hp_mmap_count(hp_mmap_tree_t *mmap_tree);
 
+/* Called for each interval of a map by hp_mmap_parse().  Anything but
+ * HP_STATUS_OK stops the walk. */
+typedef hp_status_t (*hp_mmap_parse_func_t)(hp_mmap_addr_t start_addr,
+                                            hp_mmap_addr_t end_addr,
+                                            uint32_t state,
+                                            uint32_t protect,
+                                            uint32_t type,
+                                            void *arg);
+
+/* Walk the intervals of a map in address order. */
+hp_status_t hp_mmap_parse(hp_mmap_tree_t *mmap_tree,
+                          hp_mmap_parse_func_t func,
+                          void *arg);
+
 bool hp_are_mmaps_same(hp_mmap_tree_t *m1, hp_mmap_tree_t *m2);
 
+/**
+ * Find the ranges that differ between two maps, in a single ordered walk
+ * over both.  Contiguous ranges of the same kind and attributes are
+ * reported as one.
+ *
+ * @mmap_old The map to compare against, i.e. the baseline.
+ * @mmap_new The map to compare.
+ * @diffs Filled with up to diffs_size differences, in address order.  Can
+ *        be NULL when diffs_size is 0.
+ * @flags HP_MMAP_DIFF_FLAG_*.
+ *
+ * @retval The no of differences found, which may be more than diffs_size.
+ *         0 if the maps are the same.
+ */
+uint32_t hp_mmap_diff(hp_mmap_tree_t *mmap_old,
+                      hp_mmap_tree_t *mmap_new,
+                      hp_mmap_diff_t *diffs,
+                      uint32_t diffs_size,
+                      uint32_t flags);
+
+const char *hp_mmap_diff_kind_to_string(hp_mmap_diff_kind_t kind);
+
+/**
+ * Update a map in place from the regions of a process.  Walk the regions
+ * in ascending order, passing each to hp_mmap_update_region() after
+ * hp_mmap_update_begin(), and finish with hp_mmap_update_end().
+ *
+ * Regions that match what the map holds are only confirmed, with no
+ * allocation and no change to the tree, be they in the map's own tree, a
+ * loaded file or a map shared under it.  A region that doesn't replaces
+ * just the memory it covers, along with any tracked memory the walk
+ * skipped over to reach it.  The walk is allocated by the first update of
+ * a map, and kept.
+ */
+hp_status_t hp_mmap_update_begin(hp_mmap_tree_t *mmap_tree,
+                                 hp_mmap_update_t *update);
+hp_status_t hp_mmap_update_region(hp_mmap_update_t *update,
+                                  hp_mmap_addr_t addr,
+                                  hp_mmap_addr_t size,
+                                  uint32_t state,
+                                  uint32_t protect,
+                                  uint32_t type);
+/**
+ * @changed Set to whether the map differs from what it was before the
+ *          update began.
+ */
+hp_status_t hp_mmap_update_end(hp_mmap_update_t *update, bool *changed);
+
 void hp_mmap_print(hp_mmap_tree_t *mmap_tree);
 
+/**
+ * Save a map to a file - a versioned header and the intervals in address
+ * order, checksummed against corruption.  The file is replaced whole, so
+ * a reader never sees it half written.
+ *
+ * @tag Saved along with the map, for the caller to tell what was mapped.
+ */
+hp_status_t hp_mmap_save(hp_mmap_tree_t *mmap_tree, const char *path,
+                         uint64_t tag);
+
+/**
+ * Load a map saved by hp_mmap_save().  The file is mapped and its
+ * intervals used where they lie, with nothing allocated per interval, so
+ * loading costs a checksum pass.  The first change to the map copies the
+ * intervals into a tree of its own.
+ *
+ * @mmap_tree Set to the loaded map, to be freed with hp_mmap_deinit().
+ * @tag Optional.  Set to the tag it was saved with.
+ *
+ * @retval HP_STATUS_ERROR If the file is missing, from another version
+ *         or host, or is damaged.
+ */
+hp_status_t hp_mmap_load(hp_mmap_tree_t **mmap_tree, const char *path,
+                         uint64_t *tag);
+
 #endif /* __MMAP__H__ */
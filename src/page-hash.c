@@ -0,0 +1,378 @@
+/**
+ * Copyright(C) 2018, Juniper Networks, Inc.
+ * All rights reserved
+ *
+ * This SOFTWARE is licensed under the license provided in the LICENSE.txt
+ * file.  By downloading, installing, copying, or otherwise using the
+ * SOFTWARE, you agree to be bound by the terms of that license.  This
+ * SOFTWARE is not an official Juniper product.
+ *
+ * Third-Party Code: This SOFTWARE may depend on other components under
+ * separate copyright notice and license terms.  Your use of the source
+ * code for those components is subject to the term and conditions of
+ * the respective license as noted in the Third-Party source code.
+ */
+
+/**
+ * @author Anoop Saldanha
+ */
+#include "honeyprocs-common.h"
+#include "page-hash.h"
+#include "mmap.h"
+#include "proc.h"
+#include "proc-reader.h"
+#include "status.h"
+#include "util-hash.h"
+#include "util-log.h"
+
+/* What a page that couldn't be read hashes to */
+#define HP_PAGE_HASH_UNREAD 0
+
+/* A run of watched pages, all within one region of the map */
+typedef struct hp_page_hash_range_t {
+    hp_mmap_addr_t start_addr;
+    uint32_t page_count;
+    uint32_t state;
+    uint32_t protect;
+    uint32_t type;
+} hp_page_hash_range_t;
+
+typedef struct hp_page_hash_t {
+    hp_page_hash_range_t *ranges;
+    uint32_t range_count;
+    uint32_t range_size;
+    /* A hash per page, over the ranges in order */
+    uint64_t *hashes;
+    uint32_t hash_count;
+    uint32_t hash_size;
+} hp_page_hash_t;
+
+/* Called for each watched page, in order, with its current hash */
+typedef void (*hp_page_hash_visit_func_t)(hp_page_hash_t *page_hash,
+                                          hp_page_hash_range_t *range,
+                                          uint32_t page_index,
+                                          hp_mmap_addr_t addr,
+                                          uint64_t hash,
+                                          void *arg);
+
+/* A walk over the watched pages, as the reader hands them over */
+typedef struct hp_page_hash_walk_t {
+    hp_page_hash_t *page_hash;
+    hp_proc_t *proc;
+    hp_proc_reader_t *reader;
+    hp_page_hash_visit_func_t visit;
+    void *arg;
+    /* The next page to be visited, and the range holding it */
+    uint32_t page_index;
+    uint32_t range_index;
+    uint32_t range_page;
+} hp_page_hash_walk_t;
+
+/* Pages worth watching - code, and the read only parts of the images it
+ * comes from.  Writable image pages hold data that changes anyway. */
+static bool hp_page_hash_watched(uint32_t state, uint32_t protect,
+                                 uint32_t type)
+{
+    if (state != HP_MMAP_STATE_COMMIT)
+        return false;
+    if ((protect & HP_MMAP_PROT_EXECUTE_ANY) != 0)
+        return true;
+
+    return (type == HP_MMAP_TYPE_IMAGE && protect == HP_MMAP_PROT_READONLY);
+}
+
+hp_status_t hp_page_hash_init(hp_page_hash_t **page_hash_)
+{
+    hp_page_hash_t *page_hash;
+    hp_status_t status;
+
+    *page_hash_ = NULL;
+
+    if ((page_hash = (hp_page_hash_t *)malloc(sizeof(*page_hash))) == NULL) {
+        hp_log_error("malloc() failure.");
+        status = HP_STATUS_ERROR;
+        goto return_status;
+    }
+    memset(page_hash, 0, sizeof(*page_hash));
+
+    *page_hash_ = page_hash;
+
+    status = HP_STATUS_OK;
+ return_status:
+    return status;
+}
+
+void hp_page_hash_deinit(hp_page_hash_t *page_hash)
+{
+    free(page_hash->ranges);
+    free(page_hash->hashes);
+    free(page_hash);
+
+    return;
+}
+
+uint32_t hp_page_hash_count(hp_page_hash_t *page_hash)
+{
+    return page_hash->hash_count;
+}
+
+/* Read the queued pages and visit them. */
+static hp_status_t hp_page_hash_flush(hp_page_hash_walk_t *walk)
+{
+    hp_page_hash_t *page_hash = walk->page_hash;
+    hp_proc_reader_t *reader = walk->reader;
+    hp_page_hash_range_t *range;
+    hp_proc_read_t *read;
+    size_t offset;
+    uint64_t hash;
+    uint32_t i;
+    hp_status_t status;
+
+    if (hp_proc_reader_run(reader, walk->proc) != HP_STATUS_OK) {
+        status = HP_STATUS_ERROR;
+        goto return_status;
+    }
+
+    for (i = 0; i < reader->read_count; i++) {
+        read = &reader->reads[i];
+        for (offset = 0; offset < read->len; offset += HP_MMAP_PAGE_SIZE) {
+            while (walk->range_page ==
+                   page_hash->ranges[walk->range_index].page_count)
+            {
+                walk->range_index++;
+                walk->range_page = 0;
+            }
+            range = &page_hash->ranges[walk->range_index];
+
+            if (read->unread & ((uint64_t)1 << (offset / HP_MMAP_PAGE_SIZE)))
+                hash = HP_PAGE_HASH_UNREAD;
+            else
+                hash = hp_hash64(read->buf + offset, HP_MMAP_PAGE_SIZE, 0);
+
+            walk->visit(page_hash, range, walk->page_index,
+                        read->addr + offset, hash, walk->arg);
+            walk->page_index++;
+            walk->range_page++;
+        }
+    }
+
+    status = HP_STATUS_OK;
+ return_status:
+    hp_proc_reader_reset(reader);
+    return status;
+}
+
+/* Read and hash all the watched pages, a pool full at a time. */
+static hp_status_t hp_page_hash_walk(hp_page_hash_t *page_hash,
+                                     hp_proc_t *proc,
+                                     hp_proc_reader_t *reader,
+                                     hp_page_hash_visit_func_t visit,
+                                     void *arg)
+{
+    hp_page_hash_walk_t walk;
+    hp_page_hash_range_t *range;
+    hp_mmap_addr_t addr;
+    hp_mmap_addr_t end;
+    size_t queued;
+    uint32_t i;
+    hp_status_t status;
+
+    memset(&walk, 0, sizeof(walk));
+    walk.page_hash = page_hash;
+    walk.proc = proc;
+    walk.reader = reader;
+    walk.visit = visit;
+    walk.arg = arg;
+
+    hp_proc_reader_reset(reader);
+
+    for (i = 0; i < page_hash->range_count; i++) {
+        range = &page_hash->ranges[i];
+        end = range->start_addr +
+            ((hp_mmap_addr_t)range->page_count * HP_MMAP_PAGE_SIZE);
+        for (addr = range->start_addr; addr < end; addr += queued) {
+            queued = hp_proc_reader_add(reader, addr, end - addr);
+            if (queued == 0 && hp_page_hash_flush(&walk) != HP_STATUS_OK) {
+                status = HP_STATUS_ERROR;
+                goto return_status;
+            }
+        }
+    }
+    if (hp_page_hash_flush(&walk) != HP_STATUS_OK) {
+        status = HP_STATUS_ERROR;
+        goto return_status;
+    }
+
+    status = HP_STATUS_OK;
+ return_status:
+    return status;
+}
+
+static hp_status_t hp_page_hash_add_range(hp_mmap_addr_t start_addr,
+                                          hp_mmap_addr_t end_addr,
+                                          uint32_t state,
+                                          uint32_t protect,
+                                          uint32_t type,
+                                          void *page_hash_)
+{
+    hp_page_hash_t *page_hash = (hp_page_hash_t *)page_hash_;
+    hp_page_hash_range_t *ranges;
+    hp_page_hash_range_t *range;
+    uint32_t size;
+    hp_status_t status;
+
+    if (!hp_page_hash_watched(state, protect, type)) {
+        status = HP_STATUS_OK;
+        goto return_status;
+    }
+
+    if (page_hash->range_count == page_hash->range_size) {
+        size = (page_hash->range_size != 0) ? page_hash->range_size * 2 : 64;
+        ranges = (hp_page_hash_range_t *)
+            realloc(page_hash->ranges, sizeof(*ranges) * size);
+        if (ranges == NULL) {
+            hp_log_error("realloc() failure.");
+            status = HP_STATUS_ERROR;
+            goto return_status;
+        }
+        page_hash->ranges = ranges;
+        page_hash->range_size = size;
+    }
+
+    range = &page_hash->ranges[page_hash->range_count++];
+    range->start_addr = start_addr;
+    range->page_count = (end_addr - start_addr) / HP_MMAP_PAGE_SIZE;
+    range->state = state;
+    range->protect = protect;
+    range->type = type;
+    page_hash->hash_count += range->page_count;
+
+    status = HP_STATUS_OK;
+ return_status:
+    return status;
+}
+
+static void hp_page_hash_store(hp_page_hash_t *page_hash,
+                               hp_page_hash_range_t *range,
+                               uint32_t page_index,
+                               hp_mmap_addr_t addr,
+                               uint64_t hash,
+                               void *arg)
+{
+    page_hash->hashes[page_index] = hash;
+
+    return;
+}
+
+hp_status_t hp_page_hash_build(hp_page_hash_t *page_hash,
+                               hp_mmap_tree_t *mmap_tree,
+                               hp_proc_t *proc,
+                               hp_proc_reader_t *reader)
+{
+    uint64_t *hashes;
+    hp_status_t status;
+
+    page_hash->range_count = 0;
+    page_hash->hash_count = 0;
+
+    if (hp_mmap_parse(mmap_tree, hp_page_hash_add_range,
+                      page_hash) != HP_STATUS_OK)
+    {
+        status = HP_STATUS_ERROR;
+        goto return_status;
+    }
+
+    if (page_hash->hash_count > page_hash->hash_size) {
+        hashes = (uint64_t *)realloc(page_hash->hashes,
+                                     sizeof(*hashes) * page_hash->hash_count);
+        if (hashes == NULL) {
+            hp_log_error("realloc() failure.");
+            status = HP_STATUS_ERROR;
+            goto return_status;
+        }
+        page_hash->hashes = hashes;
+        page_hash->hash_size = page_hash->hash_count;
+    }
+
+    status = hp_page_hash_walk(page_hash, proc, reader,
+                               hp_page_hash_store, NULL);
+
+ return_status:
+    if (status != HP_STATUS_OK) {
+        page_hash->range_count = 0;
+        page_hash->hash_count = 0;
+    }
+    return status;
+}
+
+/* Where modified pages go */
+typedef struct hp_page_hash_diffs_t {
+    hp_mmap_diff_t *diffs;
+    uint32_t diffs_size;
+    uint32_t diff_count;
+    /* The range the last modified page was in, and where it ended */
+    hp_page_hash_range_t *range;
+    hp_mmap_addr_t end_addr;
+} hp_page_hash_diffs_t;
+
+static void hp_page_hash_compare(hp_page_hash_t *page_hash,
+                                 hp_page_hash_range_t *range,
+                                 uint32_t page_index,
+                                 hp_mmap_addr_t addr,
+                                 uint64_t hash,
+                                 void *diffs_)
+{
+    hp_page_hash_diffs_t *diffs = (hp_page_hash_diffs_t *)diffs_;
+    hp_mmap_diff_t *diff;
+
+    if (page_hash->hashes[page_index] == hash)
+        return;
+
+    /* Extend the last one if the page continues it */
+    if (diffs->diff_count != 0 && diffs->range == range &&
+        diffs->end_addr == addr)
+    {
+        diffs->end_addr = addr + HP_MMAP_PAGE_SIZE;
+        if (diffs->diff_count <= diffs->diffs_size)
+            diffs->diffs[diffs->diff_count - 1].end_addr = diffs->end_addr;
+        return;
+    }
+
+    if (diffs->diff_count < diffs->diffs_size) {
+        diff = &diffs->diffs[diffs->diff_count];
+        diff->kind = HP_MMAP_DIFF_MODIFIED;
+        diff->start_addr = addr;
+        diff->end_addr = addr + HP_MMAP_PAGE_SIZE;
+        diff->old_state = diff->new_state = range->state;
+        diff->old_protect = diff->new_protect = range->protect;
+        diff->old_type = diff->new_type = range->type;
+    }
+    diffs->diff_count++;
+    diffs->range = range;
+    diffs->end_addr = addr + HP_MMAP_PAGE_SIZE;
+
+    return;
+}
+
+hp_status_t hp_page_hash_diff(hp_page_hash_t *page_hash,
+                              hp_proc_t *proc,
+                              hp_proc_reader_t *reader,
+                              hp_mmap_diff_t *diffs_,
+                              uint32_t diffs_size,
+                              uint32_t *diff_count)
+{
+    hp_page_hash_diffs_t diffs;
+    hp_status_t status;
+
+    diffs.diffs = diffs_;
+    diffs.diffs_size = diffs_size;
+    diffs.diff_count = 0;
+    diffs.range = NULL;
+    diffs.end_addr = 0;
+
+    status = hp_page_hash_walk(page_hash, proc, reader,
+                               hp_page_hash_compare, &diffs);
+    *diff_count = diffs.diff_count;
+
+    return status;
+}
@@ -0,0 +1,76 @@
+/**
+ * Copyright(C) 2018, Juniper Networks, Inc.
+ * All rights reserved
+ *
+ * This SOFTWARE is licensed under the license provided in the LICENSE.txt
+ * file.  By downloading, installing, copying, or otherwise using the
+ * SOFTWARE, you agree to be bound by the terms of that license.  This
+ * SOFTWARE is not an official Juniper product.
+ *
+ * Third-Party Code: This SOFTWARE may depend on other components under
+ * separate copyright notice and license terms.  Your use of the source
+ * code for those components is subject to the term and conditions of
+ * the respective license as noted in the Third-Party source code.
+ */
+
+/**
+ * @author Anoop Saldanha
+ */
+/* Content hashes of the code pages of a process.  A write into a page
+ * that is already executable, or a page reprotected, written to and
+ * protected back, leaves the memory map as it was.  Hashing the pages
+ * with a baseline and re-hashing them on a poll catches those.
+ *
+ * The pages hashed are the executable and image ones of the map given at
+ * the baseline.  Their hashes are kept in a flat array in address order,
+ * apart from the map, so a poll is a straight walk over both. */
+
+#ifndef __PAGE_HASH__H__
+#define __PAGE_HASH__H__
+
+#include "honeyprocs-common.h"
+#include "mmap.h"
+#include "proc.h"
+#include "proc-reader.h"
+#include "status.h"
+
+typedef struct hp_page_hash_t hp_page_hash_t;
+
+hp_status_t hp_page_hash_init(hp_page_hash_t **page_hash);
+void hp_page_hash_deinit(hp_page_hash_t *page_hash);
+
+/**
+ * Take the baseline - pick the pages to watch out of a map of the
+ * process, and hash them.  Replaces any earlier baseline.
+ *
+ * @reader Used to read the pages.  Left reset.
+ */
+hp_status_t hp_page_hash_build(hp_page_hash_t *page_hash,
+                               hp_mmap_tree_t *mmap_tree,
+                               hp_proc_t *proc,
+                               hp_proc_reader_t *reader);
+
+/* No of pages watched */
+uint32_t hp_page_hash_count(hp_page_hash_t *page_hash);
+
+/**
+ * Re-hash the watched pages and compare them with the baseline.  No
+ * memory is allocated.
+ *
+ * @diffs Filled with up to diffs_size HP_MMAP_DIFF_MODIFIED ranges, in
+ *        address order, with contiguous pages of a region reported as
+ *        one.  Both sides carry the region's attributes.
+ * @diff_count Set to the no of modified ranges, which may be more than
+ *             diffs_size.
+ *
+ * @retval HP_STATUS_OK On success.
+ * @retval HP_STATUS_ERROR If the process couldn't be read.
+ */
+hp_status_t hp_page_hash_diff(hp_page_hash_t *page_hash,
+                              hp_proc_t *proc,
+                              hp_proc_reader_t *reader,
+                              hp_mmap_diff_t *diffs,
+                              uint32_t diffs_size,
+                              uint32_t *diff_count);
+
+#endif /* __PAGE_HASH__H__ */
@@ -0,0 +1,528 @@
+/**
+ * Copyright(C) 2018, Juniper Networks, Inc.
+ * All rights reserved
+ *
+ * This SOFTWARE is licensed under the license provided in the LICENSE.txt
+ * file.  By downloading, installing, copying, or otherwise using the
+ * SOFTWARE, you agree to be bound by the terms of that license.  This
+ * SOFTWARE is not an official Juniper product.
+ *
+ * Third-Party Code: This SOFTWARE may depend on other components under
+ * separate copyright notice and license terms.  Your use of the source
+ * code for those components is subject to the term and conditions of
+ * the respective license as noted in the Third-Party source code.
+ */
+
+/**
+ * @author Anoop Saldanha
+ */
+
+#define _GNU_SOURCE
+
+/* hp_get_mmap() logs as part of the map code */
+#define HP_LOG_MODULE HP_LOG_MODULE_MMAP
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <sys/uio.h>
+
+#include "honeyprocs-common.h"
+#include "proc.h"
+#include "mmap.h"
+#include "status.h"
+#include "util-hash.h"
+#include "util-log.h"
+
+/* Most iovecs a single process_vm_readv() takes */
+#ifdef IOV_MAX
+#define HP_PROC_IOV_MAX IOV_MAX
+#else
+#define HP_PROC_IOV_MAX 1024
+#endif
+
+typedef struct hp_proc_t {
+    uint32_t pid;
+    uint32_t flags;
+    /* /proc/<pid>/maps, or smaps with HP_PROC_FLAG_RSS.  Kept open and
+     * re-read from the start for every snapshot. */
+    int fd;
+    uint64_t identity;
+} hp_proc_t;
+
+/* Read the whole file into the scratch buffer in one pass. */
+static hp_status_t hp_proc_read(hp_proc_t *proc, hp_scratch_t *scratch,
+                                size_t *len_)
+{
+    ssize_t r;
+    size_t len;
+    hp_status_t status;
+
+    *len_ = 0;
+
+    if (lseek(proc->fd, 0, SEEK_SET) == (off_t)-1) {
+        hp_log_error("lseek() failed for pid(%u).  Error(%d).",
+                     proc->pid, errno);
+        status = HP_STATUS_ERROR;
+        goto return_status;
+    }
+
+    len = 0;
+    while (1) {
+        if (hp_scratch_reserve(scratch, len + 1) != HP_STATUS_OK) {
+            status = HP_STATUS_ERROR;
+            goto return_status;
+        }
+
+        r = read(proc->fd, scratch->buf + len, scratch->size - len);
+        if (r < 0) {
+            if (errno == EINTR)
+                continue;
+            hp_log_error("read() failed for pid(%u).  Error(%d).",
+                         proc->pid, errno);
+            status = HP_STATUS_ERROR;
+            goto return_status;
+        }
+        if (r == 0)
+            break;
+        len += r;
+    }
+
+    /* An exited process reads back as an empty map. */
+    if (len == 0) {
+        hp_log_error("Empty memory map for pid(%u).", proc->pid);
+        status = HP_STATUS_ERROR;
+        goto return_status;
+    }
+
+    *len_ = len;
+
+    status = HP_STATUS_OK;
+ return_status:
+    return status;
+}
+
+static char *hp_parse_hex(char *p, char *end, uint64_t *val)
+{
+    uint64_t v = 0;
+    int d;
+
+    for (; p < end; p++) {
+        if (*p >= '0' && *p <= '9')
+            d = *p - '0';
+        else if (*p >= 'a' && *p <= 'f')
+            d = *p - 'a' + 10;
+        else
+            break;
+        v = (v << 4) | d;
+    }
+    *val = v;
+
+    return p;
+}
+
+static char *hp_parse_dec(char *p, char *end, uint64_t *val)
+{
+    uint64_t v = 0;
+
+    for (; p < end && *p >= '0' && *p <= '9'; p++)
+        v = (v * 10) + (*p - '0');
+    *val = v;
+
+    return p;
+}
+
+static char *hp_skip_spaces(char *p, char *end)
+{
+    while (p < end && (*p == ' ' || *p == '\t'))
+        p++;
+
+    return p;
+}
+
+static char *hp_skip_token(char *p, char *end)
+{
+    while (p < end && *p != ' ' && *p != '\t' && *p != '\n')
+        p++;
+
+    return p;
+}
+
+/* Translate the "rwxp" permissions of a mapping into the Windows style
+ * attributes hp_mmap_t tracks. */
+static void hp_perms_to_attrs(const char *perms, uint64_t inode,
+                              uint32_t *state,
+                              uint32_t *protect,
+                              uint32_t *type)
+{
+    bool r = (perms[0] == 'r');
+    bool w = (perms[1] == 'w');
+    bool x = (perms[2] == 'x');
+    bool shared = (perms[3] == 's');
+
+    if (x) {
+        *protect = w ? HP_MMAP_PROT_EXECUTE_READWRITE :
+            (r ? HP_MMAP_PROT_EXECUTE_READ : HP_MMAP_PROT_EXECUTE);
+    } else if (w) {
+        *protect = HP_MMAP_PROT_READWRITE;
+    } else if (r) {
+        *protect = HP_MMAP_PROT_READONLY;
+    } else {
+        *protect = HP_MMAP_PROT_NOACCESS;
+    }
+
+    if (shared) {
+        *type = HP_MMAP_TYPE_MAPPED;
+    } else if (inode != 0) {
+        *type = HP_MMAP_TYPE_IMAGE;
+    } else {
+        *type = HP_MMAP_TYPE_PRIVATE;
+    }
+
+    /* Inaccessible anonymous mappings are address space reservations,
+     * i.e. guard areas and heap arenas not handed out yet. */
+    if (*protect == HP_MMAP_PROT_NOACCESS && *type == HP_MMAP_TYPE_PRIVATE)
+        *state = HP_MMAP_STATE_RESERVE;
+    else
+        *state = HP_MMAP_STATE_COMMIT;
+
+    return;
+}
+
+/**
+ * Parse a region line -
+ * "start-end perms offset dev inode [path]"
+ */
+static hp_status_t hp_parse_region(char *p, char *end,
+                                   hp_mmap_update_t *update,
+                                   uint64_t *region_start)
+{
+    uint64_t start, end_addr, inode;
+    char *perms;
+    uint32_t state, protect, type;
+    hp_status_t status;
+
+    p = hp_parse_hex(p, end, &start);
+    if (p == end || *p != '-') {
+        status = HP_STATUS_ERROR;
+        goto return_status;
+    }
+    p = hp_parse_hex(p + 1, end, &end_addr);
+    p = hp_skip_spaces(p, end);
+    if (end - p < 4) {
+        status = HP_STATUS_ERROR;
+        goto return_status;
+    }
+    perms = p;
+    /* offset and dev */
+    p = hp_skip_spaces(hp_skip_token(p + 4, end), end);
+    p = hp_skip_spaces(hp_skip_token(p, end), end);
+    p = hp_skip_spaces(hp_skip_token(p, end), end);
+    hp_parse_dec(p, end, &inode);
+
+    hp_perms_to_attrs(perms, inode, &state, &protect, &type);
+
+    status = hp_mmap_update_region(update, start, end_addr - start,
+                                   state, protect, type);
+    *region_start = start;
+
+ return_status:
+    return status;
+}
+
+hp_status_t hp_get_mmap(hp_proc_t *proc, hp_scratch_t *scratch,
+                        hp_mmap_tree_t *mmap_tree, bool *changed)
+{
+    hp_mmap_update_t update;
+    bool changed_;
+    uint64_t region_start;
+    uint64_t rss;
+    size_t len;
+    char *line, *eol, *end;
+    hp_status_t status;
+
+    if (hp_proc_read(proc, scratch, &len) != HP_STATUS_OK) {
+        status = HP_STATUS_ERROR;
+        goto return_status;
+    }
+
+    if (hp_mmap_update_begin(mmap_tree, &update) != HP_STATUS_OK) {
+        status = HP_STATUS_ERROR;
+        goto return_status;
+    }
+
+    region_start = 0;
+    end = (char *)scratch->buf + len;
+    for (line = (char *)scratch->buf; line < end; line = eol + 1) {
+        eol = (char *)memchr(line, '\n', end - line);
+        if (eol == NULL)
+            eol = end;
+
+        /* Region lines start with the lowercase hex start address.  The
+         * per region attribute lines in smaps start with a capitalised
+         * key. */
+        if ((*line >= '0' && *line <= '9') || (*line >= 'a' && *line <= 'f')) {
+            if (hp_parse_region(line, eol, &update,
+                                &region_start) != HP_STATUS_OK)
+            {
+                hp_log_error("Failed to parse memory map of pid(%u).",
+                             proc->pid);
+                status = HP_STATUS_ERROR;
+                goto return_status;
+            }
+        } else if ((eol - line) > 4 && memcmp(line, "Rss:", 4) == 0) {
+            hp_parse_dec(hp_skip_spaces(line + 4, eol), eol, &rss);
+            hp_mmap_add_rss(mmap_tree, region_start, rss * 1024);
+        }
+    }
+
+    if (hp_mmap_update_end(&update, &changed_) != HP_STATUS_OK) {
+        status = HP_STATUS_ERROR;
+        goto return_status;
+    }
+    if (changed != NULL)
+        *changed = changed_;
+
+    status = HP_STATUS_OK;
+ return_status:
+    return status;
+}
+
+/* Read a small file of /proc whole.  Returns its length, or 0. */
+static size_t hp_proc_read_small(const char *path, char *buf, size_t size)
+{
+    ssize_t r;
+    int fd;
+
+    if ((fd = open(path, O_RDONLY)) < 0)
+        return 0;
+    r = read(fd, buf, size - 1);
+    close(fd);
+    if (r <= 0)
+        return 0;
+    buf[r] = '\0';
+
+    return (size_t)r;
+}
+
+/* The start time of the process, in clock ticks since boot, hashed with
+ * the boot id, as the start time alone repeats across boots. */
+static uint64_t hp_proc_read_identity(uint32_t pid)
+{
+    char path[64];
+    char stat[1024];
+    char boot_id[64];
+    char *p, *end;
+    uint64_t start_time;
+    size_t len;
+    uint32_t i;
+
+    snprintf(path, sizeof(path), "/proc/%u/stat", pid);
+    if ((len = hp_proc_read_small(path, stat, sizeof(stat))) == 0 ||
+        (p = strrchr(stat, ')')) == NULL)
+    {
+        return 0;
+    }
+    end = stat + len;
+
+    /* The comm field can hold anything, so the fields are counted from
+     * its closing parenthesis.  starttime is the 20th after it. */
+    p++;
+    for (i = 0; i < 19; i++)
+        p = hp_skip_token(hp_skip_spaces(p, end), end);
+    hp_parse_dec(hp_skip_spaces(p, end), end, &start_time);
+    if (start_time == 0)
+        return 0;
+
+    if ((len = hp_proc_read_small("/proc/sys/kernel/random/boot_id",
+                                  boot_id, sizeof(boot_id))) == 0)
+    {
+        return 0;
+    }
+
+    return hp_hash64((const uint8_t *)boot_id, len, start_time);
+}
+
+hp_status_t hp_proc_open(uint32_t pid, uint32_t flags, hp_proc_t **proc_)
+{
+    hp_proc_t *proc;
+    char path[64];
+    hp_status_t status;
+
+    *proc_ = NULL;
+
+    if ((proc = (hp_proc_t *)malloc(sizeof(*proc))) == NULL) {
+        hp_log_error("malloc() failure.");
+        status = HP_STATUS_ERROR;
+        goto return_status;
+    }
+    memset(proc, 0, sizeof(*proc));
+    proc->pid = pid;
+    proc->flags = flags;
+    proc->fd = -1;
+
+    snprintf(path, sizeof(path), "/proc/%u/%s", pid,
+             (flags & HP_PROC_FLAG_RSS) ? "smaps" : "maps");
+    if ((proc->fd = open(path, O_RDONLY)) < 0) {
+        hp_log_error("open(\"%s\") failed for process with pid(%u).  "
+                     "Error(%d).", path, pid, errno);
+        hp_proc_close(proc);
+        status = HP_STATUS_ERROR;
+        goto return_status;
+    }
+    hp_log_debug("Opened \"%s\" for process with pid(%u).", path, pid);
+    proc->identity = hp_proc_read_identity(pid);
+
+    *proc_ = proc;
+
+    status = HP_STATUS_OK;
+ return_status:
+    return status;
+}
+
+void hp_proc_close(hp_proc_t *proc)
+{
+    if (proc->fd >= 0)
+        close(proc->fd);
+    free(proc);
+
+    return;
+}
+
+uint32_t hp_proc_pid(hp_proc_t *proc)
+{
+    return proc->pid;
+}
+
+uint64_t hp_proc_identity(hp_proc_t *proc)
+{
+    return proc->identity;
+}
+
+bool hp_proc_alive(hp_proc_t *proc)
+{
+    return (kill(proc->pid, 0) == 0 || errno == EPERM);
+}
+
+/* Pages from the given offset to the end of a read */
+static uint64_t hp_proc_read_tail_mask(hp_proc_read_t *read, size_t offset)
+{
+    uint32_t pages = read->len / HP_MMAP_PAGE_SIZE;
+    uint64_t mask;
+
+    mask = (pages == 64) ? ~(uint64_t)0 : (((uint64_t)1 << pages) - 1);
+
+    return mask & ~(((uint64_t)1 << (offset / HP_MMAP_PAGE_SIZE)) - 1);
+}
+
+/* Read a single read a page at a time, flagging the pages that can't be
+ * read. */
+static hp_status_t hp_proc_read_pages(hp_proc_t *proc, hp_proc_read_t *read)
+{
+    struct iovec local, remote;
+    size_t offset;
+    ssize_t r;
+    hp_status_t status;
+
+    for (offset = 0; offset < read->len; offset += HP_MMAP_PAGE_SIZE) {
+        local.iov_base = read->buf + offset;
+        local.iov_len = HP_MMAP_PAGE_SIZE;
+        remote.iov_base = (void *)(uintptr_t)(read->addr + offset);
+        remote.iov_len = HP_MMAP_PAGE_SIZE;
+
+        r = process_vm_readv(proc->pid, &local, 1, &remote, 1, 0);
+        if (r == HP_MMAP_PAGE_SIZE)
+            continue;
+
+        if (r < 0 && errno != EFAULT) {
+            hp_log_error("process_vm_readv() failed for pid(%u).  "
+                         "Error(%d).", proc->pid, errno);
+            read->unread |= hp_proc_read_tail_mask(read, offset);
+            status = HP_STATUS_ERROR;
+            goto return_status;
+        }
+
+        read->unread |= (uint64_t)1 << (offset / HP_MMAP_PAGE_SIZE);
+    }
+
+    status = HP_STATUS_OK;
+ return_status:
+    return status;
+}
+
+hp_status_t hp_proc_read_batch(hp_proc_t *proc, hp_scratch_t *scratch,
+                               hp_proc_read_t *reads,
+                               uint32_t read_count)
+{
+    struct iovec *local;
+    struct iovec *remote;
+    /* The first read not done yet */
+    uint32_t i;
+    uint32_t n, max_n;
+    uint32_t batch_end;
+    ssize_t r;
+    hp_status_t status;
+
+    for (i = 0; i < read_count; i++) {
+        BUG_ON(reads[i].len > HP_PROC_READ_MAX_PAGES * HP_MMAP_PAGE_SIZE);
+        reads[i].unread = 0;
+    }
+
+    i = 0;
+
+    max_n = (read_count < HP_PROC_IOV_MAX) ? read_count : HP_PROC_IOV_MAX;
+    if (hp_scratch_reserve(scratch, sizeof(struct iovec) * 2 * max_n) !=
+        HP_STATUS_OK)
+    {
+        status = HP_STATUS_ERROR;
+        goto return_status;
+    }
+    local = (struct iovec *)scratch->buf;
+    remote = local + max_n;
+
+    while (i < read_count) {
+        for (n = 0; n < max_n && i + n < read_count; n++) {
+            local[n].iov_base = reads[i + n].buf;
+            local[n].iov_len = reads[i + n].len;
+            remote[n].iov_base = (void *)(uintptr_t)reads[i + n].addr;
+            remote[n].iov_len = reads[i + n].len;
+        }
+        batch_end = i + n;
+
+        r = process_vm_readv(proc->pid, local, n, remote, n, 0);
+        if (r < 0 && errno != EFAULT) {
+            hp_log_error("process_vm_readv() failed for pid(%u).  "
+                         "Error(%d).", proc->pid, errno);
+            status = HP_STATUS_ERROR;
+            goto return_status;
+        }
+
+        /* The kernel copies the iovecs in order and stops at the first
+         * one it can't copy whole, returning what it copied till then.
+         * It only promises that much per iovec, so the one it stopped in
+         * is read again a page at a time, and the batch picks up after
+         * it.  Nothing copied at all fails with EFAULT. */
+        while (r > 0 && i < batch_end && (size_t)r >= reads[i].len) {
+            r -= reads[i].len;
+            i++;
+        }
+        if (i == batch_end)
+            continue;
+
+        if (hp_proc_read_pages(proc, &reads[i]) != HP_STATUS_OK) {
+            i++;
+            status = HP_STATUS_ERROR;
+            goto return_status;
+        }
+        i++;
+    }
+
+    status = HP_STATUS_OK;
+ return_status:
+    if (status != HP_STATUS_OK) {
+        for (; i < read_count; i++)
+            reads[i].unread = hp_proc_read_tail_mask(&reads[i], 0);
+    }
+    return status;
+}
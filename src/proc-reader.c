@@ -0,0 +1,110 @@
+/**
+ * Copyright(C) 2018, Juniper Networks, Inc.
+ * All rights reserved
+ *
+ * This SOFTWARE is licensed under the license provided in the LICENSE.txt
+ * file.  By downloading, installing, copying, or otherwise using the
+ * SOFTWARE, you agree to be bound by the terms of that license.  This
+ * SOFTWARE is not an official Juniper product.
+ *
+ * Third-Party Code: This SOFTWARE may depend on other components under
+ * separate copyright notice and license terms.  Your use of the source
+ * code for those components is subject to the term and conditions of
+ * the respective license as noted in the Third-Party source code.
+ */
+
+/**
+ * @author Anoop Saldanha
+ */
+#include "honeyprocs-common.h"
+#include "align.h"
+#include "proc-reader.h"
+#include "proc.h"
+#include "mmap.h"
+#include "status.h"
+#include "util-log.h"
+
+hp_status_t hp_proc_reader_init(hp_proc_reader_t *reader,
+                                uint32_t slot_count)
+{
+    uintptr_t pool;
+    hp_status_t status;
+
+    BUG_ON(HP_PROC_READER_SLOT_SIZE >
+           HP_PROC_READ_MAX_PAGES * HP_MMAP_PAGE_SIZE);
+
+    memset(reader, 0, sizeof(*reader));
+
+    reader->pool_alloc = (uint8_t *)
+        malloc(((size_t)HP_PROC_READER_SLOT_SIZE * slot_count) +
+               HP_MMAP_PAGE_SIZE);
+    reader->reads = (hp_proc_read_t *)
+        malloc(sizeof(*reader->reads) * slot_count);
+    if (reader->pool_alloc == NULL || reader->reads == NULL) {
+        hp_log_error("malloc() failure.");
+        hp_proc_reader_deinit(reader);
+        status = HP_STATUS_ERROR;
+        goto return_status;
+    }
+
+    pool = (uintptr_t)reader->pool_alloc;
+    ALIGN_UP(pool, HP_MMAP_PAGE_SIZE);
+    reader->pool = (uint8_t *)pool;
+    reader->slot_count = slot_count;
+
+    status = HP_STATUS_OK;
+ return_status:
+    return status;
+}
+
+void hp_proc_reader_deinit(hp_proc_reader_t *reader)
+{
+    free(reader->pool_alloc);
+    free(reader->reads);
+    hp_scratch_free(&reader->scratch);
+    memset(reader, 0, sizeof(*reader));
+
+    return;
+}
+
+size_t hp_proc_reader_add(hp_proc_reader_t *reader,
+                          hp_mmap_addr_t addr, size_t len)
+{
+    hp_proc_read_t *read;
+    size_t queued = 0;
+
+    BUG_ON((addr % HP_MMAP_PAGE_SIZE) != 0 ||
+           (len % HP_MMAP_PAGE_SIZE) != 0);
+
+    while (queued < len && reader->read_count < reader->slot_count) {
+        read = &reader->reads[reader->read_count];
+        read->addr = addr + queued;
+        read->len = len - queued;
+        if (read->len > HP_PROC_READER_SLOT_SIZE)
+            read->len = HP_PROC_READER_SLOT_SIZE;
+        read->buf = reader->pool +
+            ((size_t)HP_PROC_READER_SLOT_SIZE * reader->read_count);
+        read->unread = 0;
+
+        queued += read->len;
+        reader->read_count++;
+    }
+
+    return queued;
+}
+
+hp_status_t hp_proc_reader_run(hp_proc_reader_t *reader, hp_proc_t *proc)
+{
+    if (reader->read_count == 0)
+        return HP_STATUS_OK;
+
+    return hp_proc_read_batch(proc, &reader->scratch, reader->reads,
+                              reader->read_count);
+}
+
+void hp_proc_reader_reset(hp_proc_reader_t *reader)
+{
+    reader->read_count = 0;
+
+    return;
+}
@@ -0,0 +1,71 @@
+/**
+ * Copyright(C) 2018, Juniper Networks, Inc.
+ * All rights reserved
+ *
+ * This SOFTWARE is licensed under the license provided in the LICENSE.txt
+ * file.  By downloading, installing, copying, or otherwise using the
+ * SOFTWARE, you agree to be bound by the terms of that license.  This
+ * SOFTWARE is not an official Juniper product.
+ *
+ * Third-Party Code: This SOFTWARE may depend on other components under
+ * separate copyright notice and license terms.  Your use of the source
+ * code for those components is subject to the term and conditions of
+ * the respective license as noted in the Third-Party source code.
+ */
+
+/**
+ * @author Anoop Saldanha
+ */
+/* Collects ranges of a process's memory to be read, and reads them in a
+ * batch into a buffer pool allocated once and reused.  The pool is made
+ * of page aligned slots, with a range split over as many slots as it
+ * needs, so that each slot is a single read, and the batch as few
+ * system calls as the backend allows. */
+
+#ifndef __PROC_READER__H__
+#define __PROC_READER__H__
+
+#include "honeyprocs-common.h"
+#include "proc.h"
+#include "mmap.h"
+#include "util-scratch.h"
+#include "status.h"
+
+/* Size of a pool slot, the most a single read in a batch spans */
+#define HP_PROC_READER_SLOT_SIZE (16 * HP_MMAP_PAGE_SIZE)
+
+typedef struct hp_proc_reader_t {
+    /* Where the pool was allocated, and its page aligned start */
+    uint8_t *pool_alloc;
+    uint8_t *pool;
+    uint32_t slot_count;
+    /* A read per slot in use, in the order the ranges were added */
+    hp_proc_read_t *reads;
+    uint32_t read_count;
+    /* Working memory for the backend's batch read */
+    hp_scratch_t scratch;
+} hp_proc_reader_t;
+
+hp_status_t hp_proc_reader_init(hp_proc_reader_t *reader,
+                                uint32_t slot_count);
+void hp_proc_reader_deinit(hp_proc_reader_t *reader);
+
+/**
+ * Queue a range to be read.  Ranges have to be page aligned.
+ *
+ * @retval The no of bytes from the start of the range queued.  Less than
+ *         len once the pool is full, and 0 if it already was.
+ */
+size_t hp_proc_reader_add(hp_proc_reader_t *reader,
+                          hp_mmap_addr_t addr, size_t len);
+
+/**
+ * Read the queued ranges.  Afterwards reader->reads[] holds the memory,
+ * with unreadable pages flagged per read, till hp_proc_reader_reset().
+ */
+hp_status_t hp_proc_reader_run(hp_proc_reader_t *reader, hp_proc_t *proc);
+
+/* Drop the queued ranges, keeping the pool. */
+void hp_proc_reader_reset(hp_proc_reader_t *reader);
+
+#endif /* __PROC_READER__H__ */
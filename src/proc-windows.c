@@ -0,0 +1,343 @@
+/**
+ * Copyright(C) 2018, Juniper Networks, Inc.
+ * All rights reserved
+ *
+ * This SOFTWARE is licensed under the license provided in the LICENSE.txt
+ * file.  By downloading, installing, copying, or otherwise using the
+ * SOFTWARE, you agree to be bound by the terms of that license.  This
+ * SOFTWARE is not an official Juniper product.
+ *
+ * Third-Party Code: This SOFTWARE may depend on other components under
+ * separate copyright notice and license terms.  Your use of the source
+ * code for those components is subject to the term and conditions of
+ * the respective license as noted in the Third-Party source code.
+ */
+
+/**
+ * @author Anoop Saldanha
+ */
+
+/* hp_get_mmap() logs as part of the map code */
+#define HP_LOG_MODULE HP_LOG_MODULE_MMAP
+
+#include "honeyprocs-common.h"
+#include "proc.h"
+#include "mmap.h"
+#include "status.h"
+#include "util-log.h"
+
+typedef struct hp_proc_t {
+    uint32_t pid;
+    HANDLE ph;
+    uint64_t identity;
+} hp_proc_t;
+
+typedef struct hp_char_buf_t {
+    char buf[1024];
+    uint32_t len;
+} hp_char_buf_t;
+
+static void hp_char_buf_reset(hp_char_buf_t *cbuf)
+{
+    memset(cbuf, 0, sizeof(*cbuf));
+
+    return;
+}
+
+static hp_status_t hp_write_to_char_buf(hp_char_buf_t *cbuf,
+                                        char *val)
+{
+    hp_status_t status;
+    int r;
+
+    if (cbuf->len == sizeof(cbuf->buf)) {
+        status = HP_STATUS_ERROR;
+        goto return_status;
+    }
+
+    r = _snprintf_s(cbuf->buf + cbuf->len, sizeof(cbuf->buf) - cbuf->len,
+                    _TRUNCATE, "%s", val);
+    if (r <= 0) {
+        status = HP_STATUS_ERROR;
+        goto return_status;
+    }
+    BUG_ON(r > (sizeof(cbuf->buf) - cbuf->len));
+    cbuf->len += r;
+
+    status = HP_STATUS_OK;
+ return_status:
+    return status;
+}
+
+
+static hp_status_t hp_get_process_handle(DWORD pid, LPHANDLE lph)
+{
+    hp_status_t status;
+
+    *lph = OpenProcess(PROCESS_VM_READ |
+                       PROCESS_VM_OPERATION |
+                       PROCESS_QUERY_INFORMATION,
+                       FALSE, pid);
+    if (*lph == NULL) {
+        hp_log_error("OpenProcess(PROCESS_VM_READ | PROCESS_QUERY_INFORMATION) "
+                     "failed for process with pid(%lu).  Error Code(%u).",
+                     pid, GetLastError());
+        status = HP_STATUS_ERROR;
+        goto return_status;
+    }
+    hp_log_debug("OpenProcess(PROCESS_VM_READ | PROCESS_QUERY_INFORMATION) "
+                 "succeeded for process with pid(%lu) and got handle(0x%x).",
+                 pid, *lph);
+
+    status = HP_STATUS_OK;
+ return_status:
+    return status;
+}
+
+static void hp_minfo_to_string(MEMORY_BASIC_INFORMATION *minfo,
+                               hp_char_buf_t *cbuf)
+{
+    int r;
+
+    switch (minfo->State) {
+        case MEM_COMMIT:
+            hp_write_to_char_buf(cbuf, "COMMIT,");
+            break;
+        case MEM_FREE:
+            hp_write_to_char_buf(cbuf, "FREE,");
+            goto return_status;
+        case MEM_RESERVE:
+            hp_write_to_char_buf(cbuf, "RESERVE,");
+            break;
+    }
+
+    switch (minfo->Type) {
+        case MEM_IMAGE:
+            hp_write_to_char_buf(cbuf, "IMAGE,");
+            break;
+        case MEM_MAPPED:
+            hp_write_to_char_buf(cbuf, "MAPPED,");
+            break;
+        case MEM_PRIVATE:
+            hp_write_to_char_buf(cbuf, "PRIVATE,");
+            break;
+        default:
+            BUG_ON(1);
+    }
+
+    switch (minfo->Protect) {
+        case PAGE_EXECUTE:
+            hp_write_to_char_buf(cbuf, "PAGE_EXECUTE,");
+            break;
+        case PAGE_EXECUTE_READ:
+            hp_write_to_char_buf(cbuf, "PAGE_EXECUTE_READ,");
+            break;
+        case PAGE_EXECUTE_READWRITE:
+            hp_write_to_char_buf(cbuf, "PAGE_EXECUTE_READWRITE,");
+            break;
+        case PAGE_EXECUTE_WRITECOPY:
+            hp_write_to_char_buf(cbuf, "PAGE_EXECUTE_WRITECOPY,");
+            break;
+        case PAGE_NOACCESS:
+            hp_write_to_char_buf(cbuf, "PAGENOACCESS,");
+            break;
+        case PAGE_READONLY:
+            hp_write_to_char_buf(cbuf, "PAGE_READONLY,");
+            break;
+        case PAGE_READWRITE:
+            hp_write_to_char_buf(cbuf, "PAGE_READWRITE,");
+            break;
+        case PAGE_WRITECOPY:
+            hp_write_to_char_buf(cbuf, "PAGE_WRITECOPY,");
+            break;
+#if 0
+        case PAGE_TARGETS_INVALID:
+            hp_write_to_char_buf(cbuf, "PAGE_TARGETS_INVALID,");
+            break;
+        case PAGE_TARGETS_NO_UPDATE:
+            hp_write_to_char_buf(cbuf, "PAGE_TARGETS_NO_UPDATE,");
+            break;
+#endif
+    }
+
+ return_status:
+    return;
+}
+
+hp_status_t hp_get_mmap(hp_proc_t *proc, hp_scratch_t *scratch,
+                        hp_mmap_tree_t *mmap_tree, bool *changed)
+{
+    hp_mmap_update_t update;
+    bool changed_;
+    MEMORY_BASIC_INFORMATION minfo;
+    DWORD base_address;
+    DWORD offset;
+    DWORD size;
+    hp_char_buf_t cbuf;
+    hp_status_t status;
+
+    base_address = 0x00000000;
+    offset = 0;
+    size = 0x7FFFFFFF;
+
+    if (hp_mmap_update_begin(mmap_tree, &update) != HP_STATUS_OK) {
+        status = HP_STATUS_ERROR;
+        goto return_status;
+    }
+
+    while (offset < size) {
+        hp_char_buf_reset(&cbuf);
+
+        minfo.BaseAddress = (PVOID)base_address;
+
+        /* Get information for the immediate page. */
+        if (VirtualQueryEx(proc->ph,
+                           minfo.BaseAddress,
+                           &minfo, sizeof(minfo)) == FALSE)
+        {
+            hp_log_error("VirtualQueryEx() failed to obtain permissions for "
+                         "region starting at base(0x%x).  Error Code(%u).",
+                         base_address, GetLastError());
+            break;
+        }
+
+        hp_minfo_to_string(&minfo, &cbuf);
+        //printf("%x %x - %s\n", minfo.BaseAddress, minfo.RegionSize, cbuf.buf);
+        //fflush(stdout);
+        if (minfo.State != MEM_FREE) {
+            if (hp_mmap_update_region(&update,
+                                      (uintptr_t)minfo.BaseAddress,
+                                      minfo.RegionSize,
+                                      minfo.State,
+                                      minfo.Protect,
+                                      minfo.Type) != HP_STATUS_OK)
+            {
+                status = HP_STATUS_ERROR;
+                goto return_status;
+            }
+        }
+
+        base_address += minfo.RegionSize;
+        offset += minfo.RegionSize;
+    }
+
+    if (hp_mmap_update_end(&update, &changed_) != HP_STATUS_OK) {
+        status = HP_STATUS_ERROR;
+        goto return_status;
+    }
+    if (changed != NULL)
+        *changed = changed_;
+
+    status = HP_STATUS_OK;
+ return_status:
+    return status;
+}
+
+hp_status_t hp_proc_open(uint32_t pid, uint32_t flags, hp_proc_t **proc_)
+{
+    hp_proc_t *proc;
+    FILETIME creation_time;
+    FILETIME exit_time;
+    FILETIME kernel_time;
+    FILETIME user_time;
+    hp_status_t status;
+
+    *proc_ = NULL;
+
+    /* VirtualQueryEx() doesn't report resident bytes, so
+     * HP_PROC_FLAG_RSS is a no-op here. */
+    if ((proc = (hp_proc_t *)malloc(sizeof(*proc))) == NULL) {
+        hp_log_error("malloc() failure.");
+        status = HP_STATUS_ERROR;
+        goto return_status;
+    }
+    memset(proc, 0, sizeof(*proc));
+    proc->pid = pid;
+
+    if (hp_get_process_handle(pid, &proc->ph) != HP_STATUS_OK) {
+        free(proc);
+        status = HP_STATUS_ERROR;
+        goto return_status;
+    }
+
+    /* Creation times are in 100ns ticks since 1601, and so don't repeat
+     * for a pid. */
+    if (GetProcessTimes(proc->ph, &creation_time, &exit_time,
+                        &kernel_time, &user_time))
+    {
+        proc->identity = ((uint64_t)creation_time.dwHighDateTime << 32) |
+            creation_time.dwLowDateTime;
+    }
+
+    *proc_ = proc;
+
+    status = HP_STATUS_OK;
+ return_status:
+    return status;
+}
+
+void hp_proc_close(hp_proc_t *proc)
+{
+    CloseHandle(proc->ph);
+    free(proc);
+
+    return;
+}
+
+uint32_t hp_proc_pid(hp_proc_t *proc)
+{
+    return proc->pid;
+}
+
+uint64_t hp_proc_identity(hp_proc_t *proc)
+{
+    return proc->identity;
+}
+
+bool hp_proc_alive(hp_proc_t *proc)
+{
+    DWORD exit_code;
+
+    if (GetExitCodeProcess(proc->ph, &exit_code) == FALSE)
+        return false;
+
+    return (exit_code == STILL_ACTIVE);
+}
+
+hp_status_t hp_proc_read_batch(hp_proc_t *proc, hp_scratch_t *scratch,
+                               hp_proc_read_t *reads,
+                               uint32_t read_count)
+{
+    hp_proc_read_t *read;
+    size_t offset;
+    SIZE_T r;
+    uint32_t i;
+
+    /* ReadProcessMemory() takes a single range, so each read is a call.
+     * A read that runs into an unreadable page is retried a page at a
+     * time to find out which pages are the unreadable ones. */
+    for (i = 0; i < read_count; i++) {
+        read = &reads[i];
+        read->unread = 0;
+
+        if (ReadProcessMemory(proc->ph, (LPCVOID)(uintptr_t)read->addr,
+                              read->buf, read->len, &r) != FALSE &&
+            r == read->len)
+        {
+            continue;
+        }
+
+        for (offset = 0; offset < read->len; offset += HP_MMAP_PAGE_SIZE) {
+            if (ReadProcessMemory(proc->ph,
+                                  (LPCVOID)(uintptr_t)(read->addr + offset),
+                                  read->buf + offset, HP_MMAP_PAGE_SIZE,
+                                  &r) == FALSE ||
+                r != HP_MMAP_PAGE_SIZE)
+            {
+                read->unread |= (uint64_t)1 << (offset / HP_MMAP_PAGE_SIZE);
+            }
+        }
+    }
+
+    return HP_STATUS_OK;
+}
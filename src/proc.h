@@ -0,0 +1,93 @@
+/**
+ * Copyright(C) 2018, Juniper Networks, Inc.
+ * All rights reserved
+ *
+ * This SOFTWARE is licensed under the license provided in the LICENSE.txt
+ * file.  By downloading, installing, copying, or otherwise using the
+ * SOFTWARE, you agree to be bound by the terms of that license.  This
+ * SOFTWARE is not an official Juniper product.
+ *
+ * Third-Party Code: This SOFTWARE may depend on other components under
+ * separate copyright notice and license terms.  Your use of the source
+ * code for those components is subject to the term and conditions of
+ * the respective license as noted in the Third-Party source code.
+ */
+
+/**
+ * @author Anoop Saldanha
+ */
+
+/* Platform backend used by the scanner to look into a monitored process.
+ * proc-windows.c implements it over OpenProcess()/VirtualQueryEx() and
+ * proc-linux.c over /proc/<pid>/maps and process_vm_readv(). */
+
+#ifndef __PROC__H__
+#define __PROC__H__
+
+#include "honeyprocs-common.h"
+#include "mmap.h"
+#include "util-scratch.h"
+#include "status.h"
+
+typedef struct hp_proc_t hp_proc_t;
+
+/* Also account resident bytes per region, where the backend can. */
+#define HP_PROC_FLAG_RSS 0x01
+
+hp_status_t hp_proc_open(uint32_t pid, uint32_t flags, hp_proc_t **proc);
+void hp_proc_close(hp_proc_t *proc);
+uint32_t hp_proc_pid(hp_proc_t *proc);
+/* Tells a process apart from every other process given the same pid,
+ * before or after it.  0 if the backend couldn't tell. */
+uint64_t hp_proc_identity(hp_proc_t *proc);
+bool hp_proc_alive(hp_proc_t *proc);
+
+/**
+ * Bring a map up to date with the memory map of a process.  The map is
+ * updated in place, and when nothing changed no memory is allocated.
+ *
+ * @proc The process as returned by hp_proc_open().
+ * @scratch Working memory for the snapshot, reused across calls.  Only
+ *          one thread may use a scratch at a time.
+ * @mmap_tree The map to update.  Pass an empty one for a fresh snapshot.
+ * @changed Optional.  Set to whether the map changed.
+ *
+ * @retval HP_STATUS_OK On success.
+ * @retval HP_STATUS_ERROR On failure, in which case the map is left
+ *                         partially updated.
+ */
+hp_status_t hp_get_mmap(hp_proc_t *proc, hp_scratch_t *scratch,
+                        hp_mmap_tree_t *mmap_tree, bool *changed);
+
+/* Most pages a single read in a batch can span */
+#define HP_PROC_READ_MAX_PAGES 64
+
+/* A range of memory to be copied out of a process */
+typedef struct hp_proc_read_t {
+    /* Page aligned, and at most HP_PROC_READ_MAX_PAGES pages long */
+    hp_mmap_addr_t addr;
+    size_t len;
+    uint8_t *buf;
+    /* Set by the read - a bit per page, from the first, that could not
+     * be read, such as a guard page or one unmapped since the map was
+     * taken.  Those pages are left untouched in buf. */
+    uint64_t unread;
+} hp_proc_read_t;
+
+/**
+ * Copy a batch of ranges out of a process, with as few system calls as
+ * the backend allows.  Unreadable pages are flagged per read and don't
+ * fail the batch.
+ *
+ * @scratch Working memory for the backend, reused across calls.  Only
+ *          one thread may use a scratch at a time.
+ *
+ * @retval HP_STATUS_OK On success, even if pages were unreadable.
+ * @retval HP_STATUS_ERROR If the process can't be read at all, in which
+ *                         case every page is flagged as unread.
+ */
+hp_status_t hp_proc_read_batch(hp_proc_t *proc, hp_scratch_t *scratch,
+                               hp_proc_read_t *reads,
+                               uint32_t read_count);
+
+#endif /* __PROC__H__ */
@@ -17,22 +17,1207 @@
  * @author Anoop Saldanha
  */
 
+#define HP_LOG_MODULE HP_LOG_MODULE_SCAN_ENGINE
+
 #include "honeyprocs-common.h"
+#include "scan-engine.h"
+#include "util-atomic.h"
 #include "util-log.h"
 #include "status.h"
 
-int hp_scan_engine_run(uint8_t *buf, uint32_t buf_len)
+#if defined(__x86_64__) || defined(__i386__) || \
+    defined(_M_X64) || defined(_M_IX86)
+#define HP_SCAN_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+/* MSVC lets any function use any intrinsic */
+#define HP_SCAN_TARGET(isa)
+#else
+#define HP_SCAN_TARGET(isa) __attribute__((target(isa)))
+#endif
+#endif
+
+#define HP_SCAN_STATE_ROOT 0
+/* No child, while building the trie */
+#define HP_SCAN_STATE_NONE UINT32_MAX
+/* Terminates a state's output chain */
+#define HP_SCAN_OUTPUT_NONE UINT32_MAX
+/* Once compiled, the table holds the offset of the next state's row
+ * rather than its no, which keeps a multiply out of the per byte lookup.
+ * States without a row are numbered on from the end of the rows.  The top
+ * bit flags states with something to report. */
+#define HP_SCAN_NEXT_MATCH 0x80000000U
+#define HP_SCAN_NEXT_ROW_MASK 0x7fffffffU
+
+typedef struct hp_scan_pattern_t {
+    uint8_t *pat;
+    uint32_t pat_len;
+    uint32_t pattern_id;
+} hp_scan_pattern_t;
+
+/* Patterns are spread over as many buckets as a mask byte has bits */
+#define HP_SCAN_PREFILTER_BUCKETS 8
+/* Above this many expected candidates per byte, the prefilter costs
+ * more than it saves */
+#define HP_SCAN_PREFILTER_MAX_RATE (1.0 / 16)
+/* Bits of the hash prefilter's bitmap per pattern, which keeps the bits
+ * set to about 1 in 64, within the bounds below.  At the most, 128 KB. */
+#define HP_SCAN_PREFILTER_HASH_BITS_PER_PATTERN 64
+#define HP_SCAN_PREFILTER_HASH_BITS_MIN 10
+#define HP_SCAN_PREFILTER_HASH_BITS_MAX 20
+#define HP_SCAN_PREFILTER_HASH_MUL 0x9e3779b1U
+
+/* Most bytes of dense rows.  The rows of the shallow states a scan
+ * spends its time in should stay in cache.  Tests build with a small
+ * one, to have deep states go sparse even in small sets. */
+#ifndef HP_SCAN_DENSE_MAX_BYTES
+#define HP_SCAN_DENSE_MAX_BYTES (256 * 1024)
+#endif
+
+typedef struct hp_scan_engine_t {
+    hp_scan_pattern_t *patterns;
+    uint32_t pattern_count;
+    uint32_t pattern_size;
+    bool compiled;
+
+    /* Points into the arrays below once compiled */
+    hp_scan_tables_t tables;
+
+    uint32_t *next;
+    uint32_t *sparse_edges;
+    uint32_t *sparse_fail;
+    uint8_t *edge_class;
+    uint32_t *edge_next;
+    uint32_t *state_output;
+    uint32_t *state_output_link;
+    uint32_t *pattern_len;
+    uint32_t *pattern_id;
+    uint32_t *pattern_output_next;
+    uint8_t *prefilter_hash;
+    uint32_t state_count;
+} hp_scan_engine_t;
+
+/* The patterns as a trie, only while compiling.  States are numbered in
+ * the order they are added. */
+typedef struct hp_scan_trie_t {
+    /* Per state - its first child, its next sibling and the class of the
+     * edge into it */
+    uint32_t *child;
+    uint32_t *sibling;
+    uint8_t *label;
+    /* Per state - the first pattern ending in it, its failure state, the
+     * nearest state along the failure links with an output, and whether
+     * it matches something, directly or along the failure links */
+    uint32_t *output;
+    uint32_t *fail;
+    uint32_t *output_link;
+    uint8_t *match;
+    /* The states breadth first, and each state's place in that order */
+    uint32_t *order;
+    uint32_t *rank;
+    uint32_t count;
+} hp_scan_trie_t;
+
+hp_status_t hp_scan_engine_init(hp_scan_engine_t **engine_)
 {
-    uint32_t i = 0;
-    uint8_t *pat = (uint8_t *)"hahalala";
-    uint32_t patlen = strlen((char *)pat);
-    uint32_t max = buf_len - patlen;
+    hp_scan_engine_t *engine;
+    hp_status_t status;
+
+    *engine_ = NULL;
+
+    if ((engine = (hp_scan_engine_t *)malloc(sizeof(*engine))) == NULL) {
+        hp_log_error("malloc() failure.");
+        status = HP_STATUS_ERROR;
+        goto return_status;
+    }
+    memset(engine, 0, sizeof(*engine));
 
-    for (i = 0; i < max; i++) {
-        if (memcmp(buf + i, pat, patlen) == 0) {
-            return i;
+    *engine_ = engine;
+
+    status = HP_STATUS_OK;
+ return_status:
+    return status;
+}
+
+void hp_scan_engine_deinit(hp_scan_engine_t *engine)
+{
+    uint32_t i;
+
+    for (i = 0; i < engine->pattern_count; i++)
+        free(engine->patterns[i].pat);
+    free(engine->patterns);
+    free(engine->next);
+    free(engine->sparse_edges);
+    free(engine->sparse_fail);
+    free(engine->edge_class);
+    free(engine->edge_next);
+    free(engine->state_output);
+    free(engine->state_output_link);
+    free(engine->pattern_len);
+    free(engine->pattern_id);
+    free(engine->pattern_output_next);
+    free(engine->prefilter_hash);
+    free(engine);
+
+    return;
+}
+
+hp_status_t hp_scan_engine_add_pattern(hp_scan_engine_t *engine,
+                                       const uint8_t *pat,
+                                       uint32_t pat_len,
+                                       uint32_t pattern_id)
+{
+    hp_scan_pattern_t *patterns;
+    hp_scan_pattern_t *pattern;
+    uint32_t size_new;
+    hp_status_t status;
+
+    BUG_ON(engine->compiled);
+
+    if (pat_len == 0) {
+        hp_log_error("Empty pattern with id %u.", pattern_id);
+        status = HP_STATUS_ERROR;
+        goto return_status;
+    }
+
+    if (engine->pattern_count == engine->pattern_size) {
+        size_new = (engine->pattern_size != 0) ?
+            (engine->pattern_size * 2) : 16;
+        patterns = (hp_scan_pattern_t *)realloc(engine->patterns,
+                                                sizeof(*patterns) * size_new);
+        if (patterns == NULL) {
+            hp_log_error("realloc() failure.");
+            status = HP_STATUS_ERROR;
+            goto return_status;
         }
+        engine->patterns = patterns;
+        engine->pattern_size = size_new;
+    }
+
+    pattern = &engine->patterns[engine->pattern_count];
+    if ((pattern->pat = (uint8_t *)malloc(pat_len)) == NULL) {
+        hp_log_error("malloc() failure.");
+        status = HP_STATUS_ERROR;
+        goto return_status;
     }
+    memcpy(pattern->pat, pat, pat_len);
+    pattern->pat_len = pat_len;
+    pattern->pattern_id = pattern_id;
+    engine->pattern_count++;
+
+    status = HP_STATUS_OK;
+ return_status:
+    return status;
+}
+
+/* Bytes not in any pattern share class 0, and the others get a class
+ * each.  With every byte in some pattern there is no class 0 to share,
+ * and 257 classes won't fit a byte, so each byte is its own class. */
+static void hp_scan_engine_build_classes(hp_scan_engine_t *engine)
+{
+    hp_scan_tables_t *tables = &engine->tables;
+    hp_scan_pattern_t *pattern;
+    bool used[256];
+    uint32_t used_count;
+    uint32_t i, j;
+
+    memset(used, 0, sizeof(used));
+    used_count = 0;
+    for (i = 0; i < engine->pattern_count; i++) {
+        pattern = &engine->patterns[i];
+        for (j = 0; j < pattern->pat_len; j++) {
+            if (!used[pattern->pat[j]]) {
+                used[pattern->pat[j]] = true;
+                used_count++;
+            }
+        }
+    }
+
+    if (used_count == 256) {
+        for (i = 0; i < 256; i++)
+            tables->byte_class[i] = (uint8_t)i;
+        tables->class_count = 256;
+        return;
+    }
+
+    memset(tables->byte_class, 0, sizeof(tables->byte_class));
+    tables->class_count = 1;
+    for (i = 0; i < engine->pattern_count; i++) {
+        pattern = &engine->patterns[i];
+        for (j = 0; j < pattern->pat_len; j++) {
+            if (tables->byte_class[pattern->pat[j]] == 0) {
+                tables->byte_class[pattern->pat[j]] =
+                    (uint8_t)tables->class_count++;
+            }
+        }
+    }
+
+    return;
+}
+
+/* Lay the patterns out as a trie, with each state's children listed in
+ * class order. */
+static hp_status_t hp_scan_trie_build(hp_scan_engine_t *engine,
+                                      hp_scan_trie_t *trie)
+{
+    const uint8_t *byte_class = engine->tables.byte_class;
+    hp_scan_pattern_t *pattern;
+    size_t max_states;
+    uint32_t state, child;
+    uint32_t *link;
+    uint32_t c;
+    uint32_t i, j;
+    hp_status_t status;
+
+    max_states = 1;
+    for (i = 0; i < engine->pattern_count; i++)
+        max_states += engine->patterns[i].pat_len;
+    if (max_states > HP_SCAN_NEXT_ROW_MASK) {
+        hp_log_error("Pattern set too large.");
+        status = HP_STATUS_ERROR;
+        goto return_status;
+    }
+
+    trie->child = (uint32_t *)malloc(max_states * sizeof(uint32_t));
+    trie->sibling = (uint32_t *)malloc(max_states * sizeof(uint32_t));
+    trie->label = (uint8_t *)malloc(max_states * sizeof(uint8_t));
+    trie->output = (uint32_t *)malloc(max_states * sizeof(uint32_t));
+    trie->fail = (uint32_t *)malloc(max_states * sizeof(uint32_t));
+    trie->output_link = (uint32_t *)malloc(max_states * sizeof(uint32_t));
+    trie->match = (uint8_t *)calloc(max_states, sizeof(uint8_t));
+    trie->order = (uint32_t *)malloc(max_states * sizeof(uint32_t));
+    trie->rank = (uint32_t *)malloc(max_states * sizeof(uint32_t));
+    engine->pattern_len = (uint32_t *)
+        malloc((engine->pattern_count + 1) * sizeof(uint32_t));
+    engine->pattern_id = (uint32_t *)
+        malloc((engine->pattern_count + 1) * sizeof(uint32_t));
+    engine->pattern_output_next = (uint32_t *)
+        malloc((engine->pattern_count + 1) * sizeof(uint32_t));
+    if (trie->child == NULL || trie->sibling == NULL ||
+        trie->label == NULL || trie->output == NULL || trie->fail == NULL ||
+        trie->output_link == NULL || trie->match == NULL ||
+        trie->order == NULL || trie->rank == NULL ||
+        engine->pattern_len == NULL || engine->pattern_id == NULL ||
+        engine->pattern_output_next == NULL)
+    {
+        hp_log_error("malloc() failure.");
+        status = HP_STATUS_ERROR;
+        goto return_status;
+    }
+
+    trie->child[HP_SCAN_STATE_ROOT] = HP_SCAN_STATE_NONE;
+    trie->sibling[HP_SCAN_STATE_ROOT] = HP_SCAN_STATE_NONE;
+    trie->output[HP_SCAN_STATE_ROOT] = HP_SCAN_OUTPUT_NONE;
+    trie->count = 1;
+    for (i = 0; i < engine->pattern_count; i++) {
+        pattern = &engine->patterns[i];
+        state = HP_SCAN_STATE_ROOT;
+        for (j = 0; j < pattern->pat_len; j++) {
+            c = byte_class[pattern->pat[j]];
+            link = &trie->child[state];
+            while (*link != HP_SCAN_STATE_NONE && trie->label[*link] < c)
+                link = &trie->sibling[*link];
+            if (*link == HP_SCAN_STATE_NONE || trie->label[*link] != c) {
+                child = trie->count++;
+                trie->child[child] = HP_SCAN_STATE_NONE;
+                trie->sibling[child] = *link;
+                trie->label[child] = (uint8_t)c;
+                trie->output[child] = HP_SCAN_OUTPUT_NONE;
+                *link = child;
+            }
+            state = *link;
+        }
+        engine->pattern_len[i] = pattern->pat_len;
+        engine->pattern_id[i] = pattern->pattern_id;
+        engine->pattern_output_next[i] = trie->output[state];
+        trie->output[state] = i;
+        trie->match[state] = 1;
+    }
+
+    status = HP_STATUS_OK;
+ return_status:
+    return status;
+}
+
+static uint32_t hp_scan_trie_child(const hp_scan_trie_t *trie,
+                                   uint32_t state, uint32_t c)
+{
+    uint32_t child;
+
+    for (child = trie->child[state];
+         child != HP_SCAN_STATE_NONE && trie->label[child] < c;
+         child = trie->sibling[child])
+    {
+        ;
+    }
+
+    return (child != HP_SCAN_STATE_NONE && trie->label[child] == c) ?
+        child : HP_SCAN_STATE_NONE;
+}
+
+/**
+ * Find the failure links, visiting the states breadth first, so that a
+ * state's failure state is done by the time it is needed.  The order
+ * they are visited in is the order they are laid out in, which puts the
+ * shallow states, the ones scans spend their time in, first.
+ */
+static void hp_scan_trie_link(hp_scan_trie_t *trie)
+{
+    uint32_t head, tail;
+    uint32_t state, child;
+    uint32_t f, next;
+
+    trie->fail[HP_SCAN_STATE_ROOT] = HP_SCAN_STATE_ROOT;
+    trie->output_link[HP_SCAN_STATE_ROOT] = HP_SCAN_STATE_ROOT;
+    trie->order[0] = HP_SCAN_STATE_ROOT;
+    head = 0;
+    tail = 1;
+    while (head != tail) {
+        state = trie->order[head++];
+        for (child = trie->child[state]; child != HP_SCAN_STATE_NONE;
+             child = trie->sibling[child])
+        {
+            f = HP_SCAN_STATE_ROOT;
+            if (state != HP_SCAN_STATE_ROOT) {
+                for (f = trie->fail[state]; ; f = trie->fail[f]) {
+                    next = hp_scan_trie_child(trie, f, trie->label[child]);
+                    if (next != HP_SCAN_STATE_NONE) {
+                        f = next;
+                        break;
+                    }
+                    if (f == HP_SCAN_STATE_ROOT)
+                        break;
+                }
+            }
+            trie->fail[child] = f;
+            trie->output_link[child] =
+                (trie->output[f] != HP_SCAN_OUTPUT_NONE) ?
+                f : trie->output_link[f];
+            if (trie->output_link[child] != HP_SCAN_STATE_ROOT)
+                trie->match[child] = 1;
+            trie->order[tail++] = child;
+        }
+    }
+
+    for (head = 0; head < trie->count; head++)
+        trie->rank[trie->order[head]] = head;
+
+    return;
+}
+
+/* What the table holds for a state - its row offset if it is dense, and
+ * past the dense rows if not - and whether it has something to report */
+static uint32_t hp_scan_trie_code(const hp_scan_engine_t *engine,
+                                  const hp_scan_trie_t *trie,
+                                  uint32_t state)
+{
+    uint32_t rank = trie->rank[state];
+    uint32_t code;
+
+    if (rank < engine->tables.dense_count)
+        code = rank * engine->tables.class_count;
+    else
+        code = engine->tables.dense_count * engine->tables.class_count +
+            (rank - engine->tables.dense_count);
+
+    return code | (trie->match[state] ? HP_SCAN_NEXT_MATCH : 0);
+}
+
+/**
+ * Lay the automaton out.  The first states get dense rows with the
+ * failure links folded in, as many as fit HP_SCAN_DENSE_MAX_BYTES.  The
+ * rest list their edges, in class order, and fall back on their failure
+ * state for the others.  In a large set nearly all states are deep ones
+ * with a single edge, which a scan rarely gets to, so they cost little
+ * either way, while as dense rows they would be most of the table.
+ */
+static hp_status_t hp_scan_trie_layout(hp_scan_engine_t *engine,
+                                       hp_scan_trie_t *trie)
+{
+    hp_scan_tables_t *tables = &engine->tables;
+    uint32_t class_count = tables->class_count;
+    uint32_t sparse_count;
+    uint32_t state, child;
+    uint32_t rank;
+    uint32_t *row;
+    uint32_t e;
+    hp_status_t status;
+
+    tables->shallow_count = 1;
+    for (child = trie->child[HP_SCAN_STATE_ROOT];
+         child != HP_SCAN_STATE_NONE; child = trie->sibling[child])
+    {
+        tables->shallow_count++;
+    }
+    tables->dense_count = HP_SCAN_DENSE_MAX_BYTES /
+        (class_count * sizeof(uint32_t));
+    if (tables->dense_count < tables->shallow_count)
+        tables->dense_count = tables->shallow_count;
+    if (tables->dense_count > trie->count)
+        tables->dense_count = trie->count;
+    sparse_count = trie->count - tables->dense_count;
+    if ((uint64_t)tables->dense_count * class_count + sparse_count >
+        HP_SCAN_NEXT_ROW_MASK)
+    {
+        hp_log_error("Pattern set too large.");
+        status = HP_STATUS_ERROR;
+        goto return_status;
+    }
+
+    engine->next = (uint32_t *)malloc((size_t)tables->dense_count *
+                                      class_count * sizeof(uint32_t));
+    engine->sparse_edges = (uint32_t *)
+        malloc((sparse_count + 1) * sizeof(uint32_t));
+    engine->sparse_fail = (uint32_t *)
+        malloc((sparse_count + 1) * sizeof(uint32_t));
+    engine->edge_class = (uint8_t *)malloc(trie->count * sizeof(uint8_t));
+    engine->edge_next = (uint32_t *)malloc(trie->count * sizeof(uint32_t));
+    engine->state_output = (uint32_t *)malloc(trie->count * sizeof(uint32_t));
+    engine->state_output_link = (uint32_t *)
+        malloc(trie->count * sizeof(uint32_t));
+    if (engine->next == NULL || engine->sparse_edges == NULL ||
+        engine->sparse_fail == NULL || engine->edge_class == NULL ||
+        engine->edge_next == NULL || engine->state_output == NULL ||
+        engine->state_output_link == NULL)
+    {
+        hp_log_error("malloc() failure.");
+        status = HP_STATUS_ERROR;
+        goto return_status;
+    }
+
+    /* A dense row starts as a copy of its failure state's, which comes
+     * earlier, and the root's as all root. */
+    for (rank = 0; rank < tables->dense_count; rank++) {
+        state = trie->order[rank];
+        row = engine->next + (size_t)rank * class_count;
+        if (state == HP_SCAN_STATE_ROOT) {
+            memset(row, 0, class_count * sizeof(uint32_t));
+        } else {
+            memcpy(row, engine->next +
+                   (size_t)trie->rank[trie->fail[state]] * class_count,
+                   class_count * sizeof(uint32_t));
+        }
+        for (child = trie->child[state]; child != HP_SCAN_STATE_NONE;
+             child = trie->sibling[child])
+        {
+            row[trie->label[child]] = hp_scan_trie_code(engine, trie, child);
+        }
+    }
+
+    e = 0;
+    for (; rank < trie->count; rank++) {
+        state = trie->order[rank];
+        engine->sparse_edges[rank - tables->dense_count] = e;
+        engine->sparse_fail[rank - tables->dense_count] =
+            hp_scan_trie_code(engine, trie, trie->fail[state]) &
+            HP_SCAN_NEXT_ROW_MASK;
+        for (child = trie->child[state]; child != HP_SCAN_STATE_NONE;
+             child = trie->sibling[child])
+        {
+            engine->edge_class[e] = trie->label[child];
+            engine->edge_next[e] = hp_scan_trie_code(engine, trie, child);
+            e++;
+        }
+    }
+    engine->sparse_edges[sparse_count] = e;
+    engine->sparse_fail[sparse_count] = 0;
+    tables->edge_count = e;
+
+    for (rank = 0; rank < trie->count; rank++) {
+        state = trie->order[rank];
+        engine->state_output[rank] = trie->output[state];
+        engine->state_output_link[rank] =
+            trie->rank[trie->output_link[state]];
+    }
+    engine->state_count = trie->count;
+
+    status = HP_STATUS_OK;
+ return_status:
+    return status;
+}
+
+static void hp_scan_trie_free(hp_scan_trie_t *trie)
+{
+    free(trie->child);
+    free(trie->sibling);
+    free(trie->label);
+    free(trie->output);
+    free(trie->fail);
+    free(trie->output_link);
+    free(trie->match);
+    free(trie->order);
+    free(trie->rank);
+
+    return;
+}
+
+/**
+ * Teddy style prefilter.  Each pattern goes into a bucket, and byte j of
+ * the input window can only start a pattern of bucket b if bit b is set
+ * in the masks for it at offset j.  The SIMD variants test the low and
+ * high nibbles of 16 or 32 windows at a time with byte shuffles, and the
+ * scalar one tests whole bytes.
+ *
+ * Offsets too close to the end to hold prefilter_len bytes are all
+ * returned as candidates, as the automaton has to see those bytes anyway.
+ */
+static size_t hp_scan_prefilter_find_scalar(const hp_scan_tables_t *tables,
+                                           const uint8_t *buf,
+                                           size_t pos,
+                                           size_t buf_len)
+{
+    size_t end;
+    uint8_t mask;
+    uint32_t j;
+
+    if (buf_len - pos < tables->prefilter_len)
+        return pos;
+    end = buf_len - tables->prefilter_len + 1;
+
+    for (; pos < end; pos++) {
+        mask = tables->prefilter_byte[0][buf[pos]];
+        for (j = 1; j < tables->prefilter_len && mask != 0; j++)
+            mask &= tables->prefilter_byte[j][buf[pos + j]];
+        if (mask != 0)
+            break;
+    }
+
+    return pos;
+}
+
+/**
+ * Hash prefilter.  The first prefilter_hash_len bytes of the window, as a
+ * little endian key, are hashed to a bit of the bitmap, and the window
+ * can only start a pattern if that bit is set.  Unlike the Teddy masks,
+ * which saturate past a few dozen patterns, the bitmap grows with the
+ * set, so it keeps filtering out most offsets for thousands of patterns.
+ *
+ * Keys are loaded 4 bytes at a time whatever the len, so the last 3
+ * offsets are returned as candidates.  The AVX2 variant hashes 8 windows
+ * at a time, and gathers their bits of the bitmap in one go.
+ */
+static uint32_t hp_scan_prefilter_hash(uint32_t key, uint32_t bits)
+{
+    return (key * HP_SCAN_PREFILTER_HASH_MUL) >> (32 - bits);
+}
+
+static size_t hp_scan_prefilter_find_hash(const hp_scan_tables_t *tables,
+                                          const uint8_t *buf,
+                                          size_t pos,
+                                          size_t buf_len)
+{
+    const uint8_t *bitmap = tables->prefilter_hash;
+    uint32_t bits = tables->prefilter_hash_bits;
+    uint32_t mask;
+    uint32_t key, h;
+    size_t end;
+
+    if (buf_len - pos < HP_SCAN_PREFILTER_HASH_LEN_MAX)
+        return pos;
+    end = buf_len - HP_SCAN_PREFILTER_HASH_LEN_MAX + 1;
+    mask = (tables->prefilter_hash_len == 4) ? UINT32_MAX :
+        ((1U << (tables->prefilter_hash_len * 8)) - 1);
+
+    for (; pos < end; pos++) {
+        key = (uint32_t)buf[pos] | ((uint32_t)buf[pos + 1] << 8) |
+            ((uint32_t)buf[pos + 2] << 16) | ((uint32_t)buf[pos + 3] << 24);
+        h = hp_scan_prefilter_hash(key & mask, bits);
+        if (bitmap[h >> 3] & (1 << (h & 7)))
+            break;
+    }
+
+    return pos;
+}
+
+#ifdef HP_SCAN_X86
+
+HP_SCAN_TARGET("ssse3")
+static size_t hp_scan_prefilter_find_ssse3(const hp_scan_tables_t *tables,
+                                           const uint8_t *buf,
+                                           size_t pos,
+                                           size_t buf_len)
+{
+    __m128i nibble_lo[HP_SCAN_PREFILTER_LEN_MAX];
+    __m128i nibble_hi[HP_SCAN_PREFILTER_LEN_MAX];
+    __m128i low4 = _mm_set1_epi8(0x0f);
+    __m128i zero = _mm_setzero_si128();
+    __m128i in, res;
+    uint32_t found;
+    uint32_t j;
+
+    for (j = 0; j < tables->prefilter_len; j++) {
+        nibble_lo[j] = _mm_loadu_si128((const __m128i *)tables->prefilter_nibble_lo[j]);
+        nibble_hi[j] = _mm_loadu_si128((const __m128i *)tables->prefilter_nibble_hi[j]);
+    }
+
+    /* Window pos + i needs bytes up to pos + i + len - 1 */
+    while (buf_len - pos >= 16 + tables->prefilter_len - 1) {
+        res = _mm_set1_epi8((char)0xff);
+        for (j = 0; j < tables->prefilter_len; j++) {
+            in = _mm_loadu_si128((const __m128i *)(buf + pos + j));
+            res = _mm_and_si128(res,
+                      _mm_and_si128(
+                          _mm_shuffle_epi8(nibble_lo[j],
+                                           _mm_and_si128(in, low4)),
+                          _mm_shuffle_epi8(nibble_hi[j],
+                                           _mm_and_si128(
+                                               _mm_srli_epi16(in, 4),
+                                               low4))));
+        }
+        found = ~_mm_movemask_epi8(_mm_cmpeq_epi8(res, zero)) & 0xffff;
+        if (found != 0) {
+#ifdef _MSC_VER
+            unsigned long bit;
+            _BitScanForward(&bit, found);
+            return pos + bit;
+#else
+            return pos + __builtin_ctz(found);
+#endif
+        }
+        pos += 16;
+    }
+
+    return hp_scan_prefilter_find_scalar(tables, buf, pos, buf_len);
+}
+
+HP_SCAN_TARGET("avx2")
+static size_t hp_scan_prefilter_find_avx2(const hp_scan_tables_t *tables,
+                                          const uint8_t *buf,
+                                          size_t pos,
+                                          size_t buf_len)
+{
+    __m256i nibble_lo[HP_SCAN_PREFILTER_LEN_MAX];
+    __m256i nibble_hi[HP_SCAN_PREFILTER_LEN_MAX];
+    __m256i low4 = _mm256_set1_epi8(0x0f);
+    __m256i zero = _mm256_setzero_si256();
+    __m256i in, res;
+    uint32_t found;
+    uint32_t j;
+
+    /* Shuffles work within 128 bit lanes, so both lanes get the table. */
+    for (j = 0; j < tables->prefilter_len; j++) {
+        nibble_lo[j] = _mm256_broadcastsi128_si256(
+            _mm_loadu_si128((const __m128i *)tables->prefilter_nibble_lo[j]));
+        nibble_hi[j] = _mm256_broadcastsi128_si256(
+            _mm_loadu_si128((const __m128i *)tables->prefilter_nibble_hi[j]));
+    }
+
+    while (buf_len - pos >= 32 + tables->prefilter_len - 1) {
+        res = _mm256_set1_epi8((char)0xff);
+        for (j = 0; j < tables->prefilter_len; j++) {
+            in = _mm256_loadu_si256((const __m256i *)(buf + pos + j));
+            res = _mm256_and_si256(res,
+                      _mm256_and_si256(
+                          _mm256_shuffle_epi8(nibble_lo[j],
+                                              _mm256_and_si256(in, low4)),
+                          _mm256_shuffle_epi8(nibble_hi[j],
+                                              _mm256_and_si256(
+                                                  _mm256_srli_epi16(in, 4),
+                                                  low4))));
+        }
+        found = ~(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(res, zero));
+        if (found != 0) {
+#ifdef _MSC_VER
+            unsigned long bit;
+            _BitScanForward(&bit, found);
+            return pos + bit;
+#else
+            return pos + __builtin_ctz(found);
+#endif
+        }
+        pos += 32;
+    }
+
+    return hp_scan_prefilter_find_ssse3(tables, buf, pos, buf_len);
+}
+
+HP_SCAN_TARGET("avx2")
+static size_t hp_scan_prefilter_find_hash_avx2(const hp_scan_tables_t *tables,
+                                               const uint8_t *buf,
+                                               size_t pos,
+                                               size_t buf_len)
+{
+    /* Bytes i to i + 3 of the 16 loaded, for window i, in each lane */
+    __m256i spread = _mm256_setr_epi8(0, 1, 2, 3, 1, 2, 3, 4,
+                                      2, 3, 4, 5, 3, 4, 5, 6,
+                                      4, 5, 6, 7, 5, 6, 7, 8,
+                                      6, 7, 8, 9, 7, 8, 9, 10);
+    __m256i mask = _mm256_set1_epi32((int)
+        ((tables->prefilter_hash_len == 4) ? UINT32_MAX :
+         ((1U << (tables->prefilter_hash_len * 8)) - 1)));
+    __m256i mul = _mm256_set1_epi32((int)HP_SCAN_PREFILTER_HASH_MUL);
+    __m128i shift = _mm_cvtsi32_si128(32 - tables->prefilter_hash_bits);
+    __m256i low5 = _mm256_set1_epi32(31);
+    __m256i in, h, words, hit;
+    uint32_t found;
+
+    while (buf_len - pos >= 16) {
+        in = _mm256_broadcastsi128_si256(
+            _mm_loadu_si128((const __m128i *)(buf + pos)));
+        h = _mm256_srl_epi32(
+                _mm256_mullo_epi32(
+                    _mm256_and_si256(_mm256_shuffle_epi8(in, spread), mask),
+                    mul),
+                shift);
+        /* The bitmap as little endian 32 bit words, with the window's
+         * bit moved up to the sign bit */
+        words = _mm256_i32gather_epi32((const int *)tables->prefilter_hash,
+                                       _mm256_srli_epi32(h, 5), 4);
+        hit = _mm256_sllv_epi32(words,
+                                _mm256_sub_epi32(low5,
+                                                 _mm256_and_si256(h, low5)));
+        found = (uint32_t)_mm256_movemask_ps(_mm256_castsi256_ps(hit));
+        if (found != 0) {
+#ifdef _MSC_VER
+            unsigned long bit;
+            _BitScanForward(&bit, found);
+            return pos + bit;
+#else
+            return pos + __builtin_ctz(found);
+#endif
+        }
+        pos += 8;
+    }
+
+    return hp_scan_prefilter_find_hash(tables, buf, pos, buf_len);
+}
+
+/* Pick the widest variant of the Teddy or the hash prefilter the CPU,
+ * and for AVX2 the OS, supports. */
+static hp_scan_find_func_t hp_scan_prefilter_select(bool hash)
+{
+#ifdef _MSC_VER
+    int info[4];
+    bool ssse3, avx2;
+
+    __cpuid(info, 1);
+    ssse3 = (info[2] & (1 << 9)) != 0;
+    /* OSXSAVE and AVX, with the OS saving the YMM registers */
+    avx2 = (info[2] & (1 << 27)) != 0 && (info[2] & (1 << 28)) != 0 &&
+        (_xgetbv(0) & 0x6) == 0x6;
+    if (avx2) {
+        __cpuidex(info, 7, 0);
+        avx2 = (info[1] & (1 << 5)) != 0;
+    }
+#else
+    bool ssse3, avx2;
+
+    __builtin_cpu_init();
+    ssse3 = __builtin_cpu_supports("ssse3");
+    avx2 = __builtin_cpu_supports("avx2");
+#endif
+
+    if (avx2) {
+        return hash ? hp_scan_prefilter_find_hash_avx2 :
+            hp_scan_prefilter_find_avx2;
+    }
+    if (hash)
+        return hp_scan_prefilter_find_hash;
+    if (ssse3)
+        return hp_scan_prefilter_find_ssse3;
+
+    return hp_scan_prefilter_find_scalar;
+}
+
+#else /* !HP_SCAN_X86 */
+
+static hp_scan_find_func_t hp_scan_prefilter_select(bool hash)
+{
+    return hash ? hp_scan_prefilter_find_hash : hp_scan_prefilter_find_scalar;
+}
+
+#endif /* HP_SCAN_X86 */
+
+/* The variants picked for this CPU, of the Teddy and the hash prefilter,
+ * 0 until the first scan context needs them.  Racing threads all pick
+ * the same one, so the store is harmless. */
+static hp_atomic64_t g_hp_scan_prefilter_find[2];
+
+static hp_scan_find_func_t hp_scan_prefilter_get(bool hash)
+{
+    hp_scan_find_func_t find;
+    uint64_t v;
+
+    v = hp_atomic_load(&g_hp_scan_prefilter_find[hash]);
+    if (v != 0)
+        return (hp_scan_find_func_t)(uintptr_t)v;
+
+    find = hp_scan_prefilter_select(hash);
+    hp_atomic_store(&g_hp_scan_prefilter_find[hash],
+                    (uint64_t)(uintptr_t)find);
+
+    return find;
+}
+
+/* Fall back on the hash prefilter, if the bitmap isn't too full. */
+static hp_status_t hp_scan_engine_build_hash(hp_scan_engine_t *engine)
+{
+    hp_scan_tables_t *tables = &engine->tables;
+    hp_scan_pattern_t *pattern;
+    uint32_t len, bits;
+    uint32_t key, h;
+    uint32_t set;
+    uint32_t i, j;
+    double rate;
+    hp_status_t status;
+
+    len = HP_SCAN_PREFILTER_HASH_LEN_MAX;
+    for (i = 0; i < engine->pattern_count; i++) {
+        if (engine->patterns[i].pat_len < len)
+            len = engine->patterns[i].pat_len;
+    }
+    for (bits = HP_SCAN_PREFILTER_HASH_BITS_MIN;
+         bits < HP_SCAN_PREFILTER_HASH_BITS_MAX &&
+             ((uint64_t)1 << bits) < (uint64_t)engine->pattern_count *
+             HP_SCAN_PREFILTER_HASH_BITS_PER_PATTERN;
+         bits++)
+    {
+        ;
+    }
+    /* No more bits than there are keys */
+    if (bits > len * 8)
+        bits = len * 8;
+
+    engine->prefilter_hash = (uint8_t *)calloc(((size_t)1 << bits) / 8, 1);
+    if (engine->prefilter_hash == NULL) {
+        hp_log_error("calloc() failure.");
+        status = HP_STATUS_ERROR;
+        goto return_status;
+    }
+
+    set = 0;
+    for (i = 0; i < engine->pattern_count; i++) {
+        pattern = &engine->patterns[i];
+        key = 0;
+        for (j = 0; j < len; j++)
+            key |= (uint32_t)pattern->pat[j] << (j * 8);
+        h = hp_scan_prefilter_hash(key, bits);
+        if ((engine->prefilter_hash[h >> 3] & (1 << (h & 7))) == 0) {
+            engine->prefilter_hash[h >> 3] |= (uint8_t)(1 << (h & 7));
+            set++;
+        }
+    }
+
+    /* Expected candidates per byte of random input - the windows whose
+     * key is a pattern's, and the others hashing to a set bit */
+    rate = (double)set / ((uint64_t)1 << (len * 8)) +
+        (double)set / ((uint64_t)1 << bits);
+    if (rate > HP_SCAN_PREFILTER_MAX_RATE) {
+        hp_log_debug("Hash prefilter off.  %.3f candidates per byte.", rate);
+        free(engine->prefilter_hash);
+        engine->prefilter_hash = NULL;
+        status = HP_STATUS_OK;
+        goto return_status;
+    }
+
+    tables->prefilter_hash_len = len;
+    tables->prefilter_hash_bits = bits;
+    tables->prefilter_hash = engine->prefilter_hash;
+
+    status = HP_STATUS_OK;
+ return_status:
+    return status;
+}
+
+static hp_status_t hp_scan_engine_build_prefilter(hp_scan_engine_t *engine)
+{
+    hp_scan_tables_t *tables = &engine->tables;
+    hp_scan_pattern_t *pattern;
+    uint32_t lo_count, hi_count;
+    uint32_t bucket;
+    uint32_t i, j, v;
+    double rate, bucket_rate;
+
+    tables->prefilter_len = 0;
+    memset(tables->prefilter_nibble_lo, 0,
+           sizeof(tables->prefilter_nibble_lo));
+    memset(tables->prefilter_nibble_hi, 0,
+           sizeof(tables->prefilter_nibble_hi));
+    memset(tables->prefilter_byte, 0, sizeof(tables->prefilter_byte));
+    tables->prefilter_hash_len = 0;
+    tables->prefilter_hash_bits = 0;
+    tables->prefilter_hash = NULL;
+    if (engine->pattern_count == 0)
+        return HP_STATUS_OK;
+
+    tables->prefilter_len = HP_SCAN_PREFILTER_LEN_MAX;
+    for (i = 0; i < engine->pattern_count; i++) {
+        if (engine->patterns[i].pat_len < tables->prefilter_len)
+            tables->prefilter_len = engine->patterns[i].pat_len;
+    }
+
+    for (i = 0; i < engine->pattern_count; i++) {
+        pattern = &engine->patterns[i];
+        bucket = 1 << (i % HP_SCAN_PREFILTER_BUCKETS);
+        for (j = 0; j < tables->prefilter_len; j++) {
+            tables->prefilter_nibble_lo[j][pattern->pat[j] & 0x0f] |= bucket;
+            tables->prefilter_nibble_hi[j][pattern->pat[j] >> 4] |= bucket;
+            tables->prefilter_byte[j][pattern->pat[j]] |= bucket;
+        }
+    }
+
+    /* Expected candidates per byte of random input, for the nibble masks,
+     * which let more through than the byte ones. */
+    rate = 0;
+    for (bucket = 0; bucket < HP_SCAN_PREFILTER_BUCKETS; bucket++) {
+        bucket_rate = 1;
+        for (j = 0; j < tables->prefilter_len; j++) {
+            lo_count = hi_count = 0;
+            for (v = 0; v < 16; v++) {
+                lo_count += (tables->prefilter_nibble_lo[j][v] >> bucket) & 1;
+                hi_count += (tables->prefilter_nibble_hi[j][v] >> bucket) & 1;
+            }
+            bucket_rate *= (lo_count / 16.0) * (hi_count / 16.0);
+        }
+        rate += bucket_rate;
+    }
+
+    if (rate > HP_SCAN_PREFILTER_MAX_RATE) {
+        hp_log_debug("Teddy prefilter off.  %.3f candidates per byte.",
+                     rate);
+        tables->prefilter_len = 0;
+        return hp_scan_engine_build_hash(engine);
+    }
+
+    return HP_STATUS_OK;
+}
+
+hp_status_t hp_scan_engine_compile(hp_scan_engine_t *engine)
+{
+    hp_scan_trie_t trie;
+    hp_status_t status;
+
+    BUG_ON(engine->compiled);
+
+    memset(&trie, 0, sizeof(trie));
+    hp_scan_engine_build_classes(engine);
+    if (hp_scan_trie_build(engine, &trie) != HP_STATUS_OK) {
+        status = HP_STATUS_ERROR;
+        goto return_status;
+    }
+    hp_scan_trie_link(&trie);
+    if (hp_scan_trie_layout(engine, &trie) != HP_STATUS_OK) {
+        status = HP_STATUS_ERROR;
+        goto return_status;
+    }
+    if (hp_scan_engine_build_prefilter(engine) != HP_STATUS_OK) {
+        status = HP_STATUS_ERROR;
+        goto return_status;
+    }
+
+    engine->tables.state_count = engine->state_count;
+    engine->tables.next = engine->next;
+    engine->tables.sparse_edges = engine->sparse_edges;
+    engine->tables.sparse_fail = engine->sparse_fail;
+    engine->tables.edge_class = engine->edge_class;
+    engine->tables.edge_next = engine->edge_next;
+    engine->tables.state_output = engine->state_output;
+    engine->tables.state_output_link = engine->state_output_link;
+    engine->tables.pattern_count = engine->pattern_count;
+    engine->tables.pattern_len = engine->pattern_len;
+    engine->tables.pattern_id = engine->pattern_id;
+    engine->tables.pattern_output_next = engine->pattern_output_next;
+
+    engine->compiled = true;
+    hp_log_debug("Compiled %u patterns into %u states of %u classes, %u "
+                 "of them dense.", engine->pattern_count,
+                 engine->state_count, engine->tables.class_count,
+                 engine->tables.dense_count);
+
+    status = HP_STATUS_OK;
+ return_status:
+    hp_scan_trie_free(&trie);
+    return status;
+}
+
+const hp_scan_tables_t *hp_scan_engine_tables(hp_scan_engine_t *engine)
+{
+    BUG_ON(!engine->compiled);
+
+    return &engine->tables;
+}
+
+/* The state no of what the table holds for it */
+static uint32_t hp_scan_row_state(const hp_scan_tables_t *tables,
+                                  uint32_t row)
+{
+    uint32_t dense_cells = tables->dense_count * tables->class_count;
+
+    row &= HP_SCAN_NEXT_ROW_MASK;
+    if (row < dense_cells)
+        return row / tables->class_count;
+
+    return tables->dense_count + (row - dense_cells);
+}
+
+/* Step from a sparse state, down its edges or else along its failure
+ * links, till a dense state takes the byte. */
+static uint32_t hp_scan_sparse_next(const hp_scan_tables_t *tables,
+                                    uint32_t dense_cells,
+                                    uint32_t row,
+                                    uint32_t c)
+{
+    uint32_t sparse;
+    uint32_t e, end;
+
+    while (row >= dense_cells) {
+        sparse = row - dense_cells;
+        end = tables->sparse_edges[sparse + 1];
+        for (e = tables->sparse_edges[sparse]; e < end; e++) {
+            if (tables->edge_class[e] >= c) {
+                if (tables->edge_class[e] == c)
+                    return tables->edge_next[e];
+                break;
+            }
+        }
+        row = tables->sparse_fail[sparse];
+    }
+
+    return tables->next[row + c];
+}
+
+/* Report everything ending at pos in state. */
+static uint32_t hp_scan_report(const hp_scan_tables_t *tables,
+                               uint32_t state,
+                               uint64_t pos,
+                               hp_scan_match_func_t match_func,
+                               void *arg)
+{
+    uint32_t output;
+    uint32_t count;
+
+    count = 0;
+    while (state != HP_SCAN_STATE_ROOT) {
+        for (output = tables->state_output[state];
+             output != HP_SCAN_OUTPUT_NONE;
+             output = tables->pattern_output_next[output])
+        {
+            match_func(tables->pattern_id[output],
+                       pos + 1 - tables->pattern_len[output], arg);
+            count++;
+        }
+        state = tables->state_output_link[state];
+    }
+
+    return count;
+}
+
+void hp_scan_ctx_init(hp_scan_ctx_t *ctx,
+                      const hp_scan_tables_t *tables,
+                      hp_scan_match_func_t match_func,
+                      void *arg)
+{
+    ctx->tables = tables;
+    ctx->match_func = match_func;
+    ctx->arg = arg;
+    if (tables->prefilter_len != 0)
+        ctx->find = hp_scan_prefilter_get(false);
+    else if (tables->prefilter_hash_len != 0)
+        ctx->find = hp_scan_prefilter_get(true);
+    else
+        ctx->find = NULL;
+    ctx->row = HP_SCAN_STATE_ROOT;
+    ctx->offset = 0;
+    ctx->match_count = 0;
+
+    return;
+}
+
+void hp_scan_ctx_feed(hp_scan_ctx_t *ctx, const uint8_t *buf, size_t buf_len)
+{
+    const hp_scan_tables_t *tables = ctx->tables;
+    const uint32_t *next = tables->next;
+    const uint8_t *byte_class = tables->byte_class;
+    uint32_t dense_cells = tables->dense_count * tables->class_count;
+    uint32_t shallow_cells = tables->shallow_count * tables->class_count;
+    hp_scan_find_func_t find = ctx->find;
+    uint32_t row;
+    uint32_t count;
+    uint32_t c;
+    size_t i, skip;
+
+    count = 0;
+    row = ctx->row;
+    if (find == NULL) {
+        for (i = 0; i < buf_len; i++) {
+            c = byte_class[buf[i]];
+            row &= HP_SCAN_NEXT_ROW_MASK;
+            if (row < dense_cells)
+                row = next[row + c];
+            else
+                row = hp_scan_sparse_next(tables, dense_cells, row, c);
+            if (row & HP_SCAN_NEXT_MATCH) {
+                count += hp_scan_report(tables,
+                                        hp_scan_row_state(tables, row),
+                                        ctx->offset + i,
+                                        ctx->match_func, ctx->arg);
+            }
+        }
+        goto return_status;
+    }
+
+    for (i = 0; i < buf_len; i++) {
+        /* Back at the root, nothing is partially matched, so the bytes
+         * no pattern can start at are skipped.  One byte into a pattern,
+         * only the last byte is, and if no pattern can start there
+         * either, the automaton goes back to the root.  With large sets,
+         * where most bytes start some pattern, the automaton is rarely
+         * at the root.  The prefilter leaves the last bytes of the chunk
+         * to the automaton, so a match running into the next chunk is
+         * still tracked. */
+        if (row == HP_SCAN_STATE_ROOT) {
+            i = find(tables, buf, i, buf_len);
+            if (i == buf_len)
+                break;
+        } else if ((row & HP_SCAN_NEXT_ROW_MASK) < shallow_cells && i > 0 &&
+                   (skip = find(tables, buf, i - 1, buf_len)) != i - 1)
+        {
+            row = HP_SCAN_STATE_ROOT;
+            i = skip;
+            if (i == buf_len)
+                break;
+        }
+        c = byte_class[buf[i]];
+        row &= HP_SCAN_NEXT_ROW_MASK;
+        if (row < dense_cells)
+            row = next[row + c];
+        else
+            row = hp_scan_sparse_next(tables, dense_cells, row, c);
+        if (row & HP_SCAN_NEXT_MATCH) {
+            count += hp_scan_report(tables, hp_scan_row_state(tables, row),
+                                    ctx->offset + i,
+                                    ctx->match_func, ctx->arg);
+        }
+    }
+
+ return_status:
+    ctx->row = row;
+    ctx->offset += buf_len;
+    ctx->match_count += count;
+    return;
+}
+
+uint32_t hp_scan_ctx_finish(hp_scan_ctx_t *ctx)
+{
+    uint32_t count = ctx->match_count;
+
+    ctx->row = HP_SCAN_STATE_ROOT;
+    ctx->offset = 0;
+    ctx->match_count = 0;
+
+    return count;
+}
+
+uint32_t hp_scan_run(const hp_scan_tables_t *tables,
+                     const uint8_t *buf, size_t buf_len,
+                     hp_scan_match_func_t match_func,
+                     void *arg)
+{
+    hp_scan_ctx_t ctx;
+
+    hp_scan_ctx_init(&ctx, tables, match_func, arg);
+    hp_scan_ctx_feed(&ctx, buf, buf_len);
 
-    return 0;
+    return hp_scan_ctx_finish(&ctx);
 }
@@ -17,12 +17,153 @@
  * @author Anoop Saldanha
  */
 
+/* Multi pattern literal matching.  Patterns are added to an engine, which
+ * is then compiled into an Aho-Corasick automaton, and buffers are scanned
+ * against all of them in a single pass.  Scans run off the engine's
+ * tables, which can also be generated ahead of time. */
+
 #ifndef __SCAN_ENGINE__H__
 #define __SCAN_ENGINE__H__
 
 #include "honeyprocs-common.h"
 #include "status.h"
 
-int hp_scan_engine_run(uint8_t *buf, uint32_t buf_len);
+typedef struct hp_scan_engine_t hp_scan_engine_t;
+
+/* No of leading pattern bytes the prefilters look at */
+#define HP_SCAN_PREFILTER_LEN_MAX 3
+#define HP_SCAN_PREFILTER_HASH_LEN_MAX 4
+
+/**
+ * A compiled engine, reduced to what a scan needs - flat, read only
+ * arrays.  hp_scan_engine_compile() builds them on the heap, and sigc
+ * builds them from a signature file at build time as static const data,
+ * so that a fixed signature set costs no compile and no allocation at
+ * startup.  Both come out the same for the same patterns.
+ */
+typedef struct hp_scan_tables_t {
+    /* Bytes not in any pattern share class 0, and the others get a class
+     * each.  Rows of the table are then only as wide as the no of bytes
+     * the patterns use.  If they use all 256, each byte is its own
+     * class. */
+    uint8_t byte_class[256];
+    uint32_t class_count;
+    /* The automaton.  States are numbered breadth first, and the first
+     * dense_count of them have a dense row each in next, of class_count
+     * next states, with failure links folded in so that a byte costs a
+     * single lookup.  Entries hold the offset of the next state's row,
+     * or for a state without one, dense_count * class_count plus its no
+     * among those, with the top bit set for states with something to
+     * report.  The others, the deep states, list their edges in class
+     * order - those of sparse state i are [sparse_edges[i],
+     * sparse_edges[i + 1]) - and fall back on sparse_fail[i] for the
+     * rest.  The first shallow_count states, the root and the states one
+     * byte into a pattern, always get a dense row. */
+    uint32_t state_count;
+    uint32_t dense_count;
+    uint32_t shallow_count;
+    const uint32_t *next;
+    const uint32_t *sparse_edges;
+    const uint32_t *sparse_fail;
+    uint32_t edge_count;
+    const uint8_t *edge_class;
+    const uint32_t *edge_next;
+    /* Per state - the first pattern ending in it, and the nearest state
+     * along the failure links with an output, or the root */
+    const uint32_t *state_output;
+    const uint32_t *state_output_link;
+    /* Per pattern - its length, id and the next pattern ending in the
+     * same state */
+    uint32_t pattern_count;
+    const uint32_t *pattern_len;
+    const uint32_t *pattern_id;
+    const uint32_t *pattern_output_next;
+    /* Teddy masks over the first prefilter_len bytes of the patterns.
+     * prefilter_len is 0 if the pattern set doesn't gain from one. */
+    uint32_t prefilter_len;
+    uint8_t prefilter_nibble_lo[HP_SCAN_PREFILTER_LEN_MAX][16];
+    uint8_t prefilter_nibble_hi[HP_SCAN_PREFILTER_LEN_MAX][16];
+    uint8_t prefilter_byte[HP_SCAN_PREFILTER_LEN_MAX][256];
+    /* For sets too large for the Teddy masks to filter much, a bitmap
+     * of 1 << prefilter_hash_bits bits, with the bits of the hashes of
+     * the first prefilter_hash_len bytes of the patterns set.
+     * prefilter_hash_len is 0 if the masks are used, or neither is. */
+    uint32_t prefilter_hash_len;
+    uint32_t prefilter_hash_bits;
+    const uint8_t *prefilter_hash;
+} hp_scan_tables_t;
+
+/**
+ * Called for every match.
+ *
+ * @pattern_id The id the pattern was added with.
+ * @offset Where the match starts in the buffer.
+ */
+typedef void (*hp_scan_match_func_t)(uint32_t pattern_id,
+                                     uint64_t offset,
+                                     void *arg);
+
+hp_status_t hp_scan_engine_init(hp_scan_engine_t **engine);
+void hp_scan_engine_deinit(hp_scan_engine_t *engine);
+
+/* Patterns can only be added before the engine is compiled.  Several
+ * patterns can share an id. */
+hp_status_t hp_scan_engine_add_pattern(hp_scan_engine_t *engine,
+                                       const uint8_t *pat,
+                                       uint32_t pat_len,
+                                       uint32_t pattern_id);
+hp_status_t hp_scan_engine_compile(hp_scan_engine_t *engine);
+
+/* The tables of a compiled engine, valid till it is deinit'ed */
+const hp_scan_tables_t *hp_scan_engine_tables(hp_scan_engine_t *engine);
+
+/* Find the first offset in [pos, buf_len) a pattern could start at.
+ * Internal to the engine. */
+typedef size_t (*hp_scan_find_func_t)(const hp_scan_tables_t *tables,
+                                      const uint8_t *buf,
+                                      size_t pos,
+                                      size_t buf_len);
+
+/* State of a scan over data arriving in chunks, such as memory read a
+ * page at a time.  Matches are reported as soon as their last byte is
+ * fed, with offsets counted from the first byte of the first chunk, so a
+ * match straddling chunks is reported like any other. */
+typedef struct hp_scan_ctx_t {
+    const hp_scan_tables_t *tables;
+    hp_scan_match_func_t match_func;
+    void *arg;
+    /* The prefilter picked for this CPU, or NULL.  Internal to the
+     * engine. */
+    hp_scan_find_func_t find;
+    /* Where the automaton is.  Internal to the engine. */
+    uint32_t row;
+    /* Offset of the next byte to be fed */
+    uint64_t offset;
+    uint32_t match_count;
+} hp_scan_ctx_t;
+
+/* Start a scan.  Needs no allocation, and the tables can be shared by
+ * any no of contexts. */
+void hp_scan_ctx_init(hp_scan_ctx_t *ctx,
+                      const hp_scan_tables_t *tables,
+                      hp_scan_match_func_t match_func,
+                      void *arg);
+void hp_scan_ctx_feed(hp_scan_ctx_t *ctx, const uint8_t *buf, size_t buf_len);
+/**
+ * End the scan.  The context is left ready to scan afresh.
+ *
+ * @retval The no of matches over all the chunks.
+ */
+uint32_t hp_scan_ctx_finish(hp_scan_ctx_t *ctx);
+
+/**
+ * Scan a buffer, reporting every match, including overlapping ones.
+ *
+ * @retval The no of matches.
+ */
+uint32_t hp_scan_run(const hp_scan_tables_t *tables,
+                     const uint8_t *buf, size_t buf_len,
+                     hp_scan_match_func_t match_func,
+                     void *arg);
 
 #endif /* __SCAN_ENGINE__H__ */
@@ -0,0 +1,424 @@
+/**
+ * Copyright(C) 2018, Juniper Networks, Inc.
+ * All rights reserved
+ *
+ * This SOFTWARE is licensed under the license provided in the LICENSE.txt
+ * file.  By downloading, installing, copying, or otherwise using the
+ * SOFTWARE, you agree to be bound by the terms of that license.  This
+ * SOFTWARE is not an official Juniper product.
+ *
+ * Third-Party Code: This SOFTWARE may depend on other components under
+ * separate copyright notice and license terms.  Your use of the source
+ * code for those components is subject to the term and conditions of
+ * the respective license as noted in the Third-Party source code.
+ */
+
+/**
+ * @author Anoop Saldanha
+ */
+#include <math.h>
+
+#include "honeyprocs-common.h"
+#include "scan-heur.h"
+#include "util-log.h"
+#include "status.h"
+
+/* SSE2 comes with every x64 CPU, and is all the sequence search needs */
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define HP_SCAN_HEUR_SSE2
+#include <emmintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+/* Payloads are small, where JIT heaps and mapped images aren't */
+#define HP_SCAN_HEUR_SMALL (64 * 1024)
+
+typedef struct hp_scan_heur_seq_t {
+    uint8_t len;
+    bool getpc;
+    uint8_t bytes[HP_SCAN_HEUR_SEQ_MAX];
+} hp_scan_heur_seq_t;
+
+/* No sequence is a prefix of another, so at most one matches at a time */
+static const hp_scan_heur_seq_t hp_scan_heur_seqs[] = {
+    /* push ebp; mov ebp, esp, either encoding */
+    { 3, false, { 0x55, 0x8b, 0xec } },
+    { 3, false, { 0x55, 0x89, 0xe5 } },
+    /* push rbp; mov rbp, rsp */
+    { 4, false, { 0x55, 0x48, 0x89, 0xe5 } },
+    { 4, false, { 0x55, 0x48, 0x8b, 0xec } },
+    /* sub rsp, imm8 and imm32 */
+    { 3, false, { 0x48, 0x83, 0xec } },
+    { 3, false, { 0x48, 0x81, 0xec } },
+    /* mov [rsp+8], rbx, spilling to the home space */
+    { 5, false, { 0x48, 0x89, 0x5c, 0x24, 0x08 } },
+    /* call $+5, to pop the return address */
+    { 5, true, { 0xe8, 0x00, 0x00, 0x00, 0x00 } },
+    /* call $+4, landing on its own last byte as the start of an
+     * inc or dec */
+    { 5, true, { 0xe8, 0xff, 0xff, 0xff, 0xff } },
+    /* fnstenv [esp-0xc], storing the last FPU instruction's address */
+    { 4, true, { 0xd9, 0x74, 0x24, 0xf4 } },
+};
+
+/**
+ * Count the sequence at p, if any.
+ *
+ * @min_len Only count one longer than this, it being counted already
+ *          otherwise.
+ * @avail Bytes there are from p on.
+ */
+static void hp_scan_heur_match(hp_scan_heur_t *heur, const uint8_t *p,
+                               size_t min_len, size_t avail)
+{
+    const hp_scan_heur_seq_t *seq;
+    uint32_t i;
+
+    for (i = 0; i < sizeof(hp_scan_heur_seqs) / sizeof(hp_scan_heur_seqs[0]);
+         i++)
+    {
+        seq = &hp_scan_heur_seqs[i];
+        if (seq->len > min_len && seq->len <= avail &&
+            memcmp(p, seq->bytes, seq->len) == 0)
+        {
+            if (seq->getpc)
+                heur->getpcs++;
+            else
+                heur->prologues++;
+            break;
+        }
+    }
+
+    return;
+}
+
+/* Count the sequences that fit in buf.  16 positions at a time are
+ * narrowed down by their first three bytes, which leaves next to none
+ * to check, even in x64 code full of REX.W prefixes. */
+static void hp_scan_heur_seqs_find(hp_scan_heur_t *heur, const uint8_t *buf,
+                                   size_t buf_len)
+{
+    size_t i = 0;
+
+#ifdef HP_SCAN_HEUR_SSE2
+    __m128i b0, b1, b2, c, c1;
+    uint32_t found;
+    uint32_t bit;
+
+#define HP_SCAN_HEUR_EQ(v, byte) _mm_cmpeq_epi8(v, _mm_set1_epi8((char)(byte)))
+    for (; i + 18 <= buf_len; i += 16) {
+        b0 = _mm_loadu_si128((const __m128i *)(buf + i));
+        b1 = _mm_loadu_si128((const __m128i *)(buf + i + 1));
+        b2 = _mm_loadu_si128((const __m128i *)(buf + i + 2));
+
+        /* 55 8b ec, 55 89 e5, 55 48 89 and 55 48 8b */
+        c1 = _mm_and_si128(HP_SCAN_HEUR_EQ(b1, 0x8b), HP_SCAN_HEUR_EQ(b2, 0xec));
+        c1 = _mm_or_si128(c1, _mm_and_si128(HP_SCAN_HEUR_EQ(b1, 0x89),
+                                            HP_SCAN_HEUR_EQ(b2, 0xe5)));
+        c1 = _mm_or_si128(c1, _mm_and_si128(
+                              HP_SCAN_HEUR_EQ(b1, 0x48),
+                              _mm_or_si128(HP_SCAN_HEUR_EQ(b2, 0x89),
+                                           HP_SCAN_HEUR_EQ(b2, 0x8b))));
+        c = _mm_and_si128(HP_SCAN_HEUR_EQ(b0, 0x55), c1);
+        /* 48 83 ec, 48 81 ec and 48 89 5c */
+        c1 = _mm_and_si128(_mm_or_si128(HP_SCAN_HEUR_EQ(b1, 0x83),
+                                        HP_SCAN_HEUR_EQ(b1, 0x81)),
+                           HP_SCAN_HEUR_EQ(b2, 0xec));
+        c1 = _mm_or_si128(c1, _mm_and_si128(HP_SCAN_HEUR_EQ(b1, 0x89),
+                                            HP_SCAN_HEUR_EQ(b2, 0x5c)));
+        c = _mm_or_si128(c, _mm_and_si128(HP_SCAN_HEUR_EQ(b0, 0x48), c1));
+        /* e8 00 00 and e8 ff ff, where the two bytes are the same */
+        c1 = _mm_and_si128(_mm_cmpeq_epi8(b1, b2),
+                           _mm_or_si128(HP_SCAN_HEUR_EQ(b1, 0x00),
+                                        HP_SCAN_HEUR_EQ(b1, 0xff)));
+        c = _mm_or_si128(c, _mm_and_si128(HP_SCAN_HEUR_EQ(b0, 0xe8), c1));
+        /* d9 74 24 */
+        c1 = _mm_and_si128(HP_SCAN_HEUR_EQ(b1, 0x74), HP_SCAN_HEUR_EQ(b2, 0x24));
+        c = _mm_or_si128(c, _mm_and_si128(HP_SCAN_HEUR_EQ(b0, 0xd9), c1));
+
+        for (found = (uint32_t)_mm_movemask_epi8(c); found != 0;
+             found &= found - 1)
+        {
+#ifdef _MSC_VER
+            unsigned long bit_;
+            _BitScanForward(&bit_, found);
+            bit = bit_;
+#else
+            bit = __builtin_ctz(found);
+#endif
+            hp_scan_heur_match(heur, buf + i + bit, 0, buf_len - i - bit);
+        }
+    }
+#undef HP_SCAN_HEUR_EQ
+#endif
+
+    for (; i < buf_len; i++) {
+        switch (buf[i]) {
+            case 0x55:
+            case 0x48:
+            case 0xe8:
+            case 0xd9:
+                hp_scan_heur_match(heur, buf + i, 0, buf_len - i);
+                break;
+            default:
+                break;
+        }
+    }
+
+    return;
+}
+
+/* Add to the block's histogram, a byte to each table in turn. */
+static void hp_scan_heur_count(hp_scan_heur_ctx_t *ctx, const uint8_t *buf,
+                               size_t len)
+{
+    uint32_t (*hist)[256] = ctx->block_hist;
+    uint64_t w;
+    size_t i;
+
+    for (i = 0; i + 8 <= len; i += 8) {
+        memcpy(&w, buf + i, sizeof(w));
+        hist[0][w & 0xff]++;
+        hist[1][(w >> 8) & 0xff]++;
+        hist[2][(w >> 16) & 0xff]++;
+        hist[3][(w >> 24) & 0xff]++;
+        hist[0][(w >> 32) & 0xff]++;
+        hist[1][(w >> 40) & 0xff]++;
+        hist[2][(w >> 48) & 0xff]++;
+        hist[3][w >> 56]++;
+    }
+    for (; i < len; i++)
+        hist[0][buf[i]]++;
+
+    return;
+}
+
+/* Whether a block is all zeroes, which fresh allocations mostly are.
+ * Written to be vectorized. */
+static bool hp_scan_heur_is_zero(const uint8_t *buf, size_t len)
+{
+    uint64_t acc = 0;
+    uint64_t w;
+    size_t i;
+
+    for (i = 0; i + 8 <= len; i += 8) {
+        memcpy(&w, buf + i, sizeof(w));
+        acc |= w;
+    }
+    for (; i < len; i++)
+        acc |= buf[i];
+
+    return acc == 0;
+}
+
+/* Done with a block.  Its entropy is log2(n) - sum(c * log2(c)) / n, over
+ * the count c of each byte value, and n * log2(n) is in the table too. */
+static void hp_scan_heur_block_end(hp_scan_heur_ctx_t *ctx)
+{
+    hp_scan_heur_t *heur = &ctx->heur;
+    uint32_t n = ctx->block_len;
+    uint32_t count;
+    uint32_t zeroes;
+    float sum;
+    float entropy;
+    uint32_t c;
+
+    if (n == 0)
+        return;
+
+    sum = 0;
+    zeroes = 0;
+    for (c = 0; c < 256; c++) {
+        count = ctx->block_hist[0][c] + ctx->block_hist[1][c] +
+            ctx->block_hist[2][c] + ctx->block_hist[3][c];
+        if (c == 0)
+            zeroes = count;
+        sum += ctx->clog2c[count];
+        heur->histogram[c] += count;
+    }
+    memset(ctx->block_hist, 0, sizeof(ctx->block_hist));
+    ctx->block_len = 0;
+
+    heur->block_count++;
+    if (zeroes == n) {
+        heur->zero_blocks++;
+        return;
+    }
+
+    entropy = (ctx->clog2c[n] - sum) / n;
+    ctx->entropy_sum += entropy;
+    if (entropy > heur->entropy_max)
+        heur->entropy_max = entropy;
+    if (entropy > HP_SCAN_HEUR_ENTROPY_HIGH)
+        heur->high_entropy_blocks++;
+
+    return;
+}
+
+/**
+ * Score what was gathered, on what sets payloads apart from what gets
+ * mapped in legitimately -
+ *
+ *   40  any GetPC sequence, which compilers have no use for
+ *   30  scaled by the share of high entropy blocks, for a packed or
+ *       encrypted stage
+ *   20  no prologues in 256 or more bytes, for code that isn't made of
+ *       compiled functions
+ *   10  under 64 KiB that isn't zeroes
+ *
+ * Nothing but zeroes scores 0.
+ */
+static uint32_t hp_scan_heur_score(const hp_scan_heur_t *heur)
+{
+    uint32_t blocks = heur->block_count - heur->zero_blocks;
+    uint64_t nonzero = heur->len - heur->histogram[0];
+    uint32_t score = 0;
+
+    if (blocks == 0)
+        return 0;
+
+    if (heur->getpcs != 0)
+        score += 40;
+    score += (30 * heur->high_entropy_blocks) / blocks;
+    if (heur->prologues == 0 && nonzero >= 256)
+        score += 20;
+    if (nonzero < HP_SCAN_HEUR_SMALL)
+        score += 10;
+
+    return score;
+}
+
+hp_status_t hp_scan_heur_ctx_init(hp_scan_heur_ctx_t *ctx)
+{
+    uint32_t c;
+    hp_status_t status;
+
+    memset(ctx, 0, sizeof(*ctx));
+    ctx->clog2c = (float *)malloc(sizeof(*ctx->clog2c) *
+                                  (HP_SCAN_HEUR_BLOCK_SIZE + 1));
+    if (ctx->clog2c == NULL) {
+        hp_log_error("malloc() failure.");
+        status = HP_STATUS_ERROR;
+        goto return_status;
+    }
+    ctx->clog2c[0] = 0;
+    for (c = 1; c <= HP_SCAN_HEUR_BLOCK_SIZE; c++)
+        ctx->clog2c[c] = (float)(c * log2((double)c));
+
+    status = HP_STATUS_OK;
+ return_status:
+    return status;
+}
+
+void hp_scan_heur_ctx_deinit(hp_scan_heur_ctx_t *ctx)
+{
+    free(ctx->clog2c);
+    memset(ctx, 0, sizeof(*ctx));
+
+    return;
+}
+
+void hp_scan_heur_ctx_begin(hp_scan_heur_ctx_t *ctx)
+{
+    memset(&ctx->heur, 0, sizeof(ctx->heur));
+    memset(ctx->block_hist, 0, sizeof(ctx->block_hist));
+    ctx->block_len = 0;
+    ctx->entropy_sum = 0;
+    ctx->tail_len = 0;
+    ctx->next_offset = UINT64_MAX;
+
+    return;
+}
+
+/* Keep the last bytes fed, for sequences running on into the next
+ * chunk. */
+static void hp_scan_heur_keep_tail(hp_scan_heur_ctx_t *ctx,
+                                   const uint8_t *buf, size_t buf_len)
+{
+    uint32_t keep;
+
+    if (buf_len >= sizeof(ctx->tail)) {
+        memcpy(ctx->tail, buf + buf_len - sizeof(ctx->tail),
+               sizeof(ctx->tail));
+        ctx->tail_len = sizeof(ctx->tail);
+        goto return_status;
+    }
+
+    keep = (uint32_t)(sizeof(ctx->tail) - buf_len);
+    if (keep > ctx->tail_len)
+        keep = ctx->tail_len;
+    memmove(ctx->tail, ctx->tail + ctx->tail_len - keep, keep);
+    memcpy(ctx->tail + keep, buf, buf_len);
+    ctx->tail_len = keep + (uint32_t)buf_len;
+
+ return_status:
+    return;
+}
+
+void hp_scan_heur_ctx_feed(hp_scan_heur_ctx_t *ctx, uint64_t offset,
+                           const uint8_t *buf, size_t buf_len)
+{
+    uint8_t join[2 * sizeof(ctx->tail)];
+    size_t join_len;
+    size_t len;
+    uint32_t i;
+
+    /* Past a hole, the block the last chunk ended in is done, and
+     * nothing runs on from it */
+    if (offset != ctx->next_offset) {
+        hp_scan_heur_block_end(ctx);
+        ctx->tail_len = 0;
+    }
+    ctx->next_offset = offset + buf_len;
+    ctx->heur.len += buf_len;
+
+    /* Sequences starting in the last chunk and ending in this one */
+    if (ctx->tail_len != 0) {
+        len = (buf_len < sizeof(ctx->tail)) ? buf_len : sizeof(ctx->tail);
+        memcpy(join, ctx->tail, ctx->tail_len);
+        memcpy(join + ctx->tail_len, buf, len);
+        join_len = ctx->tail_len + len;
+        for (i = 0; i < ctx->tail_len; i++) {
+            hp_scan_heur_match(&ctx->heur, join + i, ctx->tail_len - i,
+                               join_len - i);
+        }
+    }
+    hp_scan_heur_seqs_find(&ctx->heur, buf, buf_len);
+    hp_scan_heur_keep_tail(ctx, buf, buf_len);
+
+    /* Blocks are of the region's offsets, whatever the chunks are */
+    while (buf_len != 0) {
+        len = HP_SCAN_HEUR_BLOCK_SIZE - (offset % HP_SCAN_HEUR_BLOCK_SIZE);
+        if (len > buf_len)
+            len = buf_len;
+        if (len == HP_SCAN_HEUR_BLOCK_SIZE && hp_scan_heur_is_zero(buf, len))
+            ctx->block_hist[0][0] += (uint32_t)len;
+        else
+            hp_scan_heur_count(ctx, buf, len);
+        ctx->block_len += (uint32_t)len;
+        offset += len;
+        buf += len;
+        buf_len -= len;
+        if ((offset % HP_SCAN_HEUR_BLOCK_SIZE) == 0)
+            hp_scan_heur_block_end(ctx);
+    }
+
+    return;
+}
+
+const hp_scan_heur_t *hp_scan_heur_ctx_end(hp_scan_heur_ctx_t *ctx)
+{
+    hp_scan_heur_t *heur = &ctx->heur;
+
+    hp_scan_heur_block_end(ctx);
+    if (heur->block_count != heur->zero_blocks) {
+        heur->entropy_mean = ctx->entropy_sum /
+            (heur->block_count - heur->zero_blocks);
+    }
+    heur->score = hp_scan_heur_score(heur);
+
+    return heur;
+}
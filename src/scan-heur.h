@@ -0,0 +1,91 @@
+/**
+ * Copyright(C) 2018, Juniper Networks, Inc.
+ * All rights reserved
+ *
+ * This SOFTWARE is licensed under the license provided in the LICENSE.txt
+ * file.  By downloading, installing, copying, or otherwise using the
+ * SOFTWARE, you agree to be bound by the terms of that license.  This
+ * SOFTWARE is not an official Juniper product.
+ *
+ * Third-Party Code: This SOFTWARE may depend on other components under
+ * separate copyright notice and license terms.  Your use of the source
+ * code for those components is subject to the term and conditions of
+ * the respective license as noted in the Third-Party source code.
+ */
+
+/**
+ * @author Anoop Saldanha
+ */
+/* Statistics over new executable memory, for telling a payload from,
+ * say, a JIT heap without any signatures - the byte histogram, the
+ * entropy of each 4 KiB block, how many function prologues and GetPC
+ * sequences turn up, and how much of it is zero pages.  These are
+ * gathered in one pass, as the memory is fed to the rules, and summed up
+ * in a score the alerts are ranked by. */
+
+#ifndef __SCAN_HEUR__H__
+#define __SCAN_HEUR__H__
+
+#include "honeyprocs-common.h"
+#include "status.h"
+
+#define HP_SCAN_HEUR_BLOCK_SIZE 4096
+/* Bits per byte above which a block is taken to be packed or encrypted.
+ * Code comes in at around 6, and 4 KiB of random bytes at close to 8. */
+#define HP_SCAN_HEUR_ENTROPY_HIGH 7.2f
+/* Longest prologue or GetPC sequence looked for */
+#define HP_SCAN_HEUR_SEQ_MAX 5
+
+typedef struct hp_scan_heur_t {
+    /* No of bytes looked at, and how often each byte value came up */
+    uint64_t len;
+    uint64_t histogram[256];
+    /* 4 KiB blocks of the region's offsets, a block only partly looked
+     * at counting as one */
+    uint32_t block_count;
+    uint32_t zero_blocks;
+    uint32_t high_entropy_blocks;
+    /* In bits per byte, over the blocks that aren't all zeroes */
+    float entropy_max;
+    float entropy_mean;
+    /* Function prologues, like push ebp; mov ebp, esp, which compiled
+     * code is full of and shellcode mostly does without */
+    uint32_t prologues;
+    /* Ways for position independent code to find where it is - call $+5,
+     * call into its own last byte, and fnstenv after an FPU instruction */
+    uint32_t getpcs;
+    /* 0 to 100, higher for what looks more like an injected payload */
+    uint32_t score;
+} hp_scan_heur_t;
+
+/* State of a pass over a region, fed in chunks. */
+typedef struct hp_scan_heur_ctx_t {
+    hp_scan_heur_t heur;
+    /* Histogram of the block being fed, spread over 4 tables, so that
+     * runs of the same byte don't wait on their own counts */
+    uint32_t block_hist[4][256];
+    uint32_t block_len;
+    float entropy_sum;
+    /* Last bytes fed, for the sequences running into the next chunk */
+    uint8_t tail[HP_SCAN_HEUR_SEQ_MAX - 1];
+    uint32_t tail_len;
+    uint64_t next_offset;
+    /* c * log2(c) for every count a block can have */
+    float *clog2c;
+} hp_scan_heur_ctx_t;
+
+hp_status_t hp_scan_heur_ctx_init(hp_scan_heur_ctx_t *ctx);
+void hp_scan_heur_ctx_deinit(hp_scan_heur_ctx_t *ctx);
+
+void hp_scan_heur_ctx_begin(hp_scan_heur_ctx_t *ctx);
+
+/* Feed the region's bytes from offset, in order, skipping holes as
+ * hp_scan_rules_ctx_feed() does. */
+void hp_scan_heur_ctx_feed(hp_scan_heur_ctx_t *ctx, uint64_t offset,
+                           const uint8_t *buf, size_t buf_len);
+
+/* End the region, and score it.  The result stays valid till the next
+ * hp_scan_heur_ctx_begin(). */
+const hp_scan_heur_t *hp_scan_heur_ctx_end(hp_scan_heur_ctx_t *ctx);
+
+#endif /* __SCAN_HEUR__H__ */
@@ -0,0 +1,475 @@
+/**
+ * Copyright(C) 2018, Juniper Networks, Inc.
+ * All rights reserved
+ *
+ * This SOFTWARE is licensed under the license provided in the LICENSE.txt
+ * file.  By downloading, installing, copying, or otherwise using the
+ * SOFTWARE, you agree to be bound by the terms of that license.  This
+ * SOFTWARE is not an official Juniper product.
+ *
+ * Third-Party Code: This SOFTWARE may depend on other components under
+ * separate copyright notice and license terms.  Your use of the source
+ * code for those components is subject to the term and conditions of
+ * the respective license as noted in the Third-Party source code.
+ */
+
+/**
+ * @author Anoop Saldanha
+ */
+#include "honeyprocs-common.h"
+#include "scan-regex.h"
+#include "util-hash.h"
+#include "util-log.h"
+#include "status.h"
+
+/* A transition not taken yet */
+#define HP_SCAN_DFA_UNKNOWN UINT16_MAX
+#define HP_SCAN_DFA_STATES_LIMIT (HP_SCAN_DFA_UNKNOWN - 1)
+
+/* Cache size for finding prefixes, which makes at most a state per
+ * prefix byte */
+#define HP_SCAN_REGEX_PREFIX_STATES \
+    (HP_SCAN_REGEX_PREFIXES_MAX * (HP_SCAN_REGEX_PREFIX_LEN_MAX + 1) + 2)
+
+struct hp_scan_dfa_t {
+    const hp_scan_nfa_t *nfa;
+    uint32_t nfa_count;
+    const uint8_t *bytes;
+
+    uint32_t states_max;
+    uint32_t state_count;
+    /* Per state, a row of 256 next states */
+    uint16_t *next;
+    uint8_t *match;
+    /* Per state, its sorted set of NFA states, in sets */
+    uint32_t *set_off;
+    uint32_t *set_len;
+    uint64_t *set_hash;
+    uint32_t *sets;
+    uint32_t sets_len;
+    uint32_t sets_max;
+    /* States by the hash of their set, open addressed */
+    uint16_t *buckets;
+    uint32_t bucket_mask;
+
+    /* For working out a set.  mark[] holds the generation a state was
+     * last added to work[] in. */
+    uint32_t *work;
+    uint32_t *stack;
+    uint32_t *mark;
+    uint32_t gen;
+
+    uint64_t flush_count;
+};
+
+static int hp_scan_dfa_cmp(const void *a_, const void *b_)
+{
+    uint32_t a = *(const uint32_t *)a_;
+    uint32_t b = *(const uint32_t *)b_;
+
+    return (a > b) - (a < b);
+}
+
+/* Start working out a new set. */
+static void hp_scan_dfa_work_begin(hp_scan_dfa_t *dfa)
+{
+    if (++dfa->gen == 0) {
+        memset(dfa->mark, 0, sizeof(*dfa->mark) * dfa->nfa_count);
+        dfa->gen = 1;
+    }
+
+    return;
+}
+
+/* Add the states n leads to without taking a byte - the ones that take
+ * a byte or match.  Splits aren't kept, as they only lead elsewhere. */
+static void hp_scan_dfa_closure(hp_scan_dfa_t *dfa, uint32_t n,
+                                uint32_t *count)
+{
+    const hp_scan_nfa_t *node;
+    uint32_t top = 0;
+
+    if (dfa->mark[n] == dfa->gen)
+        return;
+    dfa->mark[n] = dfa->gen;
+    dfa->stack[top++] = n;
+
+    while (top != 0) {
+        n = dfa->stack[--top];
+        node = &dfa->nfa[n];
+        if (node->op != HP_SCAN_NFA_SPLIT) {
+            dfa->work[(*count)++] = n;
+            continue;
+        }
+        if (dfa->mark[node->b] != dfa->gen) {
+            dfa->mark[node->b] = dfa->gen;
+            dfa->stack[top++] = node->b;
+        }
+        if (dfa->mark[node->next] != dfa->gen) {
+            dfa->mark[node->next] = dfa->gen;
+            dfa->stack[top++] = node->next;
+        }
+    }
+
+    return;
+}
+
+static void hp_scan_dfa_flush(hp_scan_dfa_t *dfa)
+{
+    memset(dfa->buckets, 0xff, sizeof(*dfa->buckets) *
+           (dfa->bucket_mask + 1));
+    dfa->state_count = 0;
+    dfa->sets_len = 0;
+    dfa->flush_count++;
+
+    return;
+}
+
+/* The state for the set in work[], made if need be.  A full cache is
+ * flushed first, so this always gets a state. */
+static uint32_t hp_scan_dfa_state(hp_scan_dfa_t *dfa, uint32_t count)
+{
+    uint64_t hash;
+    uint32_t bucket;
+    uint32_t state;
+    uint32_t i;
+
+    qsort(dfa->work, count, sizeof(*dfa->work), hp_scan_dfa_cmp);
+    hash = hp_hash64((const uint8_t *)dfa->work,
+                     count * sizeof(*dfa->work), 0);
+
+    for (bucket = hash & dfa->bucket_mask;
+         dfa->buckets[bucket] != HP_SCAN_DFA_UNKNOWN;
+         bucket = (bucket + 1) & dfa->bucket_mask)
+    {
+        state = dfa->buckets[bucket];
+        if (dfa->set_hash[state] == hash && dfa->set_len[state] == count &&
+            memcmp(dfa->sets + dfa->set_off[state], dfa->work,
+                   count * sizeof(*dfa->work)) == 0)
+        {
+            return state;
+        }
+    }
+
+    if (dfa->state_count == dfa->states_max ||
+        dfa->sets_len + count > dfa->sets_max)
+    {
+        hp_scan_dfa_flush(dfa);
+        /* The dead state keeps its no */
+        if (count != 0)
+            hp_scan_dfa_state(dfa, 0);
+        for (bucket = hash & dfa->bucket_mask;
+             dfa->buckets[bucket] != HP_SCAN_DFA_UNKNOWN;
+             bucket = (bucket + 1) & dfa->bucket_mask)
+            ;
+    }
+
+    state = dfa->state_count++;
+    dfa->buckets[bucket] = (uint16_t)state;
+    dfa->set_hash[state] = hash;
+    dfa->set_off[state] = dfa->sets_len;
+    dfa->set_len[state] = count;
+    memcpy(dfa->sets + dfa->sets_len, dfa->work, count * sizeof(*dfa->work));
+    dfa->sets_len += count;
+
+    dfa->match[state] = 0;
+    for (i = 0; i < count; i++) {
+        if (dfa->nfa[dfa->work[i]].op == HP_SCAN_NFA_MATCH)
+            dfa->match[state] = 1;
+    }
+    memset(dfa->next + ((size_t)state * 256), 0xff,
+           256 * sizeof(*dfa->next));
+
+    return state;
+}
+
+static bool hp_scan_dfa_takes(const hp_scan_dfa_t *dfa,
+                              const hp_scan_nfa_t *node, uint8_t c)
+{
+    if (node->op == HP_SCAN_NFA_BYTE)
+        return node->a == c;
+    if (node->op == HP_SCAN_NFA_CLASS)
+        return (dfa->bytes[node->a + (c >> 3)] >> (c & 7)) & 1;
+
+    return false;
+}
+
+/* Work out where a state goes on a byte, and remember it. */
+static uint32_t hp_scan_dfa_step(hp_scan_dfa_t *dfa, uint32_t state,
+                                 uint8_t c)
+{
+    const hp_scan_nfa_t *node;
+    const uint32_t *set;
+    uint64_t flush_count;
+    uint32_t count;
+    uint32_t next;
+    uint32_t i;
+
+    hp_scan_dfa_work_begin(dfa);
+    count = 0;
+    set = dfa->sets + dfa->set_off[state];
+    for (i = 0; i < dfa->set_len[state]; i++) {
+        node = &dfa->nfa[set[i]];
+        if (hp_scan_dfa_takes(dfa, node, c))
+            hp_scan_dfa_closure(dfa, node->next, &count);
+    }
+
+    flush_count = dfa->flush_count;
+    next = hp_scan_dfa_state(dfa, count);
+    /* With the cache flushed, state is gone */
+    if (flush_count == dfa->flush_count)
+        dfa->next[((size_t)state * 256) + c] = (uint16_t)next;
+
+    return next;
+}
+
+hp_status_t hp_scan_dfa_init(hp_scan_dfa_t **dfa_,
+                             const hp_scan_nfa_t *nfa,
+                             uint32_t nfa_count,
+                             const uint8_t *bytes,
+                             uint32_t states_max)
+{
+    hp_scan_dfa_t *dfa;
+    uint32_t buckets;
+    hp_status_t status;
+
+    *dfa_ = NULL;
+
+    BUG_ON(states_max < 2 || states_max > HP_SCAN_DFA_STATES_LIMIT);
+
+    if ((dfa = (hp_scan_dfa_t *)malloc(sizeof(*dfa))) == NULL) {
+        hp_log_error("malloc() failure.");
+        status = HP_STATUS_ERROR;
+        goto return_status;
+    }
+    memset(dfa, 0, sizeof(*dfa));
+    dfa->nfa = nfa;
+    dfa->nfa_count = nfa_count;
+    dfa->bytes = bytes;
+    dfa->states_max = states_max;
+    /* Room for any one set after a flush, and an average of 16 NFA
+     * states a set */
+    dfa->sets_max = nfa_count + (states_max * 16);
+    for (buckets = 1; buckets < states_max * 2; buckets *= 2)
+        ;
+    dfa->bucket_mask = buckets - 1;
+
+    dfa->next = (uint16_t *)malloc(sizeof(*dfa->next) * 256 * states_max);
+    dfa->match = (uint8_t *)malloc(states_max);
+    dfa->set_off = (uint32_t *)malloc(sizeof(*dfa->set_off) * states_max);
+    dfa->set_len = (uint32_t *)malloc(sizeof(*dfa->set_len) * states_max);
+    dfa->set_hash = (uint64_t *)malloc(sizeof(*dfa->set_hash) * states_max);
+    dfa->sets = (uint32_t *)malloc(sizeof(*dfa->sets) * dfa->sets_max);
+    dfa->buckets = (uint16_t *)malloc(sizeof(*dfa->buckets) * buckets);
+    dfa->work = (uint32_t *)malloc(sizeof(*dfa->work) * (nfa_count + 1));
+    dfa->stack = (uint32_t *)malloc(sizeof(*dfa->stack) * (nfa_count + 1));
+    dfa->mark = (uint32_t *)calloc(nfa_count + 1, sizeof(*dfa->mark));
+    if (dfa->next == NULL || dfa->match == NULL || dfa->set_off == NULL ||
+        dfa->set_len == NULL || dfa->set_hash == NULL || dfa->sets == NULL ||
+        dfa->buckets == NULL || dfa->work == NULL || dfa->stack == NULL ||
+        dfa->mark == NULL)
+    {
+        hp_log_error("malloc() failure.");
+        hp_scan_dfa_deinit(dfa);
+        status = HP_STATUS_ERROR;
+        goto return_status;
+    }
+
+    hp_scan_dfa_flush(dfa);
+    dfa->flush_count = 0;
+    hp_scan_dfa_state(dfa, 0);
+
+    *dfa_ = dfa;
+
+    status = HP_STATUS_OK;
+ return_status:
+    return status;
+}
+
+void hp_scan_dfa_deinit(hp_scan_dfa_t *dfa)
+{
+    free(dfa->next);
+    free(dfa->match);
+    free(dfa->set_off);
+    free(dfa->set_len);
+    free(dfa->set_hash);
+    free(dfa->sets);
+    free(dfa->buckets);
+    free(dfa->work);
+    free(dfa->stack);
+    free(dfa->mark);
+    free(dfa);
+
+    return;
+}
+
+uint32_t hp_scan_dfa_start(hp_scan_dfa_t *dfa, uint32_t nfa_start)
+{
+    uint32_t count = 0;
+
+    hp_scan_dfa_work_begin(dfa);
+    hp_scan_dfa_closure(dfa, nfa_start, &count);
+
+    return hp_scan_dfa_state(dfa, count);
+}
+
+uint32_t hp_scan_dfa_run(hp_scan_dfa_t *dfa, uint32_t state,
+                         const uint8_t *buf, size_t buf_len, size_t *used)
+{
+    const uint16_t *next = dfa->next;
+    const uint8_t *match = dfa->match;
+    uint32_t to;
+    size_t i;
+
+    for (i = 0; i < buf_len; ) {
+        to = next[((size_t)state * 256) + buf[i]];
+        if (to == HP_SCAN_DFA_UNKNOWN)
+            to = hp_scan_dfa_step(dfa, state, buf[i]);
+        state = to;
+        i++;
+        if (match[state] || state == HP_SCAN_DFA_DEAD)
+            break;
+    }
+    *used = i;
+
+    return state;
+}
+
+bool hp_scan_dfa_is_match(const hp_scan_dfa_t *dfa, uint32_t state)
+{
+    return dfa->match[state] != 0;
+}
+
+uint64_t hp_scan_dfa_flush_count(const hp_scan_dfa_t *dfa)
+{
+    return dfa->flush_count;
+}
+
+typedef struct hp_scan_prefix_t {
+    uint32_t state;
+    uint32_t len;
+    uint8_t bytes[HP_SCAN_REGEX_PREFIX_LEN_MAX];
+    bool done;
+} hp_scan_prefix_t;
+
+/* The bytes a state can go on with, and how many */
+static uint32_t hp_scan_dfa_bytes(const hp_scan_dfa_t *dfa, uint32_t state,
+                                  uint8_t *takes)
+{
+    const uint32_t *set = dfa->sets + dfa->set_off[state];
+    uint32_t count;
+    uint32_t i;
+    uint32_t c;
+
+    memset(takes, 0, 256);
+    for (i = 0; i < dfa->set_len[state]; i++) {
+        for (c = 0; c < 256; c++)
+            takes[c] |= hp_scan_dfa_takes(dfa, &dfa->nfa[set[i]], c);
+    }
+    for (count = 0, c = 0; c < 256; c++)
+        count += takes[c];
+
+    return count;
+}
+
+/* Prefixes are grown a byte at a time, following the DFA, for as long as
+ * each can go on with only a few bytes and none of them can match yet.
+ * A prefix is done when it can't be grown, or growing it would make for
+ * too many. */
+hp_status_t hp_scan_regex_prefixes(const hp_scan_nfa_t *nfa,
+                                   uint32_t nfa_count,
+                                   const uint8_t *bytes,
+                                   uint32_t nfa_start,
+                                   hp_scan_prefixes_t *prefixes)
+{
+    hp_scan_dfa_t *dfa = NULL;
+    hp_scan_prefix_t items[2][HP_SCAN_REGEX_PREFIXES_MAX];
+    hp_scan_prefix_t *from;
+    hp_scan_prefix_t *to;
+    hp_scan_prefix_t *item;
+    uint32_t from_count;
+    uint32_t to_count;
+    uint8_t takes[256];
+    uint32_t take_count;
+    bool grown;
+    uint32_t depth;
+    uint32_t i;
+    uint32_t c;
+    hp_status_t status;
+
+    memset(prefixes, 0, sizeof(*prefixes));
+
+    if (hp_scan_dfa_init(&dfa, nfa, nfa_count, bytes,
+                         HP_SCAN_REGEX_PREFIX_STATES) != HP_STATUS_OK)
+    {
+        status = HP_STATUS_ERROR;
+        goto return_status;
+    }
+
+    from = items[0];
+    from_count = 1;
+    memset(&from[0], 0, sizeof(from[0]));
+    from[0].state = hp_scan_dfa_start(dfa, nfa_start);
+
+    for (depth = 0; depth < HP_SCAN_REGEX_PREFIX_LEN_MAX; depth++) {
+        to = (from == items[0]) ? items[1] : items[0];
+        to_count = 0;
+        grown = false;
+        for (i = 0; i < from_count; i++) {
+            item = &from[i];
+            if (!item->done && hp_scan_dfa_is_match(dfa, item->state))
+                item->done = true;
+            if (item->done) {
+                to[to_count++] = *item;
+                continue;
+            }
+            take_count = hp_scan_dfa_bytes(dfa, item->state, takes);
+            if (to_count + take_count + (from_count - i - 1) >
+                HP_SCAN_REGEX_PREFIXES_MAX)
+            {
+                /* This and the ones after it stay as they are */
+                for (; i < from_count; i++) {
+                    to[to_count] = from[i];
+                    to[to_count++].done = true;
+                }
+                break;
+            }
+            for (c = 0; c < 256; c++) {
+                if (!takes[c])
+                    continue;
+                to[to_count] = *item;
+                to[to_count].bytes[item->len] = (uint8_t)c;
+                to[to_count].len++;
+                to[to_count].state = hp_scan_dfa_step(dfa, item->state,
+                                                      (uint8_t)c);
+                to_count++;
+                grown = true;
+            }
+        }
+        from = to;
+        from_count = to_count;
+        if (!grown)
+            break;
+    }
+
+    /* The cache is sized to never fill here */
+    BUG_ON(hp_scan_dfa_flush_count(dfa) != 0);
+
+    for (i = 0; i < from_count; i++) {
+        if (from[i].len == 0)
+            break;
+        prefixes->len[i] = from[i].len;
+        memcpy(prefixes->bytes[i], from[i].bytes, from[i].len);
+    }
+    if (from_count == 0 || i != from_count) {
+        status = HP_STATUS_ERROR;
+        goto return_status;
+    }
+    prefixes->count = from_count;
+
+    status = HP_STATUS_OK;
+ return_status:
+    if (dfa != NULL)
+        hp_scan_dfa_deinit(dfa);
+    return status;
+}
@@ -0,0 +1,116 @@
+/**
+ * Copyright(C) 2018, Juniper Networks, Inc.
+ * All rights reserved
+ *
+ * This SOFTWARE is licensed under the license provided in the LICENSE.txt
+ * file.  By downloading, installing, copying, or otherwise using the
+ * SOFTWARE, you agree to be bound by the terms of that license.  This
+ * SOFTWARE is not an official Juniper product.
+ *
+ * Third-Party Code: This SOFTWARE may depend on other components under
+ * separate copyright notice and license terms.  Your use of the source
+ * code for those components is subject to the term and conditions of
+ * the respective license as noted in the Third-Party source code.
+ */
+
+/**
+ * @author Anoop Saldanha
+ */
+
+/* Byte oriented regexes.  A regex is compiled into a Thompson NFA, held in
+ * flat arrays alongside the rules, and is run as a DFA built lazily from
+ * it - a DFA state stands for the set of NFA states the NFA could be in,
+ * and is only made, along with its transitions, the first time a scan
+ * gets to it.  The states are kept in a cache of bounded size, which is
+ * flushed and built up again when it fills, so that input crafted to
+ * visit many states can't grow it.  A regex's literal prefixes can be
+ * found up front, so that the multi pattern engine finds where a match
+ * can start, and the DFA only runs from there. */
+
+#ifndef __SCAN_REGEX__H__
+#define __SCAN_REGEX__H__
+
+#include "honeyprocs-common.h"
+#include "status.h"
+
+typedef enum hp_scan_nfa_op_t {
+    /* Byte a, then next */
+    HP_SCAN_NFA_BYTE = 0,
+    /* A byte in the 32 byte bitmap at bytes[a], then next */
+    HP_SCAN_NFA_CLASS,
+    /* Both next and b, without taking a byte */
+    HP_SCAN_NFA_SPLIT,
+    HP_SCAN_NFA_MATCH,
+} hp_scan_nfa_op_t;
+
+typedef struct hp_scan_nfa_t {
+    uint32_t op;
+    uint32_t a;
+    uint32_t next;
+    uint32_t b;
+} hp_scan_nfa_t;
+
+/* Bitmap of the bytes a class takes */
+#define HP_SCAN_CLASS_SIZE 32
+
+/* Most literal prefixes taken from a regex, and their longest */
+#define HP_SCAN_REGEX_PREFIXES_MAX    16
+#define HP_SCAN_REGEX_PREFIX_LEN_MAX  16
+
+typedef struct hp_scan_prefixes_t {
+    uint32_t count;
+    uint32_t len[HP_SCAN_REGEX_PREFIXES_MAX];
+    uint8_t bytes[HP_SCAN_REGEX_PREFIXES_MAX][HP_SCAN_REGEX_PREFIX_LEN_MAX];
+} hp_scan_prefixes_t;
+
+typedef struct hp_scan_dfa_t hp_scan_dfa_t;
+
+/* The state no match can get out of */
+#define HP_SCAN_DFA_DEAD 0
+
+/**
+ * @nfa All of the regexes' NFA states, with their classes in bytes.
+ * @states_max Size of the state cache.  Each state costs a transition
+ *             table of 256 entries.
+ */
+hp_status_t hp_scan_dfa_init(hp_scan_dfa_t **dfa,
+                             const hp_scan_nfa_t *nfa,
+                             uint32_t nfa_count,
+                             const uint8_t *bytes,
+                             uint32_t states_max);
+void hp_scan_dfa_deinit(hp_scan_dfa_t *dfa);
+
+/* The state a regex starts in.  States are only valid till the cache is
+ * next flushed, which any of these calls can do, so only the latest one
+ * returned should be held on to. */
+uint32_t hp_scan_dfa_start(hp_scan_dfa_t *dfa, uint32_t nfa_start);
+
+/**
+ * Run from a state over a buffer, stopping at the first match or on
+ * getting stuck.
+ *
+ * @used Set to the no of bytes taken.
+ *
+ * @retval The state stopped in - a matching state, HP_SCAN_DFA_DEAD, or
+ *         whatever state the buffer ran out in.
+ */
+uint32_t hp_scan_dfa_run(hp_scan_dfa_t *dfa, uint32_t state,
+                         const uint8_t *buf, size_t buf_len, size_t *used);
+
+bool hp_scan_dfa_is_match(const hp_scan_dfa_t *dfa, uint32_t state);
+
+/* No of times the cache filled and was flushed */
+uint64_t hp_scan_dfa_flush_count(const hp_scan_dfa_t *dfa);
+
+/**
+ * Find literal prefixes every match of a regex starts with.  Fails if
+ * there are none to be had, such as when the regex can start with most
+ * any byte, as all of the input would then have to go through the DFA.
+ */
+hp_status_t hp_scan_regex_prefixes(const hp_scan_nfa_t *nfa,
+                                   uint32_t nfa_count,
+                                   const uint8_t *bytes,
+                                   uint32_t nfa_start,
+                                   hp_scan_prefixes_t *prefixes);
+
+#endif /* __SCAN_REGEX__H__ */
@@ -0,0 +1,554 @@
+/**
+ * Copyright(C) 2018, Juniper Networks, Inc.
+ * All rights reserved
+ *
+ * This SOFTWARE is licensed under the license provided in the LICENSE.txt
+ * file.  By downloading, installing, copying, or otherwise using the
+ * SOFTWARE, you agree to be bound by the terms of that license.  This
+ * SOFTWARE is not an official Juniper product.
+ *
+ * Third-Party Code: This SOFTWARE may depend on other components under
+ * separate copyright notice and license terms.  Your use of the source
+ * code for those components is subject to the term and conditions of
+ * the respective license as noted in the Third-Party source code.
+ */
+
+/**
+ * @author Anoop Saldanha
+ */
+#include "honeyprocs-common.h"
+#include "scan-rules.h"
+#include "scan-engine.h"
+#include "scan-regex.h"
+#include "util-log.h"
+#include "status.h"
+
+/* What a condition, or a part of one, is known to be.  Before a region
+ * is done, a string that hasn't matched may still match, which leaves
+ * what depends on it unknown. */
+#define HP_SCAN_FALSE   0
+#define HP_SCAN_TRUE    1
+#define HP_SCAN_UNKNOWN 2
+
+#define HP_SCAN_NO_MATCH UINT64_MAX
+
+/* What checking a string at an offset found, where MORE is that it runs
+ * past the bytes fed so far */
+#define HP_SCAN_CHECK_NO    0
+#define HP_SCAN_CHECK_MATCH 1
+#define HP_SCAN_CHECK_MORE  2
+
+/* regex_start of a regex without a cached start state */
+#define HP_SCAN_NO_STATE UINT32_MAX
+
+void hp_scan_string_anchor(const uint8_t *mask, uint32_t string_len,
+                           uint32_t *at, uint32_t *len)
+{
+    uint32_t run;
+    uint32_t i;
+
+    *at = 0;
+    if (mask == NULL) {
+        *len = string_len;
+        goto return_status;
+    }
+
+    *len = 0;
+    for (i = 0, run = 0; i < string_len; i++) {
+        run = (mask[i] == 0xff) ? (run + 1) : 0;
+        if (run > *len) {
+            *at = i + 1 - run;
+            *len = run;
+        }
+    }
+
+ return_status:
+    return;
+}
+
+hp_status_t hp_scan_rules_add_anchors(const hp_scan_rules_t *rules,
+                                      hp_scan_engine_t *engine)
+{
+    const hp_scan_anchor_t *anchor;
+    uint32_t i;
+    hp_status_t status;
+
+    for (i = 0; i < rules->anchor_count; i++) {
+        anchor = &rules->anchors[i];
+        if (hp_scan_engine_add_pattern(engine, rules->bytes + anchor->off,
+                                       anchor->len, i) != HP_STATUS_OK)
+        {
+            status = HP_STATUS_ERROR;
+            goto return_status;
+        }
+    }
+
+    status = HP_STATUS_OK;
+ return_status:
+    return status;
+}
+
+static uint8_t hp_scan_rules_string_state(const hp_scan_rules_ctx_t *ctx,
+                                          uint32_t string,
+                                          bool final)
+{
+    if (ctx->string_match[string] != HP_SCAN_NO_MATCH)
+        return HP_SCAN_TRUE;
+
+    return final ? HP_SCAN_FALSE : HP_SCAN_UNKNOWN;
+}
+
+/**
+ * Evaluate a condition as far as what is known allows.  Operands are
+ * evaluated left to right, and no further than it takes to settle the
+ * result.
+ *
+ * @final The region is done, so strings that haven't matched won't.
+ */
+static uint8_t hp_scan_rules_eval(const hp_scan_rules_ctx_t *ctx,
+                                  uint32_t n,
+                                  bool final)
+{
+    const hp_scan_node_t *node = &ctx->rules->nodes[n];
+    const uint32_t *refs;
+    uint32_t matched;
+    uint32_t open;
+    uint32_t i;
+    uint8_t l, r;
+
+    switch (node->op) {
+        case HP_SCAN_OP_STRING:
+            return hp_scan_rules_string_state(ctx, node->a, final);
+
+        case HP_SCAN_OP_OF:
+            refs = ctx->rules->string_refs + node->c;
+            matched = 0;
+            open = 0;
+            for (i = 0; i < node->b; i++) {
+                if (matched >= node->a ||
+                    matched + open + (node->b - i) < node->a)
+                {
+                    break;
+                }
+                r = hp_scan_rules_string_state(ctx, refs[i], final);
+                if (r == HP_SCAN_TRUE)
+                    matched++;
+                else if (r == HP_SCAN_UNKNOWN)
+                    open++;
+            }
+            if (matched >= node->a)
+                return HP_SCAN_TRUE;
+            if (matched + open + (node->b - i) < node->a)
+                return HP_SCAN_FALSE;
+            return HP_SCAN_UNKNOWN;
+
+        case HP_SCAN_OP_REGION:
+            return ((ctx->region & node->a) == node->a) ?
+                HP_SCAN_TRUE : HP_SCAN_FALSE;
+
+        case HP_SCAN_OP_AND:
+            if ((l = hp_scan_rules_eval(ctx, node->a, final)) == HP_SCAN_FALSE)
+                return HP_SCAN_FALSE;
+            if ((r = hp_scan_rules_eval(ctx, node->b, final)) == HP_SCAN_FALSE)
+                return HP_SCAN_FALSE;
+            return (l == HP_SCAN_TRUE && r == HP_SCAN_TRUE) ?
+                HP_SCAN_TRUE : HP_SCAN_UNKNOWN;
+
+        case HP_SCAN_OP_OR:
+            if ((l = hp_scan_rules_eval(ctx, node->a, final)) == HP_SCAN_TRUE)
+                return HP_SCAN_TRUE;
+            if ((r = hp_scan_rules_eval(ctx, node->b, final)) == HP_SCAN_TRUE)
+                return HP_SCAN_TRUE;
+            return (l == HP_SCAN_FALSE && r == HP_SCAN_FALSE) ?
+                HP_SCAN_FALSE : HP_SCAN_UNKNOWN;
+
+        case HP_SCAN_OP_NOT:
+            l = hp_scan_rules_eval(ctx, node->a, final);
+            return (l == HP_SCAN_UNKNOWN) ? HP_SCAN_UNKNOWN :
+                (l == HP_SCAN_TRUE) ? HP_SCAN_FALSE : HP_SCAN_TRUE;
+
+        default:
+            BUG_ON(1);
+            return HP_SCAN_FALSE;
+    }
+}
+
+/* The byte at a region offset, from the chunk being fed or the bytes
+ * before it. */
+static uint8_t hp_scan_rules_byte(const hp_scan_rules_ctx_t *ctx,
+                                  uint64_t offset)
+{
+    if (offset >= ctx->buf_offset)
+        return ctx->buf[offset - ctx->buf_offset];
+
+    return ctx->history[ctx->history_len - (ctx->buf_offset - offset)];
+}
+
+/* Check a string with wildcards, all of its bytes having been fed.  The
+ * anchor is checked again along with the rest, as it's cheaper than
+ * skipping it. */
+static uint8_t hp_scan_rules_check_mask(const hp_scan_rules_ctx_t *ctx,
+                                        const hp_scan_string_t *string,
+                                        uint64_t offset)
+{
+    const uint8_t *pat = ctx->rules->bytes + string->off;
+    const uint8_t *mask = ctx->rules->bytes + string->mask_off;
+    uint32_t i;
+
+    if (offset + string->len > ctx->next_offset)
+        return HP_SCAN_CHECK_MORE;
+
+    for (i = 0; i < string->len; i++) {
+        if ((hp_scan_rules_byte(ctx, offset + i) ^ pat[i]) & mask[i])
+            return HP_SCAN_CHECK_NO;
+    }
+
+    return HP_SCAN_CHECK_MATCH;
+}
+
+/* The DFA state a regex starts in.  Start states are kept till the cache
+ * is flushed, as working one out isn't cheap. */
+static uint32_t hp_scan_rules_regex_start(hp_scan_rules_ctx_t *ctx,
+                                          uint32_t string_id)
+{
+    const hp_scan_string_t *string = &ctx->rules->strings[string_id];
+    uint32_t state;
+    uint32_t i;
+
+    if (hp_scan_dfa_flush_count(ctx->dfa) == ctx->dfa_flushes &&
+        ctx->regex_start[string_id] != HP_SCAN_NO_STATE)
+    {
+        return ctx->regex_start[string_id];
+    }
+
+    /* Working it out can flush the cache too */
+    state = hp_scan_dfa_start(ctx->dfa, string->regex);
+    if (hp_scan_dfa_flush_count(ctx->dfa) != ctx->dfa_flushes) {
+        for (i = 0; i < ctx->rules->string_count; i++)
+            ctx->regex_start[i] = HP_SCAN_NO_STATE;
+        ctx->dfa_flushes = hp_scan_dfa_flush_count(ctx->dfa);
+    }
+    ctx->regex_start[string_id] = state;
+
+    return state;
+}
+
+/* Run a regex from offset over what of it has been fed, up to the
+ * longest match allowed.  Runs from the start each time, the bytes
+ * before the chunk being fed coming from history. */
+static uint8_t hp_scan_rules_check_regex(hp_scan_rules_ctx_t *ctx,
+                                         uint32_t string_id,
+                                         uint64_t offset)
+{
+    uint64_t limit = offset + HP_SCAN_RULES_SPAN_MAX;
+    uint64_t end = (limit < ctx->next_offset) ? limit : ctx->next_offset;
+    const uint8_t *p;
+    size_t used;
+    uint32_t state;
+
+    state = hp_scan_rules_regex_start(ctx, string_id);
+
+    if (offset < ctx->buf_offset) {
+        p = ctx->history + ctx->history_len - (ctx->buf_offset - offset);
+        state = hp_scan_dfa_run(ctx->dfa, state, p,
+                                ((end < ctx->buf_offset) ?
+                                 end : ctx->buf_offset) - offset, &used);
+        offset += used;
+    }
+    if (offset >= ctx->buf_offset && offset < end &&
+        state != HP_SCAN_DFA_DEAD && !hp_scan_dfa_is_match(ctx->dfa, state))
+    {
+        state = hp_scan_dfa_run(ctx->dfa, state,
+                                ctx->buf + (offset - ctx->buf_offset),
+                                end - offset, &used);
+        offset += used;
+    }
+
+    if (hp_scan_dfa_is_match(ctx->dfa, state))
+        return HP_SCAN_CHECK_MATCH;
+    if (state == HP_SCAN_DFA_DEAD || offset == limit)
+        return HP_SCAN_CHECK_NO;
+
+    return HP_SCAN_CHECK_MORE;
+}
+
+/* Check a string whose anchor matched, placing it at offset. */
+static uint8_t hp_scan_rules_check(hp_scan_rules_ctx_t *ctx,
+                                   uint32_t string_id,
+                                   uint64_t offset)
+{
+    const hp_scan_string_t *string = &ctx->rules->strings[string_id];
+
+    /* A string without wildcards is its own anchor, so the engine has
+     * seen all of it, however long, unless from before a restart */
+    if (string->regex == HP_SCAN_STRING_NO_REGEX &&
+        string->mask_off == HP_SCAN_STRING_NO_MASK)
+    {
+        return (offset >= ctx->stream_offset) ?
+            HP_SCAN_CHECK_MATCH : HP_SCAN_CHECK_NO;
+    }
+
+    /* The rest are checked against the bytes, which go no further back
+     * than history, and not past a restart */
+    if (ctx->buf_offset - ctx->history_len > offset)
+        return HP_SCAN_CHECK_NO;
+
+    if (string->regex != HP_SCAN_STRING_NO_REGEX)
+        return hp_scan_rules_check_regex(ctx, string_id, offset);
+
+    return hp_scan_rules_check_mask(ctx, string, offset);
+}
+
+/* A string matched.  Its rule is evaluated again, and if that settles
+ * it, neither the rule nor its strings are looked at again this
+ * region. */
+static void hp_scan_rules_matched(hp_scan_rules_ctx_t *ctx,
+                                  uint32_t string_id,
+                                  uint64_t offset)
+{
+    uint32_t rule = ctx->rules->strings[string_id].rule;
+    uint8_t state;
+
+    if (offset < ctx->string_match[string_id])
+        ctx->string_match[string_id] = offset;
+
+    state = hp_scan_rules_eval(ctx, ctx->rules->rules[rule].condition, false);
+    if (state != HP_SCAN_UNKNOWN) {
+        ctx->rule_state[rule] = state;
+        ctx->undecided--;
+    }
+
+    return;
+}
+
+/* Scan engine callback - an anchor matched. */
+static void hp_scan_rules_anchor(uint32_t anchor_id, uint64_t offset,
+                                 void *ctx_)
+{
+    hp_scan_rules_ctx_t *ctx = (hp_scan_rules_ctx_t *)ctx_;
+    const hp_scan_anchor_t *anchor = &ctx->rules->anchors[anchor_id];
+    uint32_t string_id = anchor->string;
+    const hp_scan_string_t *string = &ctx->rules->strings[string_id];
+    hp_scan_pending_t *pending;
+
+    if (ctx->rule_state[string->rule] != HP_SCAN_UNKNOWN ||
+        offset < anchor->at)
+    {
+        goto return_status;
+    }
+    /* From an offset in the stream to one in the region, and from the
+     * anchor to the string */
+    offset += ctx->stream_offset - anchor->at;
+    if (ctx->string_match[string_id] <= offset)
+        goto return_status;
+
+    switch (hp_scan_rules_check(ctx, string_id, offset)) {
+        case HP_SCAN_CHECK_MATCH:
+            hp_scan_rules_matched(ctx, string_id, offset);
+            break;
+        case HP_SCAN_CHECK_MORE:
+            BUG_ON(ctx->pending_count == ctx->rules->pending_max);
+            pending = &ctx->pending[ctx->pending_count++];
+            pending->string = string_id;
+            pending->offset = offset;
+            break;
+        default:
+            break;
+    }
+
+ return_status:
+    return;
+}
+
+hp_status_t hp_scan_rules_ctx_init(hp_scan_rules_ctx_t *ctx,
+                                   const hp_scan_rules_t *rules)
+{
+    hp_status_t status;
+
+    memset(ctx, 0, sizeof(*ctx));
+    ctx->rules = rules;
+    hp_scan_ctx_init(&ctx->scan, rules->tables, hp_scan_rules_anchor, ctx);
+
+    ctx->rule_state = (uint8_t *)malloc(rules->rule_count + 1);
+    ctx->string_match = (uint64_t *)
+        malloc(sizeof(*ctx->string_match) * (rules->string_count + 1));
+    ctx->pending = (hp_scan_pending_t *)
+        malloc(sizeof(*ctx->pending) * (rules->pending_max + 1));
+    ctx->regex_start = (uint32_t *)
+        malloc(sizeof(*ctx->regex_start) * (rules->string_count + 1));
+    if (ctx->rule_state == NULL || ctx->string_match == NULL ||
+        ctx->pending == NULL || ctx->regex_start == NULL)
+    {
+        hp_log_error("malloc() failure.");
+        hp_scan_rules_ctx_deinit(ctx);
+        status = HP_STATUS_ERROR;
+        goto return_status;
+    }
+    memset(ctx->regex_start, 0xff,
+           sizeof(*ctx->regex_start) * (rules->string_count + 1));
+
+    if (rules->nfa_count != 0 &&
+        hp_scan_dfa_init(&ctx->dfa, rules->nfa, rules->nfa_count,
+                         rules->bytes, HP_SCAN_RULES_DFA_STATES) != HP_STATUS_OK)
+    {
+        hp_scan_rules_ctx_deinit(ctx);
+        status = HP_STATUS_ERROR;
+        goto return_status;
+    }
+
+    status = HP_STATUS_OK;
+ return_status:
+    return status;
+}
+
+void hp_scan_rules_ctx_deinit(hp_scan_rules_ctx_t *ctx)
+{
+    free(ctx->rule_state);
+    free(ctx->string_match);
+    free(ctx->pending);
+    free(ctx->regex_start);
+    if (ctx->dfa != NULL)
+        hp_scan_dfa_deinit(ctx->dfa);
+    memset(ctx, 0, sizeof(*ctx));
+
+    return;
+}
+
+void hp_scan_rules_ctx_begin(hp_scan_rules_ctx_t *ctx, uint32_t region)
+{
+    const hp_scan_rules_t *rules = ctx->rules;
+    uint32_t i;
+
+    ctx->region = region;
+    for (i = 0; i < rules->string_count; i++)
+        ctx->string_match[i] = HP_SCAN_NO_MATCH;
+
+    /* With no string matched yet, only what the region is can settle a
+     * condition.  Those settled cost nothing from here on. */
+    ctx->undecided = 0;
+    for (i = 0; i < rules->rule_count; i++) {
+        ctx->rule_state[i] = hp_scan_rules_eval(ctx, rules->rules[i].condition,
+                                                false);
+        if (ctx->rule_state[i] == HP_SCAN_UNKNOWN)
+            ctx->undecided++;
+    }
+
+    hp_scan_ctx_finish(&ctx->scan);
+    ctx->pending_count = 0;
+    ctx->history_len = 0;
+    ctx->next_offset = HP_SCAN_NO_MATCH;
+
+    return;
+}
+
+/* Keep the last bytes fed, up to the longest string with wildcards. */
+static void hp_scan_rules_keep_history(hp_scan_rules_ctx_t *ctx)
+{
+    uint32_t keep;
+
+    if (ctx->buf_len >= HP_SCAN_RULES_SPAN_MAX) {
+        memcpy(ctx->history,
+               ctx->buf + ctx->buf_len - HP_SCAN_RULES_SPAN_MAX,
+               HP_SCAN_RULES_SPAN_MAX);
+        ctx->history_len = HP_SCAN_RULES_SPAN_MAX;
+        goto return_status;
+    }
+
+    keep = HP_SCAN_RULES_SPAN_MAX - (uint32_t)ctx->buf_len;
+    if (keep > ctx->history_len)
+        keep = ctx->history_len;
+    memmove(ctx->history, ctx->history + ctx->history_len - keep, keep);
+    memcpy(ctx->history + keep, ctx->buf, ctx->buf_len);
+    ctx->history_len = keep + (uint32_t)ctx->buf_len;
+
+ return_status:
+    return;
+}
+
+void hp_scan_rules_ctx_feed(hp_scan_rules_ctx_t *ctx, uint64_t offset,
+                            const uint8_t *buf, size_t buf_len)
+{
+    const hp_scan_string_t *string;
+    hp_scan_pending_t *pending;
+    uint8_t check;
+    uint32_t i;
+
+    if (ctx->undecided == 0)
+        goto return_status;
+
+    if (offset != ctx->next_offset) {
+        hp_scan_ctx_finish(&ctx->scan);
+        ctx->pending_count = 0;
+        ctx->history_len = 0;
+        ctx->stream_offset = offset;
+    }
+    ctx->buf = buf;
+    ctx->buf_len = buf_len;
+    ctx->buf_offset = offset;
+    ctx->next_offset = offset + buf_len;
+
+    /* Strings waiting on this chunk are checked before it is scanned,
+     * so that what is left waiting afterwards is bounded by
+     * pending_max. */
+    for (i = 0; i < ctx->pending_count; ) {
+        pending = &ctx->pending[i];
+        string = &ctx->rules->strings[pending->string];
+        if (ctx->rule_state[string->rule] == HP_SCAN_UNKNOWN) {
+            check = hp_scan_rules_check(ctx, pending->string, pending->offset);
+            if (check == HP_SCAN_CHECK_MORE) {
+                i++;
+                continue;
+            }
+            if (check == HP_SCAN_CHECK_MATCH)
+                hp_scan_rules_matched(ctx, pending->string, pending->offset);
+        }
+        *pending = ctx->pending[--ctx->pending_count];
+    }
+
+    hp_scan_ctx_feed(&ctx->scan, buf, buf_len);
+    hp_scan_rules_keep_history(ctx);
+
+ return_status:
+    return;
+}
+
+bool hp_scan_rules_ctx_decided(const hp_scan_rules_ctx_t *ctx)
+{
+    return ctx->undecided == 0;
+}
+
+uint32_t hp_scan_rules_ctx_end(hp_scan_rules_ctx_t *ctx,
+                               hp_scan_rule_func_t rule_func,
+                               void *arg)
+{
+    const hp_scan_rules_t *rules = ctx->rules;
+    const hp_scan_rule_t *rule;
+    uint64_t offset;
+    uint32_t count;
+    uint32_t i, j;
+
+    count = 0;
+    for (i = 0; i < rules->rule_count; i++) {
+        rule = &rules->rules[i];
+        if (ctx->rule_state[i] == HP_SCAN_UNKNOWN)
+            ctx->rule_state[i] = hp_scan_rules_eval(ctx, rule->condition, true);
+        if (ctx->rule_state[i] != HP_SCAN_TRUE)
+            continue;
+
+        offset = HP_SCAN_NO_MATCH;
+        for (j = rule->first_string;
+             j < rule->first_string + rule->string_count; j++)
+        {
+            if (ctx->string_match[j] < offset)
+                offset = ctx->string_match[j];
+        }
+        rule_func(i, (offset != HP_SCAN_NO_MATCH) ? offset : 0, arg);
+        count++;
+    }
+
+    hp_scan_ctx_finish(&ctx->scan);
+    ctx->pending_count = 0;
+    ctx->undecided = 0;
+
+    return count;
+}
@@ -0,0 +1,232 @@
+/**
+ * Copyright(C) 2018, Juniper Networks, Inc.
+ * All rights reserved
+ *
+ * This SOFTWARE is licensed under the license provided in the LICENSE.txt
+ * file.  By downloading, installing, copying, or otherwise using the
+ * SOFTWARE, you agree to be bound by the terms of that license.  This
+ * SOFTWARE is not an official Juniper product.
+ *
+ * Third-Party Code: This SOFTWARE may depend on other components under
+ * separate copyright notice and license terms.  Your use of the source
+ * code for those components is subject to the term and conditions of
+ * the respective license as noted in the Third-Party source code.
+ */
+
+/**
+ * @author Anoop Saldanha
+ */
+
+/* Rules over the multi pattern engine.  A rule has named strings - text,
+ * hex with wildcards, or regexes - and a condition over which of them
+ * matched and over the attributes of the region scanned, like YARA's, if
+ * a lot smaller.  The strings of all the rules are found in a single
+ * pass, each by its anchors - for text and hex, its longest run of
+ * literal bytes, and for a regex, the literal prefixes its matches start
+ * with - which are then checked against the whole string. */
+
+#ifndef __SCAN_RULES__H__
+#define __SCAN_RULES__H__
+
+#include "honeyprocs-common.h"
+#include "scan-engine.h"
+#include "scan-regex.h"
+#include "status.h"
+
+/* Attributes of a region, for "region is" conditions */
+#define HP_SCAN_REGION_PRIVATE  0x01
+#define HP_SCAN_REGION_MAPPED   0x02
+#define HP_SCAN_REGION_IMAGE    0x04
+#define HP_SCAN_REGION_READ     0x08
+#define HP_SCAN_REGION_WRITE    0x10
+#define HP_SCAN_REGION_EXECUTE  0x20
+
+/* Longest string with wildcards, and longest regex match.  Strings
+ * without wildcards can be of any length. */
+#define HP_SCAN_RULES_SPAN_MAX  256
+
+/* mask_off of a string without wildcards */
+#define HP_SCAN_STRING_NO_MASK  UINT32_MAX
+/* regex of a string that isn't one */
+#define HP_SCAN_STRING_NO_REGEX UINT32_MAX
+
+/* Size of the DFA state cache regexes are run with, per scan.  Tests
+ * build with a small one, to have it flushed. */
+#ifndef HP_SCAN_RULES_DFA_STATES
+#define HP_SCAN_RULES_DFA_STATES 256
+#endif
+
+typedef struct hp_scan_string_t {
+    /* The string's bytes, and the mask of the bits that have to match
+     * if it has wildcards, as offsets into the rules' bytes */
+    uint32_t off;
+    uint32_t mask_off;
+    uint32_t len;
+    /* The NFA state a regex starts in, in place of the bytes */
+    uint32_t regex;
+    /* The rule the string belongs to */
+    uint32_t rule;
+} hp_scan_string_t;
+
+typedef struct hp_scan_anchor_t {
+    uint32_t string;
+    /* The anchor's bytes, at an offset into the rules' bytes */
+    uint32_t off;
+    uint32_t len;
+    /* Where the anchor is in the string */
+    uint32_t at;
+} hp_scan_anchor_t;
+
+typedef enum hp_scan_op_t {
+    /* String a matched */
+    HP_SCAN_OP_STRING = 0,
+    /* At least a of the b strings listed from string_refs[c] matched */
+    HP_SCAN_OP_OF,
+    /* The region has all of the attributes a */
+    HP_SCAN_OP_REGION,
+    /* Nodes a and b */
+    HP_SCAN_OP_AND,
+    HP_SCAN_OP_OR,
+    /* Node a */
+    HP_SCAN_OP_NOT,
+} hp_scan_op_t;
+
+/* A condition is a tree of nodes */
+typedef struct hp_scan_node_t {
+    uint32_t op;
+    uint32_t a;
+    uint32_t b;
+    uint32_t c;
+} hp_scan_node_t;
+
+typedef struct hp_scan_rule_t {
+    const char *name;
+    /* The rule's strings, which are listed together */
+    uint32_t first_string;
+    uint32_t string_count;
+    /* The condition's root node */
+    uint32_t condition;
+} hp_scan_rule_t;
+
+/**
+ * A rule set, as flat, read only arrays, so that like hp_scan_tables_t
+ * it can be built at runtime or generated as static data.  tables finds
+ * the anchors, with the anchor's index as the pattern id.
+ */
+typedef struct hp_scan_rules_t {
+    const hp_scan_rule_t *rules;
+    uint32_t rule_count;
+    const hp_scan_string_t *strings;
+    uint32_t string_count;
+    const hp_scan_node_t *nodes;
+    uint32_t node_count;
+    const uint32_t *string_refs;
+    uint32_t string_ref_count;
+    const hp_scan_anchor_t *anchors;
+    uint32_t anchor_count;
+    const hp_scan_nfa_t *nfa;
+    uint32_t nfa_count;
+    const uint8_t *bytes;
+    uint32_t byte_count;
+    /* The most anchors that can be waiting at once on the bytes after
+     * them - the sum of what follows the anchors of strings with
+     * wildcards, and of the span of each regex */
+    uint32_t pending_max;
+    const hp_scan_tables_t *tables;
+} hp_scan_rules_t;
+
+/* Find where to anchor a string of bytes - its longest run without
+ * wildcards, the first of them on a tie.  mask is NULL without
+ * wildcards.  Sets len to 0 if the string is all wildcards. */
+void hp_scan_string_anchor(const uint8_t *mask, uint32_t string_len,
+                           uint32_t *at, uint32_t *len);
+
+/* Add the rules' anchors to an engine, to be compiled into their
+ * tables. */
+hp_status_t hp_scan_rules_add_anchors(const hp_scan_rules_t *rules,
+                                      hp_scan_engine_t *engine);
+
+/**
+ * Called for every rule that matched a region.
+ *
+ * @offset Where the first match found of the rule's strings starts, or 0
+ *         if the rule was settled before any of them matched.  A rule is
+ *         settled as soon as it can be, so this needn't be the first in
+ *         the region.
+ */
+typedef void (*hp_scan_rule_func_t)(uint32_t rule_id,
+                                    uint64_t offset,
+                                    void *arg);
+
+typedef struct hp_scan_pending_t {
+    uint32_t string;
+    /* Offset of the string's first byte */
+    uint64_t offset;
+} hp_scan_pending_t;
+
+/* State of a rule scan of a region, over data fed in chunks. */
+typedef struct hp_scan_rules_ctx_t {
+    const hp_scan_rules_t *rules;
+    hp_scan_ctx_t scan;
+    uint32_t region;
+    /* Per rule, whether its condition is already known to hold or not,
+     * and the no of rules it isn't known for yet */
+    uint8_t *rule_state;
+    uint32_t undecided;
+    /* Per string, the offset of its first match, or UINT64_MAX */
+    uint64_t *string_match;
+    /* Regexes run here, and per regex string, the DFA state it starts
+     * in, for as long as the cache isn't flushed */
+    hp_scan_dfa_t *dfa;
+    uint32_t *regex_start;
+    uint64_t dfa_flushes;
+    /* Anchors of strings running past the bytes fed so far */
+    hp_scan_pending_t *pending;
+    uint32_t pending_count;
+    /* The bytes fed right before the chunk being fed, so that strings
+     * running into it from the last ones can be checked */
+    uint8_t history[HP_SCAN_RULES_SPAN_MAX];
+    uint32_t history_len;
+    /* The chunk being fed */
+    const uint8_t *buf;
+    size_t buf_len;
+    /* Region offsets of the first byte fed since the data was last
+     * contiguous, of the chunk being fed, and right after it */
+    uint64_t stream_offset;
+    uint64_t buf_offset;
+    uint64_t next_offset;
+} hp_scan_rules_ctx_t;
+
+hp_status_t hp_scan_rules_ctx_init(hp_scan_rules_ctx_t *ctx,
+                                   const hp_scan_rules_t *rules);
+void hp_scan_rules_ctx_deinit(hp_scan_rules_ctx_t *ctx);
+
+/**
+ * Start on a region.  Conditions are evaluated right away as far as the
+ * region's attributes go, and a rule is only scanned for while its
+ * condition can still go either way.
+ *
+ * @region HP_SCAN_REGION_* attributes.
+ */
+void hp_scan_rules_ctx_begin(hp_scan_rules_ctx_t *ctx, uint32_t region);
+
+/* Feed the region's bytes from offset, in order.  A chunk that doesn't
+ * follow on from the last one, past an unreadable hole say, is scanned
+ * afresh, but what matched before still counts. */
+void hp_scan_rules_ctx_feed(hp_scan_rules_ctx_t *ctx, uint64_t offset,
+                            const uint8_t *buf, size_t buf_len);
+
+/* True once every rule is known to match the region or not, after which
+ * there is nothing to gain from feeding it more. */
+bool hp_scan_rules_ctx_decided(const hp_scan_rules_ctx_t *ctx);
+
+/**
+ * End the region, and report the rules that matched it.
+ *
+ * @retval The no of rules that matched.
+ */
+uint32_t hp_scan_rules_ctx_end(hp_scan_rules_ctx_t *ctx,
+                               hp_scan_rule_func_t rule_func,
+                               void *arg);
+
+#endif /* __SCAN_RULES__H__ */
@@ -17,260 +17,1138 @@
  * @author Anoop Saldanha
  */
 
+#define _CRT_SECURE_NO_WARNINGS
+#define HP_LOG_MODULE HP_LOG_MODULE_SCANNER
+
+#include <errno.h>
+
 #include "honeyprocs-common.h"
+#include "align.h"
+#include "avl.h"
+#include "baseline-cache.h"
+#include "proc.h"
+#include "proc-reader.h"
 #include "mmap.h"
+#include "page-hash.h"
+#include "scan-engine.h"
+#include "scan-heur.h"
+#include "scan-rules.h"
+#include "signatures.h"
 #include "status.h"
 #include "util-log.h"
+#include "util-log-binary.h"
+#include "util-pool.h"
+#include "util-scratch.h"
+#include "util-thread.h"
+#include "util-timer.h"
+
+/* The wheel granularity, and hence the resolution of poll intervals */
+#define HP_MONITOR_TICK_MS              1000
+#define HP_MONITOR_INTERVAL_MS          5000
+/* How often a config file is re-read to pick up new honeyprocs */
+#define HP_MONITOR_CONFIG_RELOAD_TICKS  5
+/* No of changed ranges reported in an alert */
+#define HP_MONITOR_MAX_DIFFS            16
+/* No of rule matches reported in an alert */
+#define HP_MONITOR_MAX_MATCHES          16
+/* New executable memory is read in batches of up to this many
+ * HP_PROC_READER_SLOT_SIZE slots */
+#define HP_SCANNER_READ_SLOTS           32
+/* Scanned per changed range at most, so a large new mapping, such as a
+ * JIT heap, can't hold up a worker */
+#define HP_SCANNER_SCAN_MAX             (16 * 1024 * 1024)
+
+typedef enum hp_check_result_t {
+    HP_CHECK_SAME = 0,
+    HP_CHECK_CHANGED,
+    HP_CHECK_FAILED,
+    HP_CHECK_EXITED,
+} hp_check_result_t;
+
+typedef struct hp_monitored_match_t {
+    /* Index into the scanner's rules */
+    uint32_t rule_id;
+    hp_mmap_addr_t addr;
+} hp_monitored_match_t;
+
+/* Heuristics over a diff that was scanned */
+typedef struct hp_monitored_score_t {
+    bool scanned;
+    uint32_t score;
+    float entropy_max;
+    float entropy_mean;
+    uint32_t prologues;
+    uint32_t getpcs;
+    uint32_t zero_blocks;
+    uint32_t block_count;
+} hp_monitored_score_t;
+
+/* A monitored honeyproc */
+typedef struct hp_monitored_t {
+    uint32_t pid;
+    hp_proc_t *proc;
+    /* The memory map taken when monitoring started */
+    hp_mmap_tree_t *mmap_base;
+    /* The memory map as of the last poll, updated in place by each poll.
+     * Shares the images of the baseline till a poll finds them changed. */
+    hp_mmap_tree_t *mmap_live;
+    /* Hashes of the code pages taken with the baseline, in content
+     * integrity mode.  NULL otherwise. */
+    hp_page_hash_t *page_hash;
+    /* The last poll failed half way, so mmap_live may not match the
+     * process even if the next poll sees no change. */
+    bool live_dirty;
+    /* Armed while waiting for the next poll */
+    hp_timer_t timer;
+    /* Queued on the pool when the poll is due */
+    hp_pool_job_t job;
+    /* The job is queued or running.  A process has at most one job in
+     * flight, so its baseline is never compared against two snapshots at
+     * once. */
+    bool busy;
+    /* Set by the job, read once it is done */
+    hp_check_result_t result;
+    /* What changed, with HP_CHECK_CHANGED.  diff_count can exceed
+     * HP_MONITOR_MAX_DIFFS, in which case only the first ones are kept. */
+    hp_mmap_diff_t diffs[HP_MONITOR_MAX_DIFFS];
+    uint32_t diff_count;
+    /* Rules matching the executable ranges among the kept diffs.  As
+     * with diffs, only the first HP_MONITOR_MAX_MATCHES are kept. */
+    hp_monitored_match_t matches[HP_MONITOR_MAX_MATCHES];
+    uint32_t match_count;
+    /* Per kept diff, the heuristics over it if it was private memory
+     * that was scanned, and the highest of their scores */
+    hp_monitored_score_t scores[HP_MONITOR_MAX_DIFFS];
+    uint32_t score_max;
+    /* Killed while busy, to be done once the job is back */
+    bool kill_pending;
+    /* An injection was detected.  The entry is kept, but no longer
+     * polled, so that a config reload doesn't re-baseline it. */
+    bool alerted;
+    /* Gone or dropped from the config.  Removed on the next reap. */
+    bool dead;
+    /* On the scanner's dead list while dead */
+    struct hp_monitored_t *dead_next;
+    /* Listed by the config file being loaded */
+    bool in_config;
+} hp_monitored_t;
+
+/* Per worker state, only ever touched by its own worker.  Maps aren't
+ * drawn from here.  Each map has an arena of its own, and the maps of a
+ * process are only touched by its one job in flight, so a job allocates
+ * from them without contention, whichever worker runs it.  An arena per
+ * worker would have a process's intervals freed by whichever worker
+ * polls it next. */
+typedef struct hp_scanner_worker_t {
+    hp_scratch_t scratch;
+    /* Process memory being scanned */
+    hp_proc_reader_t reader;
+    /* Over the scanner's rules, which are shared by all the workers */
+    hp_scan_rules_ctx_t rules;
+    hp_scan_heur_ctx_t heur;
+} hp_scanner_worker_t;
+
+/* A scan of the diffs of a process, fed in address order */
+typedef struct hp_scanner_scan_t {
+    hp_monitored_t *m;
+    hp_scan_rules_ctx_t *rules;
+    /* Fed along with the rules while the diff is private memory, which
+     * is where payloads are written - mapped and image memory have a file
+     * behind them to be looked at instead */
+    hp_scan_heur_ctx_t *heur;
+    bool heur_on;
+    /* The diff being scanned, NULL before the first, and the address its
+     * scan stops at */
+    const hp_mmap_diff_t *diff;
+    hp_mmap_addr_t end;
+} hp_scanner_scan_t;
 
-typedef struct hp_char_buf_t {
-    char buf[1024];
+typedef struct hp_scanner_t {
+    /* hp_monitored_t entries keyed by pid */
+    hp_avl_t *registry;
+    hp_timer_wheel_t wheel;
+    hp_pool_t *pool;
+    uint32_t worker_count;
+    hp_scanner_worker_t *workers;
+    hp_signature_set_t signatures;
+    /* Used by the main thread to take baselines */
+    hp_scratch_t scratch;
+    hp_proc_reader_t reader;
+    /* Hash the code pages of each process, and re-hash them on a poll
+     * that finds the map unchanged */
+    bool integrity;
+    uint32_t interval_ms;
+    /* NULL when the pids come from the command line */
+    const char *config_path;
+    /* Where baselines are saved, and loaded from on a restart.  NULL to
+     * take them afresh every time. */
+    const char *baseline_dir;
+    /* Image backed intervals shared by the baselines */
+    hp_baseline_cache_t baselines;
+    /* Entries neither dead nor alerted */
+    uint32_t active_count;
+    /* Entries waiting to be reaped.  They can't be removed from the
+     * registry straight away, as they die during registry walks. */
+    hp_monitored_t *dead_list;
+} hp_scanner_t;
+
+static void hp_alert(hp_scanner_t *scanner, hp_monitored_t *m)
+{
+    char buf[2048];
+    hp_mmap_diff_t *diff;
     uint32_t len;
-} hp_char_buf_t;
+    uint32_t i;
+    int r;
+
+    r = _snprintf_s(buf, sizeof(buf), _TRUNCATE,
+                    "INJECTION DETECTED in pid %u.  %u changed range(s), "
+                    "%u rule match(es), score %u.\n",
+                    m->pid, m->diff_count, m->match_count, m->score_max);
+    len = (r > 0 && (uint32_t)r < sizeof(buf)) ? r : 0;
+    for (i = 0; i < m->diff_count && i < HP_MONITOR_MAX_DIFFS; i++) {
+        diff = &m->diffs[i];
+        r = _snprintf_s(buf + len, sizeof(buf) - len, _TRUNCATE,
+                        "%s %" PRIx64 "-%" PRIx64 " state(%x->%x) "
+                        "protect(%x->%x) type(%x->%x)\n",
+                        hp_mmap_diff_kind_to_string(diff->kind),
+                        (uint64_t)diff->start_addr, (uint64_t)diff->end_addr,
+                        diff->old_state, diff->new_state,
+                        diff->old_protect, diff->new_protect,
+                        diff->old_type, diff->new_type);
+        if (r <= 0 || (uint32_t)r >= sizeof(buf) - len)
+            break;
+        len += r;
+        if (!m->scores[i].scanned)
+            continue;
+        r = _snprintf_s(buf + len, sizeof(buf) - len, _TRUNCATE,
+                        "  score %u entropy(max %.2f mean %.2f) "
+                        "getpc %u prologue %u zero pages %u/%u\n",
+                        m->scores[i].score, m->scores[i].entropy_max,
+                        m->scores[i].entropy_mean, m->scores[i].getpcs,
+                        m->scores[i].prologues, m->scores[i].zero_blocks,
+                        m->scores[i].block_count);
+        if (r <= 0 || (uint32_t)r >= sizeof(buf) - len)
+            break;
+        len += r;
+    }
+    for (i = 0; i < m->match_count && i < HP_MONITOR_MAX_MATCHES; i++) {
+        r = _snprintf_s(buf + len, sizeof(buf) - len, _TRUNCATE,
+                        "MATCH %s at %" PRIx64 "\n",
+                        scanner->signatures.rules->rules[
+                            m->matches[i].rule_id].name,
+                        (uint64_t)m->matches[i].addr);
+        if (r <= 0 || (uint32_t)r >= sizeof(buf) - len)
+            break;
+        len += r;
+    }
 
-static void hp_char_buf_reset(hp_char_buf_t *cbuf)
+#ifdef WINDOWS
+    MessageBox(NULL, buf, "HoneyProc Alert", MB_OK);
+#else
+    printf("HoneyProc Alert: %s", buf);
+    fflush(stdout);
+#endif
+
+    return;
+}
+
+static int hp_monitored_cmp(void *m1_, void *m2_)
+{
+    hp_monitored_t *m1 = (hp_monitored_t *)m1_;
+    hp_monitored_t *m2 = (hp_monitored_t *)m2_;
+
+    if (m1->pid < m2->pid)
+        return -1;
+    if (m1->pid > m2->pid)
+        return 1;
+
+    return 0;
+}
+
+static void hp_monitored_free(hp_monitored_t *m)
 {
-    memset(cbuf, 0, sizeof(*cbuf));
+    hp_timer_del(&m->timer);
+    if (m->mmap_base != NULL)
+        hp_mmap_deinit(m->mmap_base);
+    if (m->mmap_live != NULL)
+        hp_mmap_deinit(m->mmap_live);
+    if (m->page_hash != NULL)
+        hp_page_hash_deinit(m->page_hash);
+    if (m->proc != NULL)
+        hp_proc_close(m->proc);
+    free(m);
 
     return;
 }
 
-static hp_status_t hp_write_to_char_buf(hp_char_buf_t *cbuf,
-                                        char *val)
+static void hp_monitored_kill(hp_scanner_t *scanner, hp_monitored_t *m)
 {
-    hp_status_t status;
+    if (m->dead)
+        return;
+
+    if (m->busy) {
+        m->kill_pending = true;
+        return;
+    }
+
+    hp_timer_del(&m->timer);
+    if (!m->alerted)
+        scanner->active_count--;
+    m->dead = true;
+    m->dead_next = scanner->dead_list;
+    scanner->dead_list = m;
+
+    return;
+}
+
+/**
+ * Whether an alerted entry's process is still the one it alerted on.
+ * The entry isn't polled any more, so nothing else would notice the
+ * process exit, or its pid go to a new process, which is then never
+ * monitored.  A process the backend can't tell apart, or can't open
+ * afresh, is taken to be the same, as dropping the entry would have the
+ * next config reload baseline a process that was injected into.
+ */
+static bool hp_monitored_same(hp_monitored_t *m)
+{
+    hp_proc_t *proc;
+    bool same;
+
+    if (!hp_proc_alive(m->proc))
+        return false;
+    if (hp_proc_identity(m->proc) == 0 ||
+        hp_proc_open(m->pid, 0, &proc) != HP_STATUS_OK)
+    {
+        return true;
+    }
+    same = (hp_proc_identity(proc) == 0 ||
+            hp_proc_identity(proc) == hp_proc_identity(m->proc));
+    hp_proc_close(proc);
+
+    return same;
+}
+
+/**
+ * Take the baseline of a process, or load the one an earlier run saved
+ * for it.  A saved baseline is only used for the very process it was
+ * taken of, so a restart doesn't trust whatever state the process is in
+ * by now, and a new baseline is saved for the next run.
+ */
+static hp_status_t hp_scanner_baseline(hp_scanner_t *scanner,
+                                       hp_monitored_t *m)
+{
+    char path[1024];
+    uint64_t identity;
+    uint64_t tag;
     int r;
+    hp_status_t status;
 
-    if (cbuf->len == sizeof(cbuf->buf)) {
-        status = HP_STATUS_ERROR;
-        goto return_status;
+    path[0] = '\0';
+    identity = hp_proc_identity(m->proc);
+    if (scanner->baseline_dir != NULL && identity != 0) {
+        r = _snprintf_s(path, sizeof(path), _TRUNCATE, "%s/%u.map",
+                        scanner->baseline_dir, m->pid);
+        if (r <= 0 || (size_t)r >= sizeof(path))
+            path[0] = '\0';
+    }
+
+    if (path[0] != '\0' &&
+        hp_mmap_load(&m->mmap_base, path, &tag) == HP_STATUS_OK)
+    {
+        if (tag == identity) {
+            hp_log_info("Loaded the baseline of pid %u from \"%s\".",
+                        m->pid, path);
+            status = HP_STATUS_OK;
+            goto return_status;
+        }
+        hp_log_info("\"%s\" is the baseline of an earlier process with "
+                    "pid %u.", path, m->pid);
+        hp_mmap_deinit(m->mmap_base);
+        m->mmap_base = NULL;
     }
 
-    r = _snprintf_s(cbuf->buf + cbuf->len, sizeof(cbuf->buf) - cbuf->len,
-                    _TRUNCATE, "%s", val);
-    if (r <= 0) {
+    if (hp_mmap_init(&m->mmap_base) != HP_STATUS_OK ||
+        hp_get_mmap(m->proc, &scanner->scratch,
+                    m->mmap_base, NULL) != HP_STATUS_OK)
+    {
         status = HP_STATUS_ERROR;
         goto return_status;
     }
-    BUG_ON(r > (sizeof(cbuf->buf) - cbuf->len));
-    cbuf->len += r;
+
+    /* Decoys of the same build map the same images.  Those are kept once,
+     * and shared.  A baseline that can't be shared is used as is.  Loaded
+     * ones are left in their files. */
+    hp_baseline_cache_share(&scanner->baselines, m->mmap_base);
+
+    /* Monitoring goes on without it, only the next run baselines afresh. */
+    if (path[0] != '\0' &&
+        hp_mmap_save(m->mmap_base, path, identity) != HP_STATUS_OK)
+    {
+        hp_log_warning("Unable to save the baseline of pid %u.", m->pid);
+    }
 
     status = HP_STATUS_OK;
  return_status:
     return status;
 }
 
-
-static hp_status_t hp_get_process_handle(DWORD pid, LPHANDLE lph)
+/**
+ * Start monitoring a process, unless it is already monitored.  The
+ * baseline is taken, or loaded, right away and the first poll is due
+ * after delay_ms.
+ */
+static hp_status_t hp_scanner_add_pid(hp_scanner_t *scanner,
+                                      uint32_t pid,
+                                      uint32_t delay_ms)
 {
+    hp_monitored_t key;
+    hp_monitored_t *m;
+    hp_monitored_t *m_existing;
     hp_status_t status;
 
-    *lph = OpenProcess(PROCESS_VM_READ |
-                       PROCESS_VM_OPERATION |
-                       PROCESS_QUERY_INFORMATION,
-                       FALSE, pid);
-    if (*lph == NULL) {
-        hp_log_error("OpenProcess(PROCESS_VM_READ | PROCESS_QUERY_INFORMATION) "
-                     "failed for process with pid(%lu).  Error Code(%u).",
-                     pid, GetLastError());
+    key.pid = pid;
+    if ((m = (hp_monitored_t *)hp_avl_get(scanner->registry, &key)) != NULL) {
+        m->in_config = true;
+        status = HP_STATUS_OK;
+        goto return_status;
+    }
+
+    if ((m = (hp_monitored_t *)malloc(sizeof(*m))) == NULL) {
+        hp_log_error("malloc() failure.");
+        status = HP_STATUS_ERROR;
+        goto return_status;
+    }
+    memset(m, 0, sizeof(*m));
+    m->pid = pid;
+    m->in_config = true;
+    hp_timer_init(&m->timer, m);
+    m->job.data = m;
+
+    if (hp_proc_open(pid, 0, &m->proc) != HP_STATUS_OK ||
+        hp_scanner_baseline(scanner, m) != HP_STATUS_OK ||
+        hp_mmap_init(&m->mmap_live) != HP_STATUS_OK ||
+        hp_mmap_copy(m->mmap_live, m->mmap_base) != HP_STATUS_OK)
+    {
+        hp_log_error("Unable to baseline pid %u.", pid);
+        hp_monitored_free(m);
+        status = HP_STATUS_ERROR;
+        goto return_status;
+    }
+
+    if (scanner->integrity &&
+        (hp_page_hash_init(&m->page_hash) != HP_STATUS_OK ||
+         hp_page_hash_build(m->page_hash, m->mmap_base, m->proc,
+                            &scanner->reader) != HP_STATUS_OK))
+    {
+        hp_log_error("Unable to hash the pages of pid %u.", pid);
+        hp_monitored_free(m);
         status = HP_STATUS_ERROR;
         goto return_status;
     }
-    hp_log_debug("OpenProcess(PROCESS_VM_READ | PROCESS_QUERY_INFORMATION) "
-                 "succeeded for process with pid(%lu) and got handle(0x%x).",
-                 pid, *lph);
+
+    if (hp_avl_add_entry(scanner->registry, m,
+                         (void **)&m_existing) != HP_STATUS_OK)
+    {
+        hp_monitored_free(m);
+        status = HP_STATUS_ERROR;
+        goto return_status;
+    }
+
+    hp_timer_add(&scanner->wheel, &m->timer, delay_ms);
+    scanner->active_count++;
+    hp_log_debug("Monitoring pid %u.", pid);
 
     status = HP_STATUS_OK;
  return_status:
     return status;
 }
 
-static void hp_minfo_to_string(MEMORY_BASIC_INFORMATION *minfo,
-                               hp_char_buf_t *cbuf)
+static void hp_scanner_match(uint32_t rule_id, uint64_t offset, void *scan_)
 {
-    int r;
+    hp_scanner_scan_t *scan = (hp_scanner_scan_t *)scan_;
+    hp_monitored_t *m = scan->m;
 
-    switch (minfo->State) {
-        case MEM_COMMIT:
-            hp_write_to_char_buf(cbuf, "COMMIT,");
-            break;
-        case MEM_FREE:
-            hp_write_to_char_buf(cbuf, "FREE,");
-            goto return_status;
-        case MEM_RESERVE:
-            hp_write_to_char_buf(cbuf, "RESERVE,");
-            break;
+    if (m->match_count < HP_MONITOR_MAX_MATCHES) {
+        m->matches[m->match_count].rule_id = rule_id;
+        m->matches[m->match_count].addr = scan->diff->start_addr + offset;
     }
+    m->match_count++;
 
-    switch (minfo->Type) {
-        case MEM_IMAGE:
-            hp_write_to_char_buf(cbuf, "IMAGE,");
-            break;
-        case MEM_MAPPED:
-            hp_write_to_char_buf(cbuf, "MAPPED,");
-            break;
-        case MEM_PRIVATE:
-            hp_write_to_char_buf(cbuf, "PRIVATE,");
-            break;
-        default:
-            BUG_ON(1);
+    return;
+}
+
+/* What a diff's range now is, for the rules' region conditions */
+static uint32_t hp_scanner_region(const hp_mmap_diff_t *diff)
+{
+    uint32_t region = 0;
+
+    if (diff->new_type == HP_MMAP_TYPE_PRIVATE)
+        region |= HP_SCAN_REGION_PRIVATE;
+    else if (diff->new_type == HP_MMAP_TYPE_MAPPED)
+        region |= HP_SCAN_REGION_MAPPED;
+    else if (diff->new_type == HP_MMAP_TYPE_IMAGE)
+        region |= HP_SCAN_REGION_IMAGE;
+
+    if (diff->new_protect & (HP_MMAP_PROT_READONLY |
+                             HP_MMAP_PROT_READWRITE |
+                             HP_MMAP_PROT_WRITECOPY |
+                             HP_MMAP_PROT_EXECUTE_READ |
+                             HP_MMAP_PROT_EXECUTE_READWRITE |
+                             HP_MMAP_PROT_EXECUTE_WRITECOPY))
+    {
+        region |= HP_SCAN_REGION_READ;
     }
+    if (diff->new_protect & (HP_MMAP_PROT_READWRITE |
+                             HP_MMAP_PROT_WRITECOPY |
+                             HP_MMAP_PROT_EXECUTE_READWRITE |
+                             HP_MMAP_PROT_EXECUTE_WRITECOPY))
+    {
+        region |= HP_SCAN_REGION_WRITE;
+    }
+    if (diff->new_protect & HP_MMAP_PROT_EXECUTE_ANY)
+        region |= HP_SCAN_REGION_EXECUTE;
 
-    switch (minfo->Protect) {
-        case PAGE_EXECUTE:
-            hp_write_to_char_buf(cbuf, "PAGE_EXECUTE,");
-            break;
-        case PAGE_EXECUTE_READ:
-            hp_write_to_char_buf(cbuf, "PAGE_EXECUTE_READ,");
-            break;
-        case PAGE_EXECUTE_READWRITE:
-            hp_write_to_char_buf(cbuf, "PAGE_EXECUTE_READWRITE,");
-            break;
-        case PAGE_EXECUTE_WRITECOPY:
-            hp_write_to_char_buf(cbuf, "PAGE_EXECUTE_WRITECOPY,");
-            break;
-        case PAGE_NOACCESS:
-            hp_write_to_char_buf(cbuf, "PAGENOACCESS,");
-            break;
-        case PAGE_READONLY:
-            hp_write_to_char_buf(cbuf, "PAGE_READONLY,");
-            break;
-        case PAGE_READWRITE:
-            hp_write_to_char_buf(cbuf, "PAGE_READWRITE,");
-            break;
-        case PAGE_WRITECOPY:
-            hp_write_to_char_buf(cbuf, "PAGE_WRITECOPY,");
-            break;
-#if 0
-        case PAGE_TARGETS_INVALID:
-            hp_write_to_char_buf(cbuf, "PAGE_TARGETS_INVALID,");
+    return region;
+}
+
+/* Whether a diff is scanned, and where its scan stops */
+static bool hp_scanner_scan_range(const hp_mmap_diff_t *diff,
+                                  hp_mmap_addr_t *end)
+{
+    if (diff->kind == HP_MMAP_DIFF_REMOVED ||
+        (diff->new_protect & HP_MMAP_PROT_EXECUTE_ANY) == 0)
+    {
+        return false;
+    }
+
+    *end = diff->end_addr;
+    if (*end - diff->start_addr > HP_SCANNER_SCAN_MAX)
+        *end = diff->start_addr + HP_SCANNER_SCAN_MAX;
+
+    return true;
+}
+
+/* Done with the diff being scanned, if any. */
+static void hp_scanner_scan_end(hp_scanner_scan_t *scan)
+{
+    hp_monitored_t *m = scan->m;
+    hp_monitored_score_t *score;
+    const hp_scan_heur_t *heur;
+
+    if (scan->diff != NULL)
+        hp_scan_rules_ctx_end(scan->rules, hp_scanner_match, scan);
+
+    if (scan->diff != NULL && scan->heur_on) {
+        heur = hp_scan_heur_ctx_end(scan->heur);
+        score = &m->scores[scan->diff - m->diffs];
+        score->scanned = true;
+        score->score = heur->score;
+        score->entropy_max = heur->entropy_max;
+        score->entropy_mean = heur->entropy_mean;
+        score->prologues = heur->prologues;
+        score->getpcs = heur->getpcs;
+        score->zero_blocks = heur->zero_blocks;
+        score->block_count = heur->block_count;
+        if (heur->score > m->score_max)
+            m->score_max = heur->score;
+    }
+    scan->diff = NULL;
+
+    return;
+}
+
+static void hp_scanner_scan_feed(hp_scanner_scan_t *scan,
+                                 hp_mmap_addr_t addr,
+                                 const uint8_t *buf, size_t len)
+{
+    hp_monitored_t *m = scan->m;
+    const hp_mmap_diff_t *diff;
+    hp_mmap_addr_t end = 0;
+    uint32_t region;
+
+    /* Reads are queued a diff at a time, in address order, so memory
+     * past the end of the diff being scanned is from one of the next
+     * ones. */
+    if (scan->diff == NULL || addr >= scan->end) {
+        diff = (scan->diff != NULL) ? (scan->diff + 1) : m->diffs;
+        hp_scanner_scan_end(scan);
+        for (; diff < m->diffs + m->diff_count &&
+                 diff < m->diffs + HP_MONITOR_MAX_DIFFS; diff++)
+        {
+            if (hp_scanner_scan_range(diff, &end) && addr < end)
+                break;
+        }
+        BUG_ON(diff == m->diffs + m->diff_count ||
+               diff == m->diffs + HP_MONITOR_MAX_DIFFS);
+        scan->diff = diff;
+        scan->end = end;
+        region = hp_scanner_region(diff);
+        hp_scan_rules_ctx_begin(scan->rules, region);
+        scan->heur_on = (region & HP_SCAN_REGION_PRIVATE) != 0;
+        if (scan->heur_on)
+            hp_scan_heur_ctx_begin(scan->heur);
+    }
+
+    hp_scan_rules_ctx_feed(scan->rules, addr - scan->diff->start_addr,
+                           buf, len);
+    if (scan->heur_on) {
+        hp_scan_heur_ctx_feed(scan->heur, addr - scan->diff->start_addr,
+                              buf, len);
+    }
+
+    return;
+}
+
+/* Whether the rest of the diff being scanned needn't be read - the rules
+ * are settled for it, and it isn't memory the heuristics look at. */
+static bool hp_scanner_scan_settled(const hp_scanner_scan_t *scan)
+{
+    return (scan->diff != NULL && !scan->heur_on &&
+            hp_scan_rules_ctx_decided(scan->rules));
+}
+
+/* Read the queued ranges and scan them, skipping unreadable pages. */
+static void hp_scanner_scan_flush(hp_scanner_scan_t *scan,
+                                  hp_scanner_worker_t *worker)
+{
+    hp_proc_reader_t *reader = &worker->reader;
+    hp_proc_read_t *read;
+    size_t offset;
+    size_t run;
+    uint32_t i;
+
+    hp_proc_reader_run(reader, scan->m->proc);
+
+    for (i = 0; i < reader->read_count; i++) {
+        read = &reader->reads[i];
+        for (offset = 0; offset < read->len; offset += run) {
+            run = HP_MMAP_PAGE_SIZE;
+            if (read->unread & ((uint64_t)1 << (offset / HP_MMAP_PAGE_SIZE)))
+                continue;
+            while (offset + run < read->len &&
+                   !(read->unread &
+                     ((uint64_t)1 << ((offset + run) / HP_MMAP_PAGE_SIZE))))
+            {
+                run += HP_MMAP_PAGE_SIZE;
+            }
+            hp_scanner_scan_feed(scan, read->addr + offset,
+                                 read->buf + offset, run);
+        }
+    }
+
+    hp_proc_reader_reset(reader);
+
+    return;
+}
+
+/* Scan the memory that turned executable, each diff being a region to
+ * the rules.  Only the kept diffs are looked at, so what is read is
+ * bounded by what changed, and it is read in as few batches as the
+ * reader's pool allows.  Once a diff is settled, the rest of it isn't
+ * read. */
+static void hp_scanner_scan_diffs(hp_monitored_t *m,
+                                  hp_scanner_worker_t *worker)
+{
+    hp_scanner_scan_t scan;
+    hp_mmap_diff_t *diff;
+    hp_mmap_addr_t addr;
+    hp_mmap_addr_t end;
+    size_t queued;
+    uint32_t i;
+
+    m->match_count = 0;
+    memset(m->scores, 0, sizeof(m->scores));
+    m->score_max = 0;
+
+    scan.m = m;
+    scan.rules = &worker->rules;
+    scan.heur = &worker->heur;
+    scan.heur_on = false;
+    scan.diff = NULL;
+    scan.end = 0;
+
+    for (i = 0; i < m->diff_count && i < HP_MONITOR_MAX_DIFFS; i++) {
+        diff = &m->diffs[i];
+        if (!hp_scanner_scan_range(diff, &end))
+            continue;
+
+        for (addr = diff->start_addr; addr < end; addr += queued) {
+            queued = hp_proc_reader_add(&worker->reader, addr, end - addr);
+            if (queued != 0)
+                continue;
+            hp_scanner_scan_flush(&scan, worker);
+            if (scan.diff == diff && hp_scanner_scan_settled(&scan))
+                break;
+        }
+    }
+    hp_scanner_scan_flush(&scan, worker);
+    hp_scanner_scan_end(&scan);
+
+    return;
+}
+
+/* Pool job - bring the live map up to date and, if it changed, compare
+ * it with the baseline, or else compare the page hashes if there are
+ * any.  What turned executable or was modified is then scanned.  An
+ * unchanged process costs no allocation. */
+static void hp_scanner_check(void *m_, void *worker_)
+{
+    hp_monitored_t *m = (hp_monitored_t *)m_;
+    hp_scanner_worker_t *worker = (hp_scanner_worker_t *)worker_;
+    bool changed;
+
+    if (hp_get_mmap(m->proc, &worker->scratch,
+                    m->mmap_live, &changed) != HP_STATUS_OK)
+    {
+        m->live_dirty = true;
+        m->result = hp_proc_alive(m->proc) ? HP_CHECK_FAILED : HP_CHECK_EXITED;
+        goto return_status;
+    }
+
+    /* Polls are only rescheduled while the live map matches the baseline,
+     * so an unchanged live map still does. */
+    m->diff_count = 0;
+    if (changed || m->live_dirty) {
+        m->live_dirty = false;
+        m->diff_count = hp_mmap_diff(m->mmap_base, m->mmap_live,
+                                     m->diffs, HP_MONITOR_MAX_DIFFS, 0);
+    }
+
+    /* Code patched in place leaves the map as it was */
+    if (m->diff_count == 0 && m->page_hash != NULL &&
+        hp_page_hash_diff(m->page_hash, m->proc, &worker->reader,
+                          m->diffs, HP_MONITOR_MAX_DIFFS,
+                          &m->diff_count) != HP_STATUS_OK)
+    {
+        m->result = hp_proc_alive(m->proc) ? HP_CHECK_FAILED : HP_CHECK_EXITED;
+        goto return_status;
+    }
+
+    m->result = (m->diff_count != 0) ? HP_CHECK_CHANGED : HP_CHECK_SAME;
+    if (m->result == HP_CHECK_CHANGED)
+        hp_scanner_scan_diffs(m, worker);
+
+ return_status:
+    return;
+}
+
+/* Timer expiry - hand the poll to the pool. */
+static void hp_scanner_poll(void *m_, void *scanner_)
+{
+    hp_monitored_t *m = (hp_monitored_t *)m_;
+    hp_scanner_t *scanner = (hp_scanner_t *)scanner_;
+
+    m->busy = true;
+    hp_pool_submit(scanner->pool, &m->job);
+
+    return;
+}
+
+/* Act on the result of a finished pool job. */
+static void hp_scanner_complete(hp_scanner_t *scanner, hp_monitored_t *m)
+{
+    m->busy = false;
+
+    if (m->kill_pending) {
+        hp_monitored_kill(scanner, m);
+        goto return_status;
+    }
+
+    switch (m->result) {
+        case HP_CHECK_EXITED:
+            hp_log_info("pid %u exited.  Dropping it.", m->pid);
+            hp_monitored_kill(scanner, m);
+            goto return_status;
+        case HP_CHECK_CHANGED:
+            hp_alert(scanner, m);
+            m->alerted = true;
+            scanner->active_count--;
+            goto return_status;
+        case HP_CHECK_FAILED:
+            hp_log_error("Failed to snapshot pid %u.", m->pid);
             break;
-        case PAGE_TARGETS_NO_UPDATE:
-            hp_write_to_char_buf(cbuf, "PAGE_TARGETS_NO_UPDATE,");
+        case HP_CHECK_SAME:
+            hp_log_debug("MMAPS SAME for pid %u.", m->pid);
             break;
-#endif
     }
 
+    hp_timer_add(&scanner->wheel, &m->timer, scanner->interval_ms);
+
  return_status:
     return;
 }
 
-hp_status_t hp_get_mmap(HANDLE ph, hp_mmap_tree_t **mmap_tree_)
+/* Registry walk - drop alerted entries whose process is gone. */
+static void hp_scanner_alerted_sweep(void *m_, void *scanner_)
 {
-    hp_mmap_tree_t *mmap_tree = NULL;
-    MEMORY_BASIC_INFORMATION minfo;
-    DWORD base_address;
-    DWORD offset;
-    DWORD size;
-    hp_char_buf_t cbuf;
-    uint32_t a;
-    hp_status_t status;
+    hp_monitored_t *m = (hp_monitored_t *)m_;
 
-    *mmap_tree_ = NULL;
+    if (m->alerted && !m->dead && !hp_monitored_same(m)) {
+        hp_log_info("Alerted pid %u exited.  Dropping it.", m->pid);
+        hp_monitored_kill((hp_scanner_t *)scanner_, m);
+    }
 
-    base_address = 0x00000000;
-    offset = 0;
-    size = 0x7FFFFFFF;
-    mmap_tree = NULL;
+    return;
+}
 
-    if (hp_mmap_init(&mmap_tree) != HP_STATUS_OK) {
-        status = HP_STATUS_ERROR;
-        goto return_status;
+/* Drop the dead entries. */
+static void hp_scanner_reap(hp_scanner_t *scanner)
+{
+    hp_monitored_t *m;
+
+    if (scanner->dead_list == NULL)
+        return;
+
+    while ((m = scanner->dead_list) != NULL) {
+        scanner->dead_list = m->dead_next;
+        hp_avl_remove(scanner->registry, m);
+        hp_monitored_free(m);
     }
+    hp_baseline_cache_trim(&scanner->baselines);
 
-    while (offset < size) {
-        hp_char_buf_reset(&cbuf);
+    return;
+}
 
-        minfo.BaseAddress = (PVOID)base_address;
+static void hp_scanner_config_unmark(void *m_, void *arg)
+{
+    ((hp_monitored_t *)m_)->in_config = false;
 
-        /* Get information for the immediate page. */
-        if (VirtualQueryEx(ph,
-                           minfo.BaseAddress,
-                           &minfo, sizeof(minfo)) == FALSE)
-        {
-            hp_log_error("VirtualQueryEx() failed to obtain permissions for "
-                         "region starting at base(0x%x).  Error Code(%u).",
-                         base_address, GetLastError());
-            break;
-        }
+    return;
+}
 
-        hp_minfo_to_string(&minfo, &cbuf);
-        //printf("%x %x - %s\n", minfo.BaseAddress, minfo.RegionSize, cbuf.buf);
-        //fflush(stdout);
-        if (minfo.State != MEM_FREE) {
-            for (a = 0; a < minfo.RegionSize; a += HP_MMAP_PAGE_SIZE) {
-                hp_mmap_track_memory(mmap_tree,
-                                     (uint32_t)minfo.BaseAddress + a,
-                                     minfo.State,
-                                     minfo.Protect,
-                                     minfo.Type);
-            }
-        }
+static void hp_scanner_config_sweep(void *m_, void *scanner_)
+{
+    hp_monitored_t *m = (hp_monitored_t *)m_;
+
+    if (!m->in_config) {
+        hp_log_info("pid %u dropped from the config.", m->pid);
+        hp_monitored_kill((hp_scanner_t *)scanner_, m);
+    }
+
+    return;
+}
+
+/**
+ * Parse a pid or a count - a decimal no of 1 to UINT32_MAX, with nothing
+ * after it but white space.
+ */
+static hp_status_t hp_scanner_parse_u32(const char *str, uint32_t *val)
+{
+    unsigned long v;
+    char *end;
+
+    if (*str < '0' || *str > '9')
+        return HP_STATUS_ERROR;
+    errno = 0;
+    v = strtoul(str, &end, 10);
+    while (*end == ' ' || *end == '\t' || *end == '\r' || *end == '\n')
+        end++;
+    if (errno != 0 || *end != '\0' || v == 0 || (uint64_t)v > UINT32_MAX)
+        return HP_STATUS_ERROR;
+    *val = (uint32_t)v;
+
+    return HP_STATUS_OK;
+}
+
+/**
+ * Sync the registry with the config file - one pid per line, with '#'
+ * starting a comment.  New pids are baselined and polled, and pids no
+ * longer listed are dropped.
+ */
+static hp_status_t hp_scanner_load_config(hp_scanner_t *scanner)
+{
+    FILE *fp;
+    char line[256];
+    char *p;
+    uint32_t pid;
+    hp_status_t status;
+
+    if ((fp = fopen(scanner->config_path, "r")) == NULL) {
+        hp_log_error("Error opening config file \"%s\".",
+                     scanner->config_path);
+        status = HP_STATUS_ERROR;
+        goto return_status;
+    }
+
+    hp_avl_parse(scanner->registry, hp_scanner_config_unmark, NULL);
 
-        base_address += minfo.RegionSize;
-        offset += minfo.RegionSize;
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        if ((p = strchr(line, '#')) != NULL)
+            *p = '\0';
+        line[strcspn(line, "\r\n")] = '\0';
+        for (p = line; *p == ' ' || *p == '\t'; p++)
+            ;
+        if (*p == '\0')
+            continue;
+        if (hp_scanner_parse_u32(p, &pid) != HP_STATUS_OK) {
+            hp_log_warning("Ignoring \"%s\" in \"%s\", not a pid.", p,
+                           scanner->config_path);
+            continue;
+        }
+        hp_scanner_add_pid(scanner, pid, scanner->interval_ms);
     }
+    fclose(fp);
 
-    *mmap_tree_ = mmap_tree;
+    hp_avl_parse(scanner->registry, hp_scanner_config_sweep, scanner);
 
     status = HP_STATUS_OK;
  return_status:
     return status;
 }
 
-hp_status_t hp_monitor(uint32_t pid)
+hp_status_t hp_monitor(hp_scanner_t *scanner)
 {
-    hp_mmap_tree_t *mmap_base, *mmap_tmp;
-    HANDLE ph;
-    hp_status_t status;
+    hp_pool_job_t *job;
 
-    hp_log_debug("Monitoring pid %lu.", pid);
+    while (scanner->active_count > 0 || scanner->config_path != NULL) {
+        hp_sleep_ms(scanner->wheel.tick_ms);
+        hp_timer_wheel_advance(&scanner->wheel, hp_scanner_poll, scanner);
 
-    if (hp_get_process_handle(pid, &ph) != HP_STATUS_OK) {
-        status = HP_STATUS_ERROR;
-        goto return_status;
+        while ((job = hp_pool_get_done(scanner->pool)) != NULL)
+            hp_scanner_complete(scanner, (hp_monitored_t *)job->data);
+
+        /* Alerted entries are reaped first, so that a pid gone to a new
+         * process is baselined afresh by the same reload. */
+        if ((scanner->wheel.tick % HP_MONITOR_CONFIG_RELOAD_TICKS) == 0) {
+            hp_avl_parse(scanner->registry, hp_scanner_alerted_sweep,
+                         scanner);
+            hp_scanner_reap(scanner);
+            if (scanner->config_path != NULL)
+                hp_scanner_load_config(scanner);
+        }
+
+        hp_scanner_reap(scanner);
     }
 
-    if (hp_get_mmap(ph, &mmap_base) != HP_STATUS_OK) {
+    return HP_STATUS_OK;
+}
+
+static void hp_scanner_free_(void *m_, void *arg)
+{
+    hp_monitored_free((hp_monitored_t *)m_);
+
+    return;
+}
+
+static hp_status_t hp_scanner_start_workers(hp_scanner_t *scanner)
+{
+    void **worker_data = NULL;
+    uint32_t i;
+    hp_status_t status;
+
+    scanner->workers = (hp_scanner_worker_t *)
+        malloc(sizeof(*scanner->workers) * scanner->worker_count);
+    worker_data = (void **)malloc(sizeof(*worker_data) *
+                                  scanner->worker_count);
+    if (scanner->workers == NULL || worker_data == NULL) {
+        hp_log_error("malloc() failure.");
         status = HP_STATUS_ERROR;
         goto return_status;
     }
+    memset(scanner->workers, 0,
+           sizeof(*scanner->workers) * scanner->worker_count);
 
-    //hp_mmap_print(mmap_base);
-    //exit(0);
-
-    while (1) {
-        Sleep(5000);
-        hp_get_mmap(ph, &mmap_tmp);
-        if (!hp_are_mmaps_same(mmap_base, mmap_tmp)) {
-            //hp_log_emergency("<<<<<<<<<< INJECTION DETECTED >>>>>>>>>>>>");
-            MessageBox(NULL, "INJECTION DETECTED", "HoneyProc Alert", MB_OK);
-            break;
-        } else {
-            hp_log_debug("MMAPS SAME");
+    for (i = 0; i < scanner->worker_count; i++) {
+        if (hp_proc_reader_init(&scanner->workers[i].reader,
+                                HP_SCANNER_READ_SLOTS) != HP_STATUS_OK)
+        {
+            status = HP_STATUS_ERROR;
+            goto return_status;
+        }
+        if (hp_scan_rules_ctx_init(&scanner->workers[i].rules,
+                                   scanner->signatures.rules) != HP_STATUS_OK)
+        {
+            status = HP_STATUS_ERROR;
+            goto return_status;
+        }
+        if (hp_scan_heur_ctx_init(&scanner->workers[i].heur) != HP_STATUS_OK) {
+            status = HP_STATUS_ERROR;
+            goto return_status;
         }
-        hp_mmap_deinit(mmap_tmp);
+        worker_data[i] = &scanner->workers[i];
+    }
+
+    if (hp_pool_init(&scanner->pool, scanner->worker_count,
+                     hp_scanner_check, worker_data) != HP_STATUS_OK)
+    {
+        status = HP_STATUS_ERROR;
+        goto return_status;
     }
 
     status = HP_STATUS_OK;
  return_status:
+    free(worker_data);
     return status;
 }
 
+static void hp_scanner_stop_workers(hp_scanner_t *scanner)
+{
+    uint32_t i;
+
+    if (scanner->pool != NULL)
+        hp_pool_deinit(scanner->pool);
+
+    for (i = 0; i < scanner->worker_count; i++) {
+        hp_scratch_free(&scanner->workers[i].scratch);
+        hp_proc_reader_deinit(&scanner->workers[i].reader);
+        hp_scan_rules_ctx_deinit(&scanner->workers[i].rules);
+        hp_scan_heur_ctx_deinit(&scanner->workers[i].heur);
+    }
+    free(scanner->workers);
+
+    return;
+}
+
 void hp_print_usage()
 {
-    printf("scanner.exe <pid_of_honeyproc_to_monitor>\n");
+    printf("scanner.exe [-w <workers>] [-s <signature_file>] [-i] "
+           "[-l <log_level>] [-b <binary_log_file>]\n"
+           "            [-d <baseline_dir>] "
+           "<pid_of_honeyproc_to_monitor> [<pid> ...]\n");
+    printf("scanner.exe [-w <workers>] [-s <signature_file>] [-i] "
+           "[-l <log_level>] [-b <binary_log_file>]\n"
+           "            [-d <baseline_dir>] "
+           "-c <config_file_with_a_pid_per_line>\n");
+    printf("  -w  No of snapshot threads.  Defaults to the no of CPUs.\n");
+    printf("  -s  Signature file to scan with, in place of the built in "
+           "signatures.\n");
+    printf("  -i  Content integrity.  Also hash the code pages and "
+           "re-hash them on every\n"
+           "      poll, to catch code patched in place.\n");
+    printf("  -l  Log at a level, none, emerg, alert, critical, error, "
+           "warning, notice,\n"
+           "      info or debug, or set a module's level as "
+           "<module>=<level>.  Modules are\n"
+           "      avl, mmap, scanner and scan-engine.  Can be given more "
+           "than once.  Logging\n"
+           "      is off by default.\n");
+    printf("  -b  Log in binary, to a file to be read with logdec.exe.  "
+           "Logs at debug\n"
+           "      level, short of -l.\n");
+    printf("  -d  Save the baseline of each process to a directory, and "
+           "use it in place\n"
+           "      of a new one when restarted while the process lives.\n");
 }
 
 int main(int argc, char *argv[])
 {
+    hp_scanner_t scanner;
+    const char *signature_path = NULL;
+    const char *binary_log_path = NULL;
+    bool log_levels_set = false;
+    uint32_t pid;
+    int argi;
+    int i;
+
     hp_log_init(HP_LOG_LEVEL_NONE, NULL);
 
-    if (argc != 2) {
+    memset(&scanner, 0, sizeof(scanner));
+    scanner.interval_ms = HP_MONITOR_INTERVAL_MS;
+    scanner.worker_count = hp_cpu_count();
+
+    for (argi = 1; argi < argc && argv[argi][0] == '-'; argi++) {
+        if (strcmp(argv[argi], "-i") == 0) {
+            scanner.integrity = true;
+            continue;
+        }
+        if (argi + 1 >= argc) {
+            hp_print_usage();
+            exit(EXIT_FAILURE);
+        }
+        if (strcmp(argv[argi], "-w") == 0) {
+            if (hp_scanner_parse_u32(argv[++argi],
+                                     &scanner.worker_count) != HP_STATUS_OK)
+            {
+                hp_print_usage();
+                exit(EXIT_FAILURE);
+            }
+        } else if (strcmp(argv[argi], "-c") == 0) {
+            scanner.config_path = argv[++argi];
+        } else if (strcmp(argv[argi], "-s") == 0) {
+            signature_path = argv[++argi];
+        } else if (strcmp(argv[argi], "-b") == 0) {
+            binary_log_path = argv[++argi];
+        } else if (strcmp(argv[argi], "-d") == 0) {
+            scanner.baseline_dir = argv[++argi];
+        } else if (strcmp(argv[argi], "-l") == 0) {
+            if (hp_log_set_levels(argv[++argi]) != HP_STATUS_OK) {
+                hp_print_usage();
+                exit(EXIT_FAILURE);
+            }
+            log_levels_set = true;
+        } else {
+            hp_print_usage();
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if (scanner.worker_count == 0 ||
+        (scanner.config_path == NULL && argi == argc) ||
+        (scanner.config_path != NULL && argi != argc))
+    {
         hp_print_usage();
         exit(EXIT_FAILURE);
     }
 
-    hp_monitor(atol(argv[1]));
+    /* A binary log costs a few stores a line, so can be left at debug
+     * level.  Otherwise workers log from the scan path, so they hand
+     * their lines off to a writer rather than flush them themselves. */
+    if (binary_log_path != NULL) {
+        if (!log_levels_set)
+            hp_log_set_levels("debug");
+        if (hp_log_binary_open(binary_log_path, 0) != HP_STATUS_OK)
+            exit(EXIT_FAILURE);
+    } else {
+        hp_log_async_start(NULL);
+    }
+
+    if (signature_path == NULL) {
+        hp_signatures_builtin(&scanner.signatures);
+    } else if (hp_signatures_load(&scanner.signatures,
+                                  signature_path) != HP_STATUS_OK)
+    {
+        exit(EXIT_FAILURE);
+    }
+
+    hp_timer_wheel_init(&scanner.wheel, HP_MONITOR_TICK_MS);
+    hp_baseline_cache_init(&scanner.baselines);
+    if (hp_avl_init(&scanner.registry, hp_monitored_cmp,
+                    NULL, 0) != HP_STATUS_OK ||
+        (scanner.integrity &&
+         hp_proc_reader_init(&scanner.reader,
+                             HP_SCANNER_READ_SLOTS) != HP_STATUS_OK) ||
+        hp_scanner_start_workers(&scanner) != HP_STATUS_OK)
+    {
+        exit(EXIT_FAILURE);
+    }
+
+    if (scanner.config_path != NULL) {
+        if (hp_scanner_load_config(&scanner) != HP_STATUS_OK)
+            exit(EXIT_FAILURE);
+    } else {
+        /* Spread the first polls over an interval, so the processes
+         * aren't all snapshotted in the same tick. */
+        for (i = argi; i < argc; i++) {
+            if (hp_scanner_parse_u32(argv[i], &pid) != HP_STATUS_OK) {
+                hp_print_usage();
+                exit(EXIT_FAILURE);
+            }
+            hp_scanner_add_pid(&scanner, pid,
+                               (scanner.interval_ms * (i - argi + 1)) /
+                               (argc - argi));
+        }
+    }
+
+    hp_monitor(&scanner);
+
+    hp_scanner_stop_workers(&scanner);
+    hp_avl_parse(scanner.registry, hp_scanner_free_, NULL);
+    hp_avl_deinit(scanner.registry);
+    hp_baseline_cache_deinit(&scanner.baselines);
+    hp_signatures_deinit(&scanner.signatures);
+    hp_proc_reader_deinit(&scanner.reader);
+    hp_scratch_free(&scanner.scratch);
+    hp_log_deinit();
 
     return 0;
 }
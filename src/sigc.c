@@ -0,0 +1,371 @@
+/**
+ * Copyright(C) 2018, Juniper Networks, Inc.
+ * All rights reserved
+ *
+ * This SOFTWARE is licensed under the license provided in the LICENSE.txt
+ * file.  By downloading, installing, copying, or otherwise using the
+ * SOFTWARE, you agree to be bound by the terms of that license.  This
+ * SOFTWARE is not an official Juniper product.
+ *
+ * Third-Party Code: This SOFTWARE may depend on other components under
+ * separate copyright notice and license terms.  Your use of the source
+ * code for those components is subject to the term and conditions of
+ * the respective license as noted in the Third-Party source code.
+ */
+
+/**
+ * @author Anoop Saldanha
+ */
+/* Build time signature compiler.  Parses a signature file, compiles the
+ * anchors of its rules with the scan engine, and writes out the rules and
+ * tables as static const C data, to be built into the scanner as its
+ * built in signature set. */
+
+#define _CRT_SECURE_NO_WARNINGS
+
+#include "honeyprocs-common.h"
+#include "scan-engine.h"
+#include "scan-rules.h"
+#include "sigfile.h"
+#include "status.h"
+#include "util-log.h"
+
+#define HP_SIGC_PREFIX "hp_builtin"
+
+static void hp_sigc_write_u32s(FILE *fp, const char *name,
+                               const uint32_t *vals, uint32_t count)
+{
+    uint32_t i;
+
+    /* C has no empty arrays */
+    fprintf(fp, "static const uint32_t %s_%s[%u] = {",
+            HP_SIGC_PREFIX, name, (count != 0) ? count : 1);
+    for (i = 0; i < count; i++)
+        fprintf(fp, "%s0x%08x,", ((i % 6) == 0) ? "\n    " : " ", vals[i]);
+    if (count == 0)
+        fprintf(fp, "\n    0,");
+    fprintf(fp, "\n};\n\n");
+
+    return;
+}
+
+static void hp_sigc_write_u8s(FILE *fp, const char *indent,
+                              const uint8_t *vals, uint32_t count)
+{
+    uint32_t i;
+
+    fprintf(fp, "{");
+    for (i = 0; i < count; i++) {
+        if ((i % 16) == 0)
+            fprintf(fp, "\n%s", indent);
+        else
+            fprintf(fp, " ");
+        fprintf(fp, "%u,", vals[i]);
+    }
+    fprintf(fp, " }");
+
+    return;
+}
+
+static void hp_sigc_write_u8_array(FILE *fp, const char *name,
+                                   const uint8_t *vals, uint32_t count)
+{
+    static const uint8_t zero = 0;
+
+    fprintf(fp, "static const uint8_t %s_%s[%u] = ",
+            HP_SIGC_PREFIX, name, (count != 0) ? count : 1);
+    hp_sigc_write_u8s(fp, "    ", (count != 0) ? vals : &zero,
+                      (count != 0) ? count : 1);
+    fprintf(fp, ";\n\n");
+
+    return;
+}
+
+static void hp_sigc_write_masks(FILE *fp, const uint8_t *masks,
+                                uint32_t mask_len)
+{
+    uint32_t j;
+
+    fprintf(fp, "    {\n");
+    for (j = 0; j < HP_SCAN_PREFILTER_LEN_MAX; j++) {
+        fprintf(fp, "        ");
+        hp_sigc_write_u8s(fp, "            ", masks + (j * mask_len),
+                          mask_len);
+        fprintf(fp, ",\n");
+    }
+    fprintf(fp, "    },\n");
+
+    return;
+}
+
+/* Octal escapes take at most 3 digits, so unlike hex ones they can't run
+ * into the characters following them.  '?' is escaped too, to keep clear
+ * of trigraphs. */
+static void hp_sigc_write_string(FILE *fp, const uint8_t *s, uint32_t len)
+{
+    uint32_t i;
+
+    fprintf(fp, "\"");
+    for (i = 0; i < len; i++) {
+        if (s[i] >= 0x20 && s[i] < 0x7f && s[i] != '"' && s[i] != '\\' &&
+            s[i] != '?')
+        {
+            fprintf(fp, "%c", s[i]);
+        } else {
+            fprintf(fp, "\\%03o", s[i]);
+        }
+    }
+    fprintf(fp, "\"");
+
+    return;
+}
+
+static void hp_sigc_write_rules(FILE *fp, const hp_scan_rules_t *rules)
+{
+    static const char *ops[] = {
+        "HP_SCAN_OP_STRING",
+        "HP_SCAN_OP_OF",
+        "HP_SCAN_OP_REGION",
+        "HP_SCAN_OP_AND",
+        "HP_SCAN_OP_OR",
+        "HP_SCAN_OP_NOT",
+    };
+    static const char *nfa_ops[] = {
+        "HP_SCAN_NFA_BYTE",
+        "HP_SCAN_NFA_CLASS",
+        "HP_SCAN_NFA_SPLIT",
+        "HP_SCAN_NFA_MATCH",
+    };
+    const hp_scan_string_t *string;
+    const hp_scan_node_t *node;
+    const hp_scan_anchor_t *anchor;
+    const hp_scan_nfa_t *nfa;
+    uint32_t i;
+
+    fprintf(fp, "static const hp_scan_rule_t %s_rule_list[%u] = {\n",
+            HP_SIGC_PREFIX, rules->rule_count);
+    for (i = 0; i < rules->rule_count; i++) {
+        fprintf(fp, "    { ");
+        hp_sigc_write_string(fp, (const uint8_t *)rules->rules[i].name,
+                             (uint32_t)strlen(rules->rules[i].name));
+        fprintf(fp, ", %u, %u, %u },\n", rules->rules[i].first_string,
+                rules->rules[i].string_count, rules->rules[i].condition);
+    }
+    fprintf(fp, "};\n\n");
+
+    fprintf(fp, "static const hp_scan_string_t %s_strings[%u] = {\n",
+            HP_SIGC_PREFIX,
+            (rules->string_count != 0) ? rules->string_count : 1);
+    for (i = 0; i < rules->string_count; i++) {
+        string = &rules->strings[i];
+        fprintf(fp, "    { %u, ", string->off);
+        if (string->mask_off == HP_SCAN_STRING_NO_MASK)
+            fprintf(fp, "HP_SCAN_STRING_NO_MASK, ");
+        else
+            fprintf(fp, "%u, ", string->mask_off);
+        fprintf(fp, "%u, ", string->len);
+        if (string->regex == HP_SCAN_STRING_NO_REGEX)
+            fprintf(fp, "HP_SCAN_STRING_NO_REGEX, ");
+        else
+            fprintf(fp, "%u, ", string->regex);
+        fprintf(fp, "%u },\n", string->rule);
+    }
+    if (rules->string_count == 0)
+        fprintf(fp, "    { 0 },\n");
+    fprintf(fp, "};\n\n");
+
+    fprintf(fp, "static const hp_scan_node_t %s_nodes[%u] = {\n",
+            HP_SIGC_PREFIX, rules->node_count);
+    for (i = 0; i < rules->node_count; i++) {
+        node = &rules->nodes[i];
+        fprintf(fp, "    { %s, %u, %u, %u },\n",
+                ops[node->op], node->a, node->b, node->c);
+    }
+    fprintf(fp, "};\n\n");
+
+    hp_sigc_write_u32s(fp, "string_refs", rules->string_refs,
+                       rules->string_ref_count);
+
+    fprintf(fp, "static const hp_scan_anchor_t %s_anchors[%u] = {\n",
+            HP_SIGC_PREFIX,
+            (rules->anchor_count != 0) ? rules->anchor_count : 1);
+    for (i = 0; i < rules->anchor_count; i++) {
+        anchor = &rules->anchors[i];
+        fprintf(fp, "    { %u, %u, %u, %u },\n", anchor->string, anchor->off,
+                anchor->len, anchor->at);
+    }
+    if (rules->anchor_count == 0)
+        fprintf(fp, "    { 0 },\n");
+    fprintf(fp, "};\n\n");
+
+    fprintf(fp, "static const hp_scan_nfa_t %s_nfa[%u] = {\n",
+            HP_SIGC_PREFIX, (rules->nfa_count != 0) ? rules->nfa_count : 1);
+    for (i = 0; i < rules->nfa_count; i++) {
+        nfa = &rules->nfa[i];
+        fprintf(fp, "    { %s, %u, %u, %u },\n",
+                nfa_ops[nfa->op], nfa->a, nfa->next, nfa->b);
+    }
+    if (rules->nfa_count == 0)
+        fprintf(fp, "    { 0 },\n");
+    fprintf(fp, "};\n\n");
+
+    fprintf(fp, "static const uint8_t %s_bytes[%u] = ",
+            HP_SIGC_PREFIX,
+            (rules->byte_count != 0) ? rules->byte_count : 1);
+    if (rules->byte_count != 0)
+        hp_sigc_write_u8s(fp, "    ", rules->bytes, rules->byte_count);
+    else
+        fprintf(fp, "{ 0 }");
+    fprintf(fp, ";\n\n");
+
+    return;
+}
+
+static void hp_sigc_write_tables(FILE *fp, const hp_scan_tables_t *tables)
+{
+    hp_sigc_write_u32s(fp, "next", tables->next,
+                       tables->dense_count * tables->class_count);
+    hp_sigc_write_u32s(fp, "sparse_edges", tables->sparse_edges,
+                       tables->state_count - tables->dense_count + 1);
+    hp_sigc_write_u32s(fp, "sparse_fail", tables->sparse_fail,
+                       tables->state_count - tables->dense_count + 1);
+    hp_sigc_write_u8_array(fp, "edge_class", tables->edge_class,
+                           tables->edge_count);
+    hp_sigc_write_u32s(fp, "edge_next", tables->edge_next,
+                       tables->edge_count);
+    hp_sigc_write_u32s(fp, "state_output", tables->state_output,
+                       tables->state_count);
+    hp_sigc_write_u32s(fp, "state_output_link", tables->state_output_link,
+                       tables->state_count);
+    hp_sigc_write_u32s(fp, "pattern_len", tables->pattern_len,
+                       tables->pattern_count);
+    hp_sigc_write_u32s(fp, "pattern_id", tables->pattern_id,
+                       tables->pattern_count);
+    hp_sigc_write_u32s(fp, "pattern_output_next",
+                       tables->pattern_output_next, tables->pattern_count);
+    hp_sigc_write_u8_array(fp, "prefilter_hash", tables->prefilter_hash,
+                           (tables->prefilter_hash_len != 0) ?
+                           (1U << tables->prefilter_hash_bits) / 8 : 0);
+
+    fprintf(fp, "static const hp_scan_tables_t %s_tables = {\n",
+            HP_SIGC_PREFIX);
+    fprintf(fp, "    ");
+    hp_sigc_write_u8s(fp, "        ", tables->byte_class, 256);
+    fprintf(fp, ",\n");
+    fprintf(fp, "    %u,\n", tables->class_count);
+    fprintf(fp, "    %u,\n", tables->state_count);
+    fprintf(fp, "    %u,\n", tables->dense_count);
+    fprintf(fp, "    %u,\n", tables->shallow_count);
+    fprintf(fp, "    %s_next,\n", HP_SIGC_PREFIX);
+    fprintf(fp, "    %s_sparse_edges,\n", HP_SIGC_PREFIX);
+    fprintf(fp, "    %s_sparse_fail,\n", HP_SIGC_PREFIX);
+    fprintf(fp, "    %u,\n", tables->edge_count);
+    fprintf(fp, "    %s_edge_class,\n", HP_SIGC_PREFIX);
+    fprintf(fp, "    %s_edge_next,\n", HP_SIGC_PREFIX);
+    fprintf(fp, "    %s_state_output,\n", HP_SIGC_PREFIX);
+    fprintf(fp, "    %s_state_output_link,\n", HP_SIGC_PREFIX);
+    fprintf(fp, "    %u,\n", tables->pattern_count);
+    fprintf(fp, "    %s_pattern_len,\n", HP_SIGC_PREFIX);
+    fprintf(fp, "    %s_pattern_id,\n", HP_SIGC_PREFIX);
+    fprintf(fp, "    %s_pattern_output_next,\n", HP_SIGC_PREFIX);
+    fprintf(fp, "    %u,\n", tables->prefilter_len);
+    hp_sigc_write_masks(fp, &tables->prefilter_nibble_lo[0][0], 16);
+    hp_sigc_write_masks(fp, &tables->prefilter_nibble_hi[0][0], 16);
+    hp_sigc_write_masks(fp, &tables->prefilter_byte[0][0], 256);
+    fprintf(fp, "    %u,\n", tables->prefilter_hash_len);
+    fprintf(fp, "    %u,\n", tables->prefilter_hash_bits);
+    fprintf(fp, "    %s_prefilter_hash,\n", HP_SIGC_PREFIX);
+    fprintf(fp, "};\n\n");
+
+    return;
+}
+
+static hp_status_t hp_sigc_write(const char *path, const char *sig_path,
+                                 const hp_scan_rules_t *rules,
+                                 const hp_scan_tables_t *tables)
+{
+    FILE *fp;
+    hp_status_t status;
+
+    if ((fp = fopen(path, "w")) == NULL) {
+        hp_log_error("Error opening \"%s\".", path);
+        status = HP_STATUS_ERROR;
+        goto return_status;
+    }
+
+    fprintf(fp, "/* Generated by sigc from %s.  Do not edit. */\n\n", sig_path);
+    fprintf(fp, "#ifndef __SIGNATURES_GEN__H__\n");
+    fprintf(fp, "#define __SIGNATURES_GEN__H__\n\n");
+
+    hp_sigc_write_rules(fp, rules);
+    hp_sigc_write_tables(fp, tables);
+
+    fprintf(fp, "static const hp_scan_rules_t %s_rules = {\n", HP_SIGC_PREFIX);
+    fprintf(fp, "    %s_rule_list, %u,\n", HP_SIGC_PREFIX, rules->rule_count);
+    fprintf(fp, "    %s_strings, %u,\n", HP_SIGC_PREFIX,
+            rules->string_count);
+    fprintf(fp, "    %s_nodes, %u,\n", HP_SIGC_PREFIX, rules->node_count);
+    fprintf(fp, "    %s_string_refs, %u,\n", HP_SIGC_PREFIX,
+            rules->string_ref_count);
+    fprintf(fp, "    %s_anchors, %u,\n", HP_SIGC_PREFIX, rules->anchor_count);
+    fprintf(fp, "    %s_nfa, %u,\n", HP_SIGC_PREFIX, rules->nfa_count);
+    fprintf(fp, "    %s_bytes, %u,\n", HP_SIGC_PREFIX, rules->byte_count);
+    fprintf(fp, "    %u,\n", rules->pending_max);
+    fprintf(fp, "    &%s_tables,\n", HP_SIGC_PREFIX);
+    fprintf(fp, "};\n\n");
+
+    fprintf(fp, "#endif /* __SIGNATURES_GEN__H__ */\n");
+
+    if (ferror(fp)) {
+        hp_log_error("Error writing \"%s\".", path);
+        fclose(fp);
+        status = HP_STATUS_ERROR;
+        goto return_status;
+    }
+    fclose(fp);
+
+    status = HP_STATUS_OK;
+ return_status:
+    return status;
+}
+
+int main(int argc, char *argv[])
+{
+    hp_scan_rules_t rules;
+    hp_scan_engine_t *engine = NULL;
+    int ret = EXIT_FAILURE;
+
+    hp_log_init(HP_LOG_LEVEL_ERROR, NULL);
+
+    memset(&rules, 0, sizeof(rules));
+
+    if (argc != 3) {
+        printf("sigc <signature_file> <output_header>\n");
+        goto return_status;
+    }
+
+    if (hp_sigfile_load(argv[1], &rules) != HP_STATUS_OK ||
+        hp_scan_engine_init(&engine) != HP_STATUS_OK)
+    {
+        goto return_status;
+    }
+    if (rules.rule_count == 0) {
+        hp_log_error("No rules in \"%s\".", argv[1]);
+        goto return_status;
+    }
+
+    if (hp_scan_rules_add_anchors(&rules, engine) != HP_STATUS_OK ||
+        hp_scan_engine_compile(engine) != HP_STATUS_OK ||
+        hp_sigc_write(argv[2], argv[1], &rules,
+                      hp_scan_engine_tables(engine)) != HP_STATUS_OK)
+    {
+        goto return_status;
+    }
+
+    ret = EXIT_SUCCESS;
+ return_status:
+    if (engine != NULL)
+        hp_scan_engine_deinit(engine);
+    hp_sigfile_free(&rules);
+    return ret;
+}
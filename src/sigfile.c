@@ -0,0 +1,1691 @@
+/**
+ * Copyright(C) 2018, Juniper Networks, Inc.
+ * All rights reserved
+ *
+ * This SOFTWARE is licensed under the license provided in the LICENSE.txt
+ * file.  By downloading, installing, copying, or otherwise using the
+ * SOFTWARE, you agree to be bound by the terms of that license.  This
+ * SOFTWARE is not an official Juniper product.
+ *
+ * Third-Party Code: This SOFTWARE may depend on other components under
+ * separate copyright notice and license terms.  Your use of the source
+ * code for those components is subject to the term and conditions of
+ * the respective license as noted in the Third-Party source code.
+ */
+
+/**
+ * @author Anoop Saldanha
+ */
+#define _CRT_SECURE_NO_WARNINGS
+
+#include "honeyprocs-common.h"
+#include "sigfile.h"
+#include "scan-rules.h"
+#include "scan-regex.h"
+#include "status.h"
+#include "util-log.h"
+
+/* Longest string taken, and most nodes a regex parses into */
+#define HP_SIGFILE_STRING_MAX 4096
+/* How deep parentheses and nots can nest in a condition, and groups in
+ * a regex */
+#define HP_SIGFILE_DEPTH_MAX 64
+/* Most NFA states a regex compiles into.  Counted repeats copy what they
+ * repeat, so this can be reached with a short regex. */
+#define HP_SIGFILE_REGEX_STATES_MAX 16384
+/* A repeat without an upper bound */
+#define HP_SIGFILE_REPEAT_ANY UINT32_MAX
+
+/* What a regex parses into, before it is compiled into NFA states */
+typedef enum hp_sigfile_re_type_t {
+    HP_SIGFILE_RE_EMPTY = 0,
+    /* Byte a */
+    HP_SIGFILE_RE_BYTE,
+    /* A byte in the class at bytes[a] */
+    HP_SIGFILE_RE_CLASS,
+    /* Node a, then node b */
+    HP_SIGFILE_RE_CAT,
+    /* Node a or node b */
+    HP_SIGFILE_RE_ALT,
+    /* Node a, min to max times */
+    HP_SIGFILE_RE_REPEAT,
+} hp_sigfile_re_type_t;
+
+typedef struct hp_sigfile_re_t {
+    uint32_t type;
+    uint32_t a;
+    uint32_t b;
+    uint32_t min;
+    uint32_t max;
+} hp_sigfile_re_t;
+
+typedef struct hp_sigfile_name_t {
+    const char *name;
+    uint32_t len;
+} hp_sigfile_name_t;
+
+/* A file being parsed.  The arrays grow as it is, to be handed over to
+ * the rules once it is done. */
+typedef struct hp_sigfile_t {
+    char *text;
+    const char *p;
+    uint32_t line;
+    /* What was wrong, to be logged with the line */
+    const char *error;
+    uint32_t depth;
+
+    hp_scan_rule_t *rules;
+    uint32_t rule_count;
+    uint32_t rule_size;
+    hp_scan_string_t *strings;
+    uint32_t string_count;
+    uint32_t string_size;
+    hp_scan_node_t *nodes;
+    uint32_t node_count;
+    uint32_t node_size;
+    uint32_t *refs;
+    uint32_t ref_count;
+    uint32_t ref_size;
+    hp_scan_anchor_t *anchors;
+    uint32_t anchor_count;
+    uint32_t anchor_size;
+    hp_scan_nfa_t *nfa;
+    uint32_t nfa_count;
+    uint32_t nfa_size;
+    uint8_t *bytes;
+    uint32_t byte_count;
+    uint32_t byte_size;
+    uint32_t pending_max;
+
+    /* The ids of the strings of the rule being parsed, pointing into
+     * text */
+    hp_sigfile_name_t *names;
+    uint32_t name_size;
+
+    /* The regex being parsed, and its first NFA state */
+    hp_sigfile_re_t *re;
+    uint32_t re_count;
+    uint32_t re_size;
+    uint32_t regex_first;
+
+    /* The string being parsed */
+    uint8_t pat[HP_SIGFILE_STRING_MAX];
+    uint8_t mask[HP_SIGFILE_STRING_MAX];
+} hp_sigfile_t;
+
+/* Make room for add more elements in an array of count. */
+static hp_status_t hp_sigfile_grow(hp_sigfile_t *sf, void **array,
+                                   uint32_t *size, uint32_t count,
+                                   uint32_t add, size_t elem_size)
+{
+    void *array_new;
+    uint32_t size_new;
+    hp_status_t status;
+
+    if (count + add <= *size) {
+        status = HP_STATUS_OK;
+        goto return_status;
+    }
+
+    size_new = (*size != 0) ? *size : 16;
+    while (size_new < count + add)
+        size_new *= 2;
+    if ((array_new = realloc(*array, size_new * elem_size)) == NULL) {
+        hp_log_error("realloc() failure.");
+        sf->error = "Out of memory";
+        status = HP_STATUS_ERROR;
+        goto return_status;
+    }
+    *array = array_new;
+    *size = size_new;
+
+    status = HP_STATUS_OK;
+ return_status:
+    return status;
+}
+
+static hp_status_t hp_sigfile_fail(hp_sigfile_t *sf, const char *error)
+{
+    sf->error = error;
+
+    return HP_STATUS_ERROR;
+}
+
+/* Skip spaces and comments. */
+static void hp_sigfile_skip(hp_sigfile_t *sf)
+{
+    while (1) {
+        if (*sf->p == '\n') {
+            sf->line++;
+            sf->p++;
+        } else if (*sf->p == ' ' || *sf->p == '\t' || *sf->p == '\r') {
+            sf->p++;
+        } else if (*sf->p == '#') {
+            while (*sf->p != '\0' && *sf->p != '\n')
+                sf->p++;
+        } else {
+            break;
+        }
+    }
+
+    return;
+}
+
+static bool hp_sigfile_is_word_char(char c)
+{
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+        (c >= '0' && c <= '9') || c == '_' || c == '-' || c == '.';
+}
+
+/* Take a name, keyword or no.  Returns its length, 0 if there is none. */
+static uint32_t hp_sigfile_word(hp_sigfile_t *sf, const char **word)
+{
+    const char *p;
+
+    hp_sigfile_skip(sf);
+    for (p = sf->p; hp_sigfile_is_word_char(*p); p++)
+        ;
+    *word = sf->p;
+    sf->p = p;
+
+    return (uint32_t)(p - *word);
+}
+
+static bool hp_sigfile_keyword(hp_sigfile_t *sf, const char *keyword)
+{
+    size_t len = strlen(keyword);
+
+    hp_sigfile_skip(sf);
+    if (strncmp(sf->p, keyword, len) != 0 ||
+        hp_sigfile_is_word_char(sf->p[len]))
+    {
+        return false;
+    }
+    sf->p += len;
+
+    return true;
+}
+
+static bool hp_sigfile_punct(hp_sigfile_t *sf, char c)
+{
+    hp_sigfile_skip(sf);
+    if (*sf->p != c)
+        return false;
+    sf->p++;
+
+    return true;
+}
+
+static int hp_sigfile_hex_digit(char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+
+    return -1;
+}
+
+/* Parse "<text>" into pat, past the opening quote. */
+static hp_status_t hp_sigfile_text(hp_sigfile_t *sf, uint32_t *len_)
+{
+    const char *p = sf->p;
+    uint32_t len = 0;
+    int hi, lo;
+    hp_status_t status;
+
+    for (; *p != '"'; len++) {
+        if (len == HP_SIGFILE_STRING_MAX) {
+            status = hp_sigfile_fail(sf, "String too long");
+            goto return_status;
+        }
+        if (*p == '\0' || *p == '\n') {
+            status = hp_sigfile_fail(sf, "Unterminated string");
+            goto return_status;
+        }
+        if (*p != '\\') {
+            sf->pat[len] = *p++;
+            continue;
+        }
+        p++;
+        switch (*p) {
+            case '\\':
+            case '"':
+                sf->pat[len] = *p++;
+                break;
+            case 'n':
+                sf->pat[len] = '\n';
+                p++;
+                break;
+            case 'r':
+                sf->pat[len] = '\r';
+                p++;
+                break;
+            case 't':
+                sf->pat[len] = '\t';
+                p++;
+                break;
+            case 'x':
+                if ((hi = hp_sigfile_hex_digit(p[1])) < 0 ||
+                    (lo = hp_sigfile_hex_digit(p[2])) < 0)
+                {
+                    status = hp_sigfile_fail(sf, "Bad \\x escape");
+                    goto return_status;
+                }
+                sf->pat[len] = (uint8_t)((hi << 4) | lo);
+                p += 3;
+                break;
+            default:
+                status = hp_sigfile_fail(sf, "Bad escape");
+                goto return_status;
+        }
+    }
+    sf->p = p + 1;
+    memset(sf->mask, 0xff, len);
+    *len_ = len;
+
+    status = HP_STATUS_OK;
+ return_status:
+    return status;
+}
+
+/* Parse { <hex bytes> } into pat and mask, past the opening brace.  A
+ * '?' digit leaves its nibble out of the mask. */
+static hp_status_t hp_sigfile_hex(hp_sigfile_t *sf, uint32_t *len_)
+{
+    uint32_t len = 0;
+    int digit[2];
+    uint32_t i;
+    hp_status_t status;
+
+    while (!hp_sigfile_punct(sf, '}')) {
+        if (len == HP_SIGFILE_STRING_MAX) {
+            status = hp_sigfile_fail(sf, "String too long");
+            goto return_status;
+        }
+        sf->pat[len] = 0;
+        sf->mask[len] = 0;
+        for (i = 0; i < 2; i++) {
+            if (sf->p[i] == '?') {
+                continue;
+            } else if ((digit[i] = hp_sigfile_hex_digit(sf->p[i])) < 0) {
+                status = hp_sigfile_fail(sf, "Bad hex byte");
+                goto return_status;
+            }
+            sf->pat[len] |= (uint8_t)(digit[i] << (i == 0 ? 4 : 0));
+            sf->mask[len] |= (uint8_t)(0x0f << (i == 0 ? 4 : 0));
+        }
+        sf->p += 2;
+        len++;
+    }
+    *len_ = len;
+
+    status = HP_STATUS_OK;
+ return_status:
+    return status;
+}
+
+static hp_status_t hp_sigfile_re_node(hp_sigfile_t *sf, uint32_t type,
+                                      uint32_t a, uint32_t b,
+                                      uint32_t min, uint32_t max,
+                                      uint32_t *node)
+{
+    hp_sigfile_re_t *re;
+    hp_status_t status;
+
+    if (sf->re_count == HP_SIGFILE_STRING_MAX) {
+        status = hp_sigfile_fail(sf, "Regex too long");
+        goto return_status;
+    }
+    if (hp_sigfile_grow(sf, (void **)&sf->re, &sf->re_size,
+                        sf->re_count, 1, sizeof(*sf->re)) != HP_STATUS_OK)
+    {
+        status = HP_STATUS_ERROR;
+        goto return_status;
+    }
+    re = &sf->re[sf->re_count];
+    re->type = type;
+    re->a = a;
+    re->b = b;
+    re->min = min;
+    re->max = max;
+    *node = sf->re_count++;
+
+    status = HP_STATUS_OK;
+ return_status:
+    return status;
+}
+
+/* A node for a set of bytes - a byte node if there's just the one, or a
+ * class, whose bitmap goes into the bytes. */
+static hp_status_t hp_sigfile_re_set(hp_sigfile_t *sf, const uint8_t *set,
+                                     uint32_t *node)
+{
+    uint32_t count;
+    uint32_t byte;
+    uint32_t c;
+    hp_status_t status;
+
+    for (count = 0, byte = 0, c = 0; c < 256; c++) {
+        if ((set[c >> 3] >> (c & 7)) & 1) {
+            count++;
+            byte = c;
+        }
+    }
+    if (count == 1) {
+        status = hp_sigfile_re_node(sf, HP_SIGFILE_RE_BYTE, byte, 0, 0, 0,
+                                    node);
+        goto return_status;
+    }
+
+    if (hp_sigfile_grow(sf, (void **)&sf->bytes, &sf->byte_size,
+                        sf->byte_count, HP_SCAN_CLASS_SIZE,
+                        sizeof(*sf->bytes)) != HP_STATUS_OK ||
+        hp_sigfile_re_node(sf, HP_SIGFILE_RE_CLASS, sf->byte_count, 0, 0, 0,
+                           node) != HP_STATUS_OK)
+    {
+        status = HP_STATUS_ERROR;
+        goto return_status;
+    }
+    memcpy(sf->bytes + sf->byte_count, set, HP_SCAN_CLASS_SIZE);
+    sf->byte_count += HP_SCAN_CLASS_SIZE;
+
+    status = HP_STATUS_OK;
+ return_status:
+    return status;
+}
+
+static void hp_sigfile_re_range(uint8_t *set, uint32_t lo, uint32_t hi)
+{
+    uint32_t c;
+
+    for (c = lo; c <= hi; c++)
+        set[c >> 3] |= (uint8_t)(1 << (c & 7));
+
+    return;
+}
+
+/**
+ * Parse a byte of a regex, escaped or not, into the set of bytes it
+ * stands for.
+ *
+ * @byte Set to the byte, or -1 for an escape standing for a class.
+ */
+static hp_status_t hp_sigfile_re_char(hp_sigfile_t *sf, uint8_t *set,
+                                      int *byte)
+{
+    char c;
+    uint32_t i;
+    int hi, lo;
+    hp_status_t status;
+
+    memset(set, 0, HP_SCAN_CLASS_SIZE);
+    *byte = -1;
+
+    if (*sf->p == '\0' || *sf->p == '\n') {
+        status = hp_sigfile_fail(sf, "Unterminated regex");
+        goto return_status;
+    }
+    if (*sf->p != '\\') {
+        *byte = (uint8_t)*sf->p++;
+        goto byte;
+    }
+
+    c = *++sf->p;
+    sf->p++;
+    switch (c) {
+        case 'x':
+            if ((hi = hp_sigfile_hex_digit(sf->p[0])) < 0 ||
+                (lo = hp_sigfile_hex_digit(sf->p[1])) < 0)
+            {
+                status = hp_sigfile_fail(sf, "Bad \\x escape");
+                goto return_status;
+            }
+            *byte = (hi << 4) | lo;
+            sf->p += 2;
+            break;
+        case 'n':
+            *byte = '\n';
+            break;
+        case 'r':
+            *byte = '\r';
+            break;
+        case 't':
+            *byte = '\t';
+            break;
+        case 'd':
+        case 'D':
+            hp_sigfile_re_range(set, '0', '9');
+            break;
+        case 'w':
+        case 'W':
+            hp_sigfile_re_range(set, '0', '9');
+            hp_sigfile_re_range(set, 'A', 'Z');
+            hp_sigfile_re_range(set, 'a', 'z');
+            hp_sigfile_re_range(set, '_', '_');
+            break;
+        case 's':
+        case 'S':
+            hp_sigfile_re_range(set, '\t', '\r');
+            hp_sigfile_re_range(set, ' ', ' ');
+            break;
+        default:
+            /* Any other punctuation stands for itself */
+            if (c <= ' ' || c >= 0x7f || hp_sigfile_hex_digit(c) >= 0 ||
+                (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z'))
+            {
+                status = hp_sigfile_fail(sf, "Bad escape");
+                goto return_status;
+            }
+            *byte = (uint8_t)c;
+            break;
+    }
+    if (c == 'D' || c == 'W' || c == 'S') {
+        for (i = 0; i < HP_SCAN_CLASS_SIZE; i++)
+            set[i] = (uint8_t)~set[i];
+    }
+
+ byte:
+    if (*byte >= 0)
+        hp_sigfile_re_range(set, (uint32_t)*byte, (uint32_t)*byte);
+
+    status = HP_STATUS_OK;
+ return_status:
+    return status;
+}
+
+/* Parse a class, [...] or [^...], past the '['.  A ']' right at the
+ * start is taken as itself. */
+static hp_status_t hp_sigfile_re_class(hp_sigfile_t *sf, uint8_t *set)
+{
+    uint8_t item[HP_SCAN_CLASS_SIZE];
+    bool negate;
+    bool first;
+    int lo, hi;
+    uint32_t i;
+    hp_status_t status;
+
+    memset(set, 0, HP_SCAN_CLASS_SIZE);
+    negate = (*sf->p == '^');
+    if (negate)
+        sf->p++;
+
+    for (first = true; first || *sf->p != ']'; first = false) {
+        if (hp_sigfile_re_char(sf, item, &lo) != HP_STATUS_OK) {
+            status = HP_STATUS_ERROR;
+            goto return_status;
+        }
+        if (sf->p[0] == '-' && sf->p[1] != ']') {
+            sf->p++;
+            if (hp_sigfile_re_char(sf, item, &hi) != HP_STATUS_OK) {
+                status = HP_STATUS_ERROR;
+                goto return_status;
+            }
+            if (lo < 0 || hi < lo) {
+                status = hp_sigfile_fail(sf, "Bad class range");
+                goto return_status;
+            }
+            hp_sigfile_re_range(set, (uint32_t)lo, (uint32_t)hi);
+            continue;
+        }
+        for (i = 0; i < HP_SCAN_CLASS_SIZE; i++)
+            set[i] |= item[i];
+    }
+    sf->p++;
+
+    if (negate) {
+        for (i = 0; i < HP_SCAN_CLASS_SIZE; i++)
+            set[i] = (uint8_t)~set[i];
+    }
+
+    status = HP_STATUS_OK;
+ return_status:
+    return status;
+}
+
+static hp_status_t hp_sigfile_re_alt(hp_sigfile_t *sf, uint32_t *node);
+
+static hp_status_t hp_sigfile_re_atom(hp_sigfile_t *sf, uint32_t *node)
+{
+    uint8_t set[HP_SCAN_CLASS_SIZE];
+    int byte;
+    hp_status_t status;
+
+    switch (*sf->p) {
+        case '(':
+            sf->p++;
+            if (++sf->depth > HP_SIGFILE_DEPTH_MAX) {
+                status = hp_sigfile_fail(sf, "Regex nested too deep");
+                sf->depth--;
+                goto return_status;
+            }
+            status = hp_sigfile_re_alt(sf, node);
+            sf->depth--;
+            if (status != HP_STATUS_OK)
+                goto return_status;
+            if (*sf->p != ')') {
+                status = hp_sigfile_fail(sf, "Expected )");
+                goto return_status;
+            }
+            sf->p++;
+            goto done;
+        case '.':
+            sf->p++;
+            memset(set, 0xff, sizeof(set));
+            break;
+        case '[':
+            sf->p++;
+            if (hp_sigfile_re_class(sf, set) != HP_STATUS_OK) {
+                status = HP_STATUS_ERROR;
+                goto return_status;
+            }
+            break;
+        case '^':
+        case '$':
+            status = hp_sigfile_fail(sf, "Regex anchors aren't supported");
+            goto return_status;
+        case '*':
+        case '+':
+        case '?':
+        case '{':
+            status = hp_sigfile_fail(sf, "Nothing to repeat");
+            goto return_status;
+        default:
+            if (hp_sigfile_re_char(sf, set, &byte) != HP_STATUS_OK) {
+                status = HP_STATUS_ERROR;
+                goto return_status;
+            }
+            break;
+    }
+    if (hp_sigfile_re_set(sf, set, node) != HP_STATUS_OK) {
+        status = HP_STATUS_ERROR;
+        goto return_status;
+    }
+
+ done:
+    status = HP_STATUS_OK;
+ return_status:
+    return status;
+}
+
+/* Parse the no in a {n,m} repeat. */
+static hp_status_t hp_sigfile_re_count(hp_sigfile_t *sf, uint32_t *count)
+{
+    hp_status_t status;
+
+    if (*sf->p < '0' || *sf->p > '9') {
+        status = hp_sigfile_fail(sf, "Bad repeat");
+        goto return_status;
+    }
+    for (*count = 0; *sf->p >= '0' && *sf->p <= '9'; sf->p++) {
+        *count = (*count * 10) + (uint32_t)(*sf->p - '0');
+        if (*count > HP_SCAN_RULES_SPAN_MAX) {
+            status = hp_sigfile_fail(sf, "Repeat too long");
+            goto return_status;
+        }
+    }
+
+    status = HP_STATUS_OK;
+ return_status:
+    return status;
+}
+
+/* Parse an atom and the repeats after it. */
+static hp_status_t hp_sigfile_re_repeat(hp_sigfile_t *sf, uint32_t *node)
+{
+    uint32_t min;
+    uint32_t max;
+    hp_status_t status;
+
+    if (hp_sigfile_re_atom(sf, node) != HP_STATUS_OK) {
+        status = HP_STATUS_ERROR;
+        goto return_status;
+    }
+
+    while (1) {
+        if (*sf->p == '*') {
+            min = 0;
+            max = HP_SIGFILE_REPEAT_ANY;
+        } else if (*sf->p == '+') {
+            min = 1;
+            max = HP_SIGFILE_REPEAT_ANY;
+        } else if (*sf->p == '?') {
+            min = 0;
+            max = 1;
+        } else if (*sf->p == '{') {
+            sf->p++;
+            if (hp_sigfile_re_count(sf, &min) != HP_STATUS_OK) {
+                status = HP_STATUS_ERROR;
+                goto return_status;
+            }
+            max = min;
+            if (*sf->p == ',') {
+                sf->p++;
+                max = HP_SIGFILE_REPEAT_ANY;
+                if (*sf->p != '}' &&
+                    hp_sigfile_re_count(sf, &max) != HP_STATUS_OK)
+                {
+                    status = HP_STATUS_ERROR;
+                    goto return_status;
+                }
+            }
+            if (*sf->p != '}' || max < min) {
+                status = hp_sigfile_fail(sf, "Bad repeat");
+                goto return_status;
+            }
+        } else {
+            break;
+        }
+        sf->p++;
+        if (hp_sigfile_re_node(sf, HP_SIGFILE_RE_REPEAT, *node, 0, min, max,
+                               node) != HP_STATUS_OK)
+        {
+            status = HP_STATUS_ERROR;
+            goto return_status;
+        }
+    }
+
+    status = HP_STATUS_OK;
+ return_status:
+    return status;
+}
+
+static hp_status_t hp_sigfile_re_cat(hp_sigfile_t *sf, uint32_t *node)
+{
+    uint32_t r;
+    bool empty;
+    hp_status_t status;
+
+    for (empty = true; *sf->p != '|' && *sf->p != ')' && *sf->p != '/';
+         empty = false)
+    {
+        if (hp_sigfile_re_repeat(sf, empty ? node : &r) != HP_STATUS_OK ||
+            (!empty && hp_sigfile_re_node(sf, HP_SIGFILE_RE_CAT, *node, r,
+                                          0, 0, node) != HP_STATUS_OK))
+        {
+            status = HP_STATUS_ERROR;
+            goto return_status;
+        }
+    }
+    if (empty &&
+        hp_sigfile_re_node(sf, HP_SIGFILE_RE_EMPTY, 0, 0, 0, 0,
+                           node) != HP_STATUS_OK)
+    {
+        status = HP_STATUS_ERROR;
+        goto return_status;
+    }
+
+    status = HP_STATUS_OK;
+ return_status:
+    return status;
+}
+
+static hp_status_t hp_sigfile_re_alt(hp_sigfile_t *sf, uint32_t *node)
+{
+    uint32_t r;
+    hp_status_t status;
+
+    if (hp_sigfile_re_cat(sf, node) != HP_STATUS_OK) {
+        status = HP_STATUS_ERROR;
+        goto return_status;
+    }
+    while (*sf->p == '|') {
+        sf->p++;
+        if (hp_sigfile_re_cat(sf, &r) != HP_STATUS_OK ||
+            hp_sigfile_re_node(sf, HP_SIGFILE_RE_ALT, *node, r, 0, 0,
+                               node) != HP_STATUS_OK)
+        {
+            status = HP_STATUS_ERROR;
+            goto return_status;
+        }
+    }
+
+    status = HP_STATUS_OK;
+ return_status:
+    return status;
+}
+
+static hp_status_t hp_sigfile_nfa(hp_sigfile_t *sf, uint32_t op,
+                                  uint32_t a, uint32_t next, uint32_t b,
+                                  uint32_t *state)
+{
+    hp_status_t status;
+
+    if (sf->nfa_count - sf->regex_first == HP_SIGFILE_REGEX_STATES_MAX) {
+        status = hp_sigfile_fail(sf, "Regex too big");
+        goto return_status;
+    }
+    if (hp_sigfile_grow(sf, (void **)&sf->nfa, &sf->nfa_size,
+                        sf->nfa_count, 1, sizeof(*sf->nfa)) != HP_STATUS_OK)
+    {
+        status = HP_STATUS_ERROR;
+        goto return_status;
+    }
+    sf->nfa[sf->nfa_count].op = op;
+    sf->nfa[sf->nfa_count].a = a;
+    sf->nfa[sf->nfa_count].next = next;
+    sf->nfa[sf->nfa_count].b = b;
+    *state = sf->nfa_count++;
+
+    status = HP_STATUS_OK;
+ return_status:
+    return status;
+}
+
+/* Compile a regex node into NFA states leading on to next, last to
+ * first.  A counted repeat is compiled once per copy. */
+static hp_status_t hp_sigfile_re_compile(hp_sigfile_t *sf, uint32_t node,
+                                         uint32_t next, uint32_t *start)
+{
+    const hp_sigfile_re_t *re = &sf->re[node];
+    uint32_t body;
+    uint32_t l, r;
+    uint32_t i;
+    hp_status_t status;
+
+    switch (re->type) {
+        case HP_SIGFILE_RE_EMPTY:
+            *start = next;
+            break;
+
+        case HP_SIGFILE_RE_BYTE:
+            if (hp_sigfile_nfa(sf, HP_SCAN_NFA_BYTE, re->a, next, 0,
+                               start) != HP_STATUS_OK)
+            {
+                status = HP_STATUS_ERROR;
+                goto return_status;
+            }
+            break;
+
+        case HP_SIGFILE_RE_CLASS:
+            if (hp_sigfile_nfa(sf, HP_SCAN_NFA_CLASS, re->a, next, 0,
+                               start) != HP_STATUS_OK)
+            {
+                status = HP_STATUS_ERROR;
+                goto return_status;
+            }
+            break;
+
+        case HP_SIGFILE_RE_CAT:
+            if (hp_sigfile_re_compile(sf, re->b, next, &r) != HP_STATUS_OK ||
+                hp_sigfile_re_compile(sf, re->a, r, start) != HP_STATUS_OK)
+            {
+                status = HP_STATUS_ERROR;
+                goto return_status;
+            }
+            break;
+
+        case HP_SIGFILE_RE_ALT:
+            if (hp_sigfile_re_compile(sf, re->a, next, &l) != HP_STATUS_OK ||
+                hp_sigfile_re_compile(sf, re->b, next, &r) != HP_STATUS_OK ||
+                hp_sigfile_nfa(sf, HP_SCAN_NFA_SPLIT, 0, l, r,
+                               start) != HP_STATUS_OK)
+            {
+                status = HP_STATUS_ERROR;
+                goto return_status;
+            }
+            break;
+
+        case HP_SIGFILE_RE_REPEAT:
+            /* The optional copies, nested as (x(x)?)?, or a loop */
+            if (re->max == HP_SIGFILE_REPEAT_ANY) {
+                if (hp_sigfile_nfa(sf, HP_SCAN_NFA_SPLIT, 0, 0, next,
+                                   &l) != HP_STATUS_OK ||
+                    hp_sigfile_re_compile(sf, re->a, l,
+                                          &body) != HP_STATUS_OK)
+                {
+                    status = HP_STATUS_ERROR;
+                    goto return_status;
+                }
+                sf->nfa[l].next = body;
+            } else {
+                l = next;
+                for (i = re->min; i < re->max; i++) {
+                    if (hp_sigfile_re_compile(sf, re->a, l,
+                                              &body) != HP_STATUS_OK ||
+                        hp_sigfile_nfa(sf, HP_SCAN_NFA_SPLIT, 0, body, next,
+                                       &l) != HP_STATUS_OK)
+                    {
+                        status = HP_STATUS_ERROR;
+                        goto return_status;
+                    }
+                }
+            }
+            for (i = 0; i < re->min; i++) {
+                if (hp_sigfile_re_compile(sf, re->a, l, &l) != HP_STATUS_OK) {
+                    status = HP_STATUS_ERROR;
+                    goto return_status;
+                }
+            }
+            *start = l;
+            break;
+
+        default:
+            BUG_ON(1);
+            break;
+    }
+
+    status = HP_STATUS_OK;
+ return_status:
+    return status;
+}
+
+/* Parse /<regex>/ past the opening '/', and compile it into NFA states
+ * ending in a match. */
+static hp_status_t hp_sigfile_regex(hp_sigfile_t *sf, uint32_t *start)
+{
+    uint32_t root;
+    uint32_t match;
+    hp_status_t status;
+
+    sf->re_count = 0;
+    sf->regex_first = sf->nfa_count;
+
+    if (hp_sigfile_re_alt(sf, &root) != HP_STATUS_OK) {
+        status = HP_STATUS_ERROR;
+        goto return_status;
+    }
+    if (*sf->p != '/') {
+        status = hp_sigfile_fail(sf, "Unmatched )");
+        goto return_status;
+    }
+    sf->p++;
+
+    if (hp_sigfile_nfa(sf, HP_SCAN_NFA_MATCH, 0, 0, 0,
+                       &match) != HP_STATUS_OK ||
+        hp_sigfile_re_compile(sf, root, match, start) != HP_STATUS_OK)
+    {
+        status = HP_STATUS_ERROR;
+        goto return_status;
+    }
+
+    status = HP_STATUS_OK;
+ return_status:
+    return status;
+}
+
+static hp_status_t hp_sigfile_anchor(hp_sigfile_t *sf, uint32_t off,
+                                     uint32_t len, uint32_t at)
+{
+    hp_scan_anchor_t *anchor;
+    hp_status_t status;
+
+    if (hp_sigfile_grow(sf, (void **)&sf->anchors, &sf->anchor_size,
+                        sf->anchor_count, 1,
+                        sizeof(*sf->anchors)) != HP_STATUS_OK)
+    {
+        status = HP_STATUS_ERROR;
+        goto return_status;
+    }
+    anchor = &sf->anchors[sf->anchor_count++];
+    anchor->string = sf->string_count;
+    anchor->off = off;
+    anchor->len = len;
+    anchor->at = at;
+
+    status = HP_STATUS_OK;
+ return_status:
+    return status;
+}
+
+/* Parse a regex string, anchoring it by its literal prefixes. */
+static hp_status_t hp_sigfile_regex_string(hp_sigfile_t *sf)
+{
+    hp_scan_string_t *string;
+    hp_scan_prefixes_t prefixes;
+    uint32_t start;
+    uint32_t i;
+    hp_status_t status;
+
+    if (hp_sigfile_regex(sf, &start) != HP_STATUS_OK) {
+        status = HP_STATUS_ERROR;
+        goto return_status;
+    }
+    if (hp_scan_regex_prefixes(sf->nfa, sf->nfa_count, sf->bytes, start,
+                               &prefixes) != HP_STATUS_OK)
+    {
+        status = hp_sigfile_fail(sf, "Regex has no literal prefix to find "
+                                 "it by");
+        goto return_status;
+    }
+
+    if (hp_sigfile_grow(sf, (void **)&sf->strings, &sf->string_size,
+                        sf->string_count, 1,
+                        sizeof(*sf->strings)) != HP_STATUS_OK)
+    {
+        status = HP_STATUS_ERROR;
+        goto return_status;
+    }
+    for (i = 0; i < prefixes.count; i++) {
+        if (hp_sigfile_grow(sf, (void **)&sf->bytes, &sf->byte_size,
+                            sf->byte_count, prefixes.len[i],
+                            sizeof(*sf->bytes)) != HP_STATUS_OK ||
+            hp_sigfile_anchor(sf, sf->byte_count, prefixes.len[i],
+                              0) != HP_STATUS_OK)
+        {
+            status = HP_STATUS_ERROR;
+            goto return_status;
+        }
+        memcpy(sf->bytes + sf->byte_count, prefixes.bytes[i],
+               prefixes.len[i]);
+        sf->byte_count += prefixes.len[i];
+    }
+
+    string = &sf->strings[sf->string_count++];
+    string->off = 0;
+    string->mask_off = HP_SCAN_STRING_NO_MASK;
+    string->len = 0;
+    string->regex = start;
+    string->rule = sf->rule_count;
+    /* A match can be waiting on what follows from each offset of the
+     * span before */
+    sf->pending_max += HP_SCAN_RULES_SPAN_MAX;
+
+    status = HP_STATUS_OK;
+ return_status:
+    return status;
+}
+
+/* Parse a string's value, and add it to the rule being parsed. */
+static hp_status_t hp_sigfile_string(hp_sigfile_t *sf)
+{
+    hp_scan_string_t *string;
+    bool masked;
+    uint32_t len;
+    uint32_t at;
+    uint32_t anchor_len;
+    uint32_t i;
+    hp_status_t status;
+
+    if (hp_sigfile_punct(sf, '/')) {
+        status = hp_sigfile_regex_string(sf);
+        goto return_status;
+    }
+    if (hp_sigfile_punct(sf, '"')) {
+        status = hp_sigfile_text(sf, &len);
+    } else if (hp_sigfile_punct(sf, '{')) {
+        status = hp_sigfile_hex(sf, &len);
+    } else {
+        status = hp_sigfile_fail(sf, "Expected a string");
+    }
+    if (status != HP_STATUS_OK)
+        goto return_status;
+    if (len == 0) {
+        status = hp_sigfile_fail(sf, "Empty string");
+        goto return_status;
+    }
+
+    masked = false;
+    for (i = 0; i < len; i++)
+        masked |= (sf->mask[i] != 0xff);
+
+    if (hp_sigfile_grow(sf, (void **)&sf->strings, &sf->string_size,
+                        sf->string_count, 1,
+                        sizeof(*sf->strings)) != HP_STATUS_OK ||
+        hp_sigfile_grow(sf, (void **)&sf->bytes, &sf->byte_size,
+                        sf->byte_count, masked ? (len * 2) : len,
+                        sizeof(*sf->bytes)) != HP_STATUS_OK)
+    {
+        status = HP_STATUS_ERROR;
+        goto return_status;
+    }
+
+    string = &sf->strings[sf->string_count];
+    string->off = sf->byte_count;
+    string->mask_off = HP_SCAN_STRING_NO_MASK;
+    string->len = len;
+    string->regex = HP_SCAN_STRING_NO_REGEX;
+    string->rule = sf->rule_count;
+    memcpy(sf->bytes + sf->byte_count, sf->pat, len);
+    sf->byte_count += len;
+    if (masked) {
+        string->mask_off = sf->byte_count;
+        memcpy(sf->bytes + sf->byte_count, sf->mask, len);
+        sf->byte_count += len;
+    }
+
+    hp_scan_string_anchor(masked ? sf->mask : NULL, len, &at, &anchor_len);
+    if (anchor_len == 0) {
+        status = hp_sigfile_fail(sf, "String is all wildcards");
+        goto return_status;
+    }
+    if (masked) {
+        if (len > HP_SCAN_RULES_SPAN_MAX) {
+            status = hp_sigfile_fail(sf, "String with wildcards too long");
+            goto return_status;
+        }
+        sf->pending_max += len - at - anchor_len;
+    }
+    if (hp_sigfile_anchor(sf, string->off + at, anchor_len,
+                          at) != HP_STATUS_OK)
+    {
+        status = HP_STATUS_ERROR;
+        goto return_status;
+    }
+    sf->string_count++;
+
+    status = HP_STATUS_OK;
+ return_status:
+    return status;
+}
+
+static hp_status_t hp_sigfile_node(hp_sigfile_t *sf, uint32_t op,
+                                   uint32_t a, uint32_t b, uint32_t c,
+                                   uint32_t *node)
+{
+    hp_status_t status;
+
+    if (hp_sigfile_grow(sf, (void **)&sf->nodes, &sf->node_size,
+                        sf->node_count, 1,
+                        sizeof(*sf->nodes)) != HP_STATUS_OK)
+    {
+        status = HP_STATUS_ERROR;
+        goto return_status;
+    }
+    sf->nodes[sf->node_count].op = op;
+    sf->nodes[sf->node_count].a = a;
+    sf->nodes[sf->node_count].b = b;
+    sf->nodes[sf->node_count].c = c;
+    *node = sf->node_count++;
+
+    status = HP_STATUS_OK;
+ return_status:
+    return status;
+}
+
+/**
+ * Parse a string id, past the '$', and look it up in the rule being
+ * parsed.
+ *
+ * @prefix Take a trailing '*', matching all the ids starting with the
+ *         rest of it.
+ * @first Set to the rule's first string the id matches.
+ * @count Set to the no of strings matching, from first.
+ */
+static hp_status_t hp_sigfile_string_id(hp_sigfile_t *sf, bool prefix,
+                                        uint32_t *first, uint32_t *count)
+{
+    hp_scan_rule_t *rule = &sf->rules[sf->rule_count];
+    hp_sigfile_name_t *name;
+    const char *id;
+    uint32_t id_len;
+    bool wildcard;
+    uint32_t i;
+    hp_status_t status;
+
+    for (id = sf->p; hp_sigfile_is_word_char(*sf->p); sf->p++)
+        ;
+    id_len = (uint32_t)(sf->p - id);
+    wildcard = (prefix && *sf->p == '*');
+    if (wildcard)
+        sf->p++;
+
+    *count = 0;
+    for (i = 0; i < rule->string_count; i++) {
+        name = &sf->names[i];
+        if ((wildcard ? (name->len >= id_len) : (name->len == id_len)) &&
+            memcmp(name->name, id, id_len) == 0)
+        {
+            if (*count == 0)
+                *first = rule->first_string + i;
+            (*count)++;
+        }
+    }
+    if (*count == 0) {
+        status = hp_sigfile_fail(sf, "Unknown string");
+        goto return_status;
+    }
+
+    status = HP_STATUS_OK;
+ return_status:
+    return status;
+}
+
+/* Parse "them" or ($a, $b*), and list the strings they stand for. */
+static hp_status_t hp_sigfile_string_set(hp_sigfile_t *sf,
+                                         uint32_t *refs, uint32_t *ref_count)
+{
+    hp_scan_rule_t *rule = &sf->rules[sf->rule_count];
+    uint32_t first;
+    uint32_t count;
+    uint32_t i, j;
+    hp_status_t status;
+
+    *refs = sf->ref_count;
+    if (hp_sigfile_keyword(sf, "them")) {
+        first = rule->first_string;
+        count = rule->string_count;
+        if (hp_sigfile_grow(sf, (void **)&sf->refs, &sf->ref_size,
+                            sf->ref_count, count,
+                            sizeof(*sf->refs)) != HP_STATUS_OK)
+        {
+            status = HP_STATUS_ERROR;
+            goto return_status;
+        }
+        for (i = 0; i < count; i++)
+            sf->refs[sf->ref_count++] = first + i;
+        goto done;
+    }
+
+    if (!hp_sigfile_punct(sf, '(')) {
+        status = hp_sigfile_fail(sf, "Expected them or a list of strings");
+        goto return_status;
+    }
+    do {
+        if (!hp_sigfile_punct(sf, '$')) {
+            status = hp_sigfile_fail(sf, "Expected a string");
+            goto return_status;
+        }
+        if (hp_sigfile_string_id(sf, true, &first, &count) != HP_STATUS_OK ||
+            hp_sigfile_grow(sf, (void **)&sf->refs, &sf->ref_size,
+                            sf->ref_count, count,
+                            sizeof(*sf->refs)) != HP_STATUS_OK)
+        {
+            status = HP_STATUS_ERROR;
+            goto return_status;
+        }
+        /* Listed more than once, a string still counts once */
+        for (i = first; i < first + count; i++) {
+            for (j = *refs; j < sf->ref_count && sf->refs[j] != i; j++)
+                ;
+            if (j == sf->ref_count)
+                sf->refs[sf->ref_count++] = i;
+        }
+    } while (hp_sigfile_punct(sf, ','));
+    if (!hp_sigfile_punct(sf, ')')) {
+        status = hp_sigfile_fail(sf, "Expected )");
+        goto return_status;
+    }
+
+ done:
+    *ref_count = sf->ref_count - *refs;
+
+    status = HP_STATUS_OK;
+ return_status:
+    return status;
+}
+
+/* Parse <attr>[+<attr>] into HP_SCAN_REGION_* attributes. */
+static hp_status_t hp_sigfile_region(hp_sigfile_t *sf, uint32_t *region)
+{
+    static const struct {
+        const char *name;
+        uint32_t attr;
+    } attrs[] = {
+        { "PRIVATE", HP_SCAN_REGION_PRIVATE },
+        { "MAPPED", HP_SCAN_REGION_MAPPED },
+        { "IMAGE", HP_SCAN_REGION_IMAGE },
+        { "READ", HP_SCAN_REGION_READ },
+        { "WRITE", HP_SCAN_REGION_WRITE },
+        { "EXECUTE", HP_SCAN_REGION_EXECUTE },
+    };
+    uint32_t i;
+    hp_status_t status;
+
+    *region = 0;
+    do {
+        for (i = 0; i < sizeof(attrs) / sizeof(attrs[0]); i++) {
+            if (hp_sigfile_keyword(sf, attrs[i].name))
+                break;
+        }
+        if (i == sizeof(attrs) / sizeof(attrs[0])) {
+            status = hp_sigfile_fail(sf, "Unknown region attribute");
+            goto return_status;
+        }
+        *region |= attrs[i].attr;
+    } while (hp_sigfile_punct(sf, '+'));
+
+    status = HP_STATUS_OK;
+ return_status:
+    return status;
+}
+
+static hp_status_t hp_sigfile_or(hp_sigfile_t *sf, uint32_t *node);
+
+static hp_status_t hp_sigfile_factor(hp_sigfile_t *sf, uint32_t *node)
+{
+    const hp_scan_rule_t *rule = &sf->rules[sf->rule_count];
+    const char *word;
+    uint32_t word_len;
+    uint32_t n;
+    uint32_t refs;
+    uint32_t ref_count;
+    uint32_t first;
+    uint32_t count;
+    uint32_t region;
+    hp_status_t status;
+
+    if (++sf->depth > HP_SIGFILE_DEPTH_MAX) {
+        status = hp_sigfile_fail(sf, "Condition nested too deep");
+        goto return_status;
+    }
+
+    if (hp_sigfile_keyword(sf, "not")) {
+        if (hp_sigfile_factor(sf, &n) != HP_STATUS_OK ||
+            hp_sigfile_node(sf, HP_SCAN_OP_NOT, n, 0, 0,
+                            node) != HP_STATUS_OK)
+        {
+            status = HP_STATUS_ERROR;
+            goto return_status;
+        }
+    } else if (hp_sigfile_punct(sf, '(')) {
+        if (hp_sigfile_or(sf, node) != HP_STATUS_OK) {
+            status = HP_STATUS_ERROR;
+            goto return_status;
+        }
+        if (!hp_sigfile_punct(sf, ')')) {
+            status = hp_sigfile_fail(sf, "Expected )");
+            goto return_status;
+        }
+    } else if (hp_sigfile_punct(sf, '$')) {
+        if (hp_sigfile_string_id(sf, false, &first,
+                                 &count) != HP_STATUS_OK ||
+            hp_sigfile_node(sf, HP_SCAN_OP_STRING, first, 0, 0,
+                            node) != HP_STATUS_OK)
+        {
+            status = HP_STATUS_ERROR;
+            goto return_status;
+        }
+    } else if (hp_sigfile_keyword(sf, "region")) {
+        if (!hp_sigfile_keyword(sf, "is")) {
+            status = hp_sigfile_fail(sf, "Expected is");
+            goto return_status;
+        }
+        if (hp_sigfile_region(sf, &region) != HP_STATUS_OK ||
+            hp_sigfile_node(sf, HP_SCAN_OP_REGION, region, 0, 0,
+                            node) != HP_STATUS_OK)
+        {
+            status = HP_STATUS_ERROR;
+            goto return_status;
+        }
+    } else {
+        /* <n> of <strings> */
+        word_len = hp_sigfile_word(sf, &word);
+        if (word_len == 3 && strncmp(word, "any", 3) == 0) {
+            n = 1;
+        } else if (word_len == 3 && strncmp(word, "all", 3) == 0) {
+            n = UINT32_MAX;
+        } else if (word_len > 0 && word_len < 10 &&
+                   strspn(word, "0123456789") == word_len)
+        {
+            n = (uint32_t)strtoul(word, NULL, 10);
+        } else {
+            status = hp_sigfile_fail(sf, "Expected a condition");
+            goto return_status;
+        }
+        if (!hp_sigfile_keyword(sf, "of")) {
+            status = hp_sigfile_fail(sf, "Expected of");
+            goto return_status;
+        }
+        if (hp_sigfile_string_set(sf, &refs, &ref_count) != HP_STATUS_OK) {
+            status = HP_STATUS_ERROR;
+            goto return_status;
+        }
+        if (n == UINT32_MAX)
+            n = ref_count;
+        if (n > ref_count || rule->string_count == 0) {
+            status = hp_sigfile_fail(sf, "More strings asked for than "
+                                     "there are");
+            goto return_status;
+        }
+        if (hp_sigfile_node(sf, HP_SCAN_OP_OF, n, ref_count, refs,
+                            node) != HP_STATUS_OK)
+        {
+            status = HP_STATUS_ERROR;
+            goto return_status;
+        }
+    }
+
+    status = HP_STATUS_OK;
+ return_status:
+    sf->depth--;
+    return status;
+}
+
+static hp_status_t hp_sigfile_and(hp_sigfile_t *sf, uint32_t *node)
+{
+    uint32_t r;
+    hp_status_t status;
+
+    if (hp_sigfile_factor(sf, node) != HP_STATUS_OK) {
+        status = HP_STATUS_ERROR;
+        goto return_status;
+    }
+    while (hp_sigfile_keyword(sf, "and")) {
+        if (hp_sigfile_factor(sf, &r) != HP_STATUS_OK ||
+            hp_sigfile_node(sf, HP_SCAN_OP_AND, *node, r, 0,
+                            node) != HP_STATUS_OK)
+        {
+            status = HP_STATUS_ERROR;
+            goto return_status;
+        }
+    }
+
+    status = HP_STATUS_OK;
+ return_status:
+    return status;
+}
+
+static hp_status_t hp_sigfile_or(hp_sigfile_t *sf, uint32_t *node)
+{
+    uint32_t r;
+    hp_status_t status;
+
+    if (hp_sigfile_and(sf, node) != HP_STATUS_OK) {
+        status = HP_STATUS_ERROR;
+        goto return_status;
+    }
+    while (hp_sigfile_keyword(sf, "or")) {
+        if (hp_sigfile_and(sf, &r) != HP_STATUS_OK ||
+            hp_sigfile_node(sf, HP_SCAN_OP_OR, *node, r, 0,
+                            node) != HP_STATUS_OK)
+        {
+            status = HP_STATUS_ERROR;
+            goto return_status;
+        }
+    }
+
+    status = HP_STATUS_OK;
+ return_status:
+    return status;
+}
+
+/* Start a rule, checking its name is new. */
+static hp_status_t hp_sigfile_rule_begin(hp_sigfile_t *sf,
+                                         const char *name, uint32_t name_len)
+{
+    hp_scan_rule_t *rule;
+    char *name_copy;
+    uint32_t i;
+    hp_status_t status;
+
+    if (name_len == 0) {
+        status = hp_sigfile_fail(sf, "Expected a rule name");
+        goto return_status;
+    }
+    for (i = 0; i < sf->rule_count; i++) {
+        if (strlen(sf->rules[i].name) == name_len &&
+            memcmp(sf->rules[i].name, name, name_len) == 0)
+        {
+            status = hp_sigfile_fail(sf, "Duplicate rule name");
+            goto return_status;
+        }
+    }
+
+    if (hp_sigfile_grow(sf, (void **)&sf->rules, &sf->rule_size,
+                        sf->rule_count, 1,
+                        sizeof(*sf->rules)) != HP_STATUS_OK)
+    {
+        status = HP_STATUS_ERROR;
+        goto return_status;
+    }
+    if ((name_copy = (char *)malloc(name_len + 1)) == NULL) {
+        hp_log_error("malloc() failure.");
+        status = hp_sigfile_fail(sf, "Out of memory");
+        goto return_status;
+    }
+    memcpy(name_copy, name, name_len);
+    name_copy[name_len] = '\0';
+
+    rule = &sf->rules[sf->rule_count];
+    memset(rule, 0, sizeof(*rule));
+    rule->name = name_copy;
+    rule->first_string = sf->string_count;
+
+    status = HP_STATUS_OK;
+ return_status:
+    return status;
+}
+
+/* Parse a string definition, $<id> = <value>, past the '$'. */
+static hp_status_t hp_sigfile_string_def(hp_sigfile_t *sf)
+{
+    hp_scan_rule_t *rule = &sf->rules[sf->rule_count];
+    const char *id;
+    uint32_t id_len;
+    uint32_t i;
+    hp_status_t status;
+
+    for (id = sf->p; hp_sigfile_is_word_char(*sf->p); sf->p++)
+        ;
+    id_len = (uint32_t)(sf->p - id);
+    for (i = 0; i < rule->string_count; i++) {
+        if (sf->names[i].len == id_len &&
+            memcmp(sf->names[i].name, id, id_len) == 0)
+        {
+            status = hp_sigfile_fail(sf, "Duplicate string");
+            goto return_status;
+        }
+    }
+    if (!hp_sigfile_punct(sf, '=')) {
+        status = hp_sigfile_fail(sf, "Expected =");
+        goto return_status;
+    }
+    if (hp_sigfile_grow(sf, (void **)&sf->names, &sf->name_size,
+                        rule->string_count, 1,
+                        sizeof(*sf->names)) != HP_STATUS_OK ||
+        hp_sigfile_string(sf) != HP_STATUS_OK)
+    {
+        status = HP_STATUS_ERROR;
+        goto return_status;
+    }
+    sf->names[rule->string_count].name = id;
+    sf->names[rule->string_count].len = id_len;
+    rule->string_count++;
+
+    status = HP_STATUS_OK;
+ return_status:
+    return status;
+}
+
+/* Parse a rule, past its name. */
+static hp_status_t hp_sigfile_rule(hp_sigfile_t *sf)
+{
+    hp_scan_rule_t *rule = &sf->rules[sf->rule_count];
+    hp_status_t status;
+
+    if (!hp_sigfile_punct(sf, '{')) {
+        status = hp_sigfile_fail(sf, "Expected {");
+        goto return_status;
+    }
+
+    if (hp_sigfile_keyword(sf, "strings")) {
+        if (!hp_sigfile_punct(sf, ':')) {
+            status = hp_sigfile_fail(sf, "Expected :");
+            goto return_status;
+        }
+        while (hp_sigfile_punct(sf, '$')) {
+            if (hp_sigfile_string_def(sf) != HP_STATUS_OK) {
+                status = HP_STATUS_ERROR;
+                goto return_status;
+            }
+        }
+    }
+
+    if (!hp_sigfile_keyword(sf, "condition") || !hp_sigfile_punct(sf, ':')) {
+        status = hp_sigfile_fail(sf, "Expected condition:");
+        goto return_status;
+    }
+    if (hp_sigfile_or(sf, &rule->condition) != HP_STATUS_OK) {
+        status = HP_STATUS_ERROR;
+        goto return_status;
+    }
+    if (!hp_sigfile_punct(sf, '}')) {
+        status = hp_sigfile_fail(sf, "Expected }");
+        goto return_status;
+    }
+
+    status = HP_STATUS_OK;
+ return_status:
+    return status;
+}
+
+/* Parse a rule given as <name> = <value>, past the name, into a rule
+ * with the one string as its condition. */
+static hp_status_t hp_sigfile_short_rule(hp_sigfile_t *sf)
+{
+    hp_scan_rule_t *rule = &sf->rules[sf->rule_count];
+    hp_status_t status;
+
+    if (!hp_sigfile_punct(sf, '=')) {
+        status = hp_sigfile_fail(sf, "Expected =");
+        goto return_status;
+    }
+    if (hp_sigfile_string(sf) != HP_STATUS_OK ||
+        hp_sigfile_node(sf, HP_SCAN_OP_STRING, rule->first_string, 0, 0,
+                        &rule->condition) != HP_STATUS_OK)
+    {
+        status = HP_STATUS_ERROR;
+        goto return_status;
+    }
+    rule->string_count = 1;
+
+    status = HP_STATUS_OK;
+ return_status:
+    return status;
+}
+
+static hp_status_t hp_sigfile_read(hp_sigfile_t *sf, const char *path)
+{
+    FILE *fp;
+    long size;
+    size_t len;
+    hp_status_t status;
+
+    if ((fp = fopen(path, "rb")) == NULL) {
+        hp_log_error("Error opening signature file \"%s\".", path);
+        status = HP_STATUS_ERROR;
+        goto return_status;
+    }
+    if (fseek(fp, 0, SEEK_END) != 0 || (size = ftell(fp)) < 0 ||
+        fseek(fp, 0, SEEK_SET) != 0)
+    {
+        hp_log_error("Error reading signature file \"%s\".", path);
+        status = HP_STATUS_ERROR;
+        goto return_status;
+    }
+    if ((sf->text = (char *)malloc((size_t)size + 1)) == NULL) {
+        hp_log_error("malloc() failure.");
+        status = HP_STATUS_ERROR;
+        goto return_status;
+    }
+    len = fread(sf->text, 1, (size_t)size, fp);
+    sf->text[len] = '\0';
+    if (strlen(sf->text) != len) {
+        hp_log_error("Signature file \"%s\" isn't text.", path);
+        status = HP_STATUS_ERROR;
+        goto return_status;
+    }
+    sf->p = sf->text;
+    sf->line = 1;
+
+    status = HP_STATUS_OK;
+ return_status:
+    if (fp != NULL)
+        fclose(fp);
+    return status;
+}
+
+hp_status_t hp_sigfile_load(const char *path, hp_scan_rules_t *rules)
+{
+    hp_sigfile_t *sf;
+    const char *name;
+    uint32_t name_len;
+    bool full;
+    bool parsed;
+    hp_status_t status;
+
+    memset(rules, 0, sizeof(*rules));
+
+    if ((sf = (hp_sigfile_t *)malloc(sizeof(*sf))) == NULL) {
+        hp_log_error("malloc() failure.");
+        status = HP_STATUS_ERROR;
+        goto return_status;
+    }
+    memset(sf, 0, sizeof(*sf));
+    if (hp_sigfile_read(sf, path) != HP_STATUS_OK) {
+        status = HP_STATUS_ERROR;
+        goto return_status;
+    }
+
+    while (1) {
+        hp_sigfile_skip(sf);
+        if (*sf->p == '\0')
+            break;
+
+        name_len = hp_sigfile_word(sf, &name);
+        full = false;
+        if (name_len == 4 && strncmp(name, "rule", 4) == 0) {
+            hp_sigfile_skip(sf);
+            if (*sf->p != '=') {
+                name_len = hp_sigfile_word(sf, &name);
+                full = true;
+            }
+        }
+
+        /* Once begun, a rule is counted in even if it fails to parse, so
+         * that its name is freed with the others */
+        parsed = false;
+        if (hp_sigfile_rule_begin(sf, name, name_len) == HP_STATUS_OK) {
+            parsed = ((full ? hp_sigfile_rule(sf) :
+                       hp_sigfile_short_rule(sf)) == HP_STATUS_OK);
+            sf->rule_count++;
+        }
+        if (!parsed) {
+            if (sf->error != NULL) {
+                hp_log_error("%s at line %u of \"%s\".",
+                             sf->error, sf->line, path);
+            }
+            status = HP_STATUS_ERROR;
+            goto return_status;
+        }
+    }
+
+    status = HP_STATUS_OK;
+ return_status:
+    if (sf != NULL) {
+        /* Handed over as they are, even if only to be freed */
+        rules->rules = sf->rules;
+        rules->rule_count = sf->rule_count;
+        rules->strings = sf->strings;
+        rules->string_count = sf->string_count;
+        rules->nodes = sf->nodes;
+        rules->node_count = sf->node_count;
+        rules->string_refs = sf->refs;
+        rules->string_ref_count = sf->ref_count;
+        rules->anchors = sf->anchors;
+        rules->anchor_count = sf->anchor_count;
+        rules->nfa = sf->nfa;
+        rules->nfa_count = sf->nfa_count;
+        rules->bytes = sf->bytes;
+        rules->byte_count = sf->byte_count;
+        rules->pending_max = sf->pending_max;
+        free(sf->names);
+        free(sf->re);
+        free(sf->text);
+        free(sf);
+    }
+    if (status != HP_STATUS_OK)
+        hp_sigfile_free(rules);
+    return status;
+}
+
+void hp_sigfile_free(hp_scan_rules_t *rules)
+{
+    uint32_t i;
+
+    for (i = 0; i < rules->rule_count; i++)
+        free((void *)rules->rules[i].name);
+    free((void *)rules->rules);
+    free((void *)rules->strings);
+    free((void *)rules->nodes);
+    free((void *)rules->string_refs);
+    free((void *)rules->anchors);
+    free((void *)rules->nfa);
+    free((void *)rules->bytes);
+    memset(rules, 0, sizeof(*rules));
+
+    return;
+}
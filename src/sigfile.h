@@ -0,0 +1,70 @@
+/**
+ * Copyright(C) 2018, Juniper Networks, Inc.
+ * All rights reserved
+ *
+ * This SOFTWARE is licensed under the license provided in the LICENSE.txt
+ * file.  By downloading, installing, copying, or otherwise using the
+ * SOFTWARE, you agree to be bound by the terms of that license.  This
+ * SOFTWARE is not an official Juniper product.
+ *
+ * Third-Party Code: This SOFTWARE may depend on other components under
+ * separate copyright notice and license terms.  Your use of the source
+ * code for those components is subject to the term and conditions of
+ * the respective license as noted in the Third-Party source code.
+ */
+
+/**
+ * @author Anoop Saldanha
+ */
+/* Signature files, holding rules -
+ *
+ *   rule <name> {
+ *       strings:
+ *           $<id> = "<text>"
+ *           $<id> = { <hex bytes> }
+ *           $<id> = /<regex>/
+ *       condition:
+ *           <condition>
+ *   }
+ *
+ * Text takes the \\, \", \n, \r, \t and \xHH escapes.  In hex, ?? stands
+ * for any byte, and a ? in place of either digit for any nibble.  Regexes
+ * are over bytes, and take ., [...] and [^...] classes, groups, |, *, +,
+ * ?, {n}, {n,} and {n,m}, and the \xHH, \n, \r, \t, \d, \w, \s, \D, \W
+ * and \S escapes, with . taking any byte and / escaped as \/.  A match
+ * can be at most HP_SCAN_RULES_SPAN_MAX bytes, and matches have to start
+ * with some literal bytes, for the regex to be found by - /ab+c/ or
+ * /(GET|POST) / will do, /.*x/ or /[a-z]+/ won't.  A condition is made
+ * of
+ *
+ *   $<id>                        the string matched
+ *   any|all|<n> of them          of the rule's strings
+ *   any|all|<n> of ($a, $b*)     of those listed, $b* being all of the
+ *                                ids starting with b
+ *   region is <attr>[+<attr>]    PRIVATE, MAPPED, IMAGE, READ, WRITE
+ *                                and EXECUTE
+ *
+ * joined with not, and, or and parentheses.  The strings section can be
+ * left out.  A rule with a single string can also be given on a line of
+ * its own -
+ *
+ *   <name> = "<text>" | { <hex bytes> } | /<regex>/
+ *
+ * '#' starts a comment, running to the end of the line. */
+
+#ifndef __SIGFILE__H__
+#define __SIGFILE__H__
+
+#include "honeyprocs-common.h"
+#include "scan-rules.h"
+#include "status.h"
+
+/**
+ * Parse a signature file into rules, in file order.  Their tables are
+ * left NULL, to be compiled from the anchors by the caller.  The rules
+ * are to be freed with hp_sigfile_free().
+ */
+hp_status_t hp_sigfile_load(const char *path, hp_scan_rules_t *rules);
+void hp_sigfile_free(hp_scan_rules_t *rules);
+
+#endif /* __SIGFILE__H__ */
@@ -0,0 +1,72 @@
+/**
+ * Copyright(C) 2018, Juniper Networks, Inc.
+ * All rights reserved
+ *
+ * This SOFTWARE is licensed under the license provided in the LICENSE.txt
+ * file.  By downloading, installing, copying, or otherwise using the
+ * SOFTWARE, you agree to be bound by the terms of that license.  This
+ * SOFTWARE is not an official Juniper product.
+ *
+ * Third-Party Code: This SOFTWARE may depend on other components under
+ * separate copyright notice and license terms.  Your use of the source
+ * code for those components is subject to the term and conditions of
+ * the respective license as noted in the Third-Party source code.
+ */
+
+/**
+ * @author Anoop Saldanha
+ */
+#include "honeyprocs-common.h"
+#include "signatures.h"
+#include "scan-engine.h"
+#include "scan-rules.h"
+#include "sigfile.h"
+#include "status.h"
+#include "util-log.h"
+
+/* Generated by sigc from signatures.txt */
+#include "signatures-gen.h"
+
+void hp_signatures_builtin(hp_signature_set_t *set)
+{
+    memset(set, 0, sizeof(*set));
+    set->rules = &hp_builtin_rules;
+
+    return;
+}
+
+hp_status_t hp_signatures_load(hp_signature_set_t *set, const char *path)
+{
+    hp_status_t status;
+
+    memset(set, 0, sizeof(*set));
+
+    if (hp_sigfile_load(path, &set->loaded) != HP_STATUS_OK ||
+        hp_scan_engine_init(&set->engine) != HP_STATUS_OK ||
+        hp_scan_rules_add_anchors(&set->loaded,
+                                  set->engine) != HP_STATUS_OK ||
+        hp_scan_engine_compile(set->engine) != HP_STATUS_OK)
+    {
+        hp_signatures_deinit(set);
+        status = HP_STATUS_ERROR;
+        goto return_status;
+    }
+    set->loaded.tables = hp_scan_engine_tables(set->engine);
+    set->rules = &set->loaded;
+    hp_log_info("Loaded %u rules with %u strings from \"%s\".",
+                set->loaded.rule_count, set->loaded.string_count, path);
+
+    status = HP_STATUS_OK;
+ return_status:
+    return status;
+}
+
+void hp_signatures_deinit(hp_signature_set_t *set)
+{
+    if (set->engine != NULL)
+        hp_scan_engine_deinit(set->engine);
+    hp_sigfile_free(&set->loaded);
+    memset(set, 0, sizeof(*set));
+
+    return;
+}
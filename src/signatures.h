@@ -0,0 +1,49 @@
+/**
+ * Copyright(C) 2018, Juniper Networks, Inc.
+ * All rights reserved
+ *
+ * This SOFTWARE is licensed under the license provided in the LICENSE.txt
+ * file.  By downloading, installing, copying, or otherwise using the
+ * SOFTWARE, you agree to be bound by the terms of that license.  This
+ * SOFTWARE is not an official Juniper product.
+ *
+ * Third-Party Code: This SOFTWARE may depend on other components under
+ * separate copyright notice and license terms.  Your use of the source
+ * code for those components is subject to the term and conditions of
+ * the respective license as noted in the Third-Party source code.
+ */
+
+/**
+ * @author Anoop Saldanha
+ */
+/* Rules for known payloads, looked for in the executable memory that
+ * appears in a honeyproc.  The built in set comes from signatures.txt,
+ * compiled into static rules and scan tables at build time, and a set can
+ * also be loaded from a signature file at runtime. */
+
+#ifndef __SIGNATURES__H__
+#define __SIGNATURES__H__
+
+#include "honeyprocs-common.h"
+#include "scan-engine.h"
+#include "scan-rules.h"
+#include "status.h"
+
+/* Rules ready to scan with */
+typedef struct hp_signature_set_t {
+    const hp_scan_rules_t *rules;
+    /* Owned by a set loaded at runtime.  Unused by the built in one. */
+    hp_scan_rules_t loaded;
+    hp_scan_engine_t *engine;
+} hp_signature_set_t;
+
+/* The built in set.  Its rules and tables are static, so this allocates
+ * nothing. */
+void hp_signatures_builtin(hp_signature_set_t *set);
+
+/* Load a set from a signature file, and compile its anchors. */
+hp_status_t hp_signatures_load(hp_signature_set_t *set, const char *path);
+
+void hp_signatures_deinit(hp_signature_set_t *set);
+
+#endif /* __SIGNATURES__H__ */
@@ -0,0 +1,323 @@
+/**
+ * Copyright(C) 2018, Juniper Networks, Inc.
+ * All rights reserved
+ *
+ * This SOFTWARE is licensed under the license provided in the LICENSE.txt
+ * file.  By downloading, installing, copying, or otherwise using the
+ * SOFTWARE, you agree to be bound by the terms of that license.  This
+ * SOFTWARE is not an official Juniper product.
+ *
+ * Third-Party Code: This SOFTWARE may depend on other components under
+ * separate copyright notice and license terms.  Your use of the source
+ * code for those components is subject to the term and conditions of
+ * the respective license as noted in the Third-Party source code.
+ */
+
+/**
+ * @author Anoop Saldanha
+ */
+
+/* Randomised test of the arena, over a range of object and slab sizes.
+ * Objects are filled with a pattern of their own while live, so that two
+ * handed out over each other show up.  Freed objects have to come back
+ * last in first out, and after a reset the arena has to hand out the
+ * objects it already has before it allocates another slab.
+ *
+ * arena-test.exe [<seed> [<ops_per_arena>]] */
+
+#include "honeyprocs-common.h"
+#include "util-arena.h"
+#include "util-log.h"
+#include "status.h"
+
+#define HP_ARENA_TEST_OPS_DEFAULT 20000
+/* Live objects at most, and objects handed out in all per arena */
+#define HP_ARENA_TEST_LIVE_MAX 512
+#define HP_ARENA_TEST_SEEN_MAX (HP_ARENA_TEST_LIVE_MAX + 256)
+
+typedef struct hp_arena_test_t {
+    hp_arena_t arena;
+    size_t obj_size;
+    uint32_t objs_per_slab;
+    /* Live objects and the byte each is filled with */
+    uint8_t *live[HP_ARENA_TEST_LIVE_MAX];
+    uint8_t fill[HP_ARENA_TEST_LIVE_MAX];
+    uint32_t live_count;
+    /* Every object handed out since the arena was inited */
+    uint8_t *seen[HP_ARENA_TEST_SEEN_MAX];
+    uint32_t seen_count;
+    uint64_t rng;
+    uint64_t ops;
+    uint64_t resets;
+} hp_arena_test_t;
+
+#define hp_arena_test_fail(test, ...)                                   \
+    do {                                                                \
+        printf("arena-test: %s:%d: objects of %zu, %u per slab, "       \
+               "after %" PRIu64 " ops: ", __FILE__, __LINE__,           \
+               (test)->obj_size, (test)->objs_per_slab, (test)->ops);   \
+        printf(__VA_ARGS__);                                            \
+        printf("\n");                                                   \
+        return HP_STATUS_ERROR;                                         \
+    } while (0)
+
+/* Slabs allocated, counted through the linker's --wrap */
+static uint64_t g_hp_arena_test_mallocs;
+
+void *__real_malloc(size_t size);
+
+void *__wrap_malloc(size_t size)
+{
+    g_hp_arena_test_mallocs++;
+
+    return __real_malloc(size);
+}
+
+/* xorshift64* */
+static uint32_t hp_arena_test_rand(hp_arena_test_t *test)
+{
+    test->rng ^= test->rng >> 12;
+    test->rng ^= test->rng << 25;
+    test->rng ^= test->rng >> 27;
+
+    return (uint32_t)((test->rng * 0x2545F4914F6CDD1DULL) >> 32);
+}
+
+static bool hp_arena_test_seen(hp_arena_test_t *test, uint8_t *obj)
+{
+    uint32_t i;
+
+    for (i = 0; i < test->seen_count; i++) {
+        if (test->seen[i] == obj)
+            return true;
+    }
+
+    return false;
+}
+
+static hp_status_t hp_arena_test_check(hp_arena_test_t *test, uint32_t i)
+{
+    size_t j;
+
+    for (j = 0; j < test->obj_size; j++) {
+        if (test->live[i][j] != test->fill[i]) {
+            hp_arena_test_fail(test, "byte %zu of object %p is 0x%02x, "
+                               "0x%02x expected", j, (void *)test->live[i],
+                               test->live[i][j], test->fill[i]);
+        }
+    }
+
+    return HP_STATUS_OK;
+}
+
+/**
+ * @expected The object the arena should hand out, or NULL for any not
+ *           live.
+ */
+static hp_status_t hp_arena_test_alloc(hp_arena_test_t *test,
+                                       uint8_t *expected)
+{
+    uint8_t *obj;
+    uint32_t i;
+
+    test->ops++;
+    obj = (uint8_t *)hp_arena_alloc(&test->arena);
+    if (obj == NULL)
+        hp_arena_test_fail(test, "hp_arena_alloc() failed");
+    if (((uintptr_t)obj % 8) != 0)
+        hp_arena_test_fail(test, "object %p isn't 8 byte aligned",
+                           (void *)obj);
+    if (expected != NULL && obj != expected) {
+        hp_arena_test_fail(test, "object %p handed out, %p expected",
+                           (void *)obj, (void *)expected);
+    }
+    if (!hp_arena_test_seen(test, obj)) {
+        if (test->seen_count == HP_ARENA_TEST_SEEN_MAX)
+            hp_arena_test_fail(test, "too many objects handed out");
+        test->seen[test->seen_count++] = obj;
+    }
+    for (i = 0; i < test->live_count; i++) {
+        if (test->live[i] == obj)
+            hp_arena_test_fail(test, "object %p is live", (void *)obj);
+    }
+
+    i = test->live_count++;
+    test->live[i] = obj;
+    test->fill[i] = (uint8_t)hp_arena_test_rand(test);
+    memset(obj, test->fill[i], test->obj_size);
+
+    return HP_STATUS_OK;
+}
+
+static hp_status_t hp_arena_test_free(hp_arena_test_t *test, uint32_t i)
+{
+    test->ops++;
+    if (hp_arena_test_check(test, i) != HP_STATUS_OK)
+        return HP_STATUS_ERROR;
+    hp_arena_free(&test->arena, test->live[i]);
+    test->live_count--;
+    test->live[i] = test->live[test->live_count];
+    test->fill[i] = test->fill[test->live_count];
+
+    return HP_STATUS_OK;
+}
+
+/* Free a few objects, which have to come back in the reverse order. */
+static hp_status_t hp_arena_test_reuse(hp_arena_test_t *test)
+{
+    uint8_t *freed[8];
+    uint32_t count;
+    uint32_t i;
+
+    count = 1 + hp_arena_test_rand(test) % 8;
+    if (count > test->live_count)
+        count = test->live_count;
+    for (i = 0; i < count; i++) {
+        freed[i] = test->live[test->live_count - 1];
+        if (hp_arena_test_free(test, test->live_count - 1) != HP_STATUS_OK)
+            return HP_STATUS_ERROR;
+    }
+    while (count > 0) {
+        if (hp_arena_test_alloc(test, freed[--count]) != HP_STATUS_OK)
+            return HP_STATUS_ERROR;
+    }
+
+    return HP_STATUS_OK;
+}
+
+/* Everything the arena has goes back at once.  It has to hand out all of
+ * its slabs' objects again, each of them once, before it allocates
+ * another slab. */
+static hp_status_t hp_arena_test_reset(hp_arena_test_t *test,
+                                       uint64_t slabs)
+{
+    uint64_t capacity = slabs * test->objs_per_slab;
+    uint64_t mallocs;
+    uint32_t i;
+
+    /* Every object handed out so far lies in the slabs */
+    if (test->seen_count > capacity) {
+        hp_arena_test_fail(test, "%u objects out of %" PRIu64 " slabs",
+                           test->seen_count, slabs);
+    }
+
+    test->ops++;
+    test->resets++;
+    for (i = 0; i < test->live_count; i++) {
+        if (hp_arena_test_check(test, i) != HP_STATUS_OK)
+            return HP_STATUS_ERROR;
+    }
+    hp_arena_reset(&test->arena);
+    test->live_count = 0;
+
+    mallocs = g_hp_arena_test_mallocs;
+    for (i = 0; i < capacity && i < HP_ARENA_TEST_LIVE_MAX; i++) {
+        if (hp_arena_test_alloc(test, NULL) != HP_STATUS_OK)
+            return HP_STATUS_ERROR;
+    }
+    if (g_hp_arena_test_mallocs != mallocs) {
+        hp_arena_test_fail(test, "%" PRIu64 " slabs allocated after a "
+                           "reset, with %" PRIu64 " kept",
+                           g_hp_arena_test_mallocs - mallocs, slabs);
+    }
+    if (capacity >= HP_ARENA_TEST_LIVE_MAX)
+        return HP_STATUS_OK;
+
+    /* The slabs are used up, by the objects handed out before and no
+     * others, so the next takes a new slab. */
+    if (test->seen_count != capacity) {
+        hp_arena_test_fail(test, "%u objects out of %" PRIu64 " slabs",
+                           test->seen_count, slabs);
+    }
+    if (hp_arena_test_alloc(test, NULL) != HP_STATUS_OK)
+        return HP_STATUS_ERROR;
+    if (g_hp_arena_test_mallocs != mallocs + 1) {
+        hp_arena_test_fail(test, "%" PRIu64 " slabs allocated past the "
+                           "%" PRIu64 " kept", g_hp_arena_test_mallocs -
+                           mallocs, slabs);
+    }
+
+    return HP_STATUS_OK;
+}
+
+static hp_status_t hp_arena_test_run(hp_arena_test_t *test, uint64_t ops)
+{
+    uint64_t mallocs;
+    uint64_t slabs;
+    uint32_t live_max;
+    uint32_t r;
+    uint64_t i;
+    hp_status_t status;
+
+    hp_arena_init(&test->arena, test->obj_size, test->objs_per_slab);
+    test->live_count = 0;
+    test->seen_count = 0;
+    /* Grow and shrink around a random peak */
+    live_max = 1 + hp_arena_test_rand(test) % HP_ARENA_TEST_LIVE_MAX;
+    mallocs = g_hp_arena_test_mallocs;
+
+    for (i = 0; i < ops; i++) {
+        r = hp_arena_test_rand(test) % 1000;
+        if (r == 0) {
+            slabs = g_hp_arena_test_mallocs - mallocs;
+            status = hp_arena_test_reset(test, slabs);
+        } else if (r < 50) {
+            status = hp_arena_test_reuse(test);
+        } else if (test->live_count != 0 &&
+                   (test->live_count == live_max || r < 500))
+        {
+            status = hp_arena_test_free(test, hp_arena_test_rand(test) %
+                                        test->live_count);
+        } else if (test->live_count < live_max) {
+            status = hp_arena_test_alloc(test, NULL);
+        } else {
+            status = HP_STATUS_OK;
+        }
+        if (status != HP_STATUS_OK)
+            goto return_status;
+    }
+
+    status = HP_STATUS_OK;
+ return_status:
+    hp_arena_deinit(&test->arena);
+    return status;
+}
+
+int main(int argc, char *argv[])
+{
+    static const size_t obj_sizes[] = { 1, 7, 8, 24, 100 };
+    static const uint32_t objs_per_slab[] = { 1, 2, 16, 256 };
+    static hp_arena_test_t test;
+    uint64_t seed;
+    uint64_t ops;
+    uint32_t i, j;
+    int ret = EXIT_FAILURE;
+
+    seed = (argc > 1) ? strtoull(argv[1], NULL, 0) : 1;
+    ops = (argc > 2) ? strtoull(argv[2], NULL, 0) :
+        HP_ARENA_TEST_OPS_DEFAULT;
+    test.rng = seed | 1;
+
+    hp_log_init(HP_LOG_LEVEL_ERROR, NULL);
+
+    for (i = 0; i < sizeof(obj_sizes) / sizeof(obj_sizes[0]); i++) {
+        for (j = 0; j < sizeof(objs_per_slab) / sizeof(objs_per_slab[0]);
+             j++)
+        {
+            test.obj_size = obj_sizes[i];
+            test.objs_per_slab = objs_per_slab[j];
+            if (hp_arena_test_run(&test, ops) != HP_STATUS_OK) {
+                printf("arena-test: FAILED with seed %" PRIu64 ".\n", seed);
+                goto return_status;
+            }
+        }
+    }
+
+    printf("arena-test: %" PRIu64 " ops, %" PRIu64 " resets, with seed %"
+           PRIu64 " passed.\n", test.ops, test.resets, seed);
+    ret = EXIT_SUCCESS;
+
+ return_status:
+    hp_log_deinit();
+    return ret;
+}
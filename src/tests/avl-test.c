@@ -0,0 +1,282 @@
+/**
+ * Copyright(C) 2018, Juniper Networks, Inc.
+ * All rights reserved
+ *
+ * This SOFTWARE is licensed under the license provided in the LICENSE.txt
+ * file.  By downloading, installing, copying, or otherwise using the
+ * SOFTWARE, you agree to be bound by the terms of that license.  This
+ * SOFTWARE is not an official Juniper product.
+ *
+ * Third-Party Code: This SOFTWARE may depend on other components under
+ * separate copyright notice and license terms.  Your use of the source
+ * code for those components is subject to the term and conditions of
+ * the respective license as noted in the Third-Party source code.
+ */
+
+/**
+ * @author Anoop Saldanha
+ */
+
+/* Randomised test of the avl tree against a sorted array.  Every
+ * operation is done on both, and after each the tree's invariants are
+ * checked and its contents compared with the array's.
+ *
+ * avl-test.exe [<seed> [<ops_per_round>]] */
+
+#include "honeyprocs-common.h"
+#include "avl.h"
+#include "status.h"
+
+#define HP_AVL_TEST_OPS_DEFAULT 1000000
+
+/* Keys are stored as the data pointers themselves, from 1 up, as NULL
+ * is what a miss returns. */
+#define HP_AVL_TEST_KEY(data) ((uint32_t)(uintptr_t)(data))
+#define HP_AVL_TEST_DATA(key) ((void *)(uintptr_t)(key))
+
+typedef struct hp_avl_test_t {
+    hp_avl_t *tree;
+    /* The reference, in ascending order */
+    uint32_t *keys;
+    uint32_t count;
+    uint32_t key_space;
+    uint64_t rng;
+    uint64_t ops;
+} hp_avl_test_t;
+
+#define hp_avl_test_fail(test, ...)                                     \
+    do {                                                                \
+        printf("avl-test: %s:%d: after %" PRIu64 " ops: ",              \
+               __FILE__, __LINE__, (test)->ops);                        \
+        printf(__VA_ARGS__);                                            \
+        printf("\n");                                                   \
+        return HP_STATUS_ERROR;                                         \
+    } while (0)
+
+static int hp_avl_test_cmp(void *a, void *b)
+{
+    uint32_t ka = HP_AVL_TEST_KEY(a);
+    uint32_t kb = HP_AVL_TEST_KEY(b);
+
+    return (ka < kb) ? -1 : (ka > kb);
+}
+
+/* xorshift64* */
+static uint32_t hp_avl_test_rand(hp_avl_test_t *test)
+{
+    test->rng ^= test->rng >> 12;
+    test->rng ^= test->rng << 25;
+    test->rng ^= test->rng >> 27;
+
+    return (uint32_t)((test->rng * 0x2545F4914F6CDD1DULL) >> 32);
+}
+
+/* The index of the first key not below key */
+static uint32_t hp_avl_test_lower_bound(hp_avl_test_t *test, uint32_t key)
+{
+    uint32_t lo = 0;
+    uint32_t hi = test->count;
+    uint32_t mid;
+
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if (test->keys[mid] < key)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return lo;
+}
+
+static bool hp_avl_test_has(hp_avl_test_t *test, uint32_t key)
+{
+    uint32_t i = hp_avl_test_lower_bound(test, key);
+
+    return (i < test->count && test->keys[i] == key);
+}
+
+/* Walk the tree from the first key not below from, comparing with the
+ * array. */
+static hp_status_t hp_avl_test_compare(hp_avl_test_t *test, uint32_t from)
+{
+    hp_avl_iter_t iter;
+    void *data;
+    uint32_t i;
+
+    if (from == 0)
+        hp_avl_iter_init(test->tree, &iter);
+    else
+        hp_avl_iter_seek(test->tree, &iter, HP_AVL_TEST_DATA(from));
+
+    for (i = hp_avl_test_lower_bound(test, from); i < test->count; i++) {
+        if ((data = hp_avl_iter_next(&iter)) == NULL ||
+            HP_AVL_TEST_KEY(data) != test->keys[i])
+        {
+            hp_avl_test_fail(test, "walk from %u is off at index %u",
+                             from, i);
+        }
+    }
+    if (hp_avl_iter_next(&iter) != NULL)
+        hp_avl_test_fail(test, "walk from %u runs past the end", from);
+
+    return HP_STATUS_OK;
+}
+
+static hp_status_t hp_avl_test_op(hp_avl_test_t *test)
+{
+    void *existing;
+    void *data;
+    uint32_t key;
+    uint32_t hi;
+    uint32_t i;
+    uint32_t n;
+    uint32_t removed;
+    bool has;
+
+    key = 1 + hp_avl_test_rand(test) % test->key_space;
+    has = hp_avl_test_has(test, key);
+
+    switch (hp_avl_test_rand(test) % 8) {
+        case 0:
+        case 1:
+        case 2:
+            if (hp_avl_add_entry(test->tree, HP_AVL_TEST_DATA(key),
+                                 &existing) == HP_STATUS_OK)
+            {
+                if (has)
+                    hp_avl_test_fail(test, "added %u twice", key);
+                i = hp_avl_test_lower_bound(test, key);
+                memmove(&test->keys[i + 1], &test->keys[i],
+                        (test->count - i) * sizeof(*test->keys));
+                test->keys[i] = key;
+                test->count++;
+            } else if (!has || HP_AVL_TEST_KEY(existing) != key) {
+                hp_avl_test_fail(test, "failed to add %u", key);
+            }
+            break;
+        case 3:
+        case 4:
+            data = hp_avl_remove(test->tree, HP_AVL_TEST_DATA(key));
+            if (has != (data != NULL) ||
+                (data != NULL && HP_AVL_TEST_KEY(data) != key))
+            {
+                hp_avl_test_fail(test, "remove of %u is wrong", key);
+            }
+            if (has) {
+                i = hp_avl_test_lower_bound(test, key);
+                memmove(&test->keys[i], &test->keys[i + 1],
+                        (test->count - i - 1) * sizeof(*test->keys));
+                test->count--;
+            }
+            break;
+        case 5:
+            /* Mostly short ranges, as wide ones empty the tree. */
+            hi = key + 1 + hp_avl_test_rand(test) % (test->key_space / 8 + 1);
+            removed = hp_avl_erase_range(test->tree, HP_AVL_TEST_DATA(key),
+                                         HP_AVL_TEST_DATA(hi), NULL, NULL);
+            i = hp_avl_test_lower_bound(test, key);
+            n = hp_avl_test_lower_bound(test, hi) - i;
+            if (removed != n) {
+                hp_avl_test_fail(test, "erase of [%u, %u) removed %u of %u",
+                                 key, hi, removed, n);
+            }
+            memmove(&test->keys[i], &test->keys[i + n],
+                    (test->count - i - n) * sizeof(*test->keys));
+            test->count -= n;
+            break;
+        case 6:
+            data = hp_avl_get(test->tree, HP_AVL_TEST_DATA(key));
+            if (has != (data != NULL))
+                hp_avl_test_fail(test, "get of %u is wrong", key);
+            break;
+        default:
+            if (hp_avl_test_compare(test, key) != HP_STATUS_OK)
+                return HP_STATUS_ERROR;
+            break;
+    }
+    test->ops++;
+
+    if (hp_avl_verify(test->tree) != HP_STATUS_OK)
+        hp_avl_test_fail(test, "tree is unbalanced or out of order");
+    if (hp_avl_count(test->tree) != test->count) {
+        hp_avl_test_fail(test, "count %u, expected %u",
+                         hp_avl_count(test->tree), test->count);
+    }
+
+    return HP_STATUS_OK;
+}
+
+/* A round of ops over keys from 1 to key_space, in a tree of its own */
+static hp_status_t hp_avl_test_round(hp_avl_test_t *test,
+                                     uint32_t key_space,
+                                     uint32_t flags,
+                                     uint64_t ops)
+{
+    uint64_t i;
+    hp_status_t status;
+
+    test->key_space = key_space;
+    test->count = 0;
+    if (hp_avl_init(&test->tree, hp_avl_test_cmp, NULL,
+                    flags) != HP_STATUS_OK)
+    {
+        status = HP_STATUS_ERROR;
+        goto return_status;
+    }
+
+    for (i = 0; i < ops; i++) {
+        if (hp_avl_test_op(test) != HP_STATUS_OK) {
+            status = HP_STATUS_ERROR;
+            goto return_status;
+        }
+    }
+    if (hp_avl_test_compare(test, 0) != HP_STATUS_OK) {
+        status = HP_STATUS_ERROR;
+        goto return_status;
+    }
+
+    status = HP_STATUS_OK;
+ return_status:
+    if (test->tree != NULL)
+        hp_avl_deinit(test->tree);
+    test->tree = NULL;
+    return status;
+}
+
+int main(int argc, char *argv[])
+{
+    /* Small trees rebalance at the root all the time, large ones deep
+     * down. */
+    static const uint32_t key_spaces[] = { 8, 64, 512, 4096 };
+    hp_avl_test_t test;
+    uint64_t seed;
+    uint64_t ops;
+    uint32_t i;
+
+    seed = (argc > 1) ? strtoull(argv[1], NULL, 0) : 1;
+    ops = (argc > 2) ? strtoull(argv[2], NULL, 0) : HP_AVL_TEST_OPS_DEFAULT;
+
+    memset(&test, 0, sizeof(test));
+    test.rng = seed | 1;
+    if ((test.keys = (uint32_t *)malloc(4096 * sizeof(*test.keys))) == NULL)
+        return EXIT_FAILURE;
+
+    for (i = 0; i < sizeof(key_spaces) / sizeof(key_spaces[0]); i++) {
+        if (hp_avl_test_round(&test, key_spaces[i], 0,
+                              ops) != HP_STATUS_OK ||
+            hp_avl_test_round(&test, key_spaces[i], HP_AVL_FLAG_ARENA,
+                              ops) != HP_STATUS_OK)
+        {
+            printf("avl-test: FAILED with seed %" PRIu64 ".\n", seed);
+            free(test.keys);
+            return EXIT_FAILURE;
+        }
+    }
+
+    printf("avl-test: %" PRIu64 " ops with seed %" PRIu64 " passed.\n",
+           test.ops, seed);
+    free(test.keys);
+
+    return EXIT_SUCCESS;
+}
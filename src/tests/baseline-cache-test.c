@@ -0,0 +1,626 @@
+/**
+ * Copyright(C) 2018, Juniper Networks, Inc.
+ * All rights reserved
+ *
+ * This SOFTWARE is licensed under the license provided in the LICENSE.txt
+ * file.  By downloading, installing, copying, or otherwise using the
+ * SOFTWARE, you agree to be bound by the terms of that license.  This
+ * SOFTWARE is not an official Juniper product.
+ *
+ * Third-Party Code: This SOFTWARE may depend on other components under
+ * separate copyright notice and license terms.  Your use of the source
+ * code for those components is subject to the term and conditions of
+ * the respective license as noted in the Third-Party source code.
+ */
+
+/**
+ * @author Anoop Saldanha
+ */
+
+/* Randomised test of the baseline cache, and the sharing of maps under
+ * it.  Made up decoys come and go in a few slots, the way the scanner
+ * baselines and polls them.  Each maps a few runs of images, each run one
+ * of a few builds, loaded wherever ASLR would put it, with private memory
+ * around and in between.  A decoy is baselined and shared through the
+ * cache, its live map copied from the baseline, and it is then polled
+ * with nothing changed, its private memory changed, or its images
+ * changed, after which the live map holds a run of its own.  Baselines
+ * are dropped ahead of their live maps at times, and decoys killed.
+ *
+ * The maps have to diff as the same as maps built afresh all along, and
+ * after every step the cache has to hold just the images some map still
+ * shares, as counted by the test, so that a shared map is held as long as
+ * it is needed and no longer.
+ *
+ * baseline-cache-test.exe [<seed> [<rounds>]] */
+
+#include "honeyprocs-common.h"
+#include "baseline-cache.h"
+#include "mmap.h"
+#include "align.h"
+#include "util-log.h"
+#include "status.h"
+
+#define HP_BASELINE_TEST_ROUNDS_DEFAULT 4000
+#define HP_BASELINE_TEST_SLOTS          8
+/* Runs of images a decoy maps, e.g. its executable and its libraries */
+#define HP_BASELINE_TEST_RUNS           3
+/* Builds of each run */
+#define HP_BASELINE_TEST_BUILDS         3
+/* Image intervals of a build, each with the private one ahead of it */
+#define HP_BASELINE_TEST_BUILD_MAX      24
+#define HP_BASELINE_TEST_HEAP_MAX       3
+#define HP_BASELINE_TEST_INTERVALS_MAX                                  \
+    (HP_BASELINE_TEST_RUNS * HP_BASELINE_TEST_BUILD_MAX +               \
+     HP_BASELINE_TEST_HEAP_MAX + 1)
+/* Pages ASLR moves a run by, at most */
+#define HP_BASELINE_TEST_ASLR_PAGES     (1U << 20)
+
+/* Where ASLR puts each run, the heap and the stack from */
+static const hp_mmap_addr_t hp_baseline_test_run_bases[] = {
+    0x555555554000ULL, 0x7f0000000000ULL, 0x7fe000000000ULL,
+};
+#define HP_BASELINE_TEST_STACK_BASE 0x7ffc00000000ULL
+
+static const uint32_t hp_baseline_test_image_protects[] = {
+    HP_MMAP_PROT_READONLY, HP_MMAP_PROT_EXECUTE_READ,
+    HP_MMAP_PROT_READWRITE, HP_MMAP_PROT_WRITECOPY,
+};
+static const uint32_t hp_baseline_test_private_protects[] = {
+    HP_MMAP_PROT_READWRITE, HP_MMAP_PROT_READONLY, HP_MMAP_PROT_NOACCESS,
+};
+#define HP_BASELINE_TEST_PROTECTS(protects) \
+    (sizeof(protects) / sizeof(protects[0]))
+
+typedef struct hp_baseline_test_interval_t {
+    hp_mmap_addr_t start_addr;
+    hp_mmap_addr_t end_addr;
+    uint32_t protect;
+    uint32_t type;
+    /* The run it is in, or -1 */
+    int32_t run;
+} hp_baseline_test_interval_t;
+
+/* A build of a run, from where it is loaded */
+typedef struct hp_baseline_test_build_t {
+    hp_baseline_test_interval_t intervals[HP_BASELINE_TEST_BUILD_MAX];
+    uint32_t count;
+} hp_baseline_test_build_t;
+
+typedef struct hp_baseline_test_decoy_t {
+    bool alive;
+    /* NULL once dropped */
+    hp_mmap_tree_t *mmap_base;
+    hp_mmap_tree_t *mmap_live;
+    uint32_t builds[HP_BASELINE_TEST_RUNS];
+    /* The live map holds the run itself, a poll having changed it */
+    bool thawed[HP_BASELINE_TEST_RUNS];
+    /* As baselined, and as the decoy is now */
+    hp_baseline_test_interval_t base[HP_BASELINE_TEST_INTERVALS_MAX];
+    hp_baseline_test_interval_t now[HP_BASELINE_TEST_INTERVALS_MAX];
+    uint32_t count;
+} hp_baseline_test_decoy_t;
+
+typedef struct hp_baseline_test_t {
+    uint64_t rng;
+    uint64_t decoys;
+    uint64_t polls;
+    uint64_t changes;
+    uint64_t thaws;
+    uint64_t drops;
+    /* Runs found in the cache, loaded elsewhere than the first time */
+    uint64_t hits;
+    hp_baseline_cache_t cache;
+    hp_baseline_test_build_t builds[HP_BASELINE_TEST_RUNS]
+                                   [HP_BASELINE_TEST_BUILDS];
+    hp_baseline_test_decoy_t slots[HP_BASELINE_TEST_SLOTS];
+} hp_baseline_test_t;
+
+#define hp_baseline_test_fail(test, ...)                                \
+    do {                                                                \
+        printf("baseline-cache-test: %s:%d: after %" PRIu64 " polls: ", \
+               __FILE__, __LINE__, (test)->polls);                      \
+        printf(__VA_ARGS__);                                            \
+        printf("\n");                                                   \
+        return HP_STATUS_ERROR;                                         \
+    } while (0)
+
+/* Allocations made, counted through the linker's --wrap */
+static uint64_t g_hp_baseline_test_mallocs;
+
+void *__real_malloc(size_t size);
+
+void *__wrap_malloc(size_t size)
+{
+    g_hp_baseline_test_mallocs++;
+
+    return __real_malloc(size);
+}
+
+/* xorshift64* */
+static uint32_t hp_baseline_test_rand(hp_baseline_test_t *test)
+{
+    test->rng ^= test->rng >> 12;
+    test->rng ^= test->rng << 25;
+    test->rng ^= test->rng >> 27;
+
+    return (uint32_t)((test->rng * 0x2545F4914F6CDD1DULL) >> 32);
+}
+
+/* A protection an image, or a private, interval may have. */
+static uint32_t hp_baseline_test_protect(hp_baseline_test_t *test,
+                                         bool image)
+{
+    uint32_t r = hp_baseline_test_rand(test);
+
+    if (image) {
+        return hp_baseline_test_image_protects[
+            r % HP_BASELINE_TEST_PROTECTS(hp_baseline_test_image_protects)];
+    }
+    return hp_baseline_test_private_protects[
+        r % HP_BASELINE_TEST_PROTECTS(hp_baseline_test_private_protects)];
+}
+
+/**
+ * Make up the builds of each run.  The first interval of each is of a
+ * length of its own, so no two builds share a layout and the images
+ * the cache holds can be counted by build.  Some image intervals have a
+ * private one ahead of them, as a library's bss.
+ */
+static void hp_baseline_test_builds(hp_baseline_test_t *test)
+{
+    hp_baseline_test_build_t *build;
+    hp_baseline_test_interval_t *interval;
+    hp_mmap_addr_t pos;
+    uint32_t run, b, i, count;
+
+    for (run = 0; run < HP_BASELINE_TEST_RUNS; run++) {
+        for (b = 0; b < HP_BASELINE_TEST_BUILDS; b++) {
+            build = &test->builds[run][b];
+            count = 1 + hp_baseline_test_rand(test) %
+                (HP_BASELINE_TEST_BUILD_MAX / 2);
+            pos = 0;
+            build->count = 0;
+            for (i = 0; i < count; i++) {
+                if (i != 0 && hp_baseline_test_rand(test) % 3 == 0) {
+                    interval = &build->intervals[build->count++];
+                    interval->start_addr = pos;
+                    pos += (1 + hp_baseline_test_rand(test) % 4) *
+                        HP_MMAP_PAGE_SIZE;
+                    interval->end_addr = pos;
+                    interval->protect = HP_MMAP_PROT_READWRITE;
+                    interval->type = HP_MMAP_TYPE_PRIVATE;
+                    interval->run = -1;
+                }
+                if (i != 0 && hp_baseline_test_rand(test) % 4 == 0)
+                    pos += HP_MMAP_PAGE_SIZE;
+                interval = &build->intervals[build->count++];
+                interval->start_addr = pos;
+                pos += (i == 0) ?
+                    (1 + run * HP_BASELINE_TEST_BUILDS + b) *
+                    HP_MMAP_PAGE_SIZE :
+                    (1 + hp_baseline_test_rand(test) % 16) *
+                    HP_MMAP_PAGE_SIZE;
+                interval->end_addr = pos;
+                interval->protect = (i == 0) ? HP_MMAP_PROT_READONLY :
+                    hp_baseline_test_protect(test, true);
+                interval->type = HP_MMAP_TYPE_IMAGE;
+                interval->run = (int32_t)run;
+            }
+        }
+    }
+
+    return;
+}
+
+static hp_baseline_test_interval_t *
+hp_baseline_test_add(hp_baseline_test_decoy_t *decoy,
+                     hp_mmap_addr_t start_addr,
+                     hp_mmap_addr_t end_addr,
+                     uint32_t protect,
+                     uint32_t type)
+{
+    hp_baseline_test_interval_t *interval = &decoy->now[decoy->count++];
+
+    interval->start_addr = start_addr;
+    interval->end_addr = end_addr;
+    interval->protect = protect;
+    interval->type = type;
+    interval->run = -1;
+
+    return interval;
+}
+
+/* Lay a decoy out, each run a random build loaded at a random base, with
+ * the heap after the first run and the stack on top. */
+static void hp_baseline_test_layout(hp_baseline_test_t *test,
+                                    hp_baseline_test_decoy_t *decoy)
+{
+    hp_baseline_test_build_t *build;
+    hp_baseline_test_interval_t *from;
+    hp_baseline_test_interval_t *interval;
+    hp_mmap_addr_t base;
+    hp_mmap_addr_t pos;
+    uint32_t run, i, count;
+
+    decoy->count = 0;
+    for (run = 0; run < HP_BASELINE_TEST_RUNS; run++) {
+        decoy->builds[run] = hp_baseline_test_rand(test) %
+            HP_BASELINE_TEST_BUILDS;
+        decoy->thawed[run] = false;
+        build = &test->builds[run][decoy->builds[run]];
+        base = hp_baseline_test_run_bases[run] +
+            (hp_mmap_addr_t)(hp_baseline_test_rand(test) %
+                             HP_BASELINE_TEST_ASLR_PAGES) *
+            HP_MMAP_PAGE_SIZE;
+        for (i = 0; i < build->count; i++) {
+            from = &build->intervals[i];
+            interval = hp_baseline_test_add(decoy, base + from->start_addr,
+                                            base + from->end_addr,
+                                            from->protect, from->type);
+            interval->run = from->run;
+        }
+        pos = base + build->intervals[build->count - 1].end_addr;
+
+        if (run == 0) {
+            count = hp_baseline_test_rand(test) %
+                (HP_BASELINE_TEST_HEAP_MAX + 1);
+            for (i = 0; i < count; i++) {
+                pos += (1 + hp_baseline_test_rand(test) % 64) *
+                    HP_MMAP_PAGE_SIZE;
+                interval = hp_baseline_test_add(
+                    decoy, pos,
+                    pos + (1 + hp_baseline_test_rand(test) % 64) *
+                    HP_MMAP_PAGE_SIZE,
+                    hp_baseline_test_protect(test, false),
+                    HP_MMAP_TYPE_PRIVATE);
+                pos = interval->end_addr;
+            }
+        }
+    }
+    base = HP_BASELINE_TEST_STACK_BASE +
+        (hp_mmap_addr_t)(hp_baseline_test_rand(test) %
+                         HP_BASELINE_TEST_ASLR_PAGES) * HP_MMAP_PAGE_SIZE;
+    hp_baseline_test_add(decoy, base, base + 32 * HP_MMAP_PAGE_SIZE,
+                         HP_MMAP_PROT_READWRITE, HP_MMAP_TYPE_PRIVATE);
+
+    memcpy(decoy->base, decoy->now, decoy->count * sizeof(decoy->now[0]));
+
+    return;
+}
+
+/**
+ * Poll a map from the intervals of a decoy, the way a backend does,
+ * cutting some in two regions.
+ *
+ * @mallocs Set to the no of allocations made past hp_mmap_update_begin().
+ */
+static hp_status_t hp_baseline_test_poll(hp_baseline_test_t *test,
+                                         hp_mmap_tree_t *mmap_tree,
+                                         hp_baseline_test_interval_t *now,
+                                         uint32_t count,
+                                         bool *changed,
+                                         uint64_t *mallocs)
+{
+    hp_mmap_update_t update;
+    hp_mmap_addr_t cut;
+    uint32_t i;
+
+    if (hp_mmap_update_begin(mmap_tree, &update) != HP_STATUS_OK)
+        hp_baseline_test_fail(test, "hp_mmap_update_begin() failed");
+
+    *mallocs = g_hp_baseline_test_mallocs;
+    for (i = 0; i < count; i++) {
+        cut = now[i].end_addr;
+        if (hp_baseline_test_rand(test) % 4 == 0)
+            cut -= (now[i].end_addr - now[i].start_addr) / 2;
+        ALIGN_DOWN(cut, HP_MMAP_PAGE_SIZE);
+        if ((cut != now[i].start_addr &&
+             hp_mmap_update_region(&update, now[i].start_addr,
+                                   cut - now[i].start_addr,
+                                   HP_MMAP_STATE_COMMIT, now[i].protect,
+                                   now[i].type) != HP_STATUS_OK) ||
+            (cut != now[i].end_addr &&
+             hp_mmap_update_region(&update, cut, now[i].end_addr - cut,
+                                   HP_MMAP_STATE_COMMIT, now[i].protect,
+                                   now[i].type) != HP_STATUS_OK))
+        {
+            hp_baseline_test_fail(test, "updating interval %u failed", i);
+        }
+    }
+    if (hp_mmap_update_end(&update, changed) != HP_STATUS_OK)
+        hp_baseline_test_fail(test, "hp_mmap_update_end() failed");
+    *mallocs = g_hp_baseline_test_mallocs - *mallocs;
+
+    return HP_STATUS_OK;
+}
+
+/* A map has to diff as the same as one built afresh from the intervals */
+static hp_status_t hp_baseline_test_same(hp_baseline_test_t *test,
+                                         hp_mmap_tree_t *mmap_tree,
+                                         hp_baseline_test_interval_t *now,
+                                         uint32_t count,
+                                         const char *what)
+{
+    hp_mmap_tree_t *mmap_fresh = NULL;
+    uint32_t diff_count;
+    uint32_t i;
+
+    if (hp_mmap_init(&mmap_fresh) != HP_STATUS_OK)
+        hp_baseline_test_fail(test, "hp_mmap_init() failed");
+    for (i = 0; i < count; i++) {
+        if (hp_mmap_track_memory_range(mmap_fresh, now[i].start_addr,
+                                       now[i].end_addr - now[i].start_addr,
+                                       HP_MMAP_STATE_COMMIT, now[i].protect,
+                                       now[i].type) != HP_STATUS_OK)
+        {
+            hp_mmap_deinit(mmap_fresh);
+            hp_baseline_test_fail(test, "tracking interval %u failed", i);
+        }
+    }
+    diff_count = hp_mmap_diff(mmap_fresh, mmap_tree, NULL, 0, 0);
+    hp_mmap_deinit(mmap_fresh);
+    if (diff_count != 0)
+        hp_baseline_test_fail(test, "the %s differs in %u ranges", what,
+                              diff_count);
+
+    return HP_STATUS_OK;
+}
+
+/* After a trim, the cache holds an image for each build still shared by a
+ * baseline, or a live map that didn't change it. */
+static hp_status_t hp_baseline_test_count(hp_baseline_test_t *test)
+{
+    bool held[HP_BASELINE_TEST_RUNS][HP_BASELINE_TEST_BUILDS];
+    hp_baseline_test_decoy_t *decoy;
+    uint32_t count = 0;
+    uint32_t slot, run, b;
+
+    memset(held, 0, sizeof(held));
+    for (slot = 0; slot < HP_BASELINE_TEST_SLOTS; slot++) {
+        decoy = &test->slots[slot];
+        for (run = 0; decoy->alive && run < HP_BASELINE_TEST_RUNS; run++) {
+            if (decoy->mmap_base != NULL || !decoy->thawed[run])
+                held[run][decoy->builds[run]] = true;
+        }
+    }
+    for (run = 0; run < HP_BASELINE_TEST_RUNS; run++) {
+        for (b = 0; b < HP_BASELINE_TEST_BUILDS; b++)
+            count += held[run][b];
+    }
+
+    hp_baseline_cache_trim(&test->cache);
+    if (test->cache.image_count != count)
+        hp_baseline_test_fail(test, "the cache holds %u images, %u shared",
+                              test->cache.image_count, count);
+
+    return HP_STATUS_OK;
+}
+
+/* Baseline a decoy, share it and copy its live map from it, and poll it
+ * once, which has to confirm it without copying a thing. */
+static hp_status_t hp_baseline_test_spawn(hp_baseline_test_t *test,
+                                          hp_baseline_test_decoy_t *decoy)
+{
+    hp_baseline_test_decoy_t *other;
+    uint64_t mallocs;
+    bool changed;
+    uint32_t slot, run;
+
+    test->decoys++;
+    hp_baseline_test_layout(test, decoy);
+    decoy->alive = true;
+    for (run = 0; run < HP_BASELINE_TEST_RUNS; run++) {
+        for (slot = 0; slot < HP_BASELINE_TEST_SLOTS; slot++) {
+            other = &test->slots[slot];
+            if (other != decoy && other->alive &&
+                other->builds[run] == decoy->builds[run] &&
+                (other->mmap_base != NULL || !other->thawed[run]))
+            {
+                test->hits++;
+                break;
+            }
+        }
+    }
+
+    if (hp_mmap_init(&decoy->mmap_base) != HP_STATUS_OK ||
+        hp_baseline_test_poll(test, decoy->mmap_base, decoy->now,
+                              decoy->count, &changed,
+                              &mallocs) != HP_STATUS_OK)
+    {
+        hp_baseline_test_fail(test, "baselining failed");
+    }
+    if (hp_baseline_cache_share(&test->cache,
+                                decoy->mmap_base) != HP_STATUS_OK)
+        hp_baseline_test_fail(test, "hp_baseline_cache_share() failed");
+    if (hp_baseline_test_same(test, decoy->mmap_base, decoy->base,
+                              decoy->count, "shared baseline") !=
+        HP_STATUS_OK)
+    {
+        return HP_STATUS_ERROR;
+    }
+
+    if (hp_mmap_init(&decoy->mmap_live) != HP_STATUS_OK ||
+        hp_mmap_copy(decoy->mmap_live, decoy->mmap_base) != HP_STATUS_OK)
+        hp_baseline_test_fail(test, "copying the baseline failed");
+    if (hp_mmap_diff(decoy->mmap_base, decoy->mmap_live, NULL, 0, 0) != 0)
+        hp_baseline_test_fail(test, "the live map differs from its copy");
+
+    test->polls++;
+    if (hp_baseline_test_poll(test, decoy->mmap_live, decoy->now,
+                              decoy->count, &changed,
+                              &mallocs) != HP_STATUS_OK)
+    {
+        return HP_STATUS_ERROR;
+    }
+    if (changed || mallocs != 0)
+        hp_baseline_test_fail(test, "the first poll changed the live map "
+                              "%d, with %" PRIu64 " allocations", changed,
+                              mallocs);
+
+    return hp_baseline_test_count(test);
+}
+
+/**
+ * Poll a decoy, changing the protection of an interval of it first or
+ * not.  A private one changed leaves the runs shared, and one in a run
+ * copies in just that run.
+ */
+static hp_status_t hp_baseline_test_check(hp_baseline_test_t *test,
+                                          hp_baseline_test_decoy_t *decoy)
+{
+    hp_baseline_test_interval_t *interval = NULL;
+    uint32_t protect;
+    uint64_t mallocs;
+    bool changed;
+    uint32_t i;
+
+    switch (hp_baseline_test_rand(test) % 3) {
+        case 0:
+            break;
+        case 1:
+            for (i = 0; i < decoy->count && interval == NULL; i++) {
+                interval = &decoy->now[hp_baseline_test_rand(test) %
+                                       decoy->count];
+                if (interval->run != -1)
+                    interval = NULL;
+            }
+            break;
+        default:
+            for (i = 0; i < decoy->count && interval == NULL; i++) {
+                interval = &decoy->now[hp_baseline_test_rand(test) %
+                                       decoy->count];
+                if (interval->run == -1)
+                    interval = NULL;
+            }
+            break;
+    }
+    if (interval != NULL) {
+        do {
+            protect = hp_baseline_test_protect(test, interval->run != -1);
+        } while (protect == interval->protect);
+        interval->protect = protect;
+        test->changes++;
+        if (interval->run != -1 && !decoy->thawed[interval->run]) {
+            decoy->thawed[interval->run] = true;
+            test->thaws++;
+        }
+    }
+
+    test->polls++;
+    if (hp_baseline_test_poll(test, decoy->mmap_live, decoy->now,
+                              decoy->count, &changed,
+                              &mallocs) != HP_STATUS_OK ||
+        hp_baseline_test_same(test, decoy->mmap_live, decoy->now,
+                              decoy->count, "live map") != HP_STATUS_OK)
+    {
+        return HP_STATUS_ERROR;
+    }
+    if (changed != (interval != NULL))
+        hp_baseline_test_fail(test, "the poll says changed %d", changed);
+    if (!changed && mallocs != 0)
+        hp_baseline_test_fail(test, "confirming the live map made %"
+                              PRIu64 " allocations", mallocs);
+    if (decoy->mmap_base != NULL &&
+        hp_baseline_test_same(test, decoy->mmap_base, decoy->base,
+                              decoy->count, "baseline") != HP_STATUS_OK)
+    {
+        return HP_STATUS_ERROR;
+    }
+
+    return hp_baseline_test_count(test);
+}
+
+/* Drop the baseline of a decoy, and its live map with it or not. */
+static hp_status_t hp_baseline_test_drop(hp_baseline_test_t *test,
+                                         hp_baseline_test_decoy_t *decoy,
+                                         bool kill)
+{
+    if (decoy->mmap_base != NULL) {
+        hp_mmap_deinit(decoy->mmap_base);
+        decoy->mmap_base = NULL;
+        test->drops++;
+    }
+    if (kill) {
+        hp_mmap_deinit(decoy->mmap_live);
+        decoy->mmap_live = NULL;
+        decoy->alive = false;
+    }
+
+    return hp_baseline_test_count(test);
+}
+
+static hp_status_t hp_baseline_test_round(hp_baseline_test_t *test)
+{
+    hp_baseline_test_decoy_t *decoy;
+    uint32_t r;
+
+    decoy = &test->slots[hp_baseline_test_rand(test) %
+                         HP_BASELINE_TEST_SLOTS];
+    if (!decoy->alive)
+        return hp_baseline_test_spawn(test, decoy);
+
+    r = hp_baseline_test_rand(test) % 16;
+    if (r == 0)
+        return hp_baseline_test_drop(test, decoy, true);
+    if (r == 1)
+        return hp_baseline_test_drop(test, decoy, false);
+
+    return hp_baseline_test_check(test, decoy);
+}
+
+int main(int argc, char *argv[])
+{
+    static hp_baseline_test_t test;
+    uint64_t seed;
+    uint64_t rounds;
+    uint64_t i;
+    uint32_t slot;
+    int ret = EXIT_FAILURE;
+
+    seed = (argc > 1) ? strtoull(argv[1], NULL, 0) : 1;
+    rounds = (argc > 2) ? strtoull(argv[2], NULL, 0) :
+        HP_BASELINE_TEST_ROUNDS_DEFAULT;
+    test.rng = seed | 1;
+
+    hp_log_init(HP_LOG_LEVEL_ERROR, NULL);
+    hp_baseline_cache_init(&test.cache);
+    hp_baseline_test_builds(&test);
+
+    for (i = 0; i < rounds; i++) {
+        if (hp_baseline_test_round(&test) != HP_STATUS_OK) {
+            printf("baseline-cache-test: FAILED in round %" PRIu64
+                   " with seed %" PRIu64 ".\n", i, seed);
+            goto return_status;
+        }
+    }
+
+    /* The last decoy gone, the cache is empty. */
+    for (slot = 0; slot < HP_BASELINE_TEST_SLOTS; slot++) {
+        if (test.slots[slot].alive &&
+            hp_baseline_test_drop(&test, &test.slots[slot],
+                                  true) != HP_STATUS_OK)
+        {
+            printf("baseline-cache-test: FAILED with seed %" PRIu64 ".\n",
+                   seed);
+            goto return_status;
+        }
+    }
+    if (test.cache.image_count != 0 || test.cache.images != NULL) {
+        printf("baseline-cache-test: FAILED with %u images left, with "
+               "seed %" PRIu64 ".\n", test.cache.image_count, seed);
+        goto return_status;
+    }
+
+    printf("baseline-cache-test: %" PRIu64 " decoys, %" PRIu64 " runs "
+           "shared across bases, %" PRIu64 " polls, %" PRIu64 " changes, %"
+           PRIu64 " thaws, %" PRIu64 " drops, with seed %" PRIu64
+           " passed.\n", test.decoys, test.hits, test.polls, test.changes,
+           test.thaws, test.drops, seed);
+    ret = EXIT_SUCCESS;
+
+ return_status:
+    hp_baseline_cache_deinit(&test.cache);
+    hp_log_deinit();
+    return ret;
+}
@@ -0,0 +1,216 @@
+/**
+ * Copyright(C) 2018, Juniper Networks, Inc.
+ * All rights reserved
+ *
+ * This SOFTWARE is licensed under the license provided in the LICENSE.txt
+ * file.  By downloading, installing, copying, or otherwise using the
+ * SOFTWARE, you agree to be bound by the terms of that license.  This
+ * SOFTWARE is not an official Juniper product.
+ *
+ * Third-Party Code: This SOFTWARE may depend on other components under
+ * separate copyright notice and license terms.  Your use of the source
+ * code for those components is subject to the term and conditions of
+ * the respective license as noted in the Third-Party source code.
+ */
+
+/**
+ * @author Anoop Saldanha
+ */
+
+/* The avl iterator against the hp_avl_parse() callback walk, over a
+ * tree of a million entries by default: full walks, and short range
+ * walks from a key, which the callback walk can only do by walking the
+ * whole tree.
+ *
+ * bench-avl.exe [<entries> [<walks>]] */
+
+#include "honeyprocs-common.h"
+#include "avl.h"
+#include "bench.h"
+#include "status.h"
+
+#define HP_BENCH_AVL_ENTRIES_DEFAULT 1000000
+#define HP_BENCH_AVL_WALKS_DEFAULT   10
+/* Entries a range walk visits, and range walks per full walk */
+#define HP_BENCH_AVL_RANGE           16
+#define HP_BENCH_AVL_RANGES          10000
+
+/* Keys are the data pointers themselves, from 1 up, as in avl-test */
+#define HP_BENCH_AVL_KEY(data) ((uint32_t)(uintptr_t)(data))
+#define HP_BENCH_AVL_DATA(key) ((void *)(uintptr_t)(key))
+
+/* The state of a callback walk */
+typedef struct hp_bench_avl_sum_t {
+    uint64_t sum;
+    /* For range walks - the first key, and how many are left to add */
+    uint32_t from;
+    uint32_t left;
+} hp_bench_avl_sum_t;
+
+static int hp_bench_avl_cmp(void *a, void *b)
+{
+    uint32_t ka = HP_BENCH_AVL_KEY(a);
+    uint32_t kb = HP_BENCH_AVL_KEY(b);
+
+    return (ka < kb) ? -1 : (ka > kb);
+}
+
+static void hp_bench_avl_add(void *data, void *sum_)
+{
+    hp_bench_avl_sum_t *sum = (hp_bench_avl_sum_t *)sum_;
+
+    sum->sum += HP_BENCH_AVL_KEY(data);
+
+    return;
+}
+
+static void hp_bench_avl_add_range(void *data, void *sum_)
+{
+    hp_bench_avl_sum_t *sum = (hp_bench_avl_sum_t *)sum_;
+
+    if (sum->left > 0 && HP_BENCH_AVL_KEY(data) >= sum->from) {
+        sum->sum += HP_BENCH_AVL_KEY(data);
+        sum->left--;
+    }
+
+    return;
+}
+
+/* xorshift64* */
+static uint32_t hp_bench_avl_rand(uint64_t *rng)
+{
+    *rng ^= *rng >> 12;
+    *rng ^= *rng << 25;
+    *rng ^= *rng >> 27;
+
+    return (uint32_t)((*rng * 0x2545F4914F6CDD1DULL) >> 32);
+}
+
+static void hp_bench_avl_report(const char *what, uint64_t ns, uint64_t ops,
+                                const char *op)
+{
+    printf("bench-avl: %-16s %12.1f ns per %s\n", what,
+           (double)ns / (double)ops, op);
+
+    return;
+}
+
+int main(int argc, char *argv[])
+{
+    hp_avl_t *tree = NULL;
+    hp_avl_iter_t iter;
+    hp_bench_avl_sum_t sum;
+    uint32_t *keys = NULL;
+    uint32_t entries;
+    uint32_t walks;
+    uint32_t from;
+    uint32_t i, j, k;
+    uint64_t rng = 1;
+    uint64_t start;
+    uint64_t iter_sum;
+    void *data;
+    int ret = EXIT_FAILURE;
+
+    entries = (argc > 1) ? (uint32_t)strtoul(argv[1], NULL, 0) :
+        HP_BENCH_AVL_ENTRIES_DEFAULT;
+    walks = (argc > 2) ? (uint32_t)strtoul(argv[2], NULL, 0) :
+        HP_BENCH_AVL_WALKS_DEFAULT;
+    if (entries == 0 || walks == 0)
+        goto return_status;
+
+    /* Added in a random order, so the nodes aren't laid out in key order
+     * in memory */
+    if ((keys = (uint32_t *)malloc(entries * sizeof(*keys))) == NULL ||
+        hp_avl_init(&tree, hp_bench_avl_cmp, NULL,
+                    HP_AVL_FLAG_ARENA) != HP_STATUS_OK)
+    {
+        goto return_status;
+    }
+    for (i = 0; i < entries; i++)
+        keys[i] = i + 1;
+    for (i = entries - 1; i > 0; i--) {
+        j = hp_bench_avl_rand(&rng) % (i + 1);
+        k = keys[i];
+        keys[i] = keys[j];
+        keys[j] = k;
+    }
+    for (i = 0; i < entries; i++) {
+        if (hp_avl_add_entry(tree, HP_BENCH_AVL_DATA(keys[i]),
+                             &data) != HP_STATUS_OK)
+        {
+            goto return_status;
+        }
+    }
+    printf("bench-avl: %u entries, %u walks\n", entries, walks);
+
+    /* Full walks, per entry */
+    memset(&sum, 0, sizeof(sum));
+    start = hp_bench_now_ns();
+    for (i = 0; i < walks; i++)
+        hp_avl_parse(tree, hp_bench_avl_add, &sum);
+    hp_bench_avl_report("parse walk", hp_bench_now_ns() - start,
+                        (uint64_t)walks * entries, "entry");
+
+    iter_sum = 0;
+    start = hp_bench_now_ns();
+    for (i = 0; i < walks; i++) {
+        hp_avl_iter_init(tree, &iter);
+        while ((data = hp_avl_iter_next(&iter)) != NULL)
+            iter_sum += HP_BENCH_AVL_KEY(data);
+    }
+    hp_bench_avl_report("iter walk", hp_bench_now_ns() - start,
+                        (uint64_t)walks * entries, "entry");
+    if (iter_sum != sum.sum) {
+        printf("bench-avl: the walks disagree.\n");
+        goto return_status;
+    }
+
+    /* Range walks from a random key, per range.  The callback walk can't
+     * stop, so it is run a walk's worth of times only. */
+    memset(&sum, 0, sizeof(sum));
+    rng = 1;
+    start = hp_bench_now_ns();
+    for (i = 0; i < walks; i++) {
+        sum.from = 1 + hp_bench_avl_rand(&rng) % entries;
+        sum.left = HP_BENCH_AVL_RANGE;
+        hp_avl_parse(tree, hp_bench_avl_add_range, &sum);
+    }
+    hp_bench_avl_report("parse range", hp_bench_now_ns() - start, walks,
+                        "range");
+
+    iter_sum = 0;
+    rng = 1;
+    start = hp_bench_now_ns();
+    for (i = 0; i < walks; i++) {
+        from = 1 + hp_bench_avl_rand(&rng) % entries;
+        hp_avl_iter_seek(tree, &iter, HP_BENCH_AVL_DATA(from));
+        for (j = 0; j < HP_BENCH_AVL_RANGE &&
+             (data = hp_avl_iter_next(&iter)) != NULL; j++)
+        {
+            iter_sum += HP_BENCH_AVL_KEY(data);
+        }
+    }
+    if (iter_sum != sum.sum) {
+        printf("bench-avl: the range walks disagree.\n");
+        goto return_status;
+    }
+    for (i = 0; i < walks * HP_BENCH_AVL_RANGES; i++) {
+        from = 1 + hp_bench_avl_rand(&rng) % entries;
+        hp_avl_iter_seek(tree, &iter, HP_BENCH_AVL_DATA(from));
+        for (j = 0; j < HP_BENCH_AVL_RANGE &&
+             (data = hp_avl_iter_next(&iter)) != NULL; j++)
+        {
+            iter_sum += HP_BENCH_AVL_KEY(data);
+        }
+    }
+    hp_bench_avl_report("iter seek range", hp_bench_now_ns() - start,
+                        (uint64_t)walks * (HP_BENCH_AVL_RANGES + 1),
+                        "range");
+    ret = EXIT_SUCCESS;
+
+ return_status:
+    if (tree != NULL)
+        hp_avl_deinit(tree);
+    free(keys);
+    return ret;
+}
@@ -0,0 +1,216 @@
+/**
+ * Copyright(C) 2018, Juniper Networks, Inc.
+ * All rights reserved
+ *
+ * This SOFTWARE is licensed under the license provided in the LICENSE.txt
+ * file.  By downloading, installing, copying, or otherwise using the
+ * SOFTWARE, you agree to be bound by the terms of that license.  This
+ * SOFTWARE is not an official Juniper product.
+ *
+ * Third-Party Code: This SOFTWARE may depend on other components under
+ * separate copyright notice and license terms.  Your use of the source
+ * code for those components is subject to the term and conditions of
+ * the respective license as noted in the Third-Party source code.
+ */
+
+/**
+ * @author Anoop Saldanha
+ */
+
+/* Time and heap taken to baseline processes the way the scanner does -
+ * take the baseline, share it through the baseline cache and copy the
+ * live map from it - and to poll each once after.  The processes are
+ * started afresh, each with a layout of its own under ASLR, running the
+ * command given, or the bench itself waiting to be killed.  Linux only -
+ * the heap in use is read from glibc.
+ *
+ * bench-baseline.exe [<processes> [<command> [<args>...]]] */
+
+#include "honeyprocs-common.h"
+#include "baseline-cache.h"
+#include "bench.h"
+#include "mmap.h"
+#include "proc.h"
+#include "status.h"
+#include "util-log.h"
+#include "util-scratch.h"
+
+#include <malloc.h>
+#include <signal.h>
+#include <sys/wait.h>
+
+#define HP_BENCH_BASELINE_PROCESSES_DEFAULT 64
+/* Between looks at a process that is still loading */
+#define HP_BENCH_BASELINE_SETTLE_US         100000
+#define HP_BENCH_BASELINE_CHILD             "--child"
+
+typedef struct hp_bench_baseline_proc_t {
+    pid_t pid;
+    hp_proc_t *proc;
+    hp_mmap_tree_t *mmap_base;
+    hp_mmap_tree_t *mmap_live;
+} hp_bench_baseline_proc_t;
+
+/* Wait for a process to be done loading, i.e. for its map to stay the
+ * same from one look to the next.  Opened afresh for each look, as the
+ * map opened before the exec reads back empty after it. */
+static hp_status_t hp_bench_baseline_settle(hp_bench_baseline_proc_t *p,
+                                            hp_scratch_t *scratch)
+{
+    hp_mmap_tree_t *mmap_tree = NULL;
+    bool changed = true;
+    hp_status_t status;
+
+    if (hp_mmap_init(&mmap_tree) != HP_STATUS_OK) {
+        status = HP_STATUS_ERROR;
+        goto return_status;
+    }
+    while (changed) {
+        usleep(HP_BENCH_BASELINE_SETTLE_US);
+        if (p->proc != NULL)
+            hp_proc_close(p->proc);
+        if (hp_proc_open((uint32_t)p->pid, 0, &p->proc) != HP_STATUS_OK) {
+            status = HP_STATUS_ERROR;
+            goto return_status;
+        }
+        if (hp_get_mmap(p->proc, scratch, mmap_tree,
+                        &changed) != HP_STATUS_OK)
+        {
+            status = HP_STATUS_ERROR;
+            goto return_status;
+        }
+    }
+
+    status = HP_STATUS_OK;
+ return_status:
+    if (mmap_tree != NULL)
+        hp_mmap_deinit(mmap_tree);
+    return status;
+}
+
+static void hp_bench_baseline_stop(hp_bench_baseline_proc_t *p)
+{
+    if (p->mmap_live != NULL)
+        hp_mmap_deinit(p->mmap_live);
+    if (p->mmap_base != NULL)
+        hp_mmap_deinit(p->mmap_base);
+    if (p->proc != NULL)
+        hp_proc_close(p->proc);
+    if (p->pid > 0) {
+        kill(p->pid, SIGKILL);
+        waitpid(p->pid, NULL, 0);
+    }
+
+    return;
+}
+
+int main(int argc, char *argv[])
+{
+    static char *child_argv[] = { NULL, HP_BENCH_BASELINE_CHILD, NULL };
+    hp_bench_baseline_proc_t *procs;
+    hp_baseline_cache_t cache;
+    hp_scratch_t scratch;
+    char **command;
+    uint32_t proc_count;
+    uint64_t intervals = 0;
+    uint64_t start;
+    uint64_t baseline_ns;
+    uint64_t poll_ns;
+    size_t heap;
+    size_t baseline_heap;
+    bool changed;
+    uint32_t i;
+    int ret = EXIT_FAILURE;
+
+    if (argc > 1 && strcmp(argv[1], HP_BENCH_BASELINE_CHILD) == 0) {
+        for (;;)
+            pause();
+    }
+
+    proc_count = (argc > 1) ? (uint32_t)strtoul(argv[1], NULL, 0) :
+        HP_BENCH_BASELINE_PROCESSES_DEFAULT;
+    child_argv[0] = argv[0];
+    command = (argc > 2) ? &argv[2] : child_argv;
+
+    hp_log_init(HP_LOG_LEVEL_ERROR, NULL);
+    hp_baseline_cache_init(&cache);
+
+    memset(&scratch, 0, sizeof(scratch));
+    if ((procs = (hp_bench_baseline_proc_t *)
+         calloc(proc_count, sizeof(*procs))) == NULL)
+    {
+        return EXIT_FAILURE;
+    }
+    for (i = 0; i < proc_count; i++) {
+        if ((procs[i].pid = fork()) == 0) {
+            execvp(command[0], command);
+            _exit(EXIT_FAILURE);
+        }
+        if (procs[i].pid < 0) {
+            printf("bench-baseline: can't start process %u.\n", i);
+            goto return_status;
+        }
+    }
+    for (i = 0; i < proc_count; i++) {
+        if (hp_bench_baseline_settle(&procs[i], &scratch) != HP_STATUS_OK) {
+            printf("bench-baseline: process %u didn't start.\n", i);
+            goto return_status;
+        }
+    }
+
+    /* What hp_scanner_add_pid() does */
+    heap = mallinfo2().uordblks;
+    start = hp_bench_now_ns();
+    for (i = 0; i < proc_count; i++) {
+        if (hp_mmap_init(&procs[i].mmap_base) != HP_STATUS_OK ||
+            hp_get_mmap(procs[i].proc, &scratch, procs[i].mmap_base,
+                        NULL) != HP_STATUS_OK)
+        {
+            printf("bench-baseline: can't baseline process %u.\n", i);
+            goto return_status;
+        }
+        intervals += hp_mmap_count(procs[i].mmap_base);
+        hp_baseline_cache_share(&cache, procs[i].mmap_base);
+        if (hp_mmap_init(&procs[i].mmap_live) != HP_STATUS_OK ||
+            hp_mmap_copy(procs[i].mmap_live,
+                         procs[i].mmap_base) != HP_STATUS_OK)
+        {
+            printf("bench-baseline: can't copy baseline %u.\n", i);
+            goto return_status;
+        }
+    }
+    baseline_ns = hp_bench_now_ns() - start;
+    baseline_heap = mallinfo2().uordblks - heap;
+
+    /* And the first poll of each */
+    start = hp_bench_now_ns();
+    for (i = 0; i < proc_count; i++) {
+        if (hp_get_mmap(procs[i].proc, &scratch, procs[i].mmap_live,
+                        &changed) != HP_STATUS_OK)
+        {
+            printf("bench-baseline: can't poll process %u.\n", i);
+            goto return_status;
+        }
+        hp_are_mmaps_same(procs[i].mmap_base, procs[i].mmap_live);
+    }
+    poll_ns = hp_bench_now_ns() - start;
+
+    printf("bench-baseline: %u processes of %.0f intervals, %u images "
+           "cached\n", proc_count, (double)intervals / proc_count,
+           cache.image_count);
+    printf("bench-baseline: baseline %8.1f us %8.0f bytes per process\n",
+           (double)baseline_ns / 1e3 / proc_count,
+           (double)baseline_heap / proc_count);
+    printf("bench-baseline: poll     %8.1f us per process\n",
+           (double)poll_ns / 1e3 / proc_count);
+    ret = EXIT_SUCCESS;
+
+ return_status:
+    for (i = 0; i < proc_count; i++)
+        hp_bench_baseline_stop(&procs[i]);
+    hp_baseline_cache_deinit(&cache);
+    hp_scratch_free(&scratch);
+    free(procs);
+    hp_log_deinit();
+    return ret;
+}
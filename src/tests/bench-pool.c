@@ -0,0 +1,272 @@
+/**
+ * Copyright(C) 2018, Juniper Networks, Inc.
+ * All rights reserved
+ *
+ * This SOFTWARE is licensed under the license provided in the LICENSE.txt
+ * file.  By downloading, installing, copying, or otherwise using the
+ * SOFTWARE, you agree to be bound by the terms of that license.  This
+ * SOFTWARE is not an official Juniper product.
+ *
+ * Third-Party Code: This SOFTWARE may depend on other components under
+ * separate copyright notice and license terms.  Your use of the source
+ * code for those components is subject to the term and conditions of
+ * the respective license as noted in the Third-Party source code.
+ */
+
+/**
+ * @author Anoop Saldanha
+ */
+
+/* Snapshot and compare throughput of the worker pool by worker count.
+ * Forked children stand in for the honeyprocs, each with a map of a few
+ * hundred regions, and every round checks them all once, the way a poll
+ * of the scanner does.
+ *
+ * bench-pool.exe [<processes> [<rounds>]] */
+
+#include "honeyprocs-common.h"
+#include "bench.h"
+#include "mmap.h"
+#include "proc.h"
+#include "status.h"
+#include "util-log.h"
+#include "util-pool.h"
+#include "util-scratch.h"
+#include "util-thread.h"
+
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#define HP_BENCH_POOL_PROCESSES_DEFAULT 64
+#define HP_BENCH_POOL_ROUNDS_DEFAULT    20
+/* Pages of a child's mapping, every other one writable so that each is a
+ * region of its own */
+#define HP_BENCH_POOL_PAGES             512
+
+typedef struct hp_bench_pool_proc_t {
+    hp_pool_job_t job;
+    pid_t pid;
+    hp_proc_t *proc;
+    hp_mmap_tree_t *mmap_base;
+    hp_mmap_tree_t *mmap_live;
+    bool failed;
+} hp_bench_pool_proc_t;
+
+typedef struct hp_bench_pool_worker_t {
+    hp_scratch_t scratch;
+} hp_bench_pool_worker_t;
+
+/* Map the pages and wait to be killed. */
+static void hp_bench_pool_child(int ready_fd)
+{
+    long page_size = sysconf(_SC_PAGESIZE);
+    uint8_t *p;
+    uint32_t i;
+
+    p = (uint8_t *)mmap(NULL, HP_BENCH_POOL_PAGES * page_size, PROT_READ,
+                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p != MAP_FAILED) {
+        for (i = 0; i < HP_BENCH_POOL_PAGES; i += 2) {
+            mprotect(p + i * page_size, page_size,
+                     PROT_READ | PROT_WRITE);
+        }
+    }
+    if (write(ready_fd, "", 1) != 1)
+        _exit(EXIT_FAILURE);
+    for (;;)
+        pause();
+}
+
+/* Pool job - what hp_scanner_check() does with an unchanged process */
+static void hp_bench_pool_check(void *p_, void *worker_)
+{
+    hp_bench_pool_proc_t *p = (hp_bench_pool_proc_t *)p_;
+    hp_bench_pool_worker_t *worker = (hp_bench_pool_worker_t *)worker_;
+
+    if (hp_get_mmap(p->proc, &worker->scratch, p->mmap_live,
+                    NULL) != HP_STATUS_OK ||
+        !hp_are_mmaps_same(p->mmap_base, p->mmap_live))
+    {
+        p->failed = true;
+    }
+
+    return;
+}
+
+static hp_status_t hp_bench_pool_start(hp_bench_pool_proc_t *p)
+{
+    int fds[2];
+    char c;
+    hp_status_t status;
+
+    if (pipe(fds) != 0) {
+        status = HP_STATUS_ERROR;
+        goto return_status;
+    }
+    if ((p->pid = fork()) == 0)
+        hp_bench_pool_child(fds[1]);
+    if (p->pid < 0 || read(fds[0], &c, 1) != 1) {
+        status = HP_STATUS_ERROR;
+        goto close_fds;
+    }
+
+    p->job.data = p;
+    if (hp_proc_open((uint32_t)p->pid, 0, &p->proc) != HP_STATUS_OK ||
+        hp_mmap_init(&p->mmap_base) != HP_STATUS_OK ||
+        hp_mmap_init(&p->mmap_live) != HP_STATUS_OK)
+    {
+        status = HP_STATUS_ERROR;
+        goto close_fds;
+    }
+
+    status = HP_STATUS_OK;
+ close_fds:
+    close(fds[0]);
+    close(fds[1]);
+ return_status:
+    return status;
+}
+
+static void hp_bench_pool_stop(hp_bench_pool_proc_t *p)
+{
+    if (p->mmap_live != NULL)
+        hp_mmap_deinit(p->mmap_live);
+    if (p->mmap_base != NULL)
+        hp_mmap_deinit(p->mmap_base);
+    if (p->proc != NULL)
+        hp_proc_close(p->proc);
+    if (p->pid > 0) {
+        kill(p->pid, SIGKILL);
+        waitpid(p->pid, NULL, 0);
+    }
+
+    return;
+}
+
+/* Run the rounds on a pool of worker_count workers, in ns. */
+static hp_status_t hp_bench_pool_run(hp_bench_pool_proc_t *procs,
+                                     uint32_t proc_count,
+                                     uint32_t rounds,
+                                     uint32_t worker_count,
+                                     uint64_t *ns)
+{
+    hp_bench_pool_worker_t *workers;
+    void **worker_data;
+    hp_pool_t *pool = NULL;
+    uint64_t start;
+    uint32_t done;
+    uint32_t i;
+    hp_status_t status;
+
+    workers = (hp_bench_pool_worker_t *)calloc(worker_count,
+                                               sizeof(*workers));
+    worker_data = (void **)malloc(worker_count * sizeof(*worker_data));
+    if (workers == NULL || worker_data == NULL) {
+        status = HP_STATUS_ERROR;
+        goto return_status;
+    }
+    for (i = 0; i < worker_count; i++)
+        worker_data[i] = &workers[i];
+    if (hp_pool_init(&pool, worker_count, hp_bench_pool_check,
+                     worker_data) != HP_STATUS_OK)
+    {
+        status = HP_STATUS_ERROR;
+        goto return_status;
+    }
+
+    start = hp_bench_now_ns();
+    for (; rounds > 0; rounds--) {
+        for (i = 0; i < proc_count; i++)
+            hp_pool_submit(pool, &procs[i].job);
+        /* A process is polled again only once its last check is done. */
+        for (done = 0; done < proc_count;) {
+            if (hp_pool_get_done(pool) != NULL)
+                done++;
+            else
+                sched_yield();
+        }
+    }
+    *ns = hp_bench_now_ns() - start;
+
+    status = HP_STATUS_OK;
+    for (i = 0; i < proc_count; i++) {
+        if (procs[i].failed)
+            status = HP_STATUS_ERROR;
+    }
+
+ return_status:
+    if (pool != NULL)
+        hp_pool_deinit(pool);
+    for (i = 0; workers != NULL && i < worker_count; i++)
+        hp_scratch_free(&workers[i].scratch);
+    free(worker_data);
+    free(workers);
+    return status;
+}
+
+int main(int argc, char *argv[])
+{
+    hp_bench_pool_proc_t *procs;
+    hp_scratch_t scratch;
+    uint32_t proc_count;
+    uint32_t rounds;
+    uint32_t worker_count;
+    uint32_t cpu_count;
+    uint64_t ns;
+    double rate;
+    double rate_one = 0;
+    uint32_t i;
+    int ret = EXIT_FAILURE;
+
+    proc_count = (argc > 1) ? (uint32_t)strtoul(argv[1], NULL, 0) :
+        HP_BENCH_POOL_PROCESSES_DEFAULT;
+    rounds = (argc > 2) ? (uint32_t)strtoul(argv[2], NULL, 0) :
+        HP_BENCH_POOL_ROUNDS_DEFAULT;
+    cpu_count = hp_cpu_count();
+
+    hp_log_init(HP_LOG_LEVEL_ERROR, NULL);
+
+    memset(&scratch, 0, sizeof(scratch));
+    if ((procs = (hp_bench_pool_proc_t *)calloc(proc_count,
+                                                sizeof(*procs))) == NULL)
+    {
+        return EXIT_FAILURE;
+    }
+    for (i = 0; i < proc_count; i++) {
+        if (hp_bench_pool_start(&procs[i]) != HP_STATUS_OK ||
+            hp_get_mmap(procs[i].proc, &scratch, procs[i].mmap_base,
+                        NULL) != HP_STATUS_OK)
+        {
+            printf("bench-pool: can't start process %u.\n", i);
+            goto return_status;
+        }
+    }
+
+    printf("bench-pool: %u processes of %u regions, %u rounds, %u cpus\n",
+           proc_count, hp_mmap_count(procs[0].mmap_base), rounds,
+           cpu_count);
+    for (worker_count = 1; worker_count <= cpu_count * 2;
+         worker_count *= 2)
+    {
+        if (hp_bench_pool_run(procs, proc_count, rounds, worker_count,
+                              &ns) != HP_STATUS_OK)
+        {
+            printf("bench-pool: a check failed.\n");
+            goto return_status;
+        }
+        rate = (double)proc_count * rounds * 1e9 / (double)ns;
+        if (worker_count == 1)
+            rate_one = rate;
+        printf("bench-pool: %3u workers %10.0f checks/s %6.2fx\n",
+               worker_count, rate, rate / rate_one);
+    }
+    ret = EXIT_SUCCESS;
+
+ return_status:
+    for (i = 0; i < proc_count; i++)
+        hp_bench_pool_stop(&procs[i]);
+    hp_scratch_free(&scratch);
+    free(procs);
+    return ret;
+}
@@ -0,0 +1,283 @@
+/**
+ * Copyright(C) 2018, Juniper Networks, Inc.
+ * All rights reserved
+ *
+ * This SOFTWARE is licensed under the license provided in the LICENSE.txt
+ * file.  By downloading, installing, copying, or otherwise using the
+ * SOFTWARE, you agree to be bound by the terms of that license.  This
+ * SOFTWARE is not an official Juniper product.
+ *
+ * Third-Party Code: This SOFTWARE may depend on other components under
+ * separate copyright notice and license terms.  Your use of the source
+ * code for those components is subject to the term and conditions of
+ * the respective license as noted in the Third-Party source code.
+ */
+
+/**
+ * @author Anoop Saldanha
+ */
+
+/* Batched reads of another process's memory against reads a page at a
+ * time.  A forked child maps the memory, with or without a guard page
+ * every so often, and both ways read all of it, counting the
+ * process_vm_readv() calls they make.  Linux only - the build wraps
+ * process_vm_readv() to count them.
+ *
+ * bench-proc.exe [<MB> [<rounds>]] */
+
+#include "honeyprocs-common.h"
+#include "bench.h"
+#include "mmap.h"
+#include "proc.h"
+#include "status.h"
+#include "util-log.h"
+#include "util-scratch.h"
+
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+
+#define HP_BENCH_PROC_MB_DEFAULT     256
+#define HP_BENCH_PROC_ROUNDS_DEFAULT 4
+/* Pages between the guard pages, when there are any */
+#define HP_BENCH_PROC_GUARD_EVERY    256
+
+typedef struct hp_bench_proc_t {
+    pid_t pid;
+    hp_proc_t *proc;
+    hp_scratch_t scratch;
+    /* The child's memory, and where it is read to */
+    hp_mmap_addr_t addr;
+    size_t len;
+    uint8_t *buf;
+    bool guards;
+} hp_bench_proc_t;
+
+static uint64_t g_hp_bench_proc_syscalls;
+
+ssize_t __real_process_vm_readv(pid_t pid,
+                                const struct iovec *local,
+                                unsigned long local_count,
+                                const struct iovec *remote,
+                                unsigned long remote_count,
+                                unsigned long flags);
+
+ssize_t __wrap_process_vm_readv(pid_t pid,
+                                const struct iovec *local,
+                                unsigned long local_count,
+                                const struct iovec *remote,
+                                unsigned long remote_count,
+                                unsigned long flags)
+{
+    g_hp_bench_proc_syscalls++;
+
+    return __real_process_vm_readv(pid, local, local_count, remote,
+                                   remote_count, flags);
+}
+
+static bool hp_bench_proc_is_guard(const hp_bench_proc_t *b, size_t page)
+{
+    return b->guards && (page % HP_BENCH_PROC_GUARD_EVERY) ==
+        HP_BENCH_PROC_GUARD_EVERY - 1;
+}
+
+/* Map and fill the memory, each page with its page no, send its address
+ * and wait to be killed. */
+static void hp_bench_proc_child(hp_bench_proc_t *b, int ready_fd)
+{
+    uint8_t *p;
+    size_t page;
+
+    p = (uint8_t *)mmap(NULL, b->len, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED)
+        _exit(EXIT_FAILURE);
+    for (page = 0; page < b->len / HP_MMAP_PAGE_SIZE; page++) {
+        memset(p + page * HP_MMAP_PAGE_SIZE, (uint8_t)page,
+               HP_MMAP_PAGE_SIZE);
+        if (hp_bench_proc_is_guard(b, page)) {
+            mprotect(p + page * HP_MMAP_PAGE_SIZE, HP_MMAP_PAGE_SIZE,
+                     PROT_NONE);
+        }
+    }
+    b->addr = (hp_mmap_addr_t)(uintptr_t)p;
+    if (write(ready_fd, &b->addr, sizeof(b->addr)) != sizeof(b->addr))
+        _exit(EXIT_FAILURE);
+    for (;;)
+        pause();
+}
+
+static hp_status_t hp_bench_proc_start(hp_bench_proc_t *b)
+{
+    int fds[2];
+    hp_status_t status;
+
+    if (pipe(fds) != 0) {
+        status = HP_STATUS_ERROR;
+        goto return_status;
+    }
+    if ((b->pid = fork()) == 0)
+        hp_bench_proc_child(b, fds[1]);
+    if (b->pid < 0 ||
+        read(fds[0], &b->addr, sizeof(b->addr)) != sizeof(b->addr) ||
+        hp_proc_open((uint32_t)b->pid, 0, &b->proc) != HP_STATUS_OK)
+    {
+        status = HP_STATUS_ERROR;
+        goto close_fds;
+    }
+
+    status = HP_STATUS_OK;
+ close_fds:
+    close(fds[0]);
+    close(fds[1]);
+ return_status:
+    return status;
+}
+
+static void hp_bench_proc_stop(hp_bench_proc_t *b)
+{
+    if (b->proc != NULL)
+        hp_proc_close(b->proc);
+    if (b->pid > 0) {
+        kill(b->pid, SIGKILL);
+        waitpid(b->pid, NULL, 0);
+    }
+    b->proc = NULL;
+    b->pid = 0;
+
+    return;
+}
+
+/* Read all of the child's memory in reads of pages_per_read pages,
+ * batch_count reads a call, and check what came back. */
+static hp_status_t hp_bench_proc_read(hp_bench_proc_t *b,
+                                      hp_proc_read_t *reads,
+                                      uint32_t pages_per_read,
+                                      uint32_t batch_count)
+{
+    size_t read_len = (size_t)pages_per_read * HP_MMAP_PAGE_SIZE;
+    uint32_t read_count = (uint32_t)(b->len / read_len);
+    uint32_t i, j;
+    uint32_t n;
+    size_t page;
+
+    for (i = 0; i < read_count; i++) {
+        reads[i].addr = b->addr + i * read_len;
+        reads[i].len = read_len;
+        reads[i].buf = b->buf + i * read_len;
+    }
+    for (i = 0; i < read_count; i += n) {
+        n = (read_count - i < batch_count) ? read_count - i : batch_count;
+        if (hp_proc_read_batch(b->proc, &b->scratch, &reads[i],
+                               n) != HP_STATUS_OK)
+        {
+            return HP_STATUS_ERROR;
+        }
+    }
+
+    for (i = 0; i < read_count; i++) {
+        for (j = 0; j < pages_per_read; j++) {
+            page = (size_t)i * pages_per_read + j;
+            if (((reads[i].unread >> j) & 1) !=
+                hp_bench_proc_is_guard(b, page) ||
+                (!hp_bench_proc_is_guard(b, page) &&
+                 b->buf[page * HP_MMAP_PAGE_SIZE] != (uint8_t)page))
+            {
+                printf("bench-proc: page %zu read wrong.\n", page);
+                return HP_STATUS_ERROR;
+            }
+        }
+    }
+
+    return HP_STATUS_OK;
+}
+
+static hp_status_t hp_bench_proc_run(hp_bench_proc_t *b,
+                                     hp_proc_read_t *reads,
+                                     uint32_t rounds,
+                                     const char *what,
+                                     uint32_t pages_per_read,
+                                     uint32_t batch_count)
+{
+    uint64_t start;
+    uint64_t ns;
+    uint32_t i;
+
+    g_hp_bench_proc_syscalls = 0;
+    start = hp_bench_now_ns();
+    for (i = 0; i < rounds; i++) {
+        if (hp_bench_proc_read(b, reads, pages_per_read,
+                               batch_count) != HP_STATUS_OK)
+        {
+            return HP_STATUS_ERROR;
+        }
+    }
+    ns = hp_bench_now_ns() - start;
+
+    printf("bench-proc: %-8s %-10s %8.2f GB/s %10" PRIu64 " syscalls\n",
+           b->guards ? "guarded" : "plain", what,
+           (double)b->len * rounds / (double)ns,
+           g_hp_bench_proc_syscalls / rounds);
+
+    return HP_STATUS_OK;
+}
+
+int main(int argc, char *argv[])
+{
+    hp_bench_proc_t b;
+    hp_proc_read_t *reads = NULL;
+    uint32_t rounds;
+    uint32_t pages;
+    int guards;
+    int ret = EXIT_FAILURE;
+
+    memset(&b, 0, sizeof(b));
+    b.len = (size_t)((argc > 1) ? strtoul(argv[1], NULL, 0) :
+                     HP_BENCH_PROC_MB_DEFAULT) * 1024 * 1024;
+    rounds = (argc > 2) ? (uint32_t)strtoul(argv[2], NULL, 0) :
+        HP_BENCH_PROC_ROUNDS_DEFAULT;
+    pages = (uint32_t)(b.len / HP_MMAP_PAGE_SIZE);
+    /* Whole reads of the most pages, so every layout covers it all */
+    b.len = (pages / HP_PROC_READ_MAX_PAGES) * HP_PROC_READ_MAX_PAGES *
+        HP_MMAP_PAGE_SIZE;
+    if (b.len == 0 || rounds == 0)
+        return EXIT_FAILURE;
+
+    hp_log_init(HP_LOG_LEVEL_ERROR, NULL);
+
+    if ((b.buf = (uint8_t *)malloc(b.len)) == NULL ||
+        (reads = (hp_proc_read_t *)malloc((b.len / HP_MMAP_PAGE_SIZE) *
+                                          sizeof(*reads))) == NULL)
+    {
+        goto return_status;
+    }
+    /* Fault the buffer in, so neither way pays for it */
+    memset(b.buf, 0, b.len);
+
+    printf("bench-proc: %zu MB, %u rounds\n", b.len / (1024 * 1024), rounds);
+    for (guards = 0; guards < 2; guards++) {
+        b.guards = guards;
+        if (hp_bench_proc_start(&b) != HP_STATUS_OK) {
+            printf("bench-proc: can't start the child.\n");
+            goto return_status;
+        }
+        if (hp_bench_proc_run(&b, reads, rounds, "per page", 1,
+                              1) != HP_STATUS_OK ||
+            hp_bench_proc_run(&b, reads, rounds, "batched",
+                              HP_PROC_READ_MAX_PAGES,
+                              UINT32_MAX) != HP_STATUS_OK)
+        {
+            goto return_status;
+        }
+        hp_bench_proc_stop(&b);
+    }
+    ret = EXIT_SUCCESS;
+
+ return_status:
+    hp_bench_proc_stop(&b);
+    hp_scratch_free(&b.scratch);
+    free(reads);
+    free(b.buf);
+    return ret;
+}
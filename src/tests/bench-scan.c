@@ -0,0 +1,269 @@
+/**
+ * Copyright(C) 2018, Juniper Networks, Inc.
+ * All rights reserved
+ *
+ * This SOFTWARE is licensed under the license provided in the LICENSE.txt
+ * file.  By downloading, installing, copying, or otherwise using the
+ * SOFTWARE, you agree to be bound by the terms of that license.  This
+ * SOFTWARE is not an official Juniper product.
+ *
+ * Third-Party Code: This SOFTWARE may depend on other components under
+ * separate copyright notice and license terms.  Your use of the source
+ * code for those components is subject to the term and conditions of
+ * the respective license as noted in the Third-Party source code.
+ */
+
+/**
+ * @author Anoop Saldanha
+ */
+
+/* Scan throughput of the engine over the anchors of the built in
+ * signatures, with the prefilter picked for this CPU and with the plain
+ * automaton.  Random data and zeroed pages stand in for what most scans
+ * see, and any files given, such as dumps of process memory, for the
+ * rest.  Then, over random data, how throughput and table size go with
+ * the size of the pattern set, from 1 to 10000 random patterns.
+ *
+ * bench-scan.exe [<file> ...] */
+
+#include "honeyprocs-common.h"
+#include "bench.h"
+#include "scan-engine.h"
+#include "signatures.h"
+#include "status.h"
+#include "util-file-map.h"
+#include "util-log.h"
+
+#define HP_BENCH_SCAN_BUF_SIZE (64 * 1024 * 1024)
+/* Each data set is scanned over and over till this many bytes are, or
+ * for at least this long */
+#define HP_BENCH_SCAN_BYTES    (1024ULL * 1024 * 1024)
+#define HP_BENCH_SCAN_NS       1000000000ULL
+/* Of the random pattern sets */
+#define HP_BENCH_SCAN_PAT_LEN  16
+#define HP_BENCH_SCAN_SETS_MAX 10000
+
+/* xorshift64* */
+static uint8_t hp_bench_scan_rand(uint64_t *rng)
+{
+    *rng ^= *rng >> 12;
+    *rng ^= *rng << 25;
+    *rng ^= *rng >> 27;
+
+    return (uint8_t)((*rng * 0x2545F4914F6CDD1DULL) >> 56);
+}
+
+static void hp_bench_scan_matched(uint32_t pattern_id, uint64_t offset,
+                                  void *arg)
+{
+    (void)pattern_id;
+    (void)offset;
+    (void)arg;
+
+    return;
+}
+
+/* GB/s of scans of buf, and the matches of a scan */
+static double hp_bench_scan_rate(const hp_scan_tables_t *tables,
+                                 const uint8_t *buf, size_t buf_len,
+                                 uint64_t *matches)
+{
+    uint64_t scanned;
+    uint64_t start;
+    uint32_t count;
+
+    start = hp_bench_now_ns();
+    for (scanned = 0; scanned < HP_BENCH_SCAN_BYTES &&
+         hp_bench_now_ns() - start < HP_BENCH_SCAN_NS; scanned += buf_len)
+    {
+        count = hp_scan_run(tables, buf, buf_len, hp_bench_scan_matched,
+                            NULL);
+        if (scanned == 0)
+            *matches = count;
+    }
+
+    return (double)scanned / (double)(hp_bench_now_ns() - start);
+}
+
+static hp_status_t hp_bench_scan(const char *what,
+                                 const hp_scan_tables_t *tables,
+                                 const uint8_t *buf, size_t buf_len)
+{
+    hp_scan_tables_t plain;
+    uint64_t matches;
+    uint64_t plain_matches;
+    double rate;
+    double plain_rate;
+
+    if (buf_len == 0)
+        return HP_STATUS_OK;
+    /* The end of a long path tells more */
+    if (strlen(what) > 24)
+        what += strlen(what) - 24;
+
+    /* The same automaton, with no prefilter in front of it */
+    plain = *tables;
+    plain.prefilter_len = 0;
+    plain.prefilter_hash_len = 0;
+
+    rate = hp_bench_scan_rate(tables, buf, buf_len, &matches);
+    plain_rate = hp_bench_scan_rate(&plain, buf, buf_len, &plain_matches);
+    if (matches != plain_matches) {
+        printf("bench-scan: %s: %" PRIu64 " matches prefiltered, %" PRIu64
+               " plain\n", what, matches, plain_matches);
+        return HP_STATUS_ERROR;
+    }
+
+    printf("bench-scan: %-24s %8.2f GB/s prefiltered %8.2f GB/s plain "
+           "%6.2fx\n", what, rate, plain_rate, rate / plain_rate);
+
+    return HP_STATUS_OK;
+}
+
+/* Bytes of tables a scan reads */
+static size_t hp_bench_scan_size(const hp_scan_tables_t *tables)
+{
+    return (size_t)tables->dense_count * tables->class_count * 4 +
+        (size_t)(tables->state_count - tables->dense_count + 1) * 8 +
+        (size_t)tables->edge_count * 5 + (size_t)tables->state_count * 8 +
+        ((tables->prefilter_hash_len != 0) ?
+         ((size_t)1 << tables->prefilter_hash_bits) / 8 : 0);
+}
+
+/* Which prefilter the tables have, if any */
+static void hp_bench_scan_prefilter(const hp_scan_tables_t *tables,
+                                    char *desc, size_t desc_len)
+{
+    if (tables->prefilter_len != 0) {
+        snprintf(desc, desc_len, "teddy prefilter over %u bytes",
+                 tables->prefilter_len);
+    } else if (tables->prefilter_hash_len != 0) {
+        snprintf(desc, desc_len, "hash prefilter over %u bytes, %u KB",
+                 tables->prefilter_hash_len,
+                 (1U << tables->prefilter_hash_bits) / 8 / 1024);
+    } else {
+        snprintf(desc, desc_len, "no prefilter");
+    }
+
+    return;
+}
+
+/* A set of count random patterns over random data */
+static hp_status_t hp_bench_scan_set(uint32_t count, const uint8_t *buf,
+                                     size_t buf_len)
+{
+    hp_scan_engine_t *engine = NULL;
+    const hp_scan_tables_t *tables;
+    uint8_t pat[HP_BENCH_SCAN_PAT_LEN];
+    uint64_t rng = count;
+    char what[32];
+    char desc[64];
+    uint32_t i, j;
+    hp_status_t status;
+
+    if (hp_scan_engine_init(&engine) != HP_STATUS_OK) {
+        status = HP_STATUS_ERROR;
+        goto return_status;
+    }
+    for (i = 0; i < count; i++) {
+        for (j = 0; j < HP_BENCH_SCAN_PAT_LEN; j++)
+            pat[j] = hp_bench_scan_rand(&rng);
+        if (hp_scan_engine_add_pattern(engine, pat, sizeof(pat),
+                                       i) != HP_STATUS_OK)
+        {
+            status = HP_STATUS_ERROR;
+            goto return_status;
+        }
+    }
+    if (hp_scan_engine_compile(engine) != HP_STATUS_OK) {
+        status = HP_STATUS_ERROR;
+        goto return_status;
+    }
+    tables = hp_scan_engine_tables(engine);
+
+    hp_bench_scan_prefilter(tables, desc, sizeof(desc));
+    printf("bench-scan: %u patterns - %u states, %u dense, %.2f MB of "
+           "tables, %s\n", count, tables->state_count,
+           tables->dense_count,
+           (double)hp_bench_scan_size(tables) / (1024 * 1024), desc);
+    snprintf(what, sizeof(what), "random, %u patterns", count);
+    status = hp_bench_scan(what, tables, buf, buf_len);
+
+ return_status:
+    if (engine != NULL)
+        hp_scan_engine_deinit(engine);
+    return status;
+}
+
+int main(int argc, char *argv[])
+{
+    hp_signature_set_t set;
+    const hp_scan_tables_t *tables;
+    hp_file_map_t map;
+    char desc[64];
+    uint8_t *buf;
+    uint64_t rng = 1;
+    uint32_t count;
+    size_t i;
+    int arg;
+    int ret = EXIT_FAILURE;
+
+    hp_log_init(HP_LOG_LEVEL_ERROR, NULL);
+
+    hp_signatures_builtin(&set);
+    tables = set.rules->tables;
+    hp_bench_scan_prefilter(tables, desc, sizeof(desc));
+    printf("bench-scan: %u patterns, %u states, %s\n",
+           tables->pattern_count, tables->state_count, desc);
+
+    if ((buf = (uint8_t *)malloc(HP_BENCH_SCAN_BUF_SIZE)) == NULL)
+        goto return_status;
+
+    /* xorshift64* */
+    for (i = 0; i < HP_BENCH_SCAN_BUF_SIZE; i++) {
+        rng ^= rng >> 12;
+        rng ^= rng << 25;
+        rng ^= rng >> 27;
+        buf[i] = (uint8_t)((rng * 0x2545F4914F6CDD1DULL) >> 56);
+    }
+    if (hp_bench_scan("random", tables, buf,
+                      HP_BENCH_SCAN_BUF_SIZE) != HP_STATUS_OK)
+    {
+        goto return_status;
+    }
+    for (count = 1; count <= HP_BENCH_SCAN_SETS_MAX; count *= 10) {
+        if (hp_bench_scan_set(count, buf,
+                              HP_BENCH_SCAN_BUF_SIZE) != HP_STATUS_OK)
+        {
+            goto return_status;
+        }
+    }
+
+    memset(buf, 0, HP_BENCH_SCAN_BUF_SIZE);
+    if (hp_bench_scan("zeroes", tables, buf,
+                      HP_BENCH_SCAN_BUF_SIZE) != HP_STATUS_OK)
+    {
+        goto return_status;
+    }
+
+    for (arg = 1; arg < argc; arg++) {
+        hp_file_map_init(&map);
+        if (hp_file_map_open(&map, argv[arg]) != HP_STATUS_OK) {
+            printf("bench-scan: can't map \"%s\".\n", argv[arg]);
+            goto return_status;
+        }
+        if (hp_bench_scan(argv[arg], tables, map.base,
+                          (size_t)map.size) != HP_STATUS_OK)
+        {
+            hp_file_map_close(&map);
+            goto return_status;
+        }
+        hp_file_map_close(&map);
+    }
+    ret = EXIT_SUCCESS;
+
+ return_status:
+    free(buf);
+    hp_signatures_deinit(&set);
+    return ret;
+}
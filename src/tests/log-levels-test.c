@@ -0,0 +1,474 @@
+/**
+ * Copyright(C) 2018, Juniper Networks, Inc.
+ * All rights reserved
+ *
+ * This SOFTWARE is licensed under the license provided in the LICENSE.txt
+ * file.  By downloading, installing, copying, or otherwise using the
+ * SOFTWARE, you agree to be bound by the terms of that license.  This
+ * SOFTWARE is not an official Juniper product.
+ *
+ * Third-Party Code: This SOFTWARE may depend on other components under
+ * separate copyright notice and license terms.  Your use of the source
+ * code for those components is subject to the term and conditions of
+ * the respective license as noted in the Third-Party source code.
+ */
+
+/**
+ * @author Anoop Saldanha
+ */
+
+/* Test of the per module log levels.  Every module logs a line at every
+ * level, with an argument that counts its being taken, after levels are
+ * set by hp_log_init(), hp_log_set_level(), and hp_log_set_levels() with
+ * specs fixed and random, bad ones included.  A line has to be written,
+ * and its argument taken, exactly when its level is at or below its
+ * module's.  Lines of one more site are compiled out above warning, and
+ * never may be, whatever the levels.
+ *
+ * log-levels-test.exe [<seed> [<rounds>]] */
+
+/* Ahead of the includes, for every line here to be compiled in, but for
+ * those of the site compiled out further down */
+#define HP_LOG_COMPILE_LEVEL HP_LOG_LEVEL_DEBUG
+
+#include <ctype.h>
+
+#include "honeyprocs-common.h"
+#include "util-log.h"
+#include "status.h"
+
+#define HP_LOG_LEVELS_TEST_ROUNDS_DEFAULT 2000
+
+/* A site per module, and one compiled out above warning */
+#define HP_LOG_LEVELS_TEST_SITES (HP_LOG_MODULE_MAX + 1)
+#define HP_LOG_LEVELS_TEST_SITE_COMPILED_OUT HP_LOG_MODULE_MAX
+#define HP_LOG_LEVELS_TEST_COMPILED_OUT_LEVEL HP_LOG_LEVEL_WARNING
+
+typedef struct hp_log_levels_test_t {
+    uint64_t rng;
+    /* What the levels should be */
+    hp_log_level_t levels[HP_LOG_MODULE_MAX];
+    /* Per site and level, the times an argument was taken and a line was
+     * written in a round */
+    uint32_t taken[HP_LOG_LEVELS_TEST_SITES][HP_LOG_LEVEL_MAX];
+    uint32_t written[HP_LOG_LEVELS_TEST_SITES][HP_LOG_LEVEL_MAX];
+    /* stdout, which logging is sent away from */
+    FILE *console;
+    char out_path[64];
+    FILE *out;
+    char line[2 * HP_LOG_RECORD_SIZE];
+    uint64_t rounds;
+    uint64_t specs;
+    uint64_t lines;
+} hp_log_levels_test_t;
+
+#define hp_log_levels_test_fail(test, ...)                              \
+    do {                                                                \
+        fprintf((test)->console, "log-levels-test: %s:%d: round %"      \
+                PRIu64 ": ", __FILE__, __LINE__, (test)->rounds);       \
+        fprintf((test)->console, __VA_ARGS__);                          \
+        fprintf((test)->console, "\n");                                 \
+        return HP_STATUS_ERROR;                                         \
+    } while (0)
+
+/* xorshift64* */
+static uint32_t hp_log_levels_test_rand(hp_log_levels_test_t *test)
+{
+    test->rng ^= test->rng >> 12;
+    test->rng ^= test->rng << 25;
+    test->rng ^= test->rng >> 27;
+
+    return (uint32_t)((test->rng * 0x2545F4914F6CDD1DULL) >> 32);
+}
+
+static uint32_t hp_log_levels_test_arg(hp_log_levels_test_t *test,
+                                       uint32_t site, uint32_t level)
+{
+    test->taken[site][level]++;
+
+    return site * HP_LOG_LEVEL_MAX + level;
+}
+
+#define HP_LOG_LEVELS_TEST_LINE(test, site, level)                      \
+    hp_log(level, "mark %u %u %u", (uint32_t)(site), (uint32_t)(level), \
+           hp_log_levels_test_arg(test, site, level))
+
+/* A line at every level, logged as HP_LOG_MODULE where it's expanded */
+#define HP_LOG_LEVELS_TEST_LINES(test, site)                            \
+    do {                                                                \
+        HP_LOG_LEVELS_TEST_LINE(test, site, HP_LOG_LEVEL_EMERGENCY);    \
+        HP_LOG_LEVELS_TEST_LINE(test, site, HP_LOG_LEVEL_ALERT);        \
+        HP_LOG_LEVELS_TEST_LINE(test, site, HP_LOG_LEVEL_CRITICAL);     \
+        HP_LOG_LEVELS_TEST_LINE(test, site, HP_LOG_LEVEL_ERROR);        \
+        HP_LOG_LEVELS_TEST_LINE(test, site, HP_LOG_LEVEL_WARNING);      \
+        HP_LOG_LEVELS_TEST_LINE(test, site, HP_LOG_LEVEL_NOTICE);       \
+        HP_LOG_LEVELS_TEST_LINE(test, site, HP_LOG_LEVEL_INFO);         \
+        HP_LOG_LEVELS_TEST_LINE(test, site, HP_LOG_LEVEL_DEBUG);        \
+    } while (0)
+
+#undef HP_LOG_MODULE
+#define HP_LOG_MODULE HP_LOG_MODULE_AVL
+static void hp_log_levels_test_avl(hp_log_levels_test_t *test)
+{
+    HP_LOG_LEVELS_TEST_LINES(test, HP_LOG_MODULE_AVL);
+
+    return;
+}
+
+#undef HP_LOG_MODULE
+#define HP_LOG_MODULE HP_LOG_MODULE_MMAP
+static void hp_log_levels_test_mmap(hp_log_levels_test_t *test)
+{
+    HP_LOG_LEVELS_TEST_LINES(test, HP_LOG_MODULE_MMAP);
+
+    return;
+}
+
+#undef HP_LOG_MODULE
+#define HP_LOG_MODULE HP_LOG_MODULE_SCANNER
+static void hp_log_levels_test_scanner(hp_log_levels_test_t *test)
+{
+    HP_LOG_LEVELS_TEST_LINES(test, HP_LOG_MODULE_SCANNER);
+
+    return;
+}
+
+#undef HP_LOG_MODULE
+#define HP_LOG_MODULE HP_LOG_MODULE_SCAN_ENGINE
+static void hp_log_levels_test_scan_engine(hp_log_levels_test_t *test)
+{
+    HP_LOG_LEVELS_TEST_LINES(test, HP_LOG_MODULE_SCAN_ENGINE);
+
+    return;
+}
+
+/* The rest of the file logs as the default module */
+#undef HP_LOG_MODULE
+#define HP_LOG_MODULE HP_LOG_MODULE_DEFAULT
+static void hp_log_levels_test_default(hp_log_levels_test_t *test)
+{
+    HP_LOG_LEVELS_TEST_LINES(test, HP_LOG_MODULE_DEFAULT);
+
+    return;
+}
+
+#undef HP_LOG_COMPILE_LEVEL
+#define HP_LOG_COMPILE_LEVEL HP_LOG_LEVELS_TEST_COMPILED_OUT_LEVEL
+static void hp_log_levels_test_compiled_out(hp_log_levels_test_t *test)
+{
+    HP_LOG_LEVELS_TEST_LINES(test, HP_LOG_LEVELS_TEST_SITE_COMPILED_OUT);
+
+    return;
+}
+#undef HP_LOG_COMPILE_LEVEL
+#define HP_LOG_COMPILE_LEVEL HP_LOG_LEVEL_DEBUG
+
+/* Count the lines of each site and level logged since the last call. */
+static hp_status_t hp_log_levels_test_read(hp_log_levels_test_t *test)
+{
+    char tag[64];
+    const char *mark;
+    uint32_t site;
+    uint32_t level;
+    uint32_t value;
+
+    fflush(stdout);
+    clearerr(test->out);
+    while (fgets(test->line, sizeof(test->line), test->out) != NULL) {
+        /* Errors of bad specs are logged too */
+        if ((mark = strstr(test->line, "> - mark ")) == NULL)
+            continue;
+        if (sscanf(mark, "> - mark %u %u %u", &site, &level, &value) != 3 ||
+            site >= HP_LOG_LEVELS_TEST_SITES ||
+            level <= HP_LOG_LEVEL_NONE || level >= HP_LOG_LEVEL_MAX ||
+            value != site * HP_LOG_LEVEL_MAX + level)
+        {
+            hp_log_levels_test_fail(test, "bad line \"%s\"", test->line);
+        }
+        snprintf(tag, sizeof(tag), "<%s> - mark ",
+                 hp_log_level_to_string((hp_log_level_t)level));
+        if (strstr(test->line, tag) == NULL) {
+            hp_log_levels_test_fail(test, "line \"%s\" without %s",
+                                    test->line, tag);
+        }
+        test->written[site][level]++;
+        test->lines++;
+    }
+
+    return HP_STATUS_OK;
+}
+
+/* Have every site log at every level, and check what comes out against
+ * the levels. */
+static hp_status_t hp_log_levels_test_round(hp_log_levels_test_t *test)
+{
+    hp_log_module_t module;
+    hp_log_level_t compile_level;
+    uint32_t expected;
+    uint32_t site;
+    uint32_t level;
+
+    test->rounds++;
+    memset(test->taken, 0, sizeof(test->taken));
+    memset(test->written, 0, sizeof(test->written));
+
+    for (site = 0; site < HP_LOG_MODULE_MAX; site++) {
+        if (g_hp_log_levels[site] != test->levels[site]) {
+            hp_log_levels_test_fail(test, "module %s at %d, %d expected",
+                                    hp_log_module_to_string(
+                                        (hp_log_module_t)site),
+                                    g_hp_log_levels[site],
+                                    test->levels[site]);
+        }
+    }
+
+    hp_log_levels_test_default(test);
+    hp_log_levels_test_avl(test);
+    hp_log_levels_test_mmap(test);
+    hp_log_levels_test_scanner(test);
+    hp_log_levels_test_scan_engine(test);
+    hp_log_levels_test_compiled_out(test);
+    if (hp_log_levels_test_read(test) != HP_STATUS_OK)
+        return HP_STATUS_ERROR;
+
+    for (site = 0; site < HP_LOG_LEVELS_TEST_SITES; site++) {
+        if (site == HP_LOG_LEVELS_TEST_SITE_COMPILED_OUT) {
+            module = HP_LOG_MODULE_DEFAULT;
+            compile_level = HP_LOG_LEVELS_TEST_COMPILED_OUT_LEVEL;
+        } else {
+            module = (hp_log_module_t)site;
+            compile_level = HP_LOG_LEVEL_DEBUG;
+        }
+        for (level = HP_LOG_LEVEL_EMERGENCY; level < HP_LOG_LEVEL_MAX;
+             level++)
+        {
+            expected = (level <= (uint32_t)compile_level &&
+                        (int)level <= (int)test->levels[module]);
+            if (test->written[site][level] != expected ||
+                test->taken[site][level] != expected)
+            {
+                hp_log_levels_test_fail(test, "%s line of site %u, of "
+                                        "module %s at %s, written %u and "
+                                        "taken %u times, %u expected",
+                                        hp_log_level_to_string(
+                                            (hp_log_level_t)level), site,
+                                        hp_log_module_to_string(module),
+                                        (test->levels[module] ==
+                                         HP_LOG_LEVEL_NONE) ? "none" :
+                                        hp_log_level_to_string(
+                                            test->levels[module]),
+                                        test->written[site][level],
+                                        test->taken[site][level], expected);
+            }
+        }
+    }
+
+    return HP_STATUS_OK;
+}
+
+/**
+ * Set levels by spec, and check them in a round.
+ *
+ * @module The module the spec is for, or HP_LOG_MODULE_MAX for all.
+ * @level The level it sets, or HP_LOG_LEVEL_NOTSET if it's bad.
+ */
+static hp_status_t hp_log_levels_test_spec(hp_log_levels_test_t *test,
+                                           const char *spec, int module,
+                                           hp_log_level_t level)
+{
+    hp_status_t status;
+    int i;
+
+    test->specs++;
+    status = hp_log_set_levels(spec);
+    if (status != ((level == HP_LOG_LEVEL_NOTSET) ? HP_STATUS_ERROR :
+                   HP_STATUS_OK))
+    {
+        hp_log_levels_test_fail(test, "spec \"%s\" %s", spec,
+                                (status == HP_STATUS_OK) ? "taken" :
+                                "refused");
+    }
+    if (level != HP_LOG_LEVEL_NOTSET) {
+        for (i = 0; i < HP_LOG_MODULE_MAX; i++) {
+            if (module == HP_LOG_MODULE_MAX || module == i)
+                test->levels[i] = level;
+        }
+    }
+
+    return hp_log_levels_test_round(test);
+}
+
+/* Write name into buf, in random case. */
+static size_t hp_log_levels_test_name(hp_log_levels_test_t *test, char *buf,
+                                      const char *name)
+{
+    size_t i;
+
+    for (i = 0; name[i] != '\0'; i++) {
+        buf[i] = (char)((hp_log_levels_test_rand(test) % 2 != 0) ?
+                        toupper((uint8_t)name[i]) :
+                        tolower((uint8_t)name[i]));
+    }
+    buf[i] = '\0';
+
+    return i;
+}
+
+/* A random spec, good or bad, or a level set straight. */
+static hp_status_t hp_log_levels_test_random(hp_log_levels_test_t *test)
+{
+    char spec[64];
+    size_t len = 0;
+    int module;
+    hp_log_level_t level;
+    uint32_t r;
+
+    module = (int)(hp_log_levels_test_rand(test) % (HP_LOG_MODULE_MAX + 1));
+    level = (hp_log_level_t)(hp_log_levels_test_rand(test) %
+                             HP_LOG_LEVEL_MAX);
+    r = hp_log_levels_test_rand(test) % 16;
+
+    if (r == 0 && module != HP_LOG_MODULE_MAX) {
+        hp_log_set_level((hp_log_module_t)module, level);
+        test->levels[module] = level;
+        return hp_log_levels_test_round(test);
+    }
+
+    if (module != HP_LOG_MODULE_MAX) {
+        len += hp_log_levels_test_name(test, spec + len,
+                                       hp_log_module_to_string(
+                                           (hp_log_module_t)module));
+        /* A module that isn't one */
+        if (r == 1)
+            spec[len++] = 'x';
+        spec[len++] = '=';
+    }
+    len += hp_log_levels_test_name(test, spec + len,
+                                   (level == HP_LOG_LEVEL_NONE) ? "none" :
+                                   hp_log_level_to_string(level));
+    spec[len] = '\0';
+    /* Or a level that isn't one */
+    if (r == 2)
+        spec[(len > 1) ? len - 1 : len] = '\0';
+    else if (r == 3)
+        strcat(spec, " ");
+
+    if ((r == 1 && module != HP_LOG_MODULE_MAX) || r == 2 || r == 3)
+        level = HP_LOG_LEVEL_NOTSET;
+
+    return hp_log_levels_test_spec(test, spec, module, level);
+}
+
+static hp_status_t hp_log_levels_test_run(hp_log_levels_test_t *test,
+                                          uint64_t rounds)
+{
+    static const struct {
+        const char *spec;
+        int module;
+        hp_log_level_t level;
+    } specs[] = {
+        { "warning", HP_LOG_MODULE_MAX, HP_LOG_LEVEL_WARNING },
+        { "mmap=debug", HP_LOG_MODULE_MMAP, HP_LOG_LEVEL_DEBUG },
+        { "SCAN-ENGINE=None", HP_LOG_MODULE_SCAN_ENGINE,
+          HP_LOG_LEVEL_NONE },
+        { "Avl=error", HP_LOG_MODULE_AVL, HP_LOG_LEVEL_ERROR },
+        { "default=emerg", HP_LOG_MODULE_DEFAULT, HP_LOG_LEVEL_EMERGENCY },
+        { "scanner=INFO", HP_LOG_MODULE_SCANNER, HP_LOG_LEVEL_INFO },
+        { "", HP_LOG_MODULE_MAX, HP_LOG_LEVEL_NOTSET },
+        { "bogus", HP_LOG_MODULE_MAX, HP_LOG_LEVEL_NOTSET },
+        { "mmap=bogus", HP_LOG_MODULE_MAX, HP_LOG_LEVEL_NOTSET },
+        { "nomodule=info", HP_LOG_MODULE_MAX, HP_LOG_LEVEL_NOTSET },
+        { "=info", HP_LOG_MODULE_MAX, HP_LOG_LEVEL_NOTSET },
+        { "mmap=", HP_LOG_MODULE_MAX, HP_LOG_LEVEL_NOTSET },
+        { "mma=info", HP_LOG_MODULE_MAX, HP_LOG_LEVEL_NOTSET },
+        { "emergency", HP_LOG_MODULE_MAX, HP_LOG_LEVEL_NOTSET },
+        { "debug", HP_LOG_MODULE_MAX, HP_LOG_LEVEL_DEBUG },
+        { "none", HP_LOG_MODULE_MAX, HP_LOG_LEVEL_NONE },
+    };
+    uint64_t i;
+    int module;
+
+    hp_log_init(HP_LOG_LEVEL_INFO, NULL);
+    for (module = 0; module < HP_LOG_MODULE_MAX; module++)
+        test->levels[module] = HP_LOG_LEVEL_INFO;
+    if (hp_log_levels_test_round(test) != HP_STATUS_OK)
+        return HP_STATUS_ERROR;
+
+    hp_log_set_level(HP_LOG_MODULE_SCANNER, HP_LOG_LEVEL_NOTICE);
+    test->levels[HP_LOG_MODULE_SCANNER] = HP_LOG_LEVEL_NOTICE;
+    if (hp_log_levels_test_round(test) != HP_STATUS_OK)
+        return HP_STATUS_ERROR;
+
+    for (i = 0; i < sizeof(specs) / sizeof(specs[0]); i++) {
+        if (hp_log_levels_test_spec(test, specs[i].spec, specs[i].module,
+                                    specs[i].level) != HP_STATUS_OK)
+        {
+            return HP_STATUS_ERROR;
+        }
+    }
+
+    for (i = 0; i < rounds; i++) {
+        if (hp_log_levels_test_random(test) != HP_STATUS_OK)
+            return HP_STATUS_ERROR;
+    }
+
+    return HP_STATUS_OK;
+}
+
+int main(int argc, char *argv[])
+{
+    static hp_log_levels_test_t test;
+    uint64_t seed;
+    uint64_t rounds;
+    int stdout_fd = -1;
+    int fd;
+    int ret = EXIT_FAILURE;
+
+    seed = (argc > 1) ? strtoull(argv[1], NULL, 0) : 1;
+    rounds = (argc > 2) ? strtoull(argv[2], NULL, 0) :
+        HP_LOG_LEVELS_TEST_ROUNDS_DEFAULT;
+    test.rng = seed | 1;
+    test.console = stdout;
+
+    /* Logging goes to a file read back after each round, and the test's
+     * own output to stdout as was */
+    snprintf(test.out_path, sizeof(test.out_path),
+             "/tmp/log-levels-test-XXXXXX");
+    if ((fd = mkstemp(test.out_path)) < 0) {
+        printf("log-levels-test: mkstemp() failed\n");
+        return EXIT_FAILURE;
+    }
+    close(fd);
+    fflush(stdout);
+    if ((stdout_fd = dup(STDOUT_FILENO)) < 0 ||
+        (test.console = fdopen(stdout_fd, "w")) == NULL ||
+        freopen(test.out_path, "w", stdout) == NULL ||
+        (test.out = fopen(test.out_path, "r")) == NULL)
+    {
+        if (test.console == NULL)
+            test.console = stderr;
+        fprintf(test.console, "log-levels-test: unable to redirect "
+                "stdout\n");
+        goto return_status;
+    }
+
+    if (hp_log_levels_test_run(&test, rounds) != HP_STATUS_OK) {
+        fprintf(test.console, "log-levels-test: FAILED with seed %" PRIu64
+                ".\n", seed);
+        goto return_status;
+    }
+
+    fprintf(test.console, "log-levels-test: %" PRIu64 " rounds, %" PRIu64
+            " specs, %" PRIu64 " lines, with seed %" PRIu64 " passed.\n",
+            test.rounds, test.specs, test.lines, seed);
+    ret = EXIT_SUCCESS;
+
+ return_status:
+    hp_log_deinit();
+    if (test.out != NULL)
+        fclose(test.out);
+    if (test.console != stdout && test.console != stderr)
+        fclose(test.console);
+    unlink(test.out_path);
+    return ret;
+}
@@ -0,0 +1,367 @@
+/**
+ * Copyright(C) 2018, Juniper Networks, Inc.
+ * All rights reserved
+ *
+ * This SOFTWARE is licensed under the license provided in the LICENSE.txt
+ * file.  By downloading, installing, copying, or otherwise using the
+ * SOFTWARE, you agree to be bound by the terms of that license.  This
+ * SOFTWARE is not an official Juniper product.
+ *
+ * Third-Party Code: This SOFTWARE may depend on other components under
+ * separate copyright notice and license terms.  Your use of the source
+ * code for those components is subject to the term and conditions of
+ * the respective license as noted in the Third-Party source code.
+ */
+
+/**
+ * @author Anoop Saldanha
+ */
+
+/* Test of the log ring under contention.  Threads log numbered lines of
+ * varying length, some past HP_LOG_RECORD_SIZE, to a small ring, with
+ * stdout sent to a file, which is then read back.  Every line has to be
+ * whole and come in the order its thread logged it.  When the ring
+ * blocks no line may be lost, and when it drops, the lines written and
+ * dropped have to add up, as do the drops the writer reports.  Lines at
+ * HP_LOG_LEVEL_ERROR have to be written ahead of the flush interval.
+ *
+ * log-ring-test.exe [<threads> [<lines_per_thread>]] */
+
+#include <sys/stat.h>
+
+#include "honeyprocs-common.h"
+#include "util-log.h"
+#include "util-thread.h"
+#include "status.h"
+
+#define HP_LOG_RING_TEST_THREADS_DEFAULT 4
+#define HP_LOG_RING_TEST_THREADS_MAX 16
+#define HP_LOG_RING_TEST_LINES_DEFAULT 5000
+#define HP_LOG_RING_TEST_LINES_MAX 100000
+#define HP_LOG_RING_TEST_RING_SIZE 16
+/* Every this many lines, one is too long for a record */
+#define HP_LOG_RING_TEST_LONG_EVERY 100
+#define HP_LOG_RING_TEST_PAD_MAX (2 * HP_LOG_RECORD_SIZE)
+
+typedef struct hp_log_ring_test_thread_t {
+    hp_thread_t thread;
+    uint32_t id;
+    uint32_t lines;
+} hp_log_ring_test_thread_t;
+
+typedef struct hp_log_ring_test_t {
+    char path[64];
+    int stdout_fd;
+    uint32_t thread_count;
+    uint32_t lines;
+    hp_log_ring_test_thread_t threads[HP_LOG_RING_TEST_THREADS_MAX];
+    /* Per thread, the line after the last one read back */
+    uint32_t next[HP_LOG_RING_TEST_THREADS_MAX];
+    uint64_t written;
+    uint64_t reported;
+    char pad[HP_LOG_RING_TEST_PAD_MAX + 1];
+} hp_log_ring_test_t;
+
+static hp_log_ring_test_t g_hp_log_ring_test;
+
+#define hp_log_ring_test_fail(...)                                      \
+    do {                                                                \
+        printf("log-ring-test: %s:%d: ", __FILE__, __LINE__);           \
+        printf(__VA_ARGS__);                                            \
+        printf("\n");                                                   \
+        return HP_STATUS_ERROR;                                         \
+    } while (0)
+
+/* How much padding line i of thread t gets.  Most lines fit a record. */
+static uint32_t hp_log_ring_test_pad_len(uint32_t t, uint32_t i)
+{
+    if (i % HP_LOG_RING_TEST_LONG_EVERY == HP_LOG_RING_TEST_LONG_EVERY - 1)
+        return HP_LOG_RING_TEST_PAD_MAX;
+
+    return (i * 7 + t * 13) % 400;
+}
+
+static char hp_log_ring_test_pad_char(uint32_t t, uint32_t i)
+{
+    return (char)('a' + (t + i) % 26);
+}
+
+static void hp_log_ring_test_logger(void *arg)
+{
+    hp_log_ring_test_t *test = &g_hp_log_ring_test;
+    hp_log_ring_test_thread_t *thread = (hp_log_ring_test_thread_t *)arg;
+    uint32_t len;
+    uint32_t i;
+
+    for (i = 0; i < thread->lines; i++) {
+        len = hp_log_ring_test_pad_len(thread->id, i);
+        hp_log_info("t=%u i=%u len=%u %c %.*s", thread->id, i, len,
+                    hp_log_ring_test_pad_char(thread->id, i), (int)len,
+                    test->pad);
+    }
+
+    return;
+}
+
+/* Send stdout, which the writer writes to, to a file of its own. */
+static hp_status_t hp_log_ring_test_redirect(hp_log_ring_test_t *test)
+{
+    int fd;
+
+    snprintf(test->path, sizeof(test->path), "/tmp/log-ring-test-XXXXXX");
+    if ((fd = mkstemp(test->path)) < 0)
+        hp_log_ring_test_fail("mkstemp() failed");
+    close(fd);
+
+    fflush(stdout);
+    test->stdout_fd = dup(STDOUT_FILENO);
+    if (test->stdout_fd < 0 || freopen(test->path, "w", stdout) == NULL) {
+        unlink(test->path);
+        hp_log_ring_test_fail("redirecting stdout failed");
+    }
+
+    return HP_STATUS_OK;
+}
+
+static void hp_log_ring_test_restore(hp_log_ring_test_t *test)
+{
+    fflush(stdout);
+    dup2(test->stdout_fd, STDOUT_FILENO);
+    close(test->stdout_fd);
+    clearerr(stdout);
+
+    return;
+}
+
+/* Check a line as read back, which is either one of the threads' or a
+ * count of lines dropped. */
+static hp_status_t hp_log_ring_test_line(hp_log_ring_test_t *test,
+                                         const char *line, size_t line_len)
+{
+    const char *msg;
+    uint64_t dropped;
+    uint32_t t, i, len;
+    uint32_t expected_len;
+    char c;
+    int n;
+
+    if (line_len < 2 || line[line_len - 2] != '\r' ||
+        line[line_len - 1] != '\n')
+    {
+        hp_log_ring_test_fail("line \"%.60s\" isn't whole", line);
+    }
+    if (line_len > HP_LOG_RECORD_SIZE)
+        hp_log_ring_test_fail("line of %zu bytes", line_len);
+
+    if ((msg = strstr(line, "> - ")) == NULL)
+        hp_log_ring_test_fail("line \"%.60s\" has no prefix", line);
+    msg += 4;
+    if (sscanf(msg, "%" SCNu64 " log line(s) dropped", &dropped) == 1) {
+        test->reported += dropped;
+        return HP_STATUS_OK;
+    }
+    if (sscanf(msg, "t=%u i=%u len=%u %c%n", &t, &i, &len, &c, &n) != 4 ||
+        msg[n] != ' ' || t >= test->thread_count || i >= test->lines)
+    {
+        hp_log_ring_test_fail("line \"%.60s\" isn't a thread's", line);
+    }
+
+    /* Each thread's lines come in the order they were logged in */
+    if (i < test->next[t]) {
+        hp_log_ring_test_fail("line %u of thread %u after line %u", i, t,
+                              test->next[t] - 1);
+    }
+    test->next[t] = i + 1;
+    test->written++;
+
+    /* The padding follows, cut off if need be at HP_LOG_RECORD_SIZE */
+    msg += n + 1;
+    expected_len = (uint32_t)(msg - line) + len + 2;
+    if (expected_len > HP_LOG_RECORD_SIZE - 1)
+        expected_len = HP_LOG_RECORD_SIZE - 1;
+    if (line_len != expected_len || len != hp_log_ring_test_pad_len(t, i) ||
+        c != hp_log_ring_test_pad_char(t, i) ||
+        strspn(msg, "x") != line_len - (size_t)(msg - line) - 2)
+    {
+        hp_log_ring_test_fail("line %u of thread %u is %zu bytes, %u "
+                              "expected", i, t, line_len, expected_len);
+    }
+
+    return HP_STATUS_OK;
+}
+
+static hp_status_t hp_log_ring_test_read(hp_log_ring_test_t *test)
+{
+    static char line[2 * HP_LOG_RECORD_SIZE];
+    hp_status_t status;
+    FILE *fp;
+
+    if ((fp = fopen(test->path, "rb")) == NULL)
+        hp_log_ring_test_fail("unable to open %s", test->path);
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        if (hp_log_ring_test_line(test, line, strlen(line)) !=
+            HP_STATUS_OK)
+        {
+            status = HP_STATUS_ERROR;
+            goto return_status;
+        }
+    }
+
+    status = HP_STATUS_OK;
+ return_status:
+    fclose(fp);
+    return status;
+}
+
+/* Log from all the threads at once, and read back what was written. */
+static hp_status_t hp_log_ring_test_run(hp_log_ring_test_t *test,
+                                        hp_log_overflow_t overflow)
+{
+    hp_log_async_config_t config;
+    uint64_t dropped = 0;
+    uint64_t total;
+    uint32_t t;
+    hp_status_t status;
+
+    memset(test->next, 0, sizeof(test->next));
+    test->written = 0;
+    test->reported = 0;
+
+    config.ring_size = HP_LOG_RING_TEST_RING_SIZE;
+    config.flush_interval_ms = 10;
+    config.overflow = overflow;
+
+    if (hp_log_ring_test_redirect(test) != HP_STATUS_OK)
+        return HP_STATUS_ERROR;
+    hp_log_init(HP_LOG_LEVEL_INFO, NULL);
+    status = hp_log_async_start(&config);
+    if (status == HP_STATUS_OK) {
+        for (t = 0; t < test->thread_count; t++) {
+            test->threads[t].id = t;
+            test->threads[t].lines = test->lines;
+            if (hp_thread_create(&test->threads[t].thread,
+                                 hp_log_ring_test_logger,
+                                 &test->threads[t]) != HP_STATUS_OK)
+            {
+                abort();
+            }
+        }
+        for (t = 0; t < test->thread_count; t++)
+            hp_thread_join(&test->threads[t].thread);
+        dropped = hp_log_dropped();
+    }
+    hp_log_deinit();
+    hp_log_ring_test_restore(test);
+    hp_log_init(HP_LOG_LEVEL_ERROR, NULL);
+    if (status != HP_STATUS_OK) {
+        printf("log-ring-test: hp_log_async_start() failed\n");
+        goto return_status;
+    }
+
+    if (hp_log_ring_test_read(test) != HP_STATUS_OK) {
+        status = HP_STATUS_ERROR;
+        goto return_status;
+    }
+
+    total = (uint64_t)test->thread_count * test->lines;
+    if (test->written + dropped != total ||
+        (overflow == HP_LOG_OVERFLOW_BLOCK && dropped != 0))
+    {
+        printf("log-ring-test: %" PRIu64 " lines written and %" PRIu64
+               " dropped of %" PRIu64 "\n", test->written, dropped, total);
+        status = HP_STATUS_ERROR;
+        goto return_status;
+    }
+    if (test->reported != dropped) {
+        printf("log-ring-test: %" PRIu64 " lines reported dropped, %"
+               PRIu64 " dropped\n", test->reported, dropped);
+        status = HP_STATUS_ERROR;
+        goto return_status;
+    }
+
+    printf("log-ring-test: %u threads, %s, %" PRIu64 " lines written and %"
+           PRIu64 " dropped.\n", test->thread_count,
+           (overflow == HP_LOG_OVERFLOW_BLOCK) ? "blocking" : "dropping",
+           test->written, dropped);
+
+    status = HP_STATUS_OK;
+ return_status:
+    unlink(test->path);
+    return status;
+}
+
+/* An error is written right away, with the flush interval far off. */
+static hp_status_t hp_log_ring_test_wake(hp_log_ring_test_t *test)
+{
+    hp_log_async_config_t config;
+    struct stat st;
+    uint32_t ms = 0;
+    hp_status_t status;
+
+    config.ring_size = HP_LOG_RING_TEST_RING_SIZE;
+    config.flush_interval_ms = 60 * 1000;
+    config.overflow = HP_LOG_OVERFLOW_DROP;
+
+    if (hp_log_ring_test_redirect(test) != HP_STATUS_OK)
+        return HP_STATUS_ERROR;
+    hp_log_init(HP_LOG_LEVEL_INFO, NULL);
+    status = hp_log_async_start(&config);
+    if (status == HP_STATUS_OK) {
+        /* Give the writer time to be waiting */
+        hp_sleep_ms(100);
+        hp_log_error("An error to wake the writer.");
+        for (ms = 0; ms < 5000; ms += 10) {
+            if (stat(test->path, &st) == 0 && st.st_size != 0)
+                break;
+            hp_sleep_ms(10);
+        }
+    }
+    hp_log_deinit();
+    hp_log_ring_test_restore(test);
+    hp_log_init(HP_LOG_LEVEL_ERROR, NULL);
+    unlink(test->path);
+
+    if (status != HP_STATUS_OK)
+        hp_log_ring_test_fail("hp_log_async_start() failed");
+    if (ms >= 5000)
+        hp_log_ring_test_fail("an error wasn't written in %u ms", ms);
+
+    return HP_STATUS_OK;
+}
+
+int main(int argc, char *argv[])
+{
+    hp_log_ring_test_t *test = &g_hp_log_ring_test;
+    int ret = EXIT_FAILURE;
+
+    test->thread_count = (argc > 1) ? (uint32_t)strtoul(argv[1], NULL, 0) :
+        HP_LOG_RING_TEST_THREADS_DEFAULT;
+    test->lines = (argc > 2) ? (uint32_t)strtoul(argv[2], NULL, 0) :
+        HP_LOG_RING_TEST_LINES_DEFAULT;
+    if (test->thread_count == 0 ||
+        test->thread_count > HP_LOG_RING_TEST_THREADS_MAX ||
+        test->lines == 0 || test->lines > HP_LOG_RING_TEST_LINES_MAX)
+    {
+        printf("Usage: %s [<threads> [<lines_per_thread>]]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    memset(test->pad, 'x', HP_LOG_RING_TEST_PAD_MAX);
+
+    hp_log_init(HP_LOG_LEVEL_ERROR, NULL);
+
+    if (hp_log_ring_test_run(test, HP_LOG_OVERFLOW_BLOCK) != HP_STATUS_OK ||
+        hp_log_ring_test_run(test, HP_LOG_OVERFLOW_DROP) != HP_STATUS_OK ||
+        hp_log_ring_test_wake(test) != HP_STATUS_OK)
+    {
+        printf("log-ring-test: FAILED.\n");
+        goto return_status;
+    }
+
+    printf("log-ring-test: %u threads with %u lines each passed.\n",
+           test->thread_count, test->lines);
+    ret = EXIT_SUCCESS;
+
+ return_status:
+    hp_log_deinit();
+    return ret;
+}
@@ -0,0 +1,441 @@
+/**
+ * Copyright(C) 2018, Juniper Networks, Inc.
+ * All rights reserved
+ *
+ * This SOFTWARE is licensed under the license provided in the LICENSE.txt
+ * file.  By downloading, installing, copying, or otherwise using the
+ * SOFTWARE, you agree to be bound by the terms of that license.  This
+ * SOFTWARE is not an official Juniper product.
+ *
+ * Third-Party Code: This SOFTWARE may depend on other components under
+ * separate copyright notice and license terms.  Your use of the source
+ * code for those components is subject to the term and conditions of
+ * the respective license as noted in the Third-Party source code.
+ */
+
+/**
+ * @author Anoop Saldanha
+ */
+
+/* Round trip test of the binary log.  Lines with every kind of argument,
+ * with flags, widths and precisions, given or taken from arguments, are
+ * logged in binary with random values, and formatted by snprintf() as
+ * they are logged.  logdec, built in with its main() renamed, then has
+ * to render each the same, both as text and as JSON.  A log too small
+ * for all its lines has to decode to the ones that fit, with the rest
+ * counted as dropped.
+ *
+ * logdec-test.exe [<seed> [<rounds>]] */
+
+#include <stddef.h>
+
+#include "honeyprocs-common.h"
+#include "util-log.h"
+#include "util-log-binary.h"
+#include "status.h"
+
+/* Built with -Dmain=hp_logdec_main, for logdec's */
+#undef main
+int hp_logdec_main(int argc, char *argv[]);
+
+#define HP_LOGDEC_TEST_ROUNDS_DEFAULT 200
+#define HP_LOGDEC_TEST_RECORDS_MAX 4096
+/* Lines logged to a log with room for only some of them */
+#define HP_LOGDEC_TEST_FULL_LINES 2000
+#define HP_LOGDEC_TEST_FULL_SIZE (16 * 1024)
+
+typedef struct hp_logdec_test_record_t {
+    hp_log_level_t level;
+    int line;
+    char message[HP_LOG_RECORD_SIZE];
+} hp_logdec_test_record_t;
+
+typedef struct hp_logdec_test_t {
+    uint64_t rng;
+    char log_path[64];
+    char out_path[64];
+    hp_logdec_test_record_t records[HP_LOGDEC_TEST_RECORDS_MAX];
+    uint32_t record_count;
+    uint64_t decoded;
+    char line[4 * HP_LOG_RECORD_SIZE];
+    char expected[4 * HP_LOG_RECORD_SIZE];
+} hp_logdec_test_t;
+
+static hp_logdec_test_t g_hp_logdec_test;
+
+#define hp_logdec_test_fail(...)                                        \
+    do {                                                                \
+        printf("logdec-test: %s:%d: ", __FILE__, __LINE__);             \
+        printf(__VA_ARGS__);                                            \
+        printf("\n");                                                   \
+        return HP_STATUS_ERROR;                                         \
+    } while (0)
+
+/* Log a line in binary, and keep what it should come out as. */
+#define hp_logdec_test_log(test, level_, ...)                           \
+    do {                                                                \
+        hp_logdec_test_record_t *record_ =                              \
+            &(test)->records[(test)->record_count++];                   \
+        hp_log(level_, __VA_ARGS__);                                    \
+        record_->level = (level_);                                      \
+        record_->line = __LINE__;                                       \
+        snprintf(record_->message, sizeof(record_->message),            \
+                 __VA_ARGS__);                                          \
+    } while (0)
+
+/* xorshift64* */
+static uint32_t hp_logdec_test_rand(hp_logdec_test_t *test)
+{
+    test->rng ^= test->rng >> 12;
+    test->rng ^= test->rng << 25;
+    test->rng ^= test->rng >> 27;
+
+    return (uint32_t)((test->rng * 0x2545F4914F6CDD1DULL) >> 32);
+}
+
+static uint64_t hp_logdec_test_rand64(hp_logdec_test_t *test)
+{
+    uint64_t v = hp_logdec_test_rand(test);
+
+    return (v << 32) | hp_logdec_test_rand(test);
+}
+
+/* Send a stream to a file, returning the descriptor it had, or -1. */
+static int hp_logdec_test_redirect(FILE *fp, const char *path)
+{
+    int fd;
+
+    fflush(fp);
+    if ((fd = dup(fileno(fp))) < 0)
+        return -1;
+    if (freopen(path, "w", fp) == NULL) {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+static void hp_logdec_test_restore(FILE *fp, int fd)
+{
+    fflush(fp);
+    dup2(fd, fileno(fp));
+    close(fd);
+    clearerr(fp);
+
+    return;
+}
+
+/* One of each kind of line, with random values.  Arguments are taken
+ * twice, so none may have side effects.  NULL strings are logged as
+ * "(null)", which glibc only matches with no precision. */
+static void hp_logdec_test_lines(hp_logdec_test_t *test)
+{
+    static const char *strings[] = {
+        "", "honeyproc", "a \"quoted\" back\\slash and a\ttab", NULL,
+        "0123456789abcdefghijklmnopqrstuvwxyz",
+    };
+    const char *s1, *s2;
+    uint64_t v;
+    int w, p;
+    double d;
+
+    v = hp_logdec_test_rand64(test);
+    hp_logdec_test_log(test, HP_LOG_LEVEL_INFO, "%d %i %u %x %X %o",
+                       (int)v, (int)(v >> 7), (unsigned int)(v >> 13),
+                       (unsigned int)(v >> 17), (unsigned int)(v >> 19),
+                       (unsigned int)(v >> 23));
+    v = hp_logdec_test_rand64(test);
+    hp_logdec_test_log(test, HP_LOG_LEVEL_INFO, "%hhd %hhu %hd %hu %hhx",
+                       (int)v, (int)(v >> 8), (int)(v >> 16),
+                       (int)(v >> 32), (int)(v >> 48));
+    v = hp_logdec_test_rand64(test);
+    hp_logdec_test_log(test, HP_LOG_LEVEL_WARNING,
+                       "%ld %lu %lld %llu %zu %zd %td %jd %ju %lx",
+                       (long)v, (unsigned long)~v, (long long)-v,
+                       (unsigned long long)v, (size_t)(v >> 3),
+                       (ptrdiff_t)(v ^ (v << 5)), (ptrdiff_t)-(v >> 9),
+                       (intmax_t)v, (uintmax_t)(v >> 1), (unsigned long)v);
+
+    v = hp_logdec_test_rand64(test);
+    w = (int)(hp_logdec_test_rand(test) % 41) - 20;
+    p = (int)(hp_logdec_test_rand(test) % 12) - 2;
+    hp_logdec_test_log(test, HP_LOG_LEVEL_INFO,
+                       "[%-8d|%+d|% d|%08x|%#x|%#o|%.3d|%*d|%-*d|%.*d]",
+                       (int)v, (int)(v >> 11), (int)(v >> 21),
+                       (unsigned int)(v >> 5), (unsigned int)v,
+                       (unsigned int)(v >> 40), (int)(v % 1000), w,
+                       (int)(v >> 3), w, (int)(v >> 9), p,
+                       (int)(v >> 27));
+
+    d = (double)(int64_t)hp_logdec_test_rand64(test) /
+        (1 + hp_logdec_test_rand(test));
+    hp_logdec_test_log(test, HP_LOG_LEVEL_INFO,
+                       "%f %.2f %e %g %10.4f %-12.3E %Lf %.*f", d, d * 3,
+                       d / 7, d, d, -d, (long double)1.5 * (w + 20), p,
+                       d / 11);
+
+    s1 = strings[hp_logdec_test_rand(test) %
+                 (sizeof(strings) / sizeof(strings[0]))];
+    s2 = strings[hp_logdec_test_rand(test) %
+                 (sizeof(strings) / sizeof(strings[0]))];
+    w = (int)(hp_logdec_test_rand(test) % 41) - 20;
+    p = (int)(hp_logdec_test_rand(test) % 8);
+    hp_logdec_test_log(test, HP_LOG_LEVEL_NOTICE,
+                       "%c%c <%s> <%.3s> <%10s> <%-10s> <%*s> <%.*s>",
+                       (int)('a' + w + 20), '!', s1,
+                       (s2 != NULL) ? s2 : "(null)", s1,
+                       (s2 != NULL) ? s2 : "", w, (s1 != NULL) ? s1 : "",
+                       p, (s2 != NULL) ? s2 : "");
+
+    v = hp_logdec_test_rand64(test);
+    hp_logdec_test_log(test, HP_LOG_LEVEL_ERROR, "100%% of %u, 0%% left",
+                       (unsigned int)v);
+    hp_logdec_test_log(test, HP_LOG_LEVEL_CRITICAL, "No arguments at all.");
+
+    return;
+}
+
+/* Run logdec over the log, with its output to a file. */
+static hp_status_t hp_logdec_test_decode(hp_logdec_test_t *test, bool json)
+{
+    char *argv[4];
+    int argc = 0;
+    int out_fd;
+    int err_fd;
+    int ret;
+
+    argv[argc++] = (char *)"logdec.exe";
+    if (json)
+        argv[argc++] = (char *)"-j";
+    argv[argc++] = test->log_path;
+    argv[argc] = NULL;
+
+    /* Drops are noted on stderr */
+    if ((out_fd = hp_logdec_test_redirect(stdout, test->out_path)) < 0)
+        hp_logdec_test_fail("redirecting stdout failed");
+    if ((err_fd = hp_logdec_test_redirect(stderr, "/dev/null")) < 0) {
+        hp_logdec_test_restore(stdout, out_fd);
+        hp_logdec_test_fail("redirecting stderr failed");
+    }
+    ret = hp_logdec_main(argc, argv);
+    hp_logdec_test_restore(stderr, err_fd);
+    hp_logdec_test_restore(stdout, out_fd);
+
+    if (ret != EXIT_SUCCESS)
+        hp_logdec_test_fail("logdec failed");
+
+    return HP_STATUS_OK;
+}
+
+/* Write s out as a JSON string, the way logdec does. */
+static void hp_logdec_test_json(char *buf, size_t size, const char *s)
+{
+    size_t len = 0;
+
+    buf[len++] = '"';
+    for (; *s != '\0' && len + 8 < size; s++) {
+        if (*s == '"' || *s == '\\') {
+            buf[len++] = '\\';
+            buf[len++] = *s;
+        } else if ((uint8_t)*s < 0x20) {
+            len += snprintf(buf + len, size - len, "\\u%04x", (uint8_t)*s);
+        } else {
+            buf[len++] = *s;
+        }
+    }
+    buf[len++] = '"';
+    buf[len] = '\0';
+
+    return;
+}
+
+/* Check logdec's output, line by line, against the records.  A prefix of
+ * them will do, as the ones that didn't fit are dropped. */
+static hp_status_t hp_logdec_test_check(hp_logdec_test_t *test, bool json,
+                                        uint32_t *count)
+{
+    static char message[2 * HP_LOG_RECORD_SIZE];
+    hp_logdec_test_record_t *record;
+    const char *rest;
+    hp_status_t status;
+    FILE *fp;
+
+    *count = 0;
+    if ((fp = fopen(test->out_path, "rb")) == NULL)
+        hp_logdec_test_fail("unable to open %s", test->out_path);
+
+    while (fgets(test->line, sizeof(test->line), fp) != NULL) {
+        if (*count == test->record_count) {
+            printf("logdec-test: more lines than records, \"%.60s\"\n",
+                   test->line);
+            status = HP_STATUS_ERROR;
+            goto return_status;
+        }
+        record = &test->records[(*count)++];
+
+        if (!json) {
+            /* The timestamp, then the line as hp_log() would write it */
+            snprintf(test->expected, sizeof(test->expected),
+                     "(logdec-test.c:%d)(hp_logdec_test_lines) <%s> - %s\n",
+                     record->line, hp_log_level_to_string(record->level),
+                     record->message);
+            rest = strchr(test->line, ' ');
+            if (test->line[0] < '1' || test->line[0] > '9' || rest == NULL ||
+                strcmp(rest + 1, test->expected) != 0)
+            {
+                printf("logdec-test: line %u is \"%s\", \"%s\" expected\n",
+                       *count, test->line, test->expected);
+                status = HP_STATUS_ERROR;
+                goto return_status;
+            }
+            continue;
+        }
+
+        hp_logdec_test_json(message, sizeof(message), record->message);
+        snprintf(test->expected, sizeof(test->expected),
+                 "\"level\":\"%s\",\"file\":\"logdec-test.c\",\"line\":%d,"
+                 "\"function\":\"hp_logdec_test_lines\",",
+                 hp_log_level_to_string(record->level), record->line);
+        if (strncmp(test->line, "{\"time\":\"", 9) != 0 ||
+            strstr(test->line, test->expected) == NULL ||
+            (rest = strstr(test->line, ",\"message\":")) == NULL ||
+            strncmp(rest + 11, message, strlen(message)) != 0 ||
+            strncmp(rest + 11 + strlen(message), ",\"args\":[", 9) != 0 ||
+            strcmp(test->line + strlen(test->line) - 3, "]}\n") != 0)
+        {
+            printf("logdec-test: line %u is \"%s\", with %s and %s "
+                   "expected\n", *count, test->line, test->expected,
+                   message);
+            status = HP_STATUS_ERROR;
+            goto return_status;
+        }
+    }
+
+    status = HP_STATUS_OK;
+ return_status:
+    fclose(fp);
+    return status;
+}
+
+/**
+ * Log rounds of lines to a log of size, and decode it both ways.
+ *
+ * @dropped Set to the no of lines dropped.
+ */
+static hp_status_t hp_logdec_test_run(hp_logdec_test_t *test,
+                                      uint64_t size, uint32_t rounds,
+                                      uint64_t *dropped)
+{
+    uint32_t text_count;
+    uint32_t json_count;
+    uint32_t i;
+
+    test->record_count = 0;
+    hp_log_init(HP_LOG_LEVEL_INFO, NULL);
+    if (hp_log_binary_open(test->log_path, size) != HP_STATUS_OK) {
+        hp_log_deinit();
+        hp_log_init(HP_LOG_LEVEL_ERROR, NULL);
+        hp_logdec_test_fail("hp_log_binary_open() failed");
+    }
+    for (i = 0; i < rounds; i++)
+        hp_logdec_test_lines(test);
+    *dropped = hp_log_binary_dropped();
+    hp_log_deinit();
+    hp_log_init(HP_LOG_LEVEL_ERROR, NULL);
+
+    if (hp_logdec_test_decode(test, false) != HP_STATUS_OK ||
+        hp_logdec_test_check(test, false, &text_count) != HP_STATUS_OK ||
+        hp_logdec_test_decode(test, true) != HP_STATUS_OK ||
+        hp_logdec_test_check(test, true, &json_count) != HP_STATUS_OK)
+    {
+        return HP_STATUS_ERROR;
+    }
+    if (text_count != json_count ||
+        text_count + *dropped != test->record_count)
+    {
+        hp_logdec_test_fail("%u lines and %u JSON objects decoded, %"
+                            PRIu64 " dropped, of %u logged", text_count,
+                            json_count, *dropped, test->record_count);
+    }
+    test->decoded += text_count;
+
+    return HP_STATUS_OK;
+}
+
+int main(int argc, char *argv[])
+{
+    hp_logdec_test_t *test = &g_hp_logdec_test;
+    uint64_t dropped;
+    uint64_t seed;
+    uint32_t rounds;
+    uint32_t lines;
+    int fd;
+    int ret = EXIT_FAILURE;
+
+    seed = (argc > 1) ? strtoull(argv[1], NULL, 0) : 1;
+    rounds = (argc > 2) ? (uint32_t)strtoul(argv[2], NULL, 0) :
+        HP_LOGDEC_TEST_ROUNDS_DEFAULT;
+    test->rng = seed | 1;
+
+    /* Lines per round */
+    hp_logdec_test_lines(test);
+    lines = test->record_count;
+    test->record_count = 0;
+    if (rounds == 0 || rounds > HP_LOGDEC_TEST_RECORDS_MAX / lines) {
+        printf("Usage: %s [<seed> [<rounds>]], with at most %u rounds\n",
+               argv[0], HP_LOGDEC_TEST_RECORDS_MAX / lines);
+        return EXIT_FAILURE;
+    }
+
+    hp_log_init(HP_LOG_LEVEL_ERROR, NULL);
+
+    snprintf(test->log_path, sizeof(test->log_path),
+             "/tmp/logdec-test-XXXXXX");
+    snprintf(test->out_path, sizeof(test->out_path),
+             "/tmp/logdec-test-out-XXXXXX");
+    if ((fd = mkstemp(test->log_path)) < 0) {
+        printf("logdec-test: mkstemp() failed\n");
+        goto return_status;
+    }
+    close(fd);
+    if ((fd = mkstemp(test->out_path)) < 0) {
+        printf("logdec-test: mkstemp() failed\n");
+        unlink(test->log_path);
+        goto return_status;
+    }
+    close(fd);
+
+    if (hp_logdec_test_run(test, 0, rounds, &dropped) != HP_STATUS_OK)
+        goto failed;
+    if (dropped != 0) {
+        printf("logdec-test: %" PRIu64 " lines dropped\n", dropped);
+        goto failed;
+    }
+    if (hp_logdec_test_run(test, HP_LOGDEC_TEST_FULL_SIZE,
+                           HP_LOGDEC_TEST_FULL_LINES / lines,
+                           &dropped) != HP_STATUS_OK)
+    {
+        goto failed;
+    }
+    if (dropped == 0) {
+        printf("logdec-test: nothing dropped from a log of %u bytes\n",
+               HP_LOGDEC_TEST_FULL_SIZE);
+        goto failed;
+    }
+
+    printf("logdec-test: %" PRIu64 " lines decoded, %" PRIu64 " dropped "
+           "from a full log, with seed %" PRIu64 " passed.\n",
+           test->decoded, dropped, seed);
+    ret = EXIT_SUCCESS;
+    goto return_files;
+
+ failed:
+    printf("logdec-test: FAILED with seed %" PRIu64 ".\n", seed);
+ return_files:
+    unlink(test->log_path);
+    unlink(test->out_path);
+ return_status:
+    hp_log_deinit();
+    return ret;
+}
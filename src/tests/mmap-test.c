@@ -0,0 +1,830 @@
+/**
+ * Copyright(C) 2018, Juniper Networks, Inc.
+ * All rights reserved
+ *
+ * This SOFTWARE is licensed under the license provided in the LICENSE.txt
+ * file.  By downloading, installing, copying, or otherwise using the
+ * SOFTWARE, you agree to be bound by the terms of that license.  This
+ * SOFTWARE is not an official Juniper product.
+ *
+ * Third-Party Code: This SOFTWARE may depend on other components under
+ * separate copyright notice and license terms.  Your use of the source
+ * code for those components is subject to the term and conditions of
+ * the respective license as noted in the Third-Party source code.
+ */
+
+/**
+ * @author Anoop Saldanha
+ */
+
+/* Randomised test of the memory maps against a page by page model.  Each
+ * round makes up an old and a new layout of a few hundred pages, builds
+ * maps of them in random chunks, and checks what the maps report against
+ * what the model says.  A map of the old layout is then updated in place
+ * from the regions of each layout in turn, the way the scanner does.
+ * The new map is saved and loaded back, and has to come back the same,
+ * and update the same.  The file is then damaged in every way a load
+ * checks for, and has to be refused each time.
+ *
+ * mmap-test.exe [<seed> [<rounds>]] */
+
+#include "honeyprocs-common.h"
+#include "mmap.h"
+#include "util-hash.h"
+#include "util-log.h"
+#include "status.h"
+
+#define HP_MMAP_TEST_ROUNDS_DEFAULT 2000
+#define HP_MMAP_TEST_PAGES_MAX 512
+/* Every page can differ from its neighbours */
+#define HP_MMAP_TEST_DIFFS_MAX HP_MMAP_TEST_PAGES_MAX
+
+/* What a page of the model holds.  Index 0 is untracked. */
+typedef struct hp_mmap_test_attrs_t {
+    uint32_t state;
+    uint32_t protect;
+    uint32_t type;
+} hp_mmap_test_attrs_t;
+
+static const hp_mmap_test_attrs_t hp_mmap_test_attrs[] = {
+    { 0, 0, 0 },
+    { HP_MMAP_STATE_COMMIT, HP_MMAP_PROT_READWRITE, HP_MMAP_TYPE_PRIVATE },
+    { HP_MMAP_STATE_COMMIT, HP_MMAP_PROT_EXECUTE_READ, HP_MMAP_TYPE_IMAGE },
+    { HP_MMAP_STATE_COMMIT, HP_MMAP_PROT_READONLY, HP_MMAP_TYPE_IMAGE },
+    { HP_MMAP_STATE_RESERVE, HP_MMAP_PROT_NOACCESS, HP_MMAP_TYPE_PRIVATE },
+    { HP_MMAP_STATE_COMMIT, HP_MMAP_PROT_EXECUTE_READWRITE,
+      HP_MMAP_TYPE_PRIVATE },
+};
+#define HP_MMAP_TEST_ATTRS_COUNT \
+    (sizeof(hp_mmap_test_attrs) / sizeof(hp_mmap_test_attrs[0]))
+
+/* A saved map, laid out as by hp_mmap_save(), for the test to damage it
+ * in ways its checksum doesn't catch */
+typedef struct hp_mmap_test_file_header_t {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint32_t header_size;
+    uint32_t entry_size;
+    uint32_t count;
+    uint32_t reserved;
+    uint64_t checksum;
+    uint64_t tag;
+    uint8_t reserved2[16];
+} hp_mmap_test_file_header_t;
+
+typedef struct hp_mmap_test_file_entry_t {
+    hp_mmap_addr_t start_addr;
+    hp_mmap_addr_t end_addr;
+    uint32_t state;
+    uint32_t protect;
+    uint32_t type;
+    uint32_t reserved;
+    uint64_t rss;
+} hp_mmap_test_file_entry_t;
+
+#define HP_MMAP_TEST_FILE_SEED 0x6d6d6170
+/* A file with an interval for every page, and room to grow it by */
+#define HP_MMAP_TEST_FILE_MAX                                           \
+    (sizeof(hp_mmap_test_file_header_t) +                               \
+     (HP_MMAP_TEST_PAGES_MAX + 1) * sizeof(hp_mmap_test_file_entry_t))
+
+typedef struct hp_mmap_test_t {
+    uint64_t rng;
+    uint64_t checks;
+    uint64_t diffs;
+    uint64_t updates;
+    uint64_t saves;
+    uint64_t bad_loads;
+    /* The layouts, a hp_mmap_test_attrs index per page from base */
+    hp_mmap_addr_t base;
+    uint32_t page_count;
+    uint8_t old_pages[HP_MMAP_TEST_PAGES_MAX];
+    uint8_t new_pages[HP_MMAP_TEST_PAGES_MAX];
+    hp_mmap_diff_t expected[HP_MMAP_TEST_DIFFS_MAX];
+    uint32_t expected_count;
+    hp_mmap_diff_t found[HP_MMAP_TEST_DIFFS_MAX];
+    /* The file maps are saved to, its contents as saved, and as damaged */
+    char path[64];
+    uint8_t saved[HP_MMAP_TEST_FILE_MAX];
+    size_t saved_len;
+    uint8_t file[HP_MMAP_TEST_FILE_MAX];
+} hp_mmap_test_t;
+
+#define hp_mmap_test_fail(test, ...)                                    \
+    do {                                                                \
+        printf("mmap-test: %s:%d: after %" PRIu64 " checks: ",          \
+               __FILE__, __LINE__, (test)->checks);                     \
+        printf(__VA_ARGS__);                                            \
+        printf("\n");                                                   \
+        return HP_STATUS_ERROR;                                         \
+    } while (0)
+
+/* Allocations made, counted through the linker's --wrap */
+static uint64_t g_hp_mmap_test_mallocs;
+
+void *__real_malloc(size_t size);
+
+void *__wrap_malloc(size_t size)
+{
+    g_hp_mmap_test_mallocs++;
+
+    return __real_malloc(size);
+}
+
+/* xorshift64* */
+static uint32_t hp_mmap_test_rand(hp_mmap_test_t *test)
+{
+    test->rng ^= test->rng >> 12;
+    test->rng ^= test->rng << 25;
+    test->rng ^= test->rng >> 27;
+
+    return (uint32_t)((test->rng * 0x2545F4914F6CDD1DULL) >> 32);
+}
+
+static hp_mmap_addr_t hp_mmap_test_addr(hp_mmap_test_t *test, uint32_t page)
+{
+    return test->base + (hp_mmap_addr_t)page * HP_MMAP_PAGE_SIZE;
+}
+
+/* A layout of runs of a random length, a fair share of them untracked */
+static void hp_mmap_test_layout(hp_mmap_test_t *test, uint8_t *pages)
+{
+    uint32_t i, len;
+    uint8_t attrs;
+
+    for (i = 0; i < test->page_count; i += len) {
+        len = 1 + hp_mmap_test_rand(test) % 16;
+        if (len > test->page_count - i)
+            len = test->page_count - i;
+        attrs = (uint8_t)(hp_mmap_test_rand(test) %
+                          HP_MMAP_TEST_ATTRS_COUNT);
+        memset(pages + i, attrs, len);
+    }
+
+    return;
+}
+
+/* The old layout with a few runs changed, untracked or newly tracked */
+static void hp_mmap_test_mutate(hp_mmap_test_t *test)
+{
+    uint32_t i, pos, len;
+
+    memcpy(test->new_pages, test->old_pages, test->page_count);
+    for (i = hp_mmap_test_rand(test) % 8; i > 0; i--) {
+        pos = hp_mmap_test_rand(test) % test->page_count;
+        len = 1 + hp_mmap_test_rand(test) % 32;
+        if (len > test->page_count - pos)
+            len = test->page_count - pos;
+        memset(test->new_pages + pos,
+               (int)(hp_mmap_test_rand(test) % HP_MMAP_TEST_ATTRS_COUNT),
+               len);
+    }
+
+    return;
+}
+
+/**
+ * Build a map of a layout, tracking chunks of its runs in two passes, so
+ * that the map is coalesced differently each time.  Half the time the
+ * second pass goes into a map shared under the first, at a random base
+ * its intervals are tracked that much lower for.  Intervals aren't
+ * coalesced across the two, so the map then holds neighbouring intervals
+ * with the same attributes, and the diffs of those have to be merged.
+ */
+static hp_status_t hp_mmap_test_build(hp_mmap_test_t *test,
+                                      const uint8_t *pages,
+                                      hp_mmap_tree_t **mmap_tree)
+{
+    const hp_mmap_test_attrs_t *attrs;
+    hp_mmap_tree_t *shared = NULL;
+    hp_mmap_tree_t *dst;
+    hp_mmap_addr_t shared_base;
+    hp_mmap_addr_t offset;
+    uint64_t rng;
+    uint32_t pass;
+    uint32_t chunk;
+    uint32_t i, len;
+    hp_status_t status;
+
+    if (hp_mmap_init(mmap_tree) != HP_STATUS_OK ||
+        (hp_mmap_test_rand(test) % 2 == 0 &&
+         hp_mmap_init(&shared) != HP_STATUS_OK))
+    {
+        printf("mmap-test: hp_mmap_init() failed\n");
+        status = HP_STATUS_ERROR;
+        goto return_status;
+    }
+
+    shared_base = (hp_mmap_addr_t)(hp_mmap_test_rand(test) %
+                                   (test->base / HP_MMAP_PAGE_SIZE + 1)) *
+        HP_MMAP_PAGE_SIZE;
+
+    /* Both passes cut the same chunks */
+    rng = test->rng;
+    for (pass = 0; pass < 2; pass++) {
+        dst = (pass == 1 && shared != NULL) ? shared : *mmap_tree;
+        offset = (dst == shared) ? shared_base : 0;
+        test->rng = rng;
+        for (i = 0, chunk = 0; i < test->page_count; i += len, chunk++) {
+            for (len = 1; i + len < test->page_count &&
+                     pages[i + len] == pages[i] &&
+                     hp_mmap_test_rand(test) % 4 != 0; len++)
+            {
+                ;
+            }
+            if (pages[i] == 0 || (chunk % 2) != pass)
+                continue;
+            attrs = &hp_mmap_test_attrs[pages[i]];
+            if (hp_mmap_track_memory_range(dst,
+                                           hp_mmap_test_addr(test, i) -
+                                           offset,
+                                           (hp_mmap_addr_t)len *
+                                           HP_MMAP_PAGE_SIZE,
+                                           attrs->state, attrs->protect,
+                                           attrs->type) != HP_STATUS_OK)
+            {
+                printf("mmap-test: tracking page %u failed\n", i);
+                status = HP_STATUS_ERROR;
+                goto return_status;
+            }
+        }
+    }
+
+    if (shared != NULL &&
+        hp_mmap_share(*mmap_tree, shared, shared_base) != HP_STATUS_OK)
+    {
+        printf("mmap-test: hp_mmap_share() failed\n");
+        status = HP_STATUS_ERROR;
+        goto return_status;
+    }
+
+    status = HP_STATUS_OK;
+ return_status:
+    /* The map holds on to it */
+    if (shared != NULL)
+        hp_mmap_deinit(shared);
+    return status;
+}
+
+/* The diffs the model gives, page by page, with neighbouring pages of the
+ * same kind and attributes merged */
+static void hp_mmap_test_expect(hp_mmap_test_t *test)
+{
+    const hp_mmap_test_attrs_t *old_attrs;
+    const hp_mmap_test_attrs_t *new_attrs;
+    hp_mmap_diff_t diff;
+    hp_mmap_diff_t *prev;
+    uint32_t i;
+
+    test->expected_count = 0;
+    for (i = 0; i < test->page_count; i++) {
+        if (test->old_pages[i] == test->new_pages[i])
+            continue;
+        old_attrs = &hp_mmap_test_attrs[test->old_pages[i]];
+        new_attrs = &hp_mmap_test_attrs[test->new_pages[i]];
+
+        memset(&diff, 0, sizeof(diff));
+        if (test->old_pages[i] == 0)
+            diff.kind = HP_MMAP_DIFF_ADDED;
+        else if (test->new_pages[i] == 0)
+            diff.kind = HP_MMAP_DIFF_REMOVED;
+        else
+            diff.kind = HP_MMAP_DIFF_CHANGED;
+        diff.start_addr = hp_mmap_test_addr(test, i);
+        diff.end_addr = hp_mmap_test_addr(test, i + 1);
+        diff.old_state = old_attrs->state;
+        diff.old_protect = old_attrs->protect;
+        diff.old_type = old_attrs->type;
+        diff.new_state = new_attrs->state;
+        diff.new_protect = new_attrs->protect;
+        diff.new_type = new_attrs->type;
+
+        prev = (test->expected_count != 0) ?
+            &test->expected[test->expected_count - 1] : NULL;
+        if (prev != NULL && prev->end_addr == diff.start_addr &&
+            prev->kind == diff.kind &&
+            i > 0 && test->old_pages[i - 1] == test->old_pages[i] &&
+            test->new_pages[i - 1] == test->new_pages[i])
+        {
+            prev->end_addr = diff.end_addr;
+            continue;
+        }
+        test->expected[test->expected_count++] = diff;
+    }
+
+    return;
+}
+
+static hp_status_t hp_mmap_test_diff_same(hp_mmap_test_t *test,
+                                          const hp_mmap_diff_t *found,
+                                          const hp_mmap_diff_t *expected,
+                                          uint32_t i)
+{
+    if (found->kind != expected->kind ||
+        found->start_addr != expected->start_addr ||
+        found->end_addr != expected->end_addr ||
+        found->old_state != expected->old_state ||
+        found->old_protect != expected->old_protect ||
+        found->old_type != expected->old_type ||
+        found->new_state != expected->new_state ||
+        found->new_protect != expected->new_protect ||
+        found->new_type != expected->new_type)
+    {
+        hp_mmap_test_fail(test, "diff %u is %s [0x%" PRIx64 ", 0x%" PRIx64
+                          "), expected %s [0x%" PRIx64 ", 0x%" PRIx64 ")",
+                          i, hp_mmap_diff_kind_to_string(found->kind),
+                          found->start_addr, found->end_addr,
+                          hp_mmap_diff_kind_to_string(expected->kind),
+                          expected->start_addr, expected->end_addr);
+    }
+
+    return HP_STATUS_OK;
+}
+
+/* Diff the maps whole, into a buffer too small and for the first diff
+ * only, against the model. */
+static hp_status_t hp_mmap_test_diff(hp_mmap_test_t *test,
+                                     hp_mmap_tree_t *mmap_old,
+                                     hp_mmap_tree_t *mmap_new)
+{
+    uint32_t count;
+    uint32_t size;
+    uint32_t i;
+
+    test->checks++;
+    hp_mmap_test_expect(test);
+    test->diffs += test->expected_count;
+
+    count = hp_mmap_diff(mmap_old, mmap_new, test->found,
+                         HP_MMAP_TEST_DIFFS_MAX, 0);
+    if (count != test->expected_count) {
+        hp_mmap_test_fail(test, "%u diffs, %u expected", count,
+                          test->expected_count);
+    }
+    for (i = 0; i < count; i++) {
+        if (hp_mmap_test_diff_same(test, &test->found[i],
+                                   &test->expected[i], i) != HP_STATUS_OK)
+        {
+            return HP_STATUS_ERROR;
+        }
+    }
+
+    /* The ones that fit are the same, and the count doesn't depend on
+     * how many fit. */
+    size = hp_mmap_test_rand(test) % (test->expected_count + 1);
+    count = hp_mmap_diff(mmap_old, mmap_new, test->found, size, 0);
+    if (count != test->expected_count) {
+        hp_mmap_test_fail(test, "%u diffs into %u, %u expected", count,
+                          size, test->expected_count);
+    }
+    for (i = 0; i < size; i++) {
+        if (hp_mmap_test_diff_same(test, &test->found[i],
+                                   &test->expected[i], i) != HP_STATUS_OK)
+        {
+            return HP_STATUS_ERROR;
+        }
+    }
+
+    count = hp_mmap_diff(mmap_old, mmap_new, NULL, 0,
+                         HP_MMAP_DIFF_FLAG_FIRST_ONLY);
+    if (count != ((test->expected_count != 0) ? 1 : 0)) {
+        hp_mmap_test_fail(test, "%u diffs stopping at the first, %u "
+                          "expected in all", count, test->expected_count);
+    }
+    if (hp_are_mmaps_same(mmap_old, mmap_new) != (test->expected_count == 0))
+        hp_mmap_test_fail(test, "hp_are_mmaps_same() disagrees");
+
+    /* And the other way round */
+    count = hp_mmap_diff(mmap_new, mmap_old, NULL, 0, 0);
+    if (count != test->expected_count) {
+        hp_mmap_test_fail(test, "%u diffs from new to old, %u expected",
+                          count, test->expected_count);
+    }
+
+    return HP_STATUS_OK;
+}
+
+/**
+ * Update a map from the regions of a layout, its runs cut in random
+ * chunks, in address order.
+ *
+ * @mallocs Set to the no of allocations made past hp_mmap_update_begin(),
+ *          which allocates the walk the first time.
+ */
+static hp_status_t hp_mmap_test_update(hp_mmap_test_t *test,
+                                       const uint8_t *pages,
+                                       hp_mmap_tree_t *mmap_tree,
+                                       bool *changed,
+                                       uint64_t *mallocs)
+{
+    const hp_mmap_test_attrs_t *attrs;
+    hp_mmap_update_t update;
+    uint32_t i, len;
+
+    if (hp_mmap_update_begin(mmap_tree, &update) != HP_STATUS_OK)
+        hp_mmap_test_fail(test, "hp_mmap_update_begin() failed");
+
+    *mallocs = g_hp_mmap_test_mallocs;
+    for (i = 0; i < test->page_count; i += len) {
+        for (len = 1; i + len < test->page_count &&
+                 pages[i + len] == pages[i] &&
+                 hp_mmap_test_rand(test) % 4 != 0; len++)
+        {
+            ;
+        }
+        if (pages[i] == 0)
+            continue;
+        attrs = &hp_mmap_test_attrs[pages[i]];
+        if (hp_mmap_update_region(&update, hp_mmap_test_addr(test, i),
+                                  (hp_mmap_addr_t)len * HP_MMAP_PAGE_SIZE,
+                                  attrs->state, attrs->protect,
+                                  attrs->type) != HP_STATUS_OK)
+        {
+            hp_mmap_test_fail(test, "updating page %u failed", i);
+        }
+    }
+    if (hp_mmap_update_end(&update, changed) != HP_STATUS_OK)
+        hp_mmap_test_fail(test, "hp_mmap_update_end() failed");
+    *mallocs = g_hp_mmap_test_mallocs - *mallocs;
+
+    return HP_STATUS_OK;
+}
+
+/* Update a map of the old layout with the old layout, which only confirms
+ * it, and then with the new one, which erases and retracks what moved. */
+static hp_status_t hp_mmap_test_updates(hp_mmap_test_t *test,
+                                        hp_mmap_tree_t *mmap_old)
+{
+    hp_mmap_tree_t *mmap_tree = NULL;
+    uint64_t mallocs;
+    bool changed;
+    hp_status_t status;
+
+    test->updates++;
+    if (hp_mmap_test_build(test, test->old_pages, &mmap_tree) !=
+        HP_STATUS_OK ||
+        hp_mmap_test_update(test, test->old_pages, mmap_tree, &changed,
+                            &mallocs) != HP_STATUS_OK)
+    {
+        status = HP_STATUS_ERROR;
+        goto return_status;
+    }
+    if (changed || mallocs != 0) {
+        printf("mmap-test: confirming the map changed it %d, with %"
+               PRIu64 " allocations\n", changed, mallocs);
+        status = HP_STATUS_ERROR;
+        goto return_status;
+    }
+    if (hp_mmap_diff(mmap_old, mmap_tree, NULL, 0, 0) != 0) {
+        printf("mmap-test: the confirmed map differs\n");
+        status = HP_STATUS_ERROR;
+        goto return_status;
+    }
+
+    if (hp_mmap_test_update(test, test->new_pages, mmap_tree, &changed,
+                            &mallocs) != HP_STATUS_OK)
+    {
+        status = HP_STATUS_ERROR;
+        goto return_status;
+    }
+    hp_mmap_test_expect(test);
+    if (changed != (test->expected_count != 0)) {
+        printf("mmap-test: the update says changed %d, with %u diffs\n",
+               changed, test->expected_count);
+        status = HP_STATUS_ERROR;
+        goto return_status;
+    }
+    /* It is now the same as a map built afresh, diff by diff */
+    if (hp_mmap_test_diff(test, mmap_old, mmap_tree) != HP_STATUS_OK) {
+        status = HP_STATUS_ERROR;
+        goto return_status;
+    }
+
+    status = HP_STATUS_OK;
+ return_status:
+    if (mmap_tree != NULL)
+        hp_mmap_deinit(mmap_tree);
+    return status;
+}
+
+static uint64_t hp_mmap_test_rand64(hp_mmap_test_t *test)
+{
+    uint64_t v = hp_mmap_test_rand(test);
+
+    return (v << 32) | hp_mmap_test_rand(test);
+}
+
+/**
+ * Load a map file, which has to be refused.
+ *
+ * @len The no of bytes of test->file to write to it, or SIZE_MAX for no
+ *      file at all.
+ */
+static hp_status_t hp_mmap_test_load_bad(hp_mmap_test_t *test, size_t len,
+                                         const char *damage)
+{
+    hp_mmap_tree_t *mmap_tree = (hp_mmap_tree_t *)test;
+    FILE *fp;
+    bool written;
+    hp_status_t status;
+
+    test->bad_loads++;
+    if (len != SIZE_MAX) {
+        if ((fp = fopen(test->path, "wb")) == NULL)
+            hp_mmap_test_fail(test, "unable to create %s", test->path);
+        written = (len == 0 || fwrite(test->file, len, 1, fp) == 1);
+        if (fclose(fp) != 0 || !written)
+            hp_mmap_test_fail(test, "unable to write %s", test->path);
+    }
+
+    /* The errors are expected */
+    hp_log_set_level(HP_LOG_MODULE_MMAP, HP_LOG_LEVEL_NONE);
+    hp_log_set_level(HP_LOG_MODULE_DEFAULT, HP_LOG_LEVEL_NONE);
+    status = hp_mmap_load(&mmap_tree, test->path, NULL);
+    hp_log_set_level(HP_LOG_MODULE_MMAP, HP_LOG_LEVEL_ERROR);
+    hp_log_set_level(HP_LOG_MODULE_DEFAULT, HP_LOG_LEVEL_ERROR);
+
+    if (status == HP_STATUS_OK) {
+        hp_mmap_deinit(mmap_tree);
+        hp_mmap_test_fail(test, "a map file with %s loaded", damage);
+    }
+    if (mmap_tree != NULL) {
+        hp_mmap_test_fail(test, "a map file with %s left a map set",
+                          damage);
+    }
+
+    return HP_STATUS_OK;
+}
+
+/* Redo the checksum of a damaged file, as though it was saved so. */
+static void hp_mmap_test_checksum(hp_mmap_test_t *test)
+{
+    hp_mmap_test_file_header_t *header =
+        (hp_mmap_test_file_header_t *)test->file;
+
+    header->checksum = hp_hash64(test->file + sizeof(*header),
+                                 test->saved_len - sizeof(*header),
+                                 HP_MMAP_TEST_FILE_SEED);
+
+    return;
+}
+
+/* Swap two intervals of the file. */
+static void hp_mmap_test_swap(hp_mmap_test_file_entry_t *entries, uint32_t i)
+{
+    hp_mmap_test_file_entry_t entry = entries[i];
+
+    entries[i] = entries[i + 1];
+    entries[i + 1] = entry;
+
+    return;
+}
+
+/* Damage the saved file in every way a load checks for.  Those a
+ * checksum can't catch are checksummed anew. */
+static hp_status_t hp_mmap_test_damage(hp_mmap_test_t *test)
+{
+    hp_mmap_test_file_header_t *header =
+        (hp_mmap_test_file_header_t *)test->file;
+    hp_mmap_test_file_entry_t *entries =
+        (hp_mmap_test_file_entry_t *)(test->file + sizeof(*header));
+    size_t len = test->saved_len;
+    uint32_t count;
+    uint32_t i;
+
+#define HP_MMAP_TEST_DAMAGE(damage, damaged_len, change)                \
+    do {                                                                \
+        memcpy(test->file, test->saved, test->saved_len);               \
+        change;                                                         \
+        if (hp_mmap_test_load_bad(test, damaged_len, damage) !=         \
+            HP_STATUS_OK)                                               \
+        {                                                               \
+            return HP_STATUS_ERROR;                                     \
+        }                                                               \
+    } while (0)
+
+    memcpy(test->file, test->saved, test->saved_len);
+    count = header->count;
+    if (len < sizeof(*header) ||
+        len != sizeof(*header) + count * sizeof(*entries) ||
+        header->header_size != sizeof(*header) ||
+        header->entry_size != sizeof(*entries))
+    {
+        hp_mmap_test_fail(test, "a map file of %zu bytes, with %u "
+                          "intervals of %u bytes after %u", len, count,
+                          header->entry_size, header->header_size);
+    }
+    /* So that the damage below is all the test's own */
+    hp_mmap_test_checksum(test);
+    if (memcmp(test->file, test->saved, len) != 0)
+        hp_mmap_test_fail(test, "a map file's checksum isn't as saved");
+
+    HP_MMAP_TEST_DAMAGE("a bad magic", len,
+                        test->file[hp_mmap_test_rand(test) % 8] ^=
+                        (uint8_t)(1 + hp_mmap_test_rand(test) % 255));
+    HP_MMAP_TEST_DAMAGE("another version", len, header->version++);
+    HP_MMAP_TEST_DAMAGE("another byte order", len,
+                        header->byte_order = 0x04030201);
+    HP_MMAP_TEST_DAMAGE("a bad entry size", len, header->entry_size += 8);
+    HP_MMAP_TEST_DAMAGE("an unaligned header", len,
+                        header->header_size += 4);
+    HP_MMAP_TEST_DAMAGE("a bad checksum", len,
+                        header->checksum ^=
+                        (uint64_t)1 << (hp_mmap_test_rand(test) % 64));
+    HP_MMAP_TEST_DAMAGE("a bad count", len, header->count++);
+    HP_MMAP_TEST_DAMAGE("a cut", hp_mmap_test_rand(test) % len, (void)0);
+    HP_MMAP_TEST_DAMAGE("an extra interval", len + sizeof(*entries),
+                        memset(&entries[count], 0, sizeof(*entries)));
+    if (count == 0)
+        return HP_STATUS_OK;
+
+    i = hp_mmap_test_rand(test) % count;
+    HP_MMAP_TEST_DAMAGE("a damaged interval", len,
+                        ((uint8_t *)&entries[i])[hp_mmap_test_rand(test) %
+                                                 sizeof(*entries)] ^=
+                        (uint8_t)(1 + hp_mmap_test_rand(test) % 255));
+    HP_MMAP_TEST_DAMAGE("an empty interval", len,
+                        entries[i].end_addr = entries[i].start_addr;
+                        hp_mmap_test_checksum(test));
+    HP_MMAP_TEST_DAMAGE("a backward interval", len,
+                        entries[i].start_addr = entries[i].end_addr +
+                        HP_MMAP_PAGE_SIZE;
+                        hp_mmap_test_checksum(test));
+    if (count == 1)
+        return HP_STATUS_OK;
+
+    i = hp_mmap_test_rand(test) % (count - 1);
+    HP_MMAP_TEST_DAMAGE("intervals out of order", len,
+                        hp_mmap_test_swap(entries, i);
+                        hp_mmap_test_checksum(test));
+    HP_MMAP_TEST_DAMAGE("overlapping intervals", len,
+                        entries[i].end_addr = entries[i + 1].start_addr +
+                        HP_MMAP_PAGE_SIZE;
+                        hp_mmap_test_checksum(test));
+#undef HP_MMAP_TEST_DAMAGE
+
+    return HP_STATUS_OK;
+}
+
+/* Save the new map and load it back.  It has to diff as the map did, and
+ * update in place, after which the file is damaged and loaded again. */
+static hp_status_t hp_mmap_test_saves(hp_mmap_test_t *test,
+                                      hp_mmap_tree_t *mmap_old,
+                                      hp_mmap_tree_t *mmap_new)
+{
+    hp_mmap_tree_t *mmap_tree = NULL;
+    uint64_t tag = hp_mmap_test_rand64(test);
+    uint64_t loaded_tag = 0;
+    uint64_t mallocs = 0;
+    bool changed = false;
+    FILE *fp;
+    hp_status_t status;
+
+    test->saves++;
+    if (hp_mmap_save(mmap_new, test->path, tag) != HP_STATUS_OK ||
+        hp_mmap_load(&mmap_tree, test->path, &loaded_tag) != HP_STATUS_OK)
+    {
+        printf("mmap-test: saving and loading the map failed\n");
+        status = HP_STATUS_ERROR;
+        goto return_status;
+    }
+    if (loaded_tag != tag ||
+        hp_mmap_count(mmap_tree) != hp_mmap_count(mmap_new))
+    {
+        printf("mmap-test: the map loaded with tag 0x%" PRIx64 " and %u "
+               "intervals, 0x%" PRIx64 " and %u saved\n", loaded_tag,
+               hp_mmap_count(mmap_tree), tag, hp_mmap_count(mmap_new));
+        status = HP_STATUS_ERROR;
+        goto return_status;
+    }
+    if (hp_mmap_test_diff(test, mmap_old, mmap_tree) != HP_STATUS_OK) {
+        status = HP_STATUS_ERROR;
+        goto return_status;
+    }
+
+    /* Kept as saved, to be damaged after */
+    if ((fp = fopen(test->path, "rb")) == NULL) {
+        printf("mmap-test: unable to open %s\n", test->path);
+        status = HP_STATUS_ERROR;
+        goto return_status;
+    }
+    test->saved_len = fread(test->saved, 1, sizeof(test->saved), fp);
+    fclose(fp);
+
+    if (hp_mmap_test_update(test, test->new_pages, mmap_tree, &changed,
+                            &mallocs) != HP_STATUS_OK ||
+        changed || mallocs != 0)
+    {
+        printf("mmap-test: confirming the loaded map changed it %d, with %"
+               PRIu64 " allocations\n", changed, mallocs);
+        status = HP_STATUS_ERROR;
+        goto return_status;
+    }
+    if (hp_mmap_test_update(test, test->old_pages, mmap_tree, &changed,
+                            &mallocs) != HP_STATUS_OK ||
+        changed != (test->expected_count != 0) ||
+        hp_mmap_diff(mmap_old, mmap_tree, NULL, 0, 0) != 0)
+    {
+        printf("mmap-test: updating the loaded map to the old layout "
+               "failed\n");
+        status = HP_STATUS_ERROR;
+        goto return_status;
+    }
+
+    status = hp_mmap_test_damage(test);
+ return_status:
+    if (mmap_tree != NULL)
+        hp_mmap_deinit(mmap_tree);
+    return status;
+}
+
+static hp_status_t hp_mmap_test_round(hp_mmap_test_t *test)
+{
+    hp_mmap_tree_t *mmap_old = NULL;
+    hp_mmap_tree_t *mmap_new = NULL;
+    hp_status_t status;
+
+    test->page_count = 1 + hp_mmap_test_rand(test) % HP_MMAP_TEST_PAGES_MAX;
+    /* From address 0, and high up in a 64 bit address space */
+    test->base = (hp_mmap_test_rand(test) % 2 == 0) ? 0 :
+        0x7ffff0000000ULL;
+    hp_mmap_test_layout(test, test->old_pages);
+    if (hp_mmap_test_rand(test) % 8 == 0)
+        hp_mmap_test_layout(test, test->new_pages);
+    else
+        hp_mmap_test_mutate(test);
+
+    if (hp_mmap_test_build(test, test->old_pages, &mmap_old) !=
+        HP_STATUS_OK ||
+        hp_mmap_test_build(test, test->new_pages, &mmap_new) !=
+        HP_STATUS_OK ||
+        hp_mmap_test_diff(test, mmap_old, mmap_new) != HP_STATUS_OK ||
+        hp_mmap_test_updates(test, mmap_old) != HP_STATUS_OK ||
+        hp_mmap_test_saves(test, mmap_old, mmap_new) != HP_STATUS_OK)
+    {
+        status = HP_STATUS_ERROR;
+        goto return_status;
+    }
+
+    status = HP_STATUS_OK;
+ return_status:
+    if (mmap_old != NULL)
+        hp_mmap_deinit(mmap_old);
+    if (mmap_new != NULL)
+        hp_mmap_deinit(mmap_new);
+    return status;
+}
+
+int main(int argc, char *argv[])
+{
+    static hp_mmap_test_t test;
+    uint64_t seed;
+    uint64_t rounds;
+    uint64_t i;
+    int fd;
+    int ret = EXIT_FAILURE;
+
+    seed = (argc > 1) ? strtoull(argv[1], NULL, 0) : 1;
+    rounds = (argc > 2) ? strtoull(argv[2], NULL, 0) :
+        HP_MMAP_TEST_ROUNDS_DEFAULT;
+    test.rng = seed | 1;
+
+    hp_log_init(HP_LOG_LEVEL_ERROR, NULL);
+
+    snprintf(test.path, sizeof(test.path), "/tmp/mmap-test-XXXXXX");
+    if ((fd = mkstemp(test.path)) < 0) {
+        printf("mmap-test: mkstemp() failed\n");
+        goto return_status;
+    }
+    close(fd);
+
+    for (i = 0; i < rounds; i++) {
+        if (hp_mmap_test_round(&test) != HP_STATUS_OK) {
+            printf("mmap-test: FAILED in round %" PRIu64 " with seed "
+                   "%" PRIu64 ".\n", i, seed);
+            goto return_file;
+        }
+    }
+
+    /* Nor is a file that isn't there loaded */
+    unlink(test.path);
+    if (hp_mmap_test_load_bad(&test, SIZE_MAX, "nothing in it") !=
+        HP_STATUS_OK)
+    {
+        printf("mmap-test: FAILED with seed %" PRIu64 ".\n", seed);
+        goto return_file;
+    }
+
+    printf("mmap-test: %" PRIu64 " checks, %" PRIu64 " diffs, %" PRIu64
+           " updates, %" PRIu64 " saves, %" PRIu64 " bad loads, with seed "
+           "%" PRIu64 " passed.\n", test.checks, test.diffs, test.updates,
+           test.saves, test.bad_loads, seed);
+    ret = EXIT_SUCCESS;
+
+ return_file:
+    unlink(test.path);
+ return_status:
+    hp_log_deinit();
+    return ret;
+}
@@ -0,0 +1,390 @@
+/**
+ * Copyright(C) 2018, Juniper Networks, Inc.
+ * All rights reserved
+ *
+ * This SOFTWARE is licensed under the license provided in the LICENSE.txt
+ * file.  By downloading, installing, copying, or otherwise using the
+ * SOFTWARE, you agree to be bound by the terms of that license.  This
+ * SOFTWARE is not an official Juniper product.
+ *
+ * Third-Party Code: This SOFTWARE may depend on other components under
+ * separate copyright notice and license terms.  Your use of the source
+ * code for those components is subject to the term and conditions of
+ * the respective license as noted in the Third-Party source code.
+ */
+
+/**
+ * @author Anoop Saldanha
+ */
+
+/* Randomised test of the multi pattern engine against a naive reference.
+ * Each round compiles a random pattern set, over a few letters or over
+ * every byte value, and scans random buffers with the patterns planted
+ * in them, whole and in random chunks, with and without the prefilter.
+ * Every (pattern, offset) reported has to be one memcmp() finds, and
+ * every one memcmp() finds has to be reported.
+ *
+ * scan-engine-test.exe [<seed> [<rounds>]] */
+
+#include "honeyprocs-common.h"
+#include "scan-engine.h"
+#include "status.h"
+#include "util-log.h"
+
+#define HP_ENGINE_TEST_ROUNDS_DEFAULT 300
+#define HP_ENGINE_TEST_PATTERNS_MAX   2000
+#define HP_ENGINE_TEST_PAT_LEN_MAX    300
+#define HP_ENGINE_TEST_BUF_MAX        8192
+#define HP_ENGINE_TEST_SCANS          4
+
+typedef struct hp_engine_test_match_t {
+    uint32_t pattern_id;
+    uint64_t offset;
+} hp_engine_test_match_t;
+
+typedef struct hp_engine_test_matches_t {
+    hp_engine_test_match_t *matches;
+    uint32_t count;
+    uint32_t size;
+    bool failed;
+} hp_engine_test_matches_t;
+
+typedef struct hp_engine_test_pattern_t {
+    uint8_t pat[HP_ENGINE_TEST_PAT_LEN_MAX];
+    uint32_t len;
+} hp_engine_test_pattern_t;
+
+typedef struct hp_engine_test_t {
+    uint64_t rng;
+    hp_engine_test_pattern_t patterns[HP_ENGINE_TEST_PATTERNS_MAX];
+    uint32_t pattern_count;
+    uint8_t buf[HP_ENGINE_TEST_BUF_MAX];
+    uint32_t buf_len;
+    hp_engine_test_matches_t expected;
+    hp_engine_test_matches_t found;
+    uint64_t scans;
+    uint64_t matches;
+    /* Sets compiled with each prefilter */
+    uint64_t teddy_sets;
+    uint64_t hash_sets;
+} hp_engine_test_t;
+
+#define hp_engine_test_fail(test, ...)                                  \
+    do {                                                                \
+        printf("scan-engine-test: %s:%d: after %" PRIu64 " scans: ",    \
+               __FILE__, __LINE__, (test)->scans);                      \
+        printf(__VA_ARGS__);                                            \
+        printf("\n");                                                   \
+        return HP_STATUS_ERROR;                                         \
+    } while (0)
+
+/* xorshift64* */
+static uint32_t hp_engine_test_rand(hp_engine_test_t *test)
+{
+    test->rng ^= test->rng >> 12;
+    test->rng ^= test->rng << 25;
+    test->rng ^= test->rng >> 27;
+
+    return (uint32_t)((test->rng * 0x2545F4914F6CDD1DULL) >> 32);
+}
+
+static void hp_engine_test_add(hp_engine_test_matches_t *matches,
+                               uint32_t pattern_id, uint64_t offset)
+{
+    hp_engine_test_match_t *grown;
+    uint32_t size_new;
+
+    if (matches->count == matches->size) {
+        size_new = (matches->size != 0) ? matches->size * 2 : 1024;
+        grown = (hp_engine_test_match_t *)
+            realloc(matches->matches, size_new * sizeof(*grown));
+        if (grown == NULL) {
+            matches->failed = true;
+            return;
+        }
+        matches->matches = grown;
+        matches->size = size_new;
+    }
+    matches->matches[matches->count].pattern_id = pattern_id;
+    matches->matches[matches->count].offset = offset;
+    matches->count++;
+
+    return;
+}
+
+static void hp_engine_test_matched(uint32_t pattern_id, uint64_t offset,
+                                   void *matches)
+{
+    hp_engine_test_add((hp_engine_test_matches_t *)matches, pattern_id,
+                       offset);
+
+    return;
+}
+
+static int hp_engine_test_cmp(const void *a_, const void *b_)
+{
+    const hp_engine_test_match_t *a = (const hp_engine_test_match_t *)a_;
+    const hp_engine_test_match_t *b = (const hp_engine_test_match_t *)b_;
+
+    if (a->offset != b->offset)
+        return (a->offset < b->offset) ? -1 : 1;
+    return (a->pattern_id < b->pattern_id) ? -1 :
+        (a->pattern_id > b->pattern_id);
+}
+
+/* Every pattern at every offset */
+static void hp_engine_test_reference(hp_engine_test_t *test)
+{
+    hp_engine_test_pattern_t *pattern;
+    uint32_t i, pos;
+
+    test->expected.count = 0;
+    for (i = 0; i < test->pattern_count; i++) {
+        pattern = &test->patterns[i];
+        for (pos = 0; pos + pattern->len <= test->buf_len; pos++) {
+            if (memcmp(test->buf + pos, pattern->pat, pattern->len) == 0)
+                hp_engine_test_add(&test->expected, i, pos);
+        }
+    }
+    if (test->expected.count > 0) {
+        qsort(test->expected.matches, test->expected.count,
+              sizeof(*test->expected.matches), hp_engine_test_cmp);
+    }
+
+    return;
+}
+
+/* Scan the buffer in chunks of at most chunk_max bytes, and compare. */
+static hp_status_t hp_engine_test_scan(hp_engine_test_t *test,
+                                       const hp_scan_tables_t *tables,
+                                       uint32_t chunk_max)
+{
+    hp_scan_ctx_t ctx;
+    uint32_t pos, len;
+    uint32_t count;
+    uint32_t i;
+
+    test->found.count = 0;
+    hp_scan_ctx_init(&ctx, tables, hp_engine_test_matched, &test->found);
+    for (pos = 0; pos < test->buf_len; pos += len) {
+        len = 1 + hp_engine_test_rand(test) % chunk_max;
+        if (len > test->buf_len - pos)
+            len = test->buf_len - pos;
+        hp_scan_ctx_feed(&ctx, test->buf + pos, len);
+    }
+    count = hp_scan_ctx_finish(&ctx);
+    test->scans++;
+
+    if (test->found.failed || test->expected.failed)
+        hp_engine_test_fail(test, "out of memory");
+    if (count != test->found.count) {
+        hp_engine_test_fail(test, "%u matches counted, %u reported", count,
+                            test->found.count);
+    }
+    if (test->found.count > 0) {
+        qsort(test->found.matches, test->found.count,
+              sizeof(*test->found.matches), hp_engine_test_cmp);
+    }
+    for (i = 0; i < test->found.count && i < test->expected.count; i++) {
+        if (hp_engine_test_cmp(&test->found.matches[i],
+                               &test->expected.matches[i]) != 0)
+        {
+            break;
+        }
+    }
+    if (i < test->found.count || i < test->expected.count) {
+        hp_engine_test_fail(test, "%u matches, %u expected, first "
+                            "difference at match %u, with %u patterns",
+                            test->found.count, test->expected.count, i,
+                            test->pattern_count);
+    }
+    test->matches += count;
+
+    return HP_STATUS_OK;
+}
+
+/* Compile the patterns and scan the buffer every which way. */
+static hp_status_t hp_engine_test_check(hp_engine_test_t *test)
+{
+    hp_scan_engine_t *engine = NULL;
+    const hp_scan_tables_t *tables;
+    hp_scan_tables_t plain;
+    uint32_t i;
+    hp_status_t status;
+
+    if (hp_scan_engine_init(&engine) != HP_STATUS_OK) {
+        status = HP_STATUS_ERROR;
+        goto return_status;
+    }
+    for (i = 0; i < test->pattern_count; i++) {
+        if (hp_scan_engine_add_pattern(engine, test->patterns[i].pat,
+                                       test->patterns[i].len,
+                                       i) != HP_STATUS_OK)
+        {
+            status = HP_STATUS_ERROR;
+            goto return_status;
+        }
+    }
+    if (hp_scan_engine_compile(engine) != HP_STATUS_OK) {
+        status = HP_STATUS_ERROR;
+        goto return_status;
+    }
+    tables = hp_scan_engine_tables(engine);
+    if (tables->prefilter_len != 0)
+        test->teddy_sets++;
+    if (tables->prefilter_hash_len != 0)
+        test->hash_sets++;
+    plain = *tables;
+    plain.prefilter_len = 0;
+    plain.prefilter_hash_len = 0;
+
+    hp_engine_test_reference(test);
+    for (i = 0; i < HP_ENGINE_TEST_SCANS; i++) {
+        if (hp_engine_test_scan(test, tables,
+                                (i == 0) ? test->buf_len :
+                                1 + hp_engine_test_rand(test) % 64) !=
+            HP_STATUS_OK ||
+            hp_engine_test_scan(test, &plain,
+                                (i == 0) ? test->buf_len :
+                                1 + hp_engine_test_rand(test) % 64) !=
+            HP_STATUS_OK)
+        {
+            status = HP_STATUS_ERROR;
+            goto return_status;
+        }
+    }
+
+    status = HP_STATUS_OK;
+ return_status:
+    if (engine != NULL)
+        hp_scan_engine_deinit(engine);
+    return status;
+}
+
+/* A byte from an alphabet of alphabet letters, or of every byte value */
+static uint8_t hp_engine_test_byte(hp_engine_test_t *test,
+                                   uint32_t alphabet)
+{
+    if (alphabet == 256)
+        return (uint8_t)hp_engine_test_rand(test);
+
+    return (uint8_t)(0xfe - hp_engine_test_rand(test) % alphabet);
+}
+
+static hp_status_t hp_engine_test_round(hp_engine_test_t *test)
+{
+    static const uint32_t alphabets[] = { 2, 4, 16, 256 };
+    hp_engine_test_pattern_t *pattern;
+    uint32_t alphabet;
+    uint32_t len_min;
+    uint32_t len_max;
+    uint32_t pos, len;
+    uint32_t i, j;
+
+    alphabet = alphabets[hp_engine_test_rand(test) % 4];
+    /* Few letters make for a lot of matches, so fewer patterns. */
+    test->pattern_count = 1 + hp_engine_test_rand(test) %
+        ((alphabet == 256) ? HP_ENGINE_TEST_PATTERNS_MAX : 64);
+    /* Sets of longer patterns get the hash prefilter once too large for
+     * the Teddy one. */
+    len_min = (alphabet == 256 && hp_engine_test_rand(test) % 2 == 0) ?
+        1 : 4;
+    len_max = (hp_engine_test_rand(test) % 8 == 0) ?
+        HP_ENGINE_TEST_PAT_LEN_MAX : 16;
+    for (i = 0; i < test->pattern_count; i++) {
+        pattern = &test->patterns[i];
+        pattern->len = 1 + hp_engine_test_rand(test) % len_max;
+        if (pattern->len < len_min)
+            pattern->len += len_min;
+        /* Some share a prefix with an earlier one */
+        j = 0;
+        if (i > 0 && hp_engine_test_rand(test) % 4 == 0) {
+            j = hp_engine_test_rand(test) % i;
+            len = test->patterns[j].len;
+            if (len > pattern->len)
+                len = pattern->len;
+            memcpy(pattern->pat, test->patterns[j].pat, len);
+            j = len;
+        }
+        for (; j < pattern->len; j++)
+            pattern->pat[j] = hp_engine_test_byte(test, alphabet);
+    }
+
+    test->buf_len = 1 + hp_engine_test_rand(test) % HP_ENGINE_TEST_BUF_MAX;
+    for (i = 0; i < test->buf_len; i++)
+        test->buf[i] = hp_engine_test_byte(test, alphabet);
+    for (i = hp_engine_test_rand(test) % 32; i > 0; i--) {
+        pattern = &test->patterns[hp_engine_test_rand(test) %
+                                  test->pattern_count];
+        if (pattern->len > test->buf_len)
+            continue;
+        pos = hp_engine_test_rand(test) % (test->buf_len - pattern->len + 1);
+        memcpy(test->buf + pos, pattern->pat, pattern->len);
+    }
+
+    return hp_engine_test_check(test);
+}
+
+/* A pattern of every byte value used to make the byte classes wrap, so
+ * that 0xff scanned as 0x00 and matched all over a run of zeroes. */
+static hp_status_t hp_engine_test_all_bytes(hp_engine_test_t *test)
+{
+    uint32_t i;
+
+    test->pattern_count = 2;
+    for (i = 0; i < 256; i++)
+        test->patterns[0].pat[i] = (uint8_t)i;
+    test->patterns[0].len = 256;
+    memset(test->patterns[1].pat, 0xff, 6);
+    test->patterns[1].len = 6;
+
+    memset(test->buf, 0, sizeof(test->buf));
+    memset(test->buf, 0xff, 3);
+    test->buf_len = 1024;
+    if (hp_engine_test_check(test) != HP_STATUS_OK)
+        return HP_STATUS_ERROR;
+
+    for (i = 0; i < 256; i++)
+        test->buf[100 + i] = (uint8_t)i;
+    memset(test->buf + 600, 0xff, 9);
+    return hp_engine_test_check(test);
+}
+
+int main(int argc, char *argv[])
+{
+    static hp_engine_test_t test;
+    uint64_t seed;
+    uint64_t rounds;
+    uint64_t i;
+    int ret = EXIT_FAILURE;
+
+    seed = (argc > 1) ? strtoull(argv[1], NULL, 0) : 1;
+    rounds = (argc > 2) ? strtoull(argv[2], NULL, 0) :
+        HP_ENGINE_TEST_ROUNDS_DEFAULT;
+    test.rng = seed | 1;
+
+    hp_log_init(HP_LOG_LEVEL_ERROR, NULL);
+
+    if (hp_engine_test_all_bytes(&test) != HP_STATUS_OK) {
+        printf("scan-engine-test: FAILED with every byte in a pattern.\n");
+        goto return_status;
+    }
+    for (i = 0; i < rounds; i++) {
+        if (hp_engine_test_round(&test) != HP_STATUS_OK) {
+            printf("scan-engine-test: FAILED in round %" PRIu64 " with seed "
+                   "%" PRIu64 ".\n", i, seed);
+            goto return_status;
+        }
+    }
+
+    printf("scan-engine-test: %" PRIu64 " scans, %" PRIu64 " matches, %"
+           PRIu64 " sets with the teddy prefilter and %" PRIu64 " with the "
+           "hash one, with seed %" PRIu64 " passed.\n", test.scans,
+           test.matches, test.teddy_sets, test.hash_sets, seed);
+    ret = EXIT_SUCCESS;
+
+ return_status:
+    free(test.expected.matches);
+    free(test.found.matches);
+    return ret;
+}
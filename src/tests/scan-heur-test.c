@@ -0,0 +1,500 @@
+/**
+ * Copyright(C) 2018, Juniper Networks, Inc.
+ * All rights reserved
+ *
+ * This SOFTWARE is licensed under the license provided in the LICENSE.txt
+ * file.  By downloading, installing, copying, or otherwise using the
+ * SOFTWARE, you agree to be bound by the terms of that license.  This
+ * SOFTWARE is not an official Juniper product.
+ *
+ * Third-Party Code: This SOFTWARE may depend on other components under
+ * separate copyright notice and license terms.  Your use of the source
+ * code for those components is subject to the term and conditions of
+ * the respective license as noted in the Third-Party source code.
+ */
+
+/**
+ * @author Anoop Saldanha
+ */
+
+/* Randomised test of the entropy and shellcode heuristics against a
+ * byte at a time model.  Each round makes up a region of zero pages,
+ * random bytes, text and code-like bytes with prologues and GetPC
+ * sequences planted in it, with holes of whole pages as the scanner
+ * leaves for pages it can't read, and feeds it in random chunks.  A few
+ * regions with a known score are checked first.
+ *
+ * scan-heur-test.exe [<seed> [<rounds>]] */
+
+#include <math.h>
+
+#include "honeyprocs-common.h"
+#include "scan-heur.h"
+#include "util-log.h"
+#include "status.h"
+
+#define HP_SCAN_HEUR_TEST_ROUNDS_DEFAULT 400
+#define HP_SCAN_HEUR_TEST_LEN_MAX (24 * HP_SCAN_HEUR_BLOCK_SIZE)
+/* Float sums against double ones */
+#define HP_SCAN_HEUR_TEST_EPSILON 0.001
+
+typedef struct hp_scan_heur_test_seq_t {
+    uint32_t len;
+    bool getpc;
+    uint8_t bytes[HP_SCAN_HEUR_SEQ_MAX];
+} hp_scan_heur_test_seq_t;
+
+/* What the heuristics look for, spelt out again */
+static const hp_scan_heur_test_seq_t hp_scan_heur_test_seqs[] = {
+    { 3, false, { 0x55, 0x8b, 0xec } },
+    { 3, false, { 0x55, 0x89, 0xe5 } },
+    { 4, false, { 0x55, 0x48, 0x89, 0xe5 } },
+    { 4, false, { 0x55, 0x48, 0x8b, 0xec } },
+    { 3, false, { 0x48, 0x83, 0xec } },
+    { 3, false, { 0x48, 0x81, 0xec } },
+    { 5, false, { 0x48, 0x89, 0x5c, 0x24, 0x08 } },
+    { 5, true, { 0xe8, 0x00, 0x00, 0x00, 0x00 } },
+    { 5, true, { 0xe8, 0xff, 0xff, 0xff, 0xff } },
+    { 4, true, { 0xd9, 0x74, 0x24, 0xf4 } },
+};
+#define HP_SCAN_HEUR_TEST_SEQ_COUNT \
+    (sizeof(hp_scan_heur_test_seqs) / sizeof(hp_scan_heur_test_seqs[0]))
+
+/* Bytes the sequences are made of, for code that comes close to them */
+static const uint8_t hp_scan_heur_test_code[] = {
+    0x55, 0x48, 0x89, 0x8b, 0xec, 0xe5, 0x83, 0x81, 0x5c, 0x24, 0x08,
+    0xe8, 0x00, 0xff, 0xd9, 0x74, 0xf4, 0xc3, 0x90,
+};
+
+typedef struct hp_scan_heur_test_t {
+    uint64_t rng;
+    uint64_t rounds;
+    uint64_t blocks;
+    uint64_t seqs;
+    hp_scan_heur_ctx_t ctx;
+    /* The region, and which of its pages are read */
+    uint8_t buf[HP_SCAN_HEUR_TEST_LEN_MAX];
+    bool page_read[HP_SCAN_HEUR_TEST_LEN_MAX / HP_SCAN_HEUR_BLOCK_SIZE];
+    size_t len;
+    hp_scan_heur_t expected;
+    /* Blocks close enough to the threshold to come out either way */
+    uint32_t high_entropy_close;
+} hp_scan_heur_test_t;
+
+#define hp_scan_heur_test_fail(test, ...)                               \
+    do {                                                                \
+        printf("scan-heur-test: %s:%d: in round %" PRIu64 ": ",         \
+               __FILE__, __LINE__, (test)->rounds);                     \
+        printf(__VA_ARGS__);                                            \
+        printf("\n");                                                   \
+        return HP_STATUS_ERROR;                                         \
+    } while (0)
+
+/* xorshift64* */
+static uint32_t hp_scan_heur_test_rand(hp_scan_heur_test_t *test)
+{
+    test->rng ^= test->rng >> 12;
+    test->rng ^= test->rng << 25;
+    test->rng ^= test->rng >> 27;
+
+    return (uint32_t)((test->rng * 0x2545F4914F6CDD1DULL) >> 32);
+}
+
+/* Runs of zeroes, random bytes, text and code-like bytes, with
+ * sequences planted in the code */
+static void hp_scan_heur_test_fill(hp_scan_heur_test_t *test)
+{
+    const hp_scan_heur_test_seq_t *seq;
+    size_t i, len;
+    uint32_t kind;
+    size_t j;
+
+    for (i = 0; i < test->len; i += len) {
+        len = 1 + hp_scan_heur_test_rand(test) % (2 * HP_SCAN_HEUR_BLOCK_SIZE);
+        if (len > test->len - i)
+            len = test->len - i;
+        kind = hp_scan_heur_test_rand(test) % 4;
+        for (j = i; j < i + len; j++) {
+            switch (kind) {
+                case 0:
+                    test->buf[j] = 0;
+                    break;
+                case 1:
+                    test->buf[j] = (uint8_t)hp_scan_heur_test_rand(test);
+                    break;
+                case 2:
+                    test->buf[j] = (uint8_t)('a' +
+                                             hp_scan_heur_test_rand(test) %
+                                             26);
+                    break;
+                default:
+                    test->buf[j] = hp_scan_heur_test_code[
+                        hp_scan_heur_test_rand(test) %
+                        sizeof(hp_scan_heur_test_code)];
+                    if (hp_scan_heur_test_rand(test) % 64 != 0)
+                        break;
+                    seq = &hp_scan_heur_test_seqs[
+                        hp_scan_heur_test_rand(test) %
+                        HP_SCAN_HEUR_TEST_SEQ_COUNT];
+                    if (j + seq->len <= i + len) {
+                        memcpy(test->buf + j, seq->bytes, seq->len);
+                        j += seq->len - 1;
+                    }
+                    break;
+            }
+        }
+    }
+
+    return;
+}
+
+/* The entropy of buf in bits per byte, the long way round */
+static double hp_scan_heur_test_entropy(const uint8_t *buf, size_t len)
+{
+    uint32_t hist[256];
+    double entropy = 0;
+    double p;
+    size_t i;
+
+    memset(hist, 0, sizeof(hist));
+    for (i = 0; i < len; i++)
+        hist[buf[i]]++;
+    for (i = 0; i < 256; i++) {
+        if (hist[i] == 0)
+            continue;
+        p = (double)hist[i] / len;
+        entropy -= p * log2(p);
+    }
+
+    return entropy;
+}
+
+/* What the region should come out as.  Blocks are of the region's
+ * offsets, and sequences don't run across holes. */
+static void hp_scan_heur_test_expect(hp_scan_heur_test_t *test)
+{
+    hp_scan_heur_t *heur = &test->expected;
+    const hp_scan_heur_test_seq_t *seq;
+    double entropy_sum = 0;
+    double entropy;
+    size_t run_end;
+    size_t block_len;
+    size_t off;
+    uint32_t blocks;
+    uint64_t nonzero;
+    uint32_t k;
+    size_t i;
+
+    memset(heur, 0, sizeof(*heur));
+    test->high_entropy_close = 0;
+    for (off = 0; off < test->len; off += block_len) {
+        block_len = test->len - off;
+        if (block_len > HP_SCAN_HEUR_BLOCK_SIZE)
+            block_len = HP_SCAN_HEUR_BLOCK_SIZE;
+        if (!test->page_read[off / HP_SCAN_HEUR_BLOCK_SIZE])
+            continue;
+
+        heur->len += block_len;
+        heur->block_count++;
+        for (i = off; i < off + block_len; i++)
+            heur->histogram[test->buf[i]]++;
+        for (i = off; i < off + block_len && test->buf[i] == 0; i++)
+            ;
+        if (i == off + block_len) {
+            heur->zero_blocks++;
+            continue;
+        }
+
+        entropy = hp_scan_heur_test_entropy(test->buf + off, block_len);
+        entropy_sum += entropy;
+        if (entropy > heur->entropy_max)
+            heur->entropy_max = (float)entropy;
+        if (fabs(entropy - HP_SCAN_HEUR_ENTROPY_HIGH) <
+            HP_SCAN_HEUR_TEST_EPSILON)
+        {
+            test->high_entropy_close++;
+        } else if (entropy > HP_SCAN_HEUR_ENTROPY_HIGH) {
+            heur->high_entropy_blocks++;
+        }
+
+        /* Sequences starting in the block, up to the next hole */
+        for (run_end = off; run_end < test->len &&
+                 test->page_read[run_end / HP_SCAN_HEUR_BLOCK_SIZE];
+             run_end += HP_SCAN_HEUR_BLOCK_SIZE)
+        {
+            ;
+        }
+        if (run_end > test->len)
+            run_end = test->len;
+        for (i = off; i < off + block_len; i++) {
+            for (k = 0; k < HP_SCAN_HEUR_TEST_SEQ_COUNT; k++) {
+                seq = &hp_scan_heur_test_seqs[k];
+                if (i + seq->len > run_end ||
+                    memcmp(test->buf + i, seq->bytes, seq->len) != 0)
+                {
+                    continue;
+                }
+                if (seq->getpc)
+                    heur->getpcs++;
+                else
+                    heur->prologues++;
+            }
+        }
+    }
+
+    blocks = heur->block_count - heur->zero_blocks;
+    if (blocks == 0)
+        return;
+    heur->entropy_mean = (float)(entropy_sum / blocks);
+
+    nonzero = heur->len - heur->histogram[0];
+    heur->score = (heur->getpcs != 0) ? 40 : 0;
+    heur->score += (30 * heur->high_entropy_blocks) / blocks;
+    if (heur->prologues == 0 && nonzero >= 256)
+        heur->score += 20;
+    if (nonzero < 64 * 1024)
+        heur->score += 10;
+
+    return;
+}
+
+/* Feed the pages read, in chunks of random sizes */
+static const hp_scan_heur_t *hp_scan_heur_test_feed(hp_scan_heur_test_t *test)
+{
+    size_t off, end, len;
+
+    hp_scan_heur_ctx_begin(&test->ctx);
+    for (off = 0; off < test->len; off += len) {
+        if (!test->page_read[off / HP_SCAN_HEUR_BLOCK_SIZE]) {
+            len = HP_SCAN_HEUR_BLOCK_SIZE;
+            continue;
+        }
+        end = (off / HP_SCAN_HEUR_BLOCK_SIZE + 1) * HP_SCAN_HEUR_BLOCK_SIZE;
+        while (end < test->len &&
+               test->page_read[end / HP_SCAN_HEUR_BLOCK_SIZE])
+        {
+            end += HP_SCAN_HEUR_BLOCK_SIZE;
+        }
+        if (end > test->len)
+            end = test->len;
+
+        switch (hp_scan_heur_test_rand(test) % 3) {
+            case 0:
+                len = 1 + hp_scan_heur_test_rand(test) % 8;
+                break;
+            case 1:
+                len = 1 + hp_scan_heur_test_rand(test) % 200;
+                break;
+            default:
+                len = 1 + hp_scan_heur_test_rand(test) %
+                    (3 * HP_SCAN_HEUR_BLOCK_SIZE);
+                break;
+        }
+        if (len > end - off)
+            len = end - off;
+        hp_scan_heur_ctx_feed(&test->ctx, off, test->buf + off, len);
+    }
+
+    return hp_scan_heur_ctx_end(&test->ctx);
+}
+
+static hp_status_t hp_scan_heur_test_check(hp_scan_heur_test_t *test,
+                                           const hp_scan_heur_t *heur)
+{
+    const hp_scan_heur_t *expected = &test->expected;
+    uint32_t i;
+
+    if (heur->len != expected->len) {
+        hp_scan_heur_test_fail(test, "%" PRIu64 " bytes, %" PRIu64
+                               " expected", heur->len, expected->len);
+    }
+    for (i = 0; i < 256; i++) {
+        if (heur->histogram[i] != expected->histogram[i]) {
+            hp_scan_heur_test_fail(test, "%" PRIu64 " of byte 0x%02x, %"
+                                   PRIu64 " expected", heur->histogram[i],
+                                   i, expected->histogram[i]);
+        }
+    }
+    if (heur->block_count != expected->block_count ||
+        heur->zero_blocks != expected->zero_blocks)
+    {
+        hp_scan_heur_test_fail(test, "%u blocks, %u of them zeroes, %u and "
+                               "%u expected", heur->block_count,
+                               heur->zero_blocks, expected->block_count,
+                               expected->zero_blocks);
+    }
+    if (heur->high_entropy_blocks < expected->high_entropy_blocks ||
+        heur->high_entropy_blocks > expected->high_entropy_blocks +
+        test->high_entropy_close)
+    {
+        hp_scan_heur_test_fail(test, "%u high entropy blocks, %u expected",
+                               heur->high_entropy_blocks,
+                               expected->high_entropy_blocks);
+    }
+    if (fabs(heur->entropy_max - expected->entropy_max) >
+        HP_SCAN_HEUR_TEST_EPSILON ||
+        fabs(heur->entropy_mean - expected->entropy_mean) >
+        HP_SCAN_HEUR_TEST_EPSILON)
+    {
+        hp_scan_heur_test_fail(test, "entropy at most %f and %f on "
+                               "average, %f and %f expected",
+                               heur->entropy_max, heur->entropy_mean,
+                               expected->entropy_max,
+                               expected->entropy_mean);
+    }
+    if (heur->prologues != expected->prologues ||
+        heur->getpcs != expected->getpcs)
+    {
+        hp_scan_heur_test_fail(test, "%u prologues and %u GetPCs, %u and "
+                               "%u expected", heur->prologues, heur->getpcs,
+                               expected->prologues, expected->getpcs);
+    }
+    /* Off by what the blocks close to the threshold could make */
+    if (test->high_entropy_close == 0 && heur->score != expected->score) {
+        hp_scan_heur_test_fail(test, "scored %u, %u expected", heur->score,
+                               expected->score);
+    }
+
+    return HP_STATUS_OK;
+}
+
+/* A region of len bytes, all read */
+static void hp_scan_heur_test_region(hp_scan_heur_test_t *test, size_t len)
+{
+    test->len = len;
+    memset(test->page_read, true, sizeof(test->page_read));
+
+    return;
+}
+
+/**
+ * Regions the score is known for -
+ *
+ *   zeroes                                                     0
+ *   a small random payload with call $+5 in it               100
+ *   the same, but past 64 KiB                                 90
+ *   small code with prologues                                 10
+ */
+static hp_status_t hp_scan_heur_test_known(hp_scan_heur_test_t *test)
+{
+    static const struct {
+        size_t len;
+        uint32_t kind;
+        uint32_t score;
+    } known[] = {
+        { 8 * HP_SCAN_HEUR_BLOCK_SIZE, 0, 0 },
+        { 1024, 1, 100 },
+        { 20 * HP_SCAN_HEUR_BLOCK_SIZE, 1, 90 },
+        { 2 * HP_SCAN_HEUR_BLOCK_SIZE, 2, 10 },
+    };
+    static const uint8_t call[] = { 0xe8, 0x00, 0x00, 0x00, 0x00 };
+    static const uint8_t prologue[] = { 0x55, 0x48, 0x89, 0xe5 };
+    const hp_scan_heur_t *heur;
+    uint32_t i;
+    size_t j;
+
+    for (i = 0; i < sizeof(known) / sizeof(known[0]); i++) {
+        hp_scan_heur_test_region(test, known[i].len);
+        for (j = 0; j < test->len; j++) {
+            switch (known[i].kind) {
+                case 0:
+                    test->buf[j] = 0;
+                    break;
+                case 1:
+                    /* Random, but never starting a prologue */
+                    do {
+                        test->buf[j] =
+                            (uint8_t)hp_scan_heur_test_rand(test);
+                    } while (test->buf[j] == 0x55 || test->buf[j] == 0x48);
+                    break;
+                default:
+                    /* mov eax, imm32 with a small immediate */
+                    test->buf[j] = (j % 5 == 0) ? 0xb8 :
+                        ((j % 5 == 1) ? (uint8_t)(j / 5) : 0);
+                    break;
+            }
+        }
+        if (known[i].kind == 1)
+            memcpy(test->buf + test->len / 2, call, sizeof(call));
+        if (known[i].kind == 2) {
+            for (j = 0; j + sizeof(prologue) <= test->len; j += 500)
+                memcpy(test->buf + j, prologue, sizeof(prologue));
+        }
+
+        heur = hp_scan_heur_test_feed(test);
+        if (heur->score != known[i].score) {
+            hp_scan_heur_test_fail(test, "known region %u scored %u, %u "
+                                   "expected", i, heur->score,
+                                   known[i].score);
+        }
+        hp_scan_heur_test_expect(test);
+        if (hp_scan_heur_test_check(test, heur) != HP_STATUS_OK)
+            return HP_STATUS_ERROR;
+    }
+
+    return HP_STATUS_OK;
+}
+
+static hp_status_t hp_scan_heur_test_round(hp_scan_heur_test_t *test)
+{
+    const hp_scan_heur_t *heur;
+    size_t pages;
+    size_t i;
+
+    test->len = 1 + hp_scan_heur_test_rand(test) % HP_SCAN_HEUR_TEST_LEN_MAX;
+    pages = (test->len + HP_SCAN_HEUR_BLOCK_SIZE - 1) /
+        HP_SCAN_HEUR_BLOCK_SIZE;
+    for (i = 0; i < pages; i++)
+        test->page_read[i] = (hp_scan_heur_test_rand(test) % 6 != 0);
+    hp_scan_heur_test_fill(test);
+
+    heur = hp_scan_heur_test_feed(test);
+    hp_scan_heur_test_expect(test);
+    if (hp_scan_heur_test_check(test, heur) != HP_STATUS_OK)
+        return HP_STATUS_ERROR;
+
+    test->blocks += heur->block_count;
+    test->seqs += heur->prologues + heur->getpcs;
+
+    return HP_STATUS_OK;
+}
+
+int main(int argc, char *argv[])
+{
+    static hp_scan_heur_test_t test;
+    uint64_t seed;
+    uint64_t rounds;
+    int ret = EXIT_FAILURE;
+
+    seed = (argc > 1) ? strtoull(argv[1], NULL, 0) : 1;
+    rounds = (argc > 2) ? strtoull(argv[2], NULL, 0) :
+        HP_SCAN_HEUR_TEST_ROUNDS_DEFAULT;
+    test.rng = seed | 1;
+
+    hp_log_init(HP_LOG_LEVEL_ERROR, NULL);
+
+    if (hp_scan_heur_ctx_init(&test.ctx) != HP_STATUS_OK) {
+        printf("scan-heur-test: hp_scan_heur_ctx_init() failed\n");
+        goto return_status;
+    }
+
+    if (hp_scan_heur_test_known(&test) != HP_STATUS_OK)
+        goto failed;
+    for (test.rounds = 0; test.rounds < rounds; test.rounds++) {
+        if (hp_scan_heur_test_round(&test) != HP_STATUS_OK)
+            goto failed;
+    }
+
+    printf("scan-heur-test: %" PRIu64 " regions, %" PRIu64 " blocks, %"
+           PRIu64 " sequences, with seed %" PRIu64 " passed.\n",
+           test.rounds, test.blocks, test.seqs, seed);
+    ret = EXIT_SUCCESS;
+    goto return_status;
+
+ failed:
+    printf("scan-heur-test: FAILED with seed %" PRIu64 ".\n", seed);
+ return_status:
+    hp_scan_heur_ctx_deinit(&test.ctx);
+    hp_log_deinit();
+    return ret;
+}
@@ -0,0 +1,1144 @@
+/**
+ * Copyright(C) 2018, Juniper Networks, Inc.
+ * All rights reserved
+ *
+ * This SOFTWARE is licensed under the license provided in the LICENSE.txt
+ * file.  By downloading, installing, copying, or otherwise using the
+ * SOFTWARE, you agree to be bound by the terms of that license.  This
+ * SOFTWARE is not an official Juniper product.
+ *
+ * Third-Party Code: This SOFTWARE may depend on other components under
+ * separate copyright notice and license terms.  Your use of the source
+ * code for those components is subject to the term and conditions of
+ * the respective license as noted in the Third-Party source code.
+ */
+
+/**
+ * @author Anoop Saldanha
+ */
+
+/* Randomised test of rule scans against a naive reference.  Each round
+ * writes out a signature file of random rules - text, hex with wildcards
+ * and regexes, under random conditions - and loads it the way the
+ * scanner does.  Regions of random bytes, with the rules' strings planted
+ * in them, are then fed in random chunks, with holes, each chunk in a
+ * buffer of its own so that nothing past it can be read.  The rules that
+ * matched have to be the ones the reference finds by trying every string
+ * at every offset of every contiguous run.  A region whose rules are
+ * decided may be left unfed from there on, as the scanner does.
+ *
+ * Build with a small HP_SCAN_RULES_DFA_STATES so that the regexes' DFA
+ * cache is flushed and built up again all the time.
+ *
+ * scan-rules-test.exe [<seed> [<rounds>]] */
+
+#include "honeyprocs-common.h"
+#include "scan-rules.h"
+#include "signatures.h"
+#include "status.h"
+#include "util-log.h"
+
+#define HP_RULES_TEST_ROUNDS_DEFAULT  200
+#define HP_RULES_TEST_REGIONS         16
+#define HP_RULES_TEST_RULES_MAX       8
+#define HP_RULES_TEST_STRINGS_MAX     5
+#define HP_RULES_TEST_NODES_MAX       32
+#define HP_RULES_TEST_RE_NODES_MAX    48
+#define HP_RULES_TEST_REGION_MAX      4096
+/* Longer than a rule scan keeps history for */
+#define HP_RULES_TEST_LONG_MIN        (HP_SCAN_RULES_SPAN_MAX + 1)
+#define HP_RULES_TEST_LONG_MAX        700
+#define HP_RULES_TEST_PLANTS_MAX      6
+#define HP_RULES_TEST_SEGMENTS_MAX    HP_RULES_TEST_REGION_MAX
+
+#define HP_RULES_TEST_TEXT  0
+#define HP_RULES_TEST_HEX   1
+#define HP_RULES_TEST_REGEX 2
+
+/* Regex nodes.  A set takes a byte, the rest are over nodes a and b. */
+#define HP_RULES_TEST_RE_SET 0
+#define HP_RULES_TEST_RE_CAT 1
+#define HP_RULES_TEST_RE_ALT 2
+#define HP_RULES_TEST_RE_REP 3
+
+#define HP_RULES_TEST_RE_ANY UINT32_MAX
+
+/* Offsets a regex can be at, from its start, up to its longest match */
+#define HP_RULES_TEST_POS_WORDS ((HP_SCAN_RULES_SPAN_MAX / 64) + 1)
+
+typedef struct hp_rules_test_pos_t {
+    uint64_t w[HP_RULES_TEST_POS_WORDS];
+} hp_rules_test_pos_t;
+
+typedef struct hp_rules_test_re_t {
+    uint32_t type;
+    uint8_t set[HP_SCAN_CLASS_SIZE];
+    uint32_t a;
+    uint32_t b;
+    uint32_t min;
+    uint32_t max;
+} hp_rules_test_re_t;
+
+typedef struct hp_rules_test_string_t {
+    uint32_t kind;
+    char id[12];
+    /* Text and hex */
+    uint8_t pat[HP_RULES_TEST_LONG_MAX];
+    uint8_t mask[HP_RULES_TEST_LONG_MAX];
+    uint32_t len;
+    /* Regexes, with the root last */
+    hp_rules_test_re_t re[HP_RULES_TEST_RE_NODES_MAX];
+    uint32_t re_count;
+    /* Per region offset, whether a match starts there */
+    uint8_t starts[HP_RULES_TEST_REGION_MAX];
+    bool matched;
+} hp_rules_test_string_t;
+
+/* A condition node, with op one of HP_SCAN_OP_*.  refs is a bit per
+ * string of the rule, for HP_SCAN_OP_OF. */
+typedef struct hp_rules_test_node_t {
+    uint32_t op;
+    uint32_t a;
+    uint32_t b;
+    uint32_t refs;
+} hp_rules_test_node_t;
+
+typedef struct hp_rules_test_rule_t {
+    hp_rules_test_string_t strings[HP_RULES_TEST_STRINGS_MAX];
+    uint32_t string_count;
+    hp_rules_test_node_t nodes[HP_RULES_TEST_NODES_MAX];
+    uint32_t node_count;
+    uint32_t root;
+    /* What the scan reported for the region being checked */
+    bool reported;
+    uint64_t offset;
+} hp_rules_test_rule_t;
+
+typedef struct hp_rules_test_segment_t {
+    uint32_t start;
+    uint32_t end;
+} hp_rules_test_segment_t;
+
+typedef struct hp_rules_test_t {
+    const char *path;
+    uint64_t rng;
+    hp_rules_test_rule_t rules[HP_RULES_TEST_RULES_MAX];
+    uint32_t rule_count;
+    uint32_t region;
+    uint8_t data[HP_RULES_TEST_REGION_MAX];
+    uint32_t data_len;
+    /* The contiguous runs the region is fed as */
+    hp_rules_test_segment_t segments[HP_RULES_TEST_SEGMENTS_MAX];
+    uint32_t segment_count;
+    bool failed;
+    uint64_t regions;
+    uint64_t rule_matches;
+    uint64_t early_stops;
+    uint64_t dfa_flushes;
+} hp_rules_test_t;
+
+#define hp_rules_test_fail(test, ...)                                   \
+    do {                                                                \
+        printf("scan-rules-test: %s:%d: after %" PRIu64 " regions: ",   \
+               __FILE__, __LINE__, (test)->regions);                    \
+        printf(__VA_ARGS__);                                            \
+        printf("\n");                                                   \
+        return HP_STATUS_ERROR;                                         \
+    } while (0)
+
+/* xorshift64* */
+static uint32_t hp_rules_test_rand(hp_rules_test_t *test)
+{
+    test->rng ^= test->rng >> 12;
+    test->rng ^= test->rng << 25;
+    test->rng ^= test->rng >> 27;
+
+    return (uint32_t)((test->rng * 0x2545F4914F6CDD1DULL) >> 32);
+}
+
+/* Mostly a few letters, so that short strings match by chance too */
+static uint8_t hp_rules_test_byte(hp_rules_test_t *test)
+{
+    if (hp_rules_test_rand(test) % 8 != 0)
+        return (uint8_t)('a' + hp_rules_test_rand(test) % 4);
+
+    return (uint8_t)hp_rules_test_rand(test);
+}
+
+static bool hp_rules_test_set_has(const uint8_t *set, uint8_t c)
+{
+    return (set[c >> 3] >> (c & 7)) & 1;
+}
+
+static void hp_rules_test_set_add(uint8_t *set, uint8_t c)
+{
+    set[c >> 3] |= (uint8_t)(1 << (c & 7));
+
+    return;
+}
+
+/*
+ * Regexes.
+ */
+
+static uint32_t hp_rules_test_re_node(hp_rules_test_string_t *string,
+                                      uint32_t type, uint32_t a, uint32_t b,
+                                      uint32_t min, uint32_t max)
+{
+    hp_rules_test_re_t *re = &string->re[string->re_count];
+
+    memset(re, 0, sizeof(*re));
+    re->type = type;
+    re->a = a;
+    re->b = b;
+    re->min = min;
+    re->max = max;
+
+    return string->re_count++;
+}
+
+static uint32_t hp_rules_test_re_byte(hp_rules_test_string_t *string,
+                                      uint8_t c)
+{
+    uint32_t n;
+
+    n = hp_rules_test_re_node(string, HP_RULES_TEST_RE_SET, 0, 0, 0, 0);
+    hp_rules_test_set_add(string->re[n].set, c);
+
+    return n;
+}
+
+/* A byte, a class of a few letters, any byte, or a class left out */
+static uint32_t hp_rules_test_re_set(hp_rules_test_t *test,
+                                     hp_rules_test_string_t *string)
+{
+    hp_rules_test_re_t *re;
+    uint32_t n;
+    uint32_t i;
+
+    switch (hp_rules_test_rand(test) % 5) {
+        case 0:
+        case 1:
+            return hp_rules_test_re_byte(string, hp_rules_test_byte(test));
+        default:
+            break;
+    }
+
+    n = hp_rules_test_re_node(string, HP_RULES_TEST_RE_SET, 0, 0, 0, 0);
+    re = &string->re[n];
+    switch (hp_rules_test_rand(test) % 3) {
+        case 0:
+            memset(re->set, 0xff, sizeof(re->set));
+            break;
+        case 1:
+            for (i = 0; i < 4; i++) {
+                if (hp_rules_test_rand(test) % 2)
+                    hp_rules_test_set_add(re->set, (uint8_t)('a' + i));
+            }
+            hp_rules_test_set_add(re->set, (uint8_t)
+                                  ('a' + hp_rules_test_rand(test) % 4));
+            break;
+        default:
+            memset(re->set, 0xff, sizeof(re->set));
+            re->set['a' >> 3] &= (uint8_t)
+                ~(1 << (('a' + hp_rules_test_rand(test) % 4) & 7));
+            break;
+    }
+
+    return n;
+}
+
+static uint32_t hp_rules_test_re_gen(hp_rules_test_t *test,
+                                     hp_rules_test_string_t *string,
+                                     uint32_t depth)
+{
+    uint32_t a, b;
+    uint32_t min, max;
+
+    /* Each level takes at most two nodes and its children */
+    if (depth == 0 ||
+        string->re_count + 8 > HP_RULES_TEST_RE_NODES_MAX)
+    {
+        return hp_rules_test_re_set(test, string);
+    }
+
+    switch (hp_rules_test_rand(test) % 6) {
+        case 0:
+        case 1:
+            a = hp_rules_test_re_gen(test, string, depth - 1);
+            b = hp_rules_test_re_gen(test, string, depth - 1);
+            return hp_rules_test_re_node(string, HP_RULES_TEST_RE_CAT, a, b,
+                                         0, 0);
+        case 2:
+            a = hp_rules_test_re_gen(test, string, depth - 1);
+            b = hp_rules_test_re_gen(test, string, depth - 1);
+            return hp_rules_test_re_node(string, HP_RULES_TEST_RE_ALT, a, b,
+                                         0, 0);
+        case 3:
+        case 4:
+            a = hp_rules_test_re_gen(test, string, depth - 1);
+            /* Bounded repeats are expanded, so only those of a single
+             * byte are long, to keep nested ones in the NFA's limits */
+            min = hp_rules_test_rand(test) % 3;
+            if (hp_rules_test_rand(test) % 3 == 0)
+                max = HP_RULES_TEST_RE_ANY;
+            else if (string->re[a].type == HP_RULES_TEST_RE_SET)
+                max = min + hp_rules_test_rand(test) % 24;
+            else
+                max = min + hp_rules_test_rand(test) % 4;
+            if (max == 0)
+                max = 1;
+            return hp_rules_test_re_node(string, HP_RULES_TEST_RE_REP, a, 0,
+                                         min, max);
+        default:
+            return hp_rules_test_re_set(test, string);
+    }
+}
+
+/* A regex, starting with a literal byte or two for it to be found by */
+static void hp_rules_test_regex(hp_rules_test_t *test,
+                                hp_rules_test_string_t *string)
+{
+    uint32_t prefix;
+    uint32_t body;
+
+    string->re_count = 0;
+    prefix = hp_rules_test_re_byte(string, hp_rules_test_byte(test));
+    if (hp_rules_test_rand(test) % 2) {
+        body = hp_rules_test_re_byte(string, hp_rules_test_byte(test));
+        prefix = hp_rules_test_re_node(string, HP_RULES_TEST_RE_CAT,
+                                       prefix, body, 0, 0);
+    }
+    body = hp_rules_test_re_gen(test, string,
+                                1 + hp_rules_test_rand(test) % 4);
+    hp_rules_test_re_node(string, HP_RULES_TEST_RE_CAT, prefix, body, 0, 0);
+
+    return;
+}
+
+static void hp_rules_test_re_write(FILE *fp,
+                                   const hp_rules_test_string_t *string,
+                                   uint32_t n)
+{
+    const hp_rules_test_re_t *re = &string->re[n];
+    const hp_rules_test_re_t *sub;
+    uint32_t count;
+    uint32_t c, lo;
+
+    switch (re->type) {
+        case HP_RULES_TEST_RE_SET:
+            for (count = 0, c = 0; c < 256; c++)
+                count += hp_rules_test_set_has(re->set, (uint8_t)c);
+            if (count == 256) {
+                fprintf(fp, ".");
+                break;
+            }
+            if (count == 1) {
+                for (c = 0; !hp_rules_test_set_has(re->set, (uint8_t)c); c++)
+                    ;
+                fprintf(fp, "\\x%02x", c);
+                break;
+            }
+            fprintf(fp, "[");
+            for (c = 0; c < 256; c++) {
+                if (!hp_rules_test_set_has(re->set, (uint8_t)c))
+                    continue;
+                for (lo = c; c + 1 < 256 &&
+                         hp_rules_test_set_has(re->set, (uint8_t)(c + 1));
+                     c++)
+                    ;
+                if (lo == c)
+                    fprintf(fp, "\\x%02x", lo);
+                else
+                    fprintf(fp, "\\x%02x-\\x%02x", lo, c);
+            }
+            fprintf(fp, "]");
+            break;
+        case HP_RULES_TEST_RE_CAT:
+            hp_rules_test_re_write(fp, string, re->a);
+            hp_rules_test_re_write(fp, string, re->b);
+            break;
+        case HP_RULES_TEST_RE_ALT:
+            fprintf(fp, "(");
+            hp_rules_test_re_write(fp, string, re->a);
+            fprintf(fp, "|");
+            hp_rules_test_re_write(fp, string, re->b);
+            fprintf(fp, ")");
+            break;
+        default:
+            sub = &string->re[re->a];
+            if (sub->type != HP_RULES_TEST_RE_SET)
+                fprintf(fp, "(");
+            hp_rules_test_re_write(fp, string, re->a);
+            if (sub->type != HP_RULES_TEST_RE_SET)
+                fprintf(fp, ")");
+            if (re->max == HP_RULES_TEST_RE_ANY)
+                fprintf(fp, "{%u,}", re->min);
+            else if (re->min == re->max)
+                fprintf(fp, "{%u}", re->min);
+            else
+                fprintf(fp, "{%u,%u}", re->min, re->max);
+            break;
+    }
+
+    return;
+}
+
+static uint32_t hp_rules_test_ctz(uint64_t bits)
+{
+#ifdef _MSC_VER
+    unsigned long bit;
+
+    _BitScanForward64(&bit, bits);
+    return (uint32_t)bit;
+#else
+    return (uint32_t)__builtin_ctzll(bits);
+#endif
+}
+
+static bool hp_rules_test_pos_empty(const hp_rules_test_pos_t *pos)
+{
+    uint32_t i;
+
+    for (i = 0; i < HP_RULES_TEST_POS_WORDS; i++) {
+        if (pos->w[i] != 0)
+            return false;
+    }
+
+    return true;
+}
+
+/**
+ * Where a regex node can leave off, from where it can start, over the
+ * avail bytes at d.  Each set of offsets is matched as a whole, so this
+ * is linear in the span for a given regex.
+ */
+static void hp_rules_test_re_ends(const hp_rules_test_string_t *string,
+                                  uint32_t n, const uint8_t *d,
+                                  uint32_t avail,
+                                  const hp_rules_test_pos_t *in,
+                                  hp_rules_test_pos_t *out)
+{
+    const hp_rules_test_re_t *re = &string->re[n];
+    hp_rules_test_pos_t cur, next, other;
+    uint64_t bits;
+    uint32_t p;
+    uint32_t i, k;
+    bool grew;
+
+    memset(out, 0, sizeof(*out));
+    if (hp_rules_test_pos_empty(in))
+        return;
+
+    switch (re->type) {
+        case HP_RULES_TEST_RE_SET:
+            for (i = 0; i < HP_RULES_TEST_POS_WORDS; i++) {
+                for (bits = in->w[i]; bits != 0; bits &= bits - 1) {
+                    p = (i * 64) + hp_rules_test_ctz(bits);
+                    if (p < avail && hp_rules_test_set_has(re->set, d[p]))
+                        out->w[(p + 1) / 64] |= (uint64_t)1 << ((p + 1) % 64);
+                }
+            }
+            break;
+        case HP_RULES_TEST_RE_CAT:
+            hp_rules_test_re_ends(string, re->a, d, avail, in, &cur);
+            hp_rules_test_re_ends(string, re->b, d, avail, &cur, out);
+            break;
+        case HP_RULES_TEST_RE_ALT:
+            hp_rules_test_re_ends(string, re->a, d, avail, in, out);
+            hp_rules_test_re_ends(string, re->b, d, avail, in, &other);
+            for (i = 0; i < HP_RULES_TEST_POS_WORDS; i++)
+                out->w[i] |= other.w[i];
+            break;
+        default:
+            cur = *in;
+            for (k = 0; k < re->min; k++) {
+                hp_rules_test_re_ends(string, re->a, d, avail, &cur, &next);
+                cur = next;
+            }
+            *out = cur;
+            /* Taking it again only adds offsets while it keeps getting
+             * somewhere new */
+            for (; re->max == HP_RULES_TEST_RE_ANY || k < re->max; k++) {
+                hp_rules_test_re_ends(string, re->a, d, avail, &cur, &next);
+                grew = false;
+                for (i = 0; i < HP_RULES_TEST_POS_WORDS; i++) {
+                    grew |= (next.w[i] & ~out->w[i]) != 0;
+                    out->w[i] |= next.w[i];
+                }
+                if (!grew)
+                    break;
+                cur = next;
+            }
+            break;
+    }
+
+    return;
+}
+
+static bool hp_rules_test_re_match(const hp_rules_test_string_t *string,
+                                   const uint8_t *d, uint32_t avail)
+{
+    hp_rules_test_pos_t in, out;
+    uint32_t i;
+
+    if (avail > HP_SCAN_RULES_SPAN_MAX)
+        avail = HP_SCAN_RULES_SPAN_MAX;
+
+    memset(&in, 0, sizeof(in));
+    in.w[0] = 1;
+    hp_rules_test_re_ends(string, string->re_count - 1, d, avail, &in, &out);
+    /* Nothing matches empty, as every regex starts with a byte */
+    for (i = 0; i < HP_RULES_TEST_POS_WORDS; i++) {
+        if (out.w[i] != 0)
+            return true;
+    }
+
+    return false;
+}
+
+/* Write out a match of a regex node, or fail if it runs past max. */
+static bool hp_rules_test_re_sample(hp_rules_test_t *test,
+                                    const hp_rules_test_string_t *string,
+                                    uint32_t n, uint8_t *buf, uint32_t *len,
+                                    uint32_t max)
+{
+    const hp_rules_test_re_t *re = &string->re[n];
+    uint32_t count;
+    uint32_t c;
+    uint32_t i;
+
+    switch (re->type) {
+        case HP_RULES_TEST_RE_SET:
+            if (*len == max)
+                return false;
+            do {
+                c = (hp_rules_test_rand(test) % 2) ?
+                    hp_rules_test_byte(test) : hp_rules_test_rand(test) % 256;
+            } while (!hp_rules_test_set_has(re->set, (uint8_t)c));
+            buf[(*len)++] = (uint8_t)c;
+            return true;
+        case HP_RULES_TEST_RE_CAT:
+            return (hp_rules_test_re_sample(test, string, re->a, buf, len,
+                                            max) &&
+                    hp_rules_test_re_sample(test, string, re->b, buf, len,
+                                            max));
+        case HP_RULES_TEST_RE_ALT:
+            return hp_rules_test_re_sample(test, string,
+                                           (hp_rules_test_rand(test) % 2) ?
+                                           re->a : re->b, buf, len, max);
+        default:
+            count = re->min + hp_rules_test_rand(test) % 4;
+            if (re->max != HP_RULES_TEST_RE_ANY && count > re->max)
+                count = re->max;
+            for (i = 0; i < count; i++) {
+                if (!hp_rules_test_re_sample(test, string, re->a, buf, len,
+                                             max))
+                {
+                    return false;
+                }
+            }
+            return true;
+    }
+}
+
+/*
+ * Rules.
+ */
+
+static void hp_rules_test_string(hp_rules_test_t *test,
+                                 hp_rules_test_string_t *string,
+                                 uint32_t index)
+{
+    uint32_t at, anchor_len;
+    uint32_t i;
+
+    snprintf(string->id, sizeof(string->id), "%c%u",
+             'a' + (int)(hp_rules_test_rand(test) % 2), index);
+
+    switch (hp_rules_test_rand(test) % 10) {
+        case 0:
+        case 1:
+        case 2:
+        case 3:
+            string->kind = HP_RULES_TEST_TEXT;
+            if (hp_rules_test_rand(test) % 6 == 0) {
+                string->len = HP_RULES_TEST_LONG_MIN +
+                    hp_rules_test_rand(test) %
+                    (HP_RULES_TEST_LONG_MAX - HP_RULES_TEST_LONG_MIN + 1);
+            } else {
+                string->len = 1 + hp_rules_test_rand(test) % 4;
+            }
+            for (i = 0; i < string->len; i++)
+                string->pat[i] = hp_rules_test_byte(test);
+            memset(string->mask, 0xff, string->len);
+            break;
+        case 4:
+        case 5:
+        case 6:
+            string->kind = HP_RULES_TEST_HEX;
+            if (hp_rules_test_rand(test) % 10 == 0) {
+                string->len = HP_SCAN_RULES_SPAN_MAX - 64 +
+                    hp_rules_test_rand(test) % 65;
+            } else {
+                string->len = 2 + hp_rules_test_rand(test) % 11;
+            }
+            do {
+                for (i = 0; i < string->len; i++) {
+                    string->pat[i] = hp_rules_test_byte(test);
+                    switch (hp_rules_test_rand(test) % 8) {
+                        case 0:
+                            string->mask[i] = 0x00;
+                            break;
+                        case 1:
+                            string->mask[i] = 0xf0;
+                            break;
+                        case 2:
+                            string->mask[i] = 0x0f;
+                            break;
+                        default:
+                            string->mask[i] = 0xff;
+                            break;
+                    }
+                    string->pat[i] &= string->mask[i];
+                }
+                hp_scan_string_anchor(string->mask, string->len, &at,
+                                      &anchor_len);
+            } while (anchor_len == 0);
+            break;
+        default:
+            string->kind = HP_RULES_TEST_REGEX;
+            hp_rules_test_regex(test, string);
+            break;
+    }
+
+    return;
+}
+
+static uint32_t hp_rules_test_cond_node(hp_rules_test_rule_t *rule,
+                                        uint32_t op, uint32_t a, uint32_t b,
+                                        uint32_t refs)
+{
+    hp_rules_test_node_t *node = &rule->nodes[rule->node_count];
+
+    node->op = op;
+    node->a = a;
+    node->b = b;
+    node->refs = refs;
+
+    return rule->node_count++;
+}
+
+static uint32_t hp_rules_test_cond(hp_rules_test_t *test,
+                                   hp_rules_test_rule_t *rule,
+                                   uint32_t depth)
+{
+    uint32_t all = (1u << rule->string_count) - 1;
+    uint32_t refs;
+    uint32_t count;
+    uint32_t a, b;
+    uint32_t i;
+
+    if (depth == 0 || rule->node_count + 8 > HP_RULES_TEST_NODES_MAX)
+        goto leaf;
+
+    switch (hp_rules_test_rand(test) % 5) {
+        case 0:
+        case 1:
+            a = hp_rules_test_cond(test, rule, depth - 1);
+            b = hp_rules_test_cond(test, rule, depth - 1);
+            return hp_rules_test_cond_node(rule, HP_SCAN_OP_AND, a, b, 0);
+        case 2:
+        case 3:
+            a = hp_rules_test_cond(test, rule, depth - 1);
+            b = hp_rules_test_cond(test, rule, depth - 1);
+            return hp_rules_test_cond_node(rule, HP_SCAN_OP_OR, a, b, 0);
+        default:
+            a = hp_rules_test_cond(test, rule, depth - 1);
+            return hp_rules_test_cond_node(rule, HP_SCAN_OP_NOT, a, 0, 0);
+    }
+
+ leaf:
+    switch (hp_rules_test_rand(test) % 6) {
+        case 0:
+        case 1:
+        case 2:
+            return hp_rules_test_cond_node(rule, HP_SCAN_OP_STRING,
+                                           hp_rules_test_rand(test) %
+                                           rule->string_count, 0, 0);
+        case 3:
+            return hp_rules_test_cond_node(rule, HP_SCAN_OP_REGION,
+                                           1u << (hp_rules_test_rand(test) %
+                                                  6), 0, 0);
+        default:
+            refs = all;
+            if (hp_rules_test_rand(test) % 2)
+                refs = (hp_rules_test_rand(test) & all) | 1;
+            for (count = 0, i = 0; i < rule->string_count; i++)
+                count += (refs >> i) & 1;
+            return hp_rules_test_cond_node(rule, HP_SCAN_OP_OF,
+                                           1 + hp_rules_test_rand(test) %
+                                           count, 0, refs);
+    }
+}
+
+static void hp_rules_test_cond_write(FILE *fp,
+                                     const hp_rules_test_rule_t *rule,
+                                     uint32_t n)
+{
+    static const char *attrs[] = {
+        "PRIVATE", "MAPPED", "IMAGE", "READ", "WRITE", "EXECUTE",
+    };
+    const hp_rules_test_node_t *node = &rule->nodes[n];
+    uint32_t i;
+    bool first;
+
+    switch (node->op) {
+        case HP_SCAN_OP_STRING:
+            fprintf(fp, "$%s", rule->strings[node->a].id);
+            break;
+        case HP_SCAN_OP_REGION:
+            for (i = 0; !((node->a >> i) & 1); i++)
+                ;
+            fprintf(fp, "region is %s", attrs[i]);
+            break;
+        case HP_SCAN_OP_OF:
+            fprintf(fp, "%u of ", node->a);
+            if (node->refs == (1u << rule->string_count) - 1) {
+                fprintf(fp, "them");
+                break;
+            }
+            fprintf(fp, "(");
+            for (first = true, i = 0; i < rule->string_count; i++) {
+                if ((node->refs >> i) & 1) {
+                    fprintf(fp, "%s$%s", first ? "" : ", ",
+                            rule->strings[i].id);
+                    first = false;
+                }
+            }
+            fprintf(fp, ")");
+            break;
+        case HP_SCAN_OP_AND:
+        case HP_SCAN_OP_OR:
+            fprintf(fp, "(");
+            hp_rules_test_cond_write(fp, rule, node->a);
+            fprintf(fp, (node->op == HP_SCAN_OP_AND) ? " and " : " or ");
+            hp_rules_test_cond_write(fp, rule, node->b);
+            fprintf(fp, ")");
+            break;
+        default:
+            fprintf(fp, "not ");
+            hp_rules_test_cond_write(fp, rule, node->a);
+            break;
+    }
+
+    return;
+}
+
+/* Make up the round's rules, and write them out as a signature file. */
+static hp_status_t hp_rules_test_write(hp_rules_test_t *test)
+{
+    hp_rules_test_rule_t *rule;
+    hp_rules_test_string_t *string;
+    FILE *fp;
+    uint32_t r, s, i;
+
+    if ((fp = fopen(test->path, "w")) == NULL)
+        hp_rules_test_fail(test, "can't write \"%s\"", test->path);
+
+    test->rule_count = 1 + hp_rules_test_rand(test) % HP_RULES_TEST_RULES_MAX;
+    for (r = 0; r < test->rule_count; r++) {
+        rule = &test->rules[r];
+        rule->string_count = 1 + hp_rules_test_rand(test) %
+            HP_RULES_TEST_STRINGS_MAX;
+        for (s = 0; s < rule->string_count; s++)
+            hp_rules_test_string(test, &rule->strings[s], s);
+        rule->node_count = 0;
+        rule->root = hp_rules_test_cond(test, rule,
+                                        hp_rules_test_rand(test) % 4);
+
+        fprintf(fp, "rule r%u {\n    strings:\n", r);
+        for (s = 0; s < rule->string_count; s++) {
+            string = &rule->strings[s];
+            fprintf(fp, "        $%s = ", string->id);
+            switch (string->kind) {
+                case HP_RULES_TEST_TEXT:
+                    fprintf(fp, "\"");
+                    for (i = 0; i < string->len; i++)
+                        fprintf(fp, "\\x%02x", string->pat[i]);
+                    fprintf(fp, "\"");
+                    break;
+                case HP_RULES_TEST_HEX:
+                    fprintf(fp, "{");
+                    for (i = 0; i < string->len; i++) {
+                        if (string->mask[i] == 0x00)
+                            fprintf(fp, " ??");
+                        else if (string->mask[i] == 0xf0)
+                            fprintf(fp, " %x?", string->pat[i] >> 4);
+                        else if (string->mask[i] == 0x0f)
+                            fprintf(fp, " ?%x", string->pat[i] & 0xf);
+                        else
+                            fprintf(fp, " %02x", string->pat[i]);
+                    }
+                    fprintf(fp, " }");
+                    break;
+                default:
+                    fprintf(fp, "/");
+                    hp_rules_test_re_write(fp, string, string->re_count - 1);
+                    fprintf(fp, "/");
+                    break;
+            }
+            fprintf(fp, "\n");
+        }
+        fprintf(fp, "    condition:\n        ");
+        hp_rules_test_cond_write(fp, rule, rule->root);
+        fprintf(fp, "\n}\n");
+    }
+
+    if (fclose(fp) != 0)
+        hp_rules_test_fail(test, "can't write \"%s\"", test->path);
+
+    return HP_STATUS_OK;
+}
+
+/*
+ * Regions.
+ */
+
+/* Fill the region with random bytes and plant some of the strings. */
+static void hp_rules_test_fill(hp_rules_test_t *test)
+{
+    const hp_rules_test_string_t *string;
+    const hp_rules_test_rule_t *rule;
+    uint8_t buf[HP_RULES_TEST_LONG_MAX];
+    uint32_t plants;
+    uint32_t len;
+    uint32_t at;
+    uint32_t i;
+
+    test->data_len = hp_rules_test_rand(test) % (HP_RULES_TEST_REGION_MAX + 1);
+    if (hp_rules_test_rand(test) % 4 == 0)
+        test->data_len %= 64;
+    for (i = 0; i < test->data_len; i++)
+        test->data[i] = hp_rules_test_byte(test);
+
+    plants = hp_rules_test_rand(test) % (HP_RULES_TEST_PLANTS_MAX + 1);
+    while (plants-- > 0) {
+        rule = &test->rules[hp_rules_test_rand(test) % test->rule_count];
+        string = &rule->strings[hp_rules_test_rand(test) %
+                                rule->string_count];
+        if (string->kind == HP_RULES_TEST_REGEX) {
+            len = 0;
+            if (!hp_rules_test_re_sample(test, string, string->re_count - 1,
+                                         buf, &len, HP_SCAN_RULES_SPAN_MAX))
+            {
+                continue;
+            }
+        } else {
+            len = string->len;
+            for (i = 0; i < len; i++) {
+                buf[i] = (uint8_t)((string->pat[i] & string->mask[i]) |
+                                   (hp_rules_test_rand(test) &
+                                    ~string->mask[i]));
+            }
+        }
+        if (len > test->data_len)
+            continue;
+        at = hp_rules_test_rand(test) % (test->data_len - len + 1);
+        memcpy(test->data + at, buf, len);
+    }
+
+    return;
+}
+
+/* Split the region into the runs it will be fed as, with holes between
+ * them. */
+static void hp_rules_test_split(hp_rules_test_t *test)
+{
+    hp_rules_test_segment_t *segment;
+    uint32_t pos;
+    uint32_t len;
+
+    test->segment_count = 0;
+    for (pos = 0; pos < test->data_len;
+         pos += len + 1 + hp_rules_test_rand(test) % 64)
+    {
+        len = test->data_len - pos;
+        if (hp_rules_test_rand(test) % 3 == 0)
+            len = 1 + hp_rules_test_rand(test) % len;
+        segment = &test->segments[test->segment_count++];
+        segment->start = pos;
+        segment->end = pos + len;
+    }
+
+    return;
+}
+
+/* Find where each string matches by trying it at every offset of every
+ * run. */
+static void hp_rules_test_reference(hp_rules_test_t *test)
+{
+    const hp_rules_test_segment_t *segment;
+    hp_rules_test_string_t *string;
+    uint32_t r, s, g;
+    uint32_t at, i;
+    bool match;
+
+    for (r = 0; r < test->rule_count; r++) {
+        for (s = 0; s < test->rules[r].string_count; s++) {
+            string = &test->rules[r].strings[s];
+            string->matched = false;
+            memset(string->starts, 0, test->data_len);
+            for (g = 0; g < test->segment_count; g++) {
+                segment = &test->segments[g];
+                for (at = segment->start; at < segment->end; at++) {
+                    if (string->kind == HP_RULES_TEST_REGEX) {
+                        match = hp_rules_test_re_match(string,
+                                                       test->data + at,
+                                                       segment->end - at);
+                    } else {
+                        if (at + string->len > segment->end)
+                            break;
+                        for (i = 0; i < string->len; i++) {
+                            if ((test->data[at + i] ^ string->pat[i]) &
+                                string->mask[i])
+                            {
+                                break;
+                            }
+                        }
+                        match = (i == string->len);
+                    }
+                    if (match) {
+                        string->starts[at] = 1;
+                        string->matched = true;
+                    }
+                }
+            }
+        }
+    }
+
+    return;
+}
+
+static bool hp_rules_test_eval(const hp_rules_test_t *test,
+                               const hp_rules_test_rule_t *rule, uint32_t n)
+{
+    const hp_rules_test_node_t *node = &rule->nodes[n];
+    uint32_t count;
+    uint32_t i;
+
+    switch (node->op) {
+        case HP_SCAN_OP_STRING:
+            return rule->strings[node->a].matched;
+        case HP_SCAN_OP_REGION:
+            return (test->region & node->a) == node->a;
+        case HP_SCAN_OP_OF:
+            for (count = 0, i = 0; i < rule->string_count; i++) {
+                if ((node->refs >> i) & 1)
+                    count += rule->strings[i].matched;
+            }
+            return count >= node->a;
+        case HP_SCAN_OP_AND:
+            return (hp_rules_test_eval(test, rule, node->a) &&
+                    hp_rules_test_eval(test, rule, node->b));
+        case HP_SCAN_OP_OR:
+            return (hp_rules_test_eval(test, rule, node->a) ||
+                    hp_rules_test_eval(test, rule, node->b));
+        default:
+            return !hp_rules_test_eval(test, rule, node->a);
+    }
+}
+
+static void hp_rules_test_matched(uint32_t rule_id, uint64_t offset,
+                                  void *test_)
+{
+    hp_rules_test_t *test = (hp_rules_test_t *)test_;
+    hp_rules_test_rule_t *rule;
+
+    if (rule_id >= test->rule_count || test->rules[rule_id].reported) {
+        test->failed = true;
+        return;
+    }
+    rule = &test->rules[rule_id];
+    rule->reported = true;
+    rule->offset = offset;
+
+    return;
+}
+
+/* Feed a region in its runs, and compare what the scan reports with the
+ * reference. */
+static hp_status_t hp_rules_test_region(hp_rules_test_t *test,
+                                        hp_scan_rules_ctx_t *ctx)
+{
+    const hp_rules_test_segment_t *segment;
+    hp_rules_test_rule_t *rule;
+    uint8_t *chunk;
+    uint32_t pos;
+    uint32_t len;
+    uint32_t count;
+    uint32_t expected;
+    uint32_t r, s, g;
+    bool starts;
+
+    test->region = hp_rules_test_rand(test) & 0x3f;
+    hp_rules_test_fill(test);
+    hp_rules_test_split(test);
+    hp_rules_test_reference(test);
+
+    hp_scan_rules_ctx_begin(ctx, test->region);
+    for (g = 0; g < test->segment_count; g++) {
+        segment = &test->segments[g];
+        for (pos = segment->start; pos < segment->end; pos += len) {
+            len = segment->end - pos;
+            switch (hp_rules_test_rand(test) % 4) {
+                case 0:
+                    len = 1 + hp_rules_test_rand(test) % ((len < 8) ? len : 8);
+                    break;
+                case 1:
+                case 2:
+                    len = 1 + hp_rules_test_rand(test) %
+                        ((len < 300) ? len : 300);
+                    break;
+                default:
+                    break;
+            }
+            if ((chunk = (uint8_t *)malloc(len)) == NULL)
+                hp_rules_test_fail(test, "malloc() failure");
+            memcpy(chunk, test->data + pos, len);
+            hp_scan_rules_ctx_feed(ctx, pos, chunk, len);
+            free(chunk);
+        }
+        if (hp_scan_rules_ctx_decided(ctx) && hp_rules_test_rand(test) % 2) {
+            test->early_stops++;
+            break;
+        }
+    }
+
+    for (r = 0; r < test->rule_count; r++)
+        test->rules[r].reported = false;
+    test->failed = false;
+    count = hp_scan_rules_ctx_end(ctx, hp_rules_test_matched, test);
+    if (test->failed)
+        hp_rules_test_fail(test, "a rule was reported twice");
+
+    expected = 0;
+    for (r = 0; r < test->rule_count; r++) {
+        rule = &test->rules[r];
+        if (hp_rules_test_eval(test, rule, rule->root) != rule->reported) {
+            hp_rules_test_fail(test, "rule r%u %s, region %#x, %u bytes in "
+                               "%u runs - see \"%s\"", r,
+                               rule->reported ? "matched" : "didn't match",
+                               test->region, test->data_len,
+                               test->segment_count, test->path);
+        }
+        if (!rule->reported)
+            continue;
+        expected++;
+
+        /* Where one of its strings matched, if one did */
+        starts = false;
+        for (s = 0; s < rule->string_count; s++) {
+            starts |= (rule->offset < test->data_len &&
+                       rule->strings[s].starts[rule->offset]);
+        }
+        if (!starts && rule->offset != 0) {
+            hp_rules_test_fail(test, "rule r%u reported at %" PRIu64 ", "
+                               "where none of its strings match", r,
+                               rule->offset);
+        }
+        test->rule_matches++;
+    }
+    if (count != expected)
+        hp_rules_test_fail(test, "%u rules counted, %u reported", count,
+                           expected);
+
+    test->regions++;
+
+    return HP_STATUS_OK;
+}
+
+static hp_status_t hp_rules_test_round(hp_rules_test_t *test)
+{
+    hp_signature_set_t set;
+    hp_scan_rules_ctx_t ctx;
+    bool ctx_on = false;
+    uint32_t i;
+    hp_status_t status;
+
+    memset(&set, 0, sizeof(set));
+
+    if (hp_rules_test_write(test) != HP_STATUS_OK) {
+        status = HP_STATUS_ERROR;
+        goto return_status;
+    }
+    if (hp_signatures_load(&set, test->path) != HP_STATUS_OK) {
+        printf("scan-rules-test: can't load \"%s\"\n", test->path);
+        status = HP_STATUS_ERROR;
+        goto return_status;
+    }
+    if (hp_scan_rules_ctx_init(&ctx, set.rules) != HP_STATUS_OK) {
+        status = HP_STATUS_ERROR;
+        goto return_status;
+    }
+    ctx_on = true;
+
+    for (i = 0; i < HP_RULES_TEST_REGIONS; i++) {
+        if (hp_rules_test_region(test, &ctx) != HP_STATUS_OK) {
+            status = HP_STATUS_ERROR;
+            goto return_status;
+        }
+    }
+
+    status = HP_STATUS_OK;
+ return_status:
+    if (ctx_on) {
+        if (ctx.dfa != NULL)
+            test->dfa_flushes += hp_scan_dfa_flush_count(ctx.dfa);
+        hp_scan_rules_ctx_deinit(&ctx);
+    }
+    hp_signatures_deinit(&set);
+    return status;
+}
+
+int main(int argc, char *argv[])
+{
+    static char path[4096];
+    static hp_rules_test_t test;
+    uint64_t seed;
+    uint64_t rounds;
+    uint64_t i;
+
+    seed = (argc > 1) ? strtoull(argv[1], NULL, 0) : 1;
+    rounds = (argc > 2) ? strtoull(argv[2], NULL, 0) :
+        HP_RULES_TEST_ROUNDS_DEFAULT;
+
+    /* The rules are written out next to the test, and left there on a
+     * failure to be looked at */
+    snprintf(path, sizeof(path), "%s.sig", argv[0]);
+    test.path = path;
+    test.rng = seed | 1;
+
+    hp_log_init(HP_LOG_LEVEL_ERROR, NULL);
+
+    for (i = 0; i < rounds; i++) {
+        if (hp_rules_test_round(&test) != HP_STATUS_OK) {
+            printf("scan-rules-test: FAILED in round %" PRIu64 " with seed "
+                   "%" PRIu64 ".\n", i, seed);
+            return EXIT_FAILURE;
+        }
+    }
+    /* Without flushes the cache was too big to test rebuilding it */
+    if (test.dfa_flushes == 0) {
+        printf("scan-rules-test: the DFA cache was never flushed.\n");
+        return EXIT_FAILURE;
+    }
+
+    printf("scan-rules-test: %" PRIu64 " regions, %" PRIu64 " rule "
+           "matches, %" PRIu64 " stopped early, %" PRIu64 " DFA flushes, "
+           "with seed %" PRIu64 " passed.\n", test.regions,
+           test.rule_matches, test.early_stops, test.dfa_flushes, seed);
+    remove(path);
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,407 @@
+/**
+ * Copyright(C) 2018, Juniper Networks, Inc.
+ * All rights reserved
+ *
+ * This SOFTWARE is licensed under the license provided in the LICENSE.txt
+ * file.  By downloading, installing, copying, or otherwise using the
+ * SOFTWARE, you agree to be bound by the terms of that license.  This
+ * SOFTWARE is not an official Juniper product.
+ *
+ * Third-Party Code: This SOFTWARE may depend on other components under
+ * separate copyright notice and license terms.  Your use of the source
+ * code for those components is subject to the term and conditions of
+ * the respective license as noted in the Third-Party source code.
+ */
+
+/**
+ * @author Anoop Saldanha
+ */
+
+/* Conformance test of the built in signatures.  Every sample of the
+ * corpus is scanned with the rules and tables sigc generated from
+ * signatures.txt, and with signatures.txt loaded at runtime, whole and
+ * in small chunks.  The two have to report the same matches, at the same
+ * offsets, and the rules the corpus lists.  See signatures-corpus.txt
+ * for its format.
+ *
+ * signatures-test.exe [<signatures.txt> [<corpus>]] */
+
+#include "honeyprocs-common.h"
+#include "scan-rules.h"
+#include "signatures.h"
+#include "status.h"
+#include "util-log.h"
+
+#define HP_SIGNATURES_TEST_LINE_MAX    4096
+#define HP_SIGNATURES_TEST_MATCHES_MAX 64
+
+typedef struct hp_signatures_test_match_t {
+    uint32_t rule;
+    uint64_t offset;
+} hp_signatures_test_match_t;
+
+typedef struct hp_signatures_test_result_t {
+    hp_signatures_test_match_t matches[HP_SIGNATURES_TEST_MATCHES_MAX];
+    uint32_t count;
+} hp_signatures_test_result_t;
+
+typedef struct hp_signatures_test_t {
+    const char *corpus;
+    uint32_t line_no;
+    hp_signature_set_t builtin;
+    hp_signature_set_t loaded;
+    /* The sample being checked */
+    uint32_t region;
+    char *expected;
+    uint8_t data[HP_SIGNATURES_TEST_LINE_MAX];
+    uint32_t data_len;
+    uint32_t samples;
+} hp_signatures_test_t;
+
+#define hp_signatures_test_fail(test, ...)                              \
+    do {                                                                \
+        printf("signatures-test: %s:%u: ", (test)->corpus,              \
+               (test)->line_no);                                        \
+        printf(__VA_ARGS__);                                            \
+        printf("\n");                                                   \
+        return HP_STATUS_ERROR;                                         \
+    } while (0)
+
+static int hp_signatures_test_hex_digit(char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+
+    return -1;
+}
+
+/* Parse region attributes joined with '+', up to the next space. */
+static hp_status_t hp_signatures_test_region(hp_signatures_test_t *test,
+                                             char **p_)
+{
+    static const struct {
+        const char *name;
+        uint32_t attr;
+    } attrs[] = {
+        { "PRIVATE", HP_SCAN_REGION_PRIVATE },
+        { "MAPPED", HP_SCAN_REGION_MAPPED },
+        { "IMAGE", HP_SCAN_REGION_IMAGE },
+        { "READ", HP_SCAN_REGION_READ },
+        { "WRITE", HP_SCAN_REGION_WRITE },
+        { "EXECUTE", HP_SCAN_REGION_EXECUTE },
+    };
+    char *p = *p_;
+    size_t len;
+    uint32_t i;
+
+    test->region = 0;
+    do {
+        len = strcspn(p, "+ ");
+        for (i = 0; i < sizeof(attrs) / sizeof(attrs[0]); i++) {
+            if (strlen(attrs[i].name) == len &&
+                strncmp(attrs[i].name, p, len) == 0)
+            {
+                break;
+            }
+        }
+        if (i == sizeof(attrs) / sizeof(attrs[0]))
+            hp_signatures_test_fail(test, "unknown region attribute");
+        test->region |= attrs[i].attr;
+        p += len;
+    } while (*p++ == '+');
+
+    *p_ = p;
+
+    return HP_STATUS_OK;
+}
+
+/* Parse the quoted bytes of a sample. */
+static hp_status_t hp_signatures_test_data(hp_signatures_test_t *test,
+                                           char *p)
+{
+    int hi, lo;
+
+    if (*p++ != '"')
+        hp_signatures_test_fail(test, "expected a quoted sample");
+
+    test->data_len = 0;
+    for (; *p != '"'; test->data_len++) {
+        if (*p == '\0' || *p == '\n')
+            hp_signatures_test_fail(test, "unterminated sample");
+        if (*p != '\\') {
+            test->data[test->data_len] = (uint8_t)*p++;
+            continue;
+        }
+        p++;
+        switch (*p) {
+            case '\\':
+            case '"':
+                test->data[test->data_len] = (uint8_t)*p++;
+                break;
+            case 'n':
+                test->data[test->data_len] = '\n';
+                p++;
+                break;
+            case 'r':
+                test->data[test->data_len] = '\r';
+                p++;
+                break;
+            case 't':
+                test->data[test->data_len] = '\t';
+                p++;
+                break;
+            case 'x':
+                if ((hi = hp_signatures_test_hex_digit(p[1])) < 0 ||
+                    (lo = hp_signatures_test_hex_digit(p[2])) < 0)
+                {
+                    hp_signatures_test_fail(test, "bad \\x escape");
+                }
+                test->data[test->data_len] = (uint8_t)((hi << 4) | lo);
+                p += 3;
+                break;
+            default:
+                hp_signatures_test_fail(test, "bad escape");
+        }
+    }
+
+    return HP_STATUS_OK;
+}
+
+static void hp_signatures_test_matched(uint32_t rule_id, uint64_t offset,
+                                       void *result_)
+{
+    hp_signatures_test_result_t *result =
+        (hp_signatures_test_result_t *)result_;
+
+    if (result->count < HP_SIGNATURES_TEST_MATCHES_MAX) {
+        result->matches[result->count].rule = rule_id;
+        result->matches[result->count].offset = offset;
+    }
+    result->count++;
+
+    return;
+}
+
+/* Scan the sample with a set, chunk bytes at a time. */
+static hp_status_t hp_signatures_test_scan(hp_signatures_test_t *test,
+                                           const hp_signature_set_t *set,
+                                           uint32_t chunk,
+                                           hp_signatures_test_result_t *result)
+{
+    hp_scan_rules_ctx_t ctx;
+    uint32_t pos;
+    uint32_t len;
+
+    if (hp_scan_rules_ctx_init(&ctx, set->rules) != HP_STATUS_OK)
+        hp_signatures_test_fail(test, "can't init a rule scan");
+
+    memset(result, 0, sizeof(*result));
+    hp_scan_rules_ctx_begin(&ctx, test->region);
+    for (pos = 0; pos < test->data_len; pos += len) {
+        len = test->data_len - pos;
+        if (len > chunk)
+            len = chunk;
+        hp_scan_rules_ctx_feed(&ctx, pos, test->data + pos, len);
+    }
+    hp_scan_rules_ctx_end(&ctx, hp_signatures_test_matched, result);
+    hp_scan_rules_ctx_deinit(&ctx);
+
+    if (result->count > HP_SIGNATURES_TEST_MATCHES_MAX)
+        hp_signatures_test_fail(test, "too many matches");
+
+    return HP_STATUS_OK;
+}
+
+/* Whether the corpus lists a rule for the sample */
+static bool hp_signatures_test_expects(const hp_signatures_test_t *test,
+                                       const char *name)
+{
+    const char *p = test->expected;
+    size_t len;
+
+    for (; *p != '\0'; p += len + (p[len] == ',')) {
+        len = strcspn(p, ",");
+        if (strlen(name) == len && strncmp(name, p, len) == 0)
+            return true;
+    }
+
+    return false;
+}
+
+static hp_status_t hp_signatures_test_sample(hp_signatures_test_t *test)
+{
+    static const uint32_t chunks[] = { UINT32_MAX, 1, 7 };
+    const hp_scan_rules_t *rules = test->builtin.rules;
+    hp_signatures_test_result_t builtin;
+    hp_signatures_test_result_t loaded;
+    const char *name;
+    uint32_t expected_count;
+    uint32_t listed;
+    uint32_t i, j;
+
+    /* Every rule the corpus lists has to be one of signatures.txt's */
+    if (strcmp(test->expected, "-") == 0)
+        test->expected[0] = '\0';
+    listed = (test->expected[0] != '\0');
+    for (i = 0; test->expected[i] != '\0'; i++)
+        listed += (test->expected[i] == ',');
+    expected_count = 0;
+    for (i = 0; i < rules->rule_count; i++)
+        expected_count += hp_signatures_test_expects(test,
+                                                     rules->rules[i].name);
+    if (expected_count != listed)
+        hp_signatures_test_fail(test, "lists a rule signatures.txt hasn't");
+
+    for (i = 0; i < sizeof(chunks) / sizeof(chunks[0]); i++) {
+        if (hp_signatures_test_scan(test, &test->builtin, chunks[i],
+                                    &builtin) != HP_STATUS_OK ||
+            hp_signatures_test_scan(test, &test->loaded, chunks[i],
+                                    &loaded) != HP_STATUS_OK)
+        {
+            return HP_STATUS_ERROR;
+        }
+
+        if (builtin.count != loaded.count) {
+            hp_signatures_test_fail(test, "%u matches built in, %u loaded",
+                                    builtin.count, loaded.count);
+        }
+        for (j = 0; j < builtin.count; j++) {
+            if (builtin.matches[j].rule != loaded.matches[j].rule ||
+                builtin.matches[j].offset != loaded.matches[j].offset)
+            {
+                hp_signatures_test_fail(test, "built in matched %s at %"
+                                        PRIu64 ", loaded %s at %" PRIu64,
+                                        rules->rules[builtin.matches[j].
+                                                     rule].name,
+                                        builtin.matches[j].offset,
+                                        rules->rules[loaded.matches[j].
+                                                     rule].name,
+                                        loaded.matches[j].offset);
+            }
+        }
+
+        if (builtin.count != expected_count) {
+            hp_signatures_test_fail(test, "%u rules matched, %u listed",
+                                    builtin.count, expected_count);
+        }
+        for (j = 0; j < builtin.count; j++) {
+            name = rules->rules[builtin.matches[j].rule].name;
+            if (!hp_signatures_test_expects(test, name))
+                hp_signatures_test_fail(test, "%s matched", name);
+        }
+    }
+    test->samples++;
+
+    return HP_STATUS_OK;
+}
+
+static hp_status_t hp_signatures_test_corpus(hp_signatures_test_t *test)
+{
+    char line[HP_SIGNATURES_TEST_LINE_MAX];
+    char *p;
+    FILE *fp;
+    hp_status_t status;
+
+    if ((fp = fopen(test->corpus, "r")) == NULL) {
+        printf("signatures-test: can't open \"%s\".\n", test->corpus);
+        status = HP_STATUS_ERROR;
+        goto return_status;
+    }
+
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        test->line_no++;
+        p = line + strspn(line, " \t");
+        if (*p == '#' || *p == '\n' || *p == '\r' || *p == '\0')
+            continue;
+
+        if (hp_signatures_test_region(test, &p) != HP_STATUS_OK) {
+            status = HP_STATUS_ERROR;
+            goto return_status;
+        }
+        test->expected = p;
+        p += strcspn(p, " ");
+        if (*p != ' ') {
+            printf("signatures-test: %s:%u: expected the sample's rules\n",
+                   test->corpus, test->line_no);
+            status = HP_STATUS_ERROR;
+            goto return_status;
+        }
+        *p++ = '\0';
+        if (hp_signatures_test_data(test, p) != HP_STATUS_OK ||
+            hp_signatures_test_sample(test) != HP_STATUS_OK)
+        {
+            status = HP_STATUS_ERROR;
+            goto return_status;
+        }
+    }
+
+    status = HP_STATUS_OK;
+ return_status:
+    if (fp != NULL)
+        fclose(fp);
+    return status;
+}
+
+/* The two sets have to hold the same rules, in the same order. */
+static hp_status_t hp_signatures_test_rules(hp_signatures_test_t *test)
+{
+    const hp_scan_rules_t *builtin = test->builtin.rules;
+    const hp_scan_rules_t *loaded = test->loaded.rules;
+    uint32_t i;
+
+    if (builtin->rule_count != loaded->rule_count ||
+        builtin->string_count != loaded->string_count)
+    {
+        hp_signatures_test_fail(test, "%u rules with %u strings built in, "
+                                "%u with %u loaded", builtin->rule_count,
+                                builtin->string_count, loaded->rule_count,
+                                loaded->string_count);
+    }
+    for (i = 0; i < builtin->rule_count; i++) {
+        if (strcmp(builtin->rules[i].name, loaded->rules[i].name) != 0) {
+            hp_signatures_test_fail(test, "rule %u is %s built in, %s "
+                                    "loaded", i, builtin->rules[i].name,
+                                    loaded->rules[i].name);
+        }
+    }
+
+    return HP_STATUS_OK;
+}
+
+int main(int argc, char *argv[])
+{
+    static hp_signatures_test_t test;
+    const char *path;
+    int ret = EXIT_FAILURE;
+
+    path = (argc > 1) ? argv[1] : "signatures.txt";
+    test.corpus = (argc > 2) ? argv[2] : "tests/signatures-corpus.txt";
+
+    hp_log_init(HP_LOG_LEVEL_ERROR, NULL);
+
+    hp_signatures_builtin(&test.builtin);
+    if (hp_signatures_load(&test.loaded, path) != HP_STATUS_OK) {
+        printf("signatures-test: can't load \"%s\".\n", path);
+        goto return_status;
+    }
+
+    if (hp_signatures_test_rules(&test) != HP_STATUS_OK ||
+        hp_signatures_test_corpus(&test) != HP_STATUS_OK)
+    {
+        printf("signatures-test: FAILED.\n");
+        goto return_status;
+    }
+
+    printf("signatures-test: %u samples of \"%s\" passed.\n", test.samples,
+           test.corpus);
+    ret = EXIT_SUCCESS;
+
+ return_status:
+    hp_signatures_deinit(&test.loaded);
+    hp_signatures_deinit(&test.builtin);
+    return ret;
+}
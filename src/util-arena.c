@@ -0,0 +1,118 @@
+/**
+ * Copyright(C) 2018, Juniper Networks, Inc.
+ * All rights reserved
+ *
+ * This SOFTWARE is licensed under the license provided in the LICENSE.txt
+ * file.  By downloading, installing, copying, or otherwise using the
+ * SOFTWARE, you agree to be bound by the terms of that license.  This
+ * SOFTWARE is not an official Juniper product.
+ *
+ * Third-Party Code: This SOFTWARE may depend on other components under
+ * separate copyright notice and license terms.  Your use of the source
+ * code for those components is subject to the term and conditions of
+ * the respective license as noted in the Third-Party source code.
+ */
+
+/**
+ * @author Anoop Saldanha
+ */
+
+#include "honeyprocs-common.h"
+#include "util-arena.h"
+#include "util-log.h"
+#include "align.h"
+#include "status.h"
+
+typedef struct hp_arena_slab_t {
+    struct hp_arena_slab_t *next;
+    /* Keeps the objects following the header 8 byte aligned */
+    uint64_t objs[];
+} hp_arena_slab_t;
+
+void hp_arena_init(hp_arena_t *arena, size_t obj_size,
+                   uint32_t objs_per_slab)
+{
+    BUG_ON(objs_per_slab == 0);
+
+    memset(arena, 0, sizeof(*arena));
+    /* Free objects hold the freelist link. */
+    if (obj_size < sizeof(void *))
+        obj_size = sizeof(void *);
+    ALIGN_UP(obj_size, 8);
+    arena->obj_size = obj_size;
+    arena->objs_per_slab = objs_per_slab;
+
+    return;
+}
+
+void hp_arena_deinit(hp_arena_t *arena)
+{
+    hp_arena_slab_t *slab;
+
+    while ((slab = arena->slab_head) != NULL) {
+        arena->slab_head = slab->next;
+        free(slab);
+    }
+    arena->slab_cur = NULL;
+    arena->slab_used = 0;
+    arena->free_list = NULL;
+
+    return;
+}
+
+void *hp_arena_alloc(hp_arena_t *arena)
+{
+    hp_arena_slab_t *slab;
+    void *obj;
+
+    if ((obj = arena->free_list) != NULL) {
+        arena->free_list = *(void **)obj;
+        goto return_status;
+    }
+
+    slab = arena->slab_cur;
+    if (slab == NULL || arena->slab_used == arena->objs_per_slab) {
+        if (slab != NULL && slab->next != NULL) {
+            /* A slab kept across a reset */
+            slab = slab->next;
+        } else {
+            slab = (hp_arena_slab_t *)malloc(sizeof(*slab) +
+                                             (arena->obj_size *
+                                              arena->objs_per_slab));
+            if (slab == NULL) {
+                hp_log_error("malloc() failure.");
+                goto return_status;
+            }
+            slab->next = NULL;
+            if (arena->slab_cur == NULL)
+                arena->slab_head = slab;
+            else
+                arena->slab_cur->next = slab;
+        }
+        arena->slab_cur = slab;
+        arena->slab_used = 0;
+    }
+
+    obj = (uint8_t *)slab->objs + (arena->obj_size * arena->slab_used);
+    arena->slab_used++;
+
+ return_status:
+    return obj;
+}
+
+void hp_arena_free(hp_arena_t *arena, void *obj)
+{
+    *(void **)obj = arena->free_list;
+    arena->free_list = obj;
+
+    return;
+}
+
+void hp_arena_reset(hp_arena_t *arena)
+{
+    arena->slab_cur = arena->slab_head;
+    arena->slab_used = 0;
+    arena->free_list = NULL;
+
+    return;
+}
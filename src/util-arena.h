@@ -0,0 +1,58 @@
+/**
+ * Copyright(C) 2018, Juniper Networks, Inc.
+ * All rights reserved
+ *
+ * This SOFTWARE is licensed under the license provided in the LICENSE.txt
+ * file.  By downloading, installing, copying, or otherwise using the
+ * SOFTWARE, you agree to be bound by the terms of that license.  This
+ * SOFTWARE is not an official Juniper product.
+ *
+ * Third-Party Code: This SOFTWARE may depend on other components under
+ * separate copyright notice and license terms.  Your use of the source
+ * code for those components is subject to the term and conditions of
+ * the respective license as noted in the Third-Party source code.
+ */
+
+/**
+ * @author Anoop Saldanha
+ */
+
+/* Fixed size object allocator.  Objects are carved out of large slabs and
+ * freed objects are kept on a freelist for reuse.  Resetting hands every
+ * object back at once while keeping the slabs, so a structure that is
+ * torn down and rebuilt repeatedly stops hitting malloc() once it has
+ * reached its peak size. */
+
+#ifndef __UTIL_ARENA__H__
+#define __UTIL_ARENA__H__
+
+#include "honeyprocs-common.h"
+#include "status.h"
+
+typedef struct hp_arena_slab_t hp_arena_slab_t;
+
+typedef struct hp_arena_t {
+    size_t obj_size;
+    uint32_t objs_per_slab;
+    hp_arena_slab_t *slab_head;
+    /* The slab objects are currently carved from, and how many of its
+     * objects have been handed out.  Slabs past it are free. */
+    hp_arena_slab_t *slab_cur;
+    uint32_t slab_used;
+    /* Objects freed since the last reset */
+    void *free_list;
+} hp_arena_t;
+
+void hp_arena_init(hp_arena_t *arena, size_t obj_size,
+                   uint32_t objs_per_slab);
+/* Release the slabs.  Every object handed out is invalid after this. */
+void hp_arena_deinit(hp_arena_t *arena);
+
+/* Returns uninitialised memory, or NULL on failure. */
+void *hp_arena_alloc(hp_arena_t *arena);
+void hp_arena_free(hp_arena_t *arena, void *obj);
+
+/* Free every object at once.  The slabs are kept for reuse. */
+void hp_arena_reset(hp_arena_t *arena);
+
+#endif /* __UTIL_ARENA__H__ */
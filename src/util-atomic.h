@@ -0,0 +1,117 @@
+/**
+ * Copyright(C) 2018, Juniper Networks, Inc.
+ * All rights reserved
+ *
+ * This SOFTWARE is licensed under the license provided in the LICENSE.txt
+ * file.  By downloading, installing, copying, or otherwise using the
+ * SOFTWARE, you agree to be bound by the terms of that license.  This
+ * SOFTWARE is not an official Juniper product.
+ *
+ * Third-Party Code: This SOFTWARE may depend on other components under
+ * separate copyright notice and license terms.  Your use of the source
+ * code for those components is subject to the term and conditions of
+ * the respective license as noted in the Third-Party source code.
+ */
+
+/**
+ * @author Anoop Saldanha
+ */
+
+/* Atomic operations on 64 bit counters, and loads and stores of 32 bit
+ * words, over the Interlocked functions on
+ * Windows and the GCC builtins elsewhere.  Loads acquire, stores release
+ * and read-modify-writes are full barriers, which is all the lock-free
+ * code here needs.  hp_atomic_add() returns the new value, and
+ * hp_atomic_cas() whether *p was old_v and so was set to new_v. */
+
+#ifndef __UTIL_ATOMIC__H__
+#define __UTIL_ATOMIC__H__
+
+#include "honeyprocs-common.h"
+
+typedef volatile uint64_t hp_atomic64_t;
+typedef volatile uint32_t hp_atomic32_t;
+
+#ifdef WINDOWS
+
+static inline uint64_t hp_atomic_load(hp_atomic64_t *p)
+{
+    uint64_t v = *p;
+
+    _ReadWriteBarrier();
+
+    return v;
+}
+
+static inline void hp_atomic_store(hp_atomic64_t *p, uint64_t v)
+{
+    _ReadWriteBarrier();
+    *p = v;
+}
+
+static inline uint32_t hp_atomic_load32(hp_atomic32_t *p)
+{
+    uint32_t v = *p;
+
+    _ReadWriteBarrier();
+
+    return v;
+}
+
+static inline void hp_atomic_store32(hp_atomic32_t *p, uint32_t v)
+{
+    _ReadWriteBarrier();
+    *p = v;
+}
+
+static inline uint64_t hp_atomic_add(hp_atomic64_t *p, uint64_t v)
+{
+    return (uint64_t)InterlockedExchangeAdd64((volatile LONG64 *)p,
+                                              (LONG64)v) + v;
+}
+
+static inline bool hp_atomic_cas(hp_atomic64_t *p, uint64_t old_v,
+                                 uint64_t new_v)
+{
+    return (uint64_t)InterlockedCompareExchange64((volatile LONG64 *)p,
+                                                  (LONG64)new_v,
+                                                  (LONG64)old_v) == old_v;
+}
+
+#else /* !WINDOWS */
+
+static inline uint64_t hp_atomic_load(hp_atomic64_t *p)
+{
+    return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+
+static inline void hp_atomic_store(hp_atomic64_t *p, uint64_t v)
+{
+    __atomic_store_n(p, v, __ATOMIC_RELEASE);
+}
+
+static inline uint32_t hp_atomic_load32(hp_atomic32_t *p)
+{
+    return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+
+static inline void hp_atomic_store32(hp_atomic32_t *p, uint32_t v)
+{
+    __atomic_store_n(p, v, __ATOMIC_RELEASE);
+}
+
+static inline uint64_t hp_atomic_add(hp_atomic64_t *p, uint64_t v)
+{
+    return __atomic_add_fetch(p, v, __ATOMIC_SEQ_CST);
+}
+
+static inline bool hp_atomic_cas(hp_atomic64_t *p, uint64_t old_v,
+                                 uint64_t new_v)
+{
+    return __atomic_compare_exchange_n(p, &old_v, new_v, false,
+                                       __ATOMIC_SEQ_CST, __ATOMIC_RELAXED);
+}
+
+#endif /* WINDOWS */
+
+#endif /* __UTIL_ATOMIC__H__ */
@@ -0,0 +1,122 @@
+/**
+ * Copyright(C) 2018, Juniper Networks, Inc.
+ * All rights reserved
+ *
+ * This SOFTWARE is licensed under the license provided in the LICENSE.txt
+ * file.  By downloading, installing, copying, or otherwise using the
+ * SOFTWARE, you agree to be bound by the terms of that license.  This
+ * SOFTWARE is not an official Juniper product.
+ *
+ * Third-Party Code: This SOFTWARE may depend on other components under
+ * separate copyright notice and license terms.  Your use of the source
+ * code for those components is subject to the term and conditions of
+ * the respective license as noted in the Third-Party source code.
+ */
+
+/**
+ * @author Anoop Saldanha
+ */
+
+#include "honeyprocs-common.h"
+#include "status.h"
+#include "util-file-map.h"
+#include "util-log.h"
+
+#ifndef WINDOWS
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+void hp_file_map_init(hp_file_map_t *map)
+{
+    memset(map, 0, sizeof(*map));
+#ifdef WINDOWS
+    map->file = INVALID_HANDLE_VALUE;
+#else
+    map->fd = -1;
+#endif
+
+    return;
+}
+
+void hp_file_map_close(hp_file_map_t *map)
+{
+#ifdef WINDOWS
+    if (map->base != NULL)
+        UnmapViewOfFile(map->base);
+    if (map->mapping != NULL)
+        CloseHandle(map->mapping);
+    if (map->file != INVALID_HANDLE_VALUE)
+        CloseHandle(map->file);
+#else
+    if (map->base != NULL)
+        munmap((void *)map->base, map->size);
+    if (map->fd >= 0)
+        close(map->fd);
+#endif
+    hp_file_map_init(map);
+
+    return;
+}
+
+hp_status_t hp_file_map_open(hp_file_map_t *map, const char *path)
+{
+#ifdef WINDOWS
+    LARGE_INTEGER li;
+#else
+    struct stat st;
+    void *base;
+#endif
+    hp_status_t status;
+
+    hp_file_map_init(map);
+
+#ifdef WINDOWS
+    map->file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL,
+                            OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (map->file == INVALID_HANDLE_VALUE ||
+        !GetFileSizeEx(map->file, &li) || li.QuadPart <= 0)
+    {
+        hp_log_debug("Unable to open \"%s\".  Error Code(%u).",
+                     path, GetLastError());
+        status = HP_STATUS_ERROR;
+        goto return_status;
+    }
+    map->size = (uint64_t)li.QuadPart;
+    if ((map->mapping = CreateFileMappingA(map->file, NULL, PAGE_READONLY,
+                                           0, 0, NULL)) == NULL ||
+        (map->base = (const uint8_t *)MapViewOfFile(map->mapping,
+                                                    FILE_MAP_READ,
+                                                    0, 0, 0)) == NULL)
+    {
+        hp_log_error("Unable to map \"%s\".  Error Code(%u).",
+                     path, GetLastError());
+        status = HP_STATUS_ERROR;
+        goto return_status;
+    }
+#else
+    if ((map->fd = open(path, O_RDONLY)) < 0 ||
+        fstat(map->fd, &st) != 0 || st.st_size <= 0)
+    {
+        hp_log_debug("Unable to open \"%s\".  Error(%d).", path, errno);
+        status = HP_STATUS_ERROR;
+        goto return_status;
+    }
+    map->size = (uint64_t)st.st_size;
+    base = mmap(NULL, map->size, PROT_READ, MAP_SHARED, map->fd, 0);
+    if (base == MAP_FAILED) {
+        hp_log_error("Unable to map \"%s\".  Error(%d).", path, errno);
+        status = HP_STATUS_ERROR;
+        goto return_status;
+    }
+    map->base = (const uint8_t *)base;
+#endif
+
+    status = HP_STATUS_OK;
+ return_status:
+    if (status != HP_STATUS_OK)
+        hp_file_map_close(map);
+    return status;
+}
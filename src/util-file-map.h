@@ -0,0 +1,55 @@
+/**
+ * Copyright(C) 2018, Juniper Networks, Inc.
+ * All rights reserved
+ *
+ * This SOFTWARE is licensed under the license provided in the LICENSE.txt
+ * file.  By downloading, installing, copying, or otherwise using the
+ * SOFTWARE, you agree to be bound by the terms of that license.  This
+ * SOFTWARE is not an official Juniper product.
+ *
+ * Third-Party Code: This SOFTWARE may depend on other components under
+ * separate copyright notice and license terms.  Your use of the source
+ * code for those components is subject to the term and conditions of
+ * the respective license as noted in the Third-Party source code.
+ */
+
+/**
+ * @author Anoop Saldanha
+ */
+
+/* Read only mapping of a whole file.  Pages are shared with every other
+ * process mapping the same file, and come from the page cache as they are
+ * touched. */
+
+#ifndef __UTIL_FILE_MAP__H__
+#define __UTIL_FILE_MAP__H__
+
+#include "honeyprocs-common.h"
+#include "status.h"
+
+typedef struct hp_file_map_t {
+    const uint8_t *base;
+    uint64_t size;
+#ifdef WINDOWS
+    HANDLE file;
+    HANDLE mapping;
+#else
+    int fd;
+#endif
+} hp_file_map_t;
+
+/* Set up a map as closed, so hp_file_map_close() can be called on it. */
+void hp_file_map_init(hp_file_map_t *map);
+
+/**
+ * Map a file for reading.
+ *
+ * @retval HP_STATUS_OK On success.
+ * @retval HP_STATUS_ERROR If the file can't be opened or mapped, or is
+ *         empty.  The map is left closed.
+ */
+hp_status_t hp_file_map_open(hp_file_map_t *map, const char *path);
+/* Unmap a file mapped by hp_file_map_open().  base is invalid after this. */
+void hp_file_map_close(hp_file_map_t *map);
+
+#endif /* __UTIL_FILE_MAP__H__ */
@@ -0,0 +1,145 @@
+/**
+ * Copyright(C) 2018, Juniper Networks, Inc.
+ * All rights reserved
+ *
+ * This SOFTWARE is licensed under the license provided in the LICENSE.txt
+ * file.  By downloading, installing, copying, or otherwise using the
+ * SOFTWARE, you agree to be bound by the terms of that license.  This
+ * SOFTWARE is not an official Juniper product.
+ *
+ * Third-Party Code: This SOFTWARE may depend on other components under
+ * separate copyright notice and license terms.  Your use of the source
+ * code for those components is subject to the term and conditions of
+ * the respective license as noted in the Third-Party source code.
+ */
+
+/**
+ * @author Anoop Saldanha
+ */
+#include "honeyprocs-common.h"
+#include "util-hash.h"
+
+#define HP_HASH_PRIME32_1   0x9E3779B1U
+#define HP_HASH_PRIME64_1   0x9E3779B185EBCA87ULL
+#define HP_HASH_PRIME64_2   0xC2B2AE3D27D4EB4FULL
+#define HP_HASH_PRIME64_3   0x165667B19E3779F9ULL
+
+/* Each stripe feeds a 64 bit word to each lane */
+#define HP_HASH_LANES       8
+#define HP_HASH_STRIPE_LEN  (HP_HASH_LANES * 8)
+/* The lanes are scrambled once per block of stripes */
+#define HP_HASH_BLOCK_LEN   (16 * HP_HASH_STRIPE_LEN)
+
+/* Mixed into the lanes; any bytes without structure do. */
+static const uint64_t hp_hash_keys[HP_HASH_LANES] = {
+    0xbe4ba423396cfeb8ULL, 0x1cad21f72c81017cULL,
+    0xdb979083e96dd4deULL, 0x1f67b3b7a4a44072ULL,
+    0x78e5c0cc4ee679cbULL, 0x2172ffcc7dd05a82ULL,
+    0x8e2443f7744608b8ULL, 0x4c263a81e69035e0ULL,
+};
+
+static inline uint64_t hp_hash_read64(const uint8_t *p)
+{
+    uint64_t v;
+
+    memcpy(&v, p, sizeof(v));
+
+    return v;
+}
+
+/* The 128 bit product of a and b, folded to 64 bits */
+static inline uint64_t hp_hash_mul_fold64(uint64_t a, uint64_t b)
+{
+#ifdef __SIZEOF_INT128__
+    __uint128_t r = (__uint128_t)a * b;
+
+    return (uint64_t)r ^ (uint64_t)(r >> 64);
+#else
+    uint64_t lo_lo = (a & 0xFFFFFFFF) * (b & 0xFFFFFFFF);
+    uint64_t hi_lo = (a >> 32) * (b & 0xFFFFFFFF);
+    uint64_t lo_hi = (a & 0xFFFFFFFF) * (b >> 32);
+    uint64_t hi_hi = (a >> 32) * (b >> 32);
+    uint64_t cross = (lo_lo >> 32) + (hi_lo & 0xFFFFFFFF) + lo_hi;
+    uint64_t upper = (hi_lo >> 32) + (cross >> 32) + hi_hi;
+    uint64_t lower = (cross << 32) | (lo_lo & 0xFFFFFFFF);
+
+    return lower ^ upper;
+#endif
+}
+
+static inline uint64_t hp_hash_avalanche(uint64_t h)
+{
+    h ^= h >> 37;
+    h *= 0x165667919E3779F9ULL;
+    h ^= h >> 32;
+
+    return h;
+}
+
+static inline void hp_hash_stripe(uint64_t *acc, const uint8_t *p,
+                                  uint64_t seed)
+{
+    uint64_t data;
+    uint64_t key;
+    uint32_t i;
+
+    for (i = 0; i < HP_HASH_LANES; i++) {
+        data = hp_hash_read64(p + (i * 8));
+        key = data ^ (hp_hash_keys[i] + seed);
+        acc[i ^ 1] += data;
+        acc[i] += (key & 0xFFFFFFFF) * (key >> 32);
+    }
+
+    return;
+}
+
+static inline void hp_hash_scramble(uint64_t *acc)
+{
+    uint32_t i;
+
+    for (i = 0; i < HP_HASH_LANES; i++) {
+        acc[i] ^= acc[i] >> 47;
+        acc[i] ^= hp_hash_keys[HP_HASH_LANES - 1 - i];
+        acc[i] *= HP_HASH_PRIME32_1;
+    }
+
+    return;
+}
+
+uint64_t hp_hash64(const uint8_t *buf, size_t len, uint64_t seed)
+{
+    uint64_t acc[HP_HASH_LANES] = {
+        HP_HASH_PRIME32_1, HP_HASH_PRIME64_1,
+        HP_HASH_PRIME64_2, HP_HASH_PRIME64_3,
+        HP_HASH_PRIME64_1 ^ seed, HP_HASH_PRIME64_2 ^ seed,
+        HP_HASH_PRIME64_3 ^ seed, HP_HASH_PRIME32_1 ^ seed,
+    };
+    uint8_t tail[HP_HASH_STRIPE_LEN];
+    size_t pos;
+    uint64_t h;
+    uint32_t i;
+
+    for (pos = 0; pos + HP_HASH_STRIPE_LEN <= len;
+         pos += HP_HASH_STRIPE_LEN)
+    {
+        hp_hash_stripe(acc, buf + pos, seed);
+        if (((pos + HP_HASH_STRIPE_LEN) % HP_HASH_BLOCK_LEN) == 0)
+            hp_hash_scramble(acc);
+    }
+
+    /* A short last stripe is zero padded.  The length, mixed in below,
+     * tells it from a buffer that really ends in zeroes. */
+    if (pos < len) {
+        memset(tail, 0, sizeof(tail));
+        memcpy(tail, buf + pos, len - pos);
+        hp_hash_stripe(acc, tail, seed);
+    }
+
+    h = (uint64_t)len * HP_HASH_PRIME64_1;
+    for (i = 0; i < HP_HASH_LANES; i += 2) {
+        h += hp_hash_mul_fold64(acc[i] ^ hp_hash_keys[i],
+                                acc[i + 1] ^ hp_hash_keys[i + 1]);
+    }
+
+    return hp_hash_avalanche(h);
+}
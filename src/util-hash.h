@@ -0,0 +1,31 @@
+/**
+ * Copyright(C) 2018, Juniper Networks, Inc.
+ * All rights reserved
+ *
+ * This SOFTWARE is licensed under the license provided in the LICENSE.txt
+ * file.  By downloading, installing, copying, or otherwise using the
+ * SOFTWARE, you agree to be bound by the terms of that license.  This
+ * SOFTWARE is not an official Juniper product.
+ *
+ * Third-Party Code: This SOFTWARE may depend on other components under
+ * separate copyright notice and license terms.  Your use of the source
+ * code for those components is subject to the term and conditions of
+ * the respective license as noted in the Third-Party source code.
+ */
+
+/**
+ * @author Anoop Saldanha
+ */
+/* Fast non cryptographic hashing.  Built the way XXH3 is, around
+ * independent 64 bit accumulator lanes that compilers turn into SIMD
+ * code, so hashing runs close to memory bandwidth.  Not for anything an
+ * attacker can try to collide offline. */
+
+#ifndef __UTIL_HASH__H__
+#define __UTIL_HASH__H__
+
+#include "honeyprocs-common.h"
+
+uint64_t hp_hash64(const uint8_t *buf, size_t len, uint64_t seed);
+
+#endif /* __UTIL_HASH__H__ */
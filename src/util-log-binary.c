@@ -0,0 +1,566 @@
+/**
+ * Copyright(C) 2018, Juniper Networks, Inc.
+ * All rights reserved
+ *
+ * This SOFTWARE is licensed under the license provided in the LICENSE.txt
+ * file.  By downloading, installing, copying, or otherwise using the
+ * SOFTWARE, you agree to be bound by the terms of that license.  This
+ * SOFTWARE is not an official Juniper product.
+ *
+ * Third-Party Code: This SOFTWARE may depend on other components under
+ * separate copyright notice and license terms.  Your use of the source
+ * code for those components is subject to the term and conditions of
+ * the respective license as noted in the Third-Party source code.
+ */
+
+/**
+ * @author Anoop Saldanha
+ */
+
+#define _CRT_SECURE_NO_WARNINGS
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <time.h>
+
+#include "honeyprocs-common.h"
+#include "align.h"
+#include "status.h"
+#include "util-atomic.h"
+#include "util-log.h"
+#include "util-log-binary.h"
+#include "util-thread.h"
+
+#ifndef WINDOWS
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#define HP_LOG_BIN_HEADER_SIZE 64
+
+struct hp_log_binary_t {
+    uint8_t *base;
+    uint64_t size;
+    hp_log_bin_header_t *header;
+    /* Sites registered with an earlier file are registered again */
+    uint32_t generation;
+    uint32_t site_count;
+    /* Held to register a site */
+    hp_mutex_t lock;
+#ifdef WINDOWS
+    HANDLE file;
+    HANDLE mapping;
+#else
+    int fd;
+#endif
+};
+
+hp_log_binary_t *g_hp_log_binary;
+static uint32_t g_hp_log_binary_generation;
+
+static uint64_t hp_log_time_ns(void)
+{
+#ifdef WINDOWS
+    FILETIME ft;
+    uint64_t t;
+
+    GetSystemTimePreciseAsFileTime(&ft);
+    t = ((uint64_t)ft.dwHighDateTime << 32) | ft.dwLowDateTime;
+
+    /* From 100ns ticks since 1601 */
+    return (t - 116444736000000000ULL) * 100;
+#else
+    struct timespec ts;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+static int hp_log_conv_number(const char **p)
+{
+    int n = 0;
+
+    while (**p >= '0' && **p <= '9') {
+        if (n < 100000)
+            n = n * 10 + (**p - '0');
+        (*p)++;
+    }
+
+    return n;
+}
+
+hp_status_t hp_log_conv_next(const char **format, hp_log_conv_t *conv)
+{
+    const char *p = *format;
+    const char *length;
+    size_t length_len;
+    uint32_t flag_count = 0;
+    bool is_signed;
+    hp_status_t status;
+
+    memset(conv, 0, sizeof(*conv));
+    conv->width = -1;
+    conv->precision = -1;
+
+    conv->text = p;
+    while (*p != '\0' && *p != '%')
+        p++;
+    conv->text_len = p - conv->text;
+    if (*p == '\0') {
+        status = HP_STATUS_OK;
+        goto return_status;
+    }
+    p++;
+
+    while (*p != '\0' && strchr("-+ #0", *p) != NULL) {
+        if (flag_count < sizeof(conv->flags) - 1)
+            conv->flags[flag_count++] = *p;
+        p++;
+    }
+    if (*p == '*') {
+        conv->width_arg = true;
+        p++;
+    } else if (*p >= '0' && *p <= '9') {
+        conv->width = hp_log_conv_number(&p);
+    }
+    if (*p == '.') {
+        p++;
+        if (*p == '*') {
+            conv->precision_arg = true;
+            p++;
+        } else {
+            conv->precision = hp_log_conv_number(&p);
+        }
+    }
+
+    length = p;
+    if (strncmp(p, "hh", 2) == 0 || strncmp(p, "ll", 2) == 0)
+        p += 2;
+    else if (strncmp(p, "I64", 3) == 0 || strncmp(p, "I32", 3) == 0)
+        p += 3;
+    else if (*p != '\0' && strchr("hljztLI", *p) != NULL)
+        p++;
+    length_len = p - length;
+
+    conv->conv = *p;
+    if (*p == '\0') {
+        status = HP_STATUS_ERROR;
+        goto return_status;
+    }
+    p++;
+
+    switch (conv->conv) {
+        case '%':
+            conv->kind = HP_LOG_ARG_NONE;
+            break;
+        case 'd':
+        case 'i':
+        case 'o':
+        case 'u':
+        case 'x':
+        case 'X':
+            is_signed = (conv->conv == 'd' || conv->conv == 'i');
+            if (length_len == 0 || strncmp(length, "I32", 3) == 0)
+                conv->kind = is_signed ? HP_LOG_ARG_INT : HP_LOG_ARG_UINT;
+            else if (strncmp(length, "hh", 2) == 0)
+                conv->kind = is_signed ? HP_LOG_ARG_CHAR : HP_LOG_ARG_UCHAR;
+            else if (strncmp(length, "ll", 2) == 0 ||
+                     strncmp(length, "I64", 3) == 0)
+                conv->kind = is_signed ? HP_LOG_ARG_LLONG : HP_LOG_ARG_ULLONG;
+            else if (*length == 'h')
+                conv->kind = is_signed ? HP_LOG_ARG_SHORT : HP_LOG_ARG_USHORT;
+            else if (*length == 'l')
+                conv->kind = is_signed ? HP_LOG_ARG_LONG : HP_LOG_ARG_ULONG;
+            else if (*length == 'j')
+                conv->kind = is_signed ? HP_LOG_ARG_INTMAX : HP_LOG_ARG_UINTMAX;
+            else if (*length == 'z')
+                conv->kind = is_signed ? HP_LOG_ARG_SSIZE : HP_LOG_ARG_SIZE;
+            else if (*length == 't' || *length == 'I')
+                conv->kind = is_signed ? HP_LOG_ARG_PTRDIFF : HP_LOG_ARG_SIZE;
+            else
+                goto return_error;
+            break;
+        case 'c':
+            if (length_len != 0)
+                goto return_error;
+            conv->kind = HP_LOG_ARG_INT;
+            break;
+        case 's':
+            if (length_len != 0)
+                goto return_error;
+            conv->kind = HP_LOG_ARG_STRING;
+            break;
+        case 'p':
+            if (length_len != 0)
+                goto return_error;
+            conv->kind = HP_LOG_ARG_POINTER;
+            break;
+        case 'e':
+        case 'E':
+        case 'f':
+        case 'F':
+        case 'g':
+        case 'G':
+        case 'a':
+        case 'A':
+            if (length_len == 0 || (length_len == 1 && *length == 'l'))
+                conv->kind = HP_LOG_ARG_DOUBLE;
+            else if (length_len == 1 && *length == 'L')
+                conv->kind = HP_LOG_ARG_LDOUBLE;
+            else
+                goto return_error;
+            break;
+        default:
+            goto return_error;
+    }
+
+    status = HP_STATUS_OK;
+    goto return_status;
+ return_error:
+    status = HP_STATUS_ERROR;
+ return_status:
+    *format = p;
+    return status;
+}
+
+/* Reserve len bytes at the end of the file, or NULL if it is full. */
+static uint8_t *hp_log_binary_reserve(hp_log_binary_t *bin, uint32_t len)
+{
+    uint64_t end;
+
+    end = hp_atomic_add(&bin->header->tail, len);
+    if (end > bin->size) {
+        hp_atomic_add(&bin->header->dropped, 1);
+        return NULL;
+    }
+
+    return bin->base + (end - len);
+}
+
+static void hp_log_binary_append(hp_log_binary_t *bin, uint32_t site,
+                                 const void *payload, uint32_t payload_len)
+{
+    hp_log_bin_record_t *record;
+    uint32_t len;
+
+    len = sizeof(*record) + payload_len;
+    ALIGN_UP(len, 8);
+    if ((record = (hp_log_bin_record_t *)
+         hp_log_binary_reserve(bin, len)) == NULL)
+    {
+        return;
+    }
+    /* The file is zeroed, so the padding is too */
+    record->len = len;
+    record->time = hp_log_time_ns();
+    memcpy(record + 1, payload, payload_len);
+    hp_atomic_store32(&record->site, site);
+
+    return;
+}
+
+/* Give a site an id in the file being logged to, writing out its
+ * definition.  The id's lower half is left 0 if its format can't be
+ * logged. */
+static uint64_t hp_log_site_register(hp_log_binary_t *bin,
+                                     hp_log_site_t *site)
+{
+    uint8_t def[sizeof(hp_log_bin_site_t) + HP_LOG_BIN_ARGS_MAX +
+                3 * HP_LOG_RECORD_SIZE];
+    hp_log_bin_site_t *bin_site = (hp_log_bin_site_t *)def;
+    const char *strings[3];
+    const char *format;
+    hp_log_conv_t conv;
+    uint32_t arg_count = 0;
+    uint32_t len;
+    uint32_t i;
+    size_t n;
+    uint64_t id;
+
+    hp_mutex_lock(&bin->lock);
+
+    id = hp_atomic_load(&site->id);
+    if ((id >> 32) == bin->generation)
+        goto return_status;
+    id = (uint64_t)bin->generation << 32;
+
+    for (format = site->format; ; ) {
+        if (hp_log_conv_next(&format, &conv) != HP_STATUS_OK)
+            goto return_id;
+        if (conv.conv == '\0')
+            break;
+        if (arg_count + conv.width_arg + conv.precision_arg +
+            (conv.kind != HP_LOG_ARG_NONE) > HP_LOG_BIN_ARGS_MAX)
+        {
+            goto return_id;
+        }
+        if (conv.width_arg)
+            site->arg_kinds[arg_count++] = HP_LOG_ARG_INT;
+        if (conv.precision_arg)
+            site->arg_kinds[arg_count++] = HP_LOG_ARG_INT;
+        if (conv.kind != HP_LOG_ARG_NONE)
+            site->arg_kinds[arg_count++] = conv.kind;
+    }
+    site->arg_count = arg_count;
+
+    id |= ++bin->site_count;
+    bin_site->id = (uint32_t)id;
+    bin_site->level = site->level;
+    bin_site->line = site->line;
+    bin_site->arg_count = arg_count;
+    len = sizeof(*bin_site);
+    memcpy(def + len, site->arg_kinds, arg_count);
+    len += arg_count;
+    strings[0] = site->file;
+    strings[1] = site->function;
+    strings[2] = site->format;
+    for (i = 0; i < 3; i++) {
+        n = strlen(strings[i]);
+        if (n >= HP_LOG_RECORD_SIZE)
+            n = HP_LOG_RECORD_SIZE - 1;
+        memcpy(def + len, strings[i], n);
+        len += (uint32_t)n;
+        def[len++] = '\0';
+    }
+    hp_log_binary_append(bin, HP_LOG_BIN_SITE_DEFINE, def, len);
+
+ return_id:
+    hp_atomic_store(&site->id, id);
+ return_status:
+    hp_mutex_unlock(&bin->lock);
+    return id;
+}
+
+void hp_log_binary(hp_log_site_t *site, const char *format, ...)
+{
+    hp_log_binary_t *bin = g_hp_log_binary;
+    /* Scalars take 8 bytes each, and strings up to 12 more than their
+     * share of HP_LOG_RECORD_SIZE */
+    uint64_t payload[HP_LOG_BIN_ARGS_MAX * 2 + HP_LOG_RECORD_SIZE / 8];
+    uint8_t *p = (uint8_t *)payload;
+    uint32_t string_room = HP_LOG_RECORD_SIZE;
+    const char *s;
+    uint64_t id;
+    uint64_t v;
+    uint32_t len;
+    uint32_t i;
+    double d;
+    va_list ap;
+
+    id = hp_atomic_load(&site->id);
+    if ((id >> 32) != bin->generation)
+        id = hp_log_site_register(bin, site);
+    if ((uint32_t)id == 0)
+        return;
+
+    va_start(ap, format);
+    for (i = 0; i < site->arg_count; i++) {
+        switch (site->arg_kinds[i]) {
+            case HP_LOG_ARG_INT:
+                v = (uint64_t)(int64_t)va_arg(ap, int);
+                break;
+            case HP_LOG_ARG_UINT:
+                v = va_arg(ap, unsigned int);
+                break;
+            case HP_LOG_ARG_CHAR:
+                v = (uint64_t)(int64_t)(signed char)va_arg(ap, int);
+                break;
+            case HP_LOG_ARG_UCHAR:
+                v = (unsigned char)va_arg(ap, unsigned int);
+                break;
+            case HP_LOG_ARG_SHORT:
+                v = (uint64_t)(int64_t)(short)va_arg(ap, int);
+                break;
+            case HP_LOG_ARG_USHORT:
+                v = (unsigned short)va_arg(ap, unsigned int);
+                break;
+            case HP_LOG_ARG_LONG:
+                v = (uint64_t)(int64_t)va_arg(ap, long);
+                break;
+            case HP_LOG_ARG_ULONG:
+                v = va_arg(ap, unsigned long);
+                break;
+            case HP_LOG_ARG_LLONG:
+                v = (uint64_t)va_arg(ap, long long);
+                break;
+            case HP_LOG_ARG_ULLONG:
+                v = va_arg(ap, unsigned long long);
+                break;
+            case HP_LOG_ARG_SIZE:
+                v = va_arg(ap, size_t);
+                break;
+            case HP_LOG_ARG_SSIZE:
+            case HP_LOG_ARG_PTRDIFF:
+                v = (uint64_t)(int64_t)va_arg(ap, ptrdiff_t);
+                break;
+            case HP_LOG_ARG_INTMAX:
+                v = (uint64_t)va_arg(ap, intmax_t);
+                break;
+            case HP_LOG_ARG_UINTMAX:
+                v = va_arg(ap, uintmax_t);
+                break;
+            case HP_LOG_ARG_DOUBLE:
+                d = va_arg(ap, double);
+                memcpy(&v, &d, sizeof(v));
+                break;
+            case HP_LOG_ARG_LDOUBLE:
+                d = (double)va_arg(ap, long double);
+                memcpy(&v, &d, sizeof(v));
+                break;
+            case HP_LOG_ARG_POINTER:
+                v = (uintptr_t)va_arg(ap, void *);
+                break;
+            case HP_LOG_ARG_STRING:
+                if ((s = va_arg(ap, const char *)) == NULL)
+                    s = "(null)";
+                for (len = 0; len < string_room && s[len] != '\0'; len++)
+                    ;
+                string_room -= len;
+                memcpy(p, &len, sizeof(len));
+                memcpy(p + sizeof(len), s, len);
+                len += sizeof(len);
+                ALIGN_UP(len, 8);
+                p += len;
+                continue;
+            default:
+                v = 0;
+                break;
+        }
+        memcpy(p, &v, sizeof(v));
+        p += sizeof(v);
+    }
+    va_end(ap);
+
+    hp_log_binary_append(bin, (uint32_t)id, payload,
+                         (uint32_t)(p - (uint8_t *)payload));
+
+    return;
+}
+
+static void hp_log_binary_free(hp_log_binary_t *bin)
+{
+#ifdef WINDOWS
+    LARGE_INTEGER li;
+#endif
+    uint64_t end;
+
+    end = (bin->header != NULL) ? hp_atomic_load(&bin->header->tail) : 0;
+    if (end > bin->size)
+        end = bin->size;
+
+#ifdef WINDOWS
+    if (bin->base != NULL)
+        UnmapViewOfFile(bin->base);
+    if (bin->mapping != NULL)
+        CloseHandle(bin->mapping);
+    if (bin->file != INVALID_HANDLE_VALUE) {
+        li.QuadPart = (LONGLONG)end;
+        if (SetFilePointerEx(bin->file, li, NULL, FILE_BEGIN))
+            SetEndOfFile(bin->file);
+        CloseHandle(bin->file);
+    }
+#else
+    if (bin->base != NULL)
+        munmap(bin->base, bin->size);
+    if (bin->fd >= 0) {
+        if (ftruncate(bin->fd, (off_t)end) != 0)
+            hp_log_error("Unable to trim the binary log.");
+        close(bin->fd);
+    }
+#endif
+    hp_mutex_destroy(&bin->lock);
+    free(bin);
+
+    return;
+}
+
+hp_status_t hp_log_binary_open(const char *path, uint64_t size)
+{
+    hp_log_binary_t *bin;
+    hp_log_bin_header_t *header;
+    hp_status_t status;
+
+    BUG_ON(g_hp_log_binary != NULL);
+
+    if (size == 0)
+        size = HP_LOG_BIN_SIZE_DEFAULT;
+    if (size < HP_LOG_BIN_HEADER_SIZE + HP_LOG_RECORD_SIZE) {
+        hp_log_error("Binary log size %" PRIu64 " is too small.", size);
+        status = HP_STATUS_ERROR;
+        goto return_status;
+    }
+
+    if ((bin = (hp_log_binary_t *)malloc(sizeof(*bin))) == NULL) {
+        hp_log_error("malloc() failure.");
+        status = HP_STATUS_ERROR;
+        goto return_status;
+    }
+    memset(bin, 0, sizeof(*bin));
+    bin->size = size;
+    hp_mutex_init(&bin->lock);
+
+#ifdef WINDOWS
+    bin->file = CreateFileA(path, GENERIC_READ | GENERIC_WRITE,
+                            FILE_SHARE_READ, NULL, CREATE_ALWAYS,
+                            FILE_ATTRIBUTE_NORMAL, NULL);
+    if (bin->file == INVALID_HANDLE_VALUE ||
+        (bin->mapping = CreateFileMappingA(bin->file, NULL, PAGE_READWRITE,
+                                           (DWORD)(size >> 32),
+                                           (DWORD)size, NULL)) == NULL ||
+        (bin->base = (uint8_t *)MapViewOfFile(bin->mapping,
+                                              FILE_MAP_WRITE, 0, 0,
+                                              (SIZE_T)size)) == NULL)
+#else
+    bin->fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (bin->fd < 0 || ftruncate(bin->fd, (off_t)size) != 0 ||
+        (bin->base = (uint8_t *)mmap(NULL, size, PROT_READ | PROT_WRITE,
+                                     MAP_SHARED, bin->fd, 0)) == MAP_FAILED)
+#endif
+    {
+        hp_log_error("Unable to map binary log \"%s\".", path);
+#ifndef WINDOWS
+        bin->base = NULL;
+#endif
+        hp_log_binary_free(bin);
+        status = HP_STATUS_ERROR;
+        goto return_status;
+    }
+
+    header = (hp_log_bin_header_t *)bin->base;
+    memcpy(header->magic, HP_LOG_BIN_MAGIC, sizeof(header->magic));
+    header->version = HP_LOG_BIN_VERSION;
+    header->header_size = HP_LOG_BIN_HEADER_SIZE;
+    header->size = size;
+    header->tail = HP_LOG_BIN_HEADER_SIZE;
+    header->dropped = 0;
+    bin->header = header;
+    bin->generation = ++g_hp_log_binary_generation;
+    g_hp_log_binary = bin;
+
+    status = HP_STATUS_OK;
+ return_status:
+    return status;
+}
+
+void hp_log_binary_close(void)
+{
+    hp_log_binary_t *bin = g_hp_log_binary;
+
+    if (bin == NULL)
+        return;
+
+    g_hp_log_binary = NULL;
+    hp_log_binary_free(bin);
+
+    return;
+}
+
+uint64_t hp_log_binary_dropped(void)
+{
+    hp_log_binary_t *bin = g_hp_log_binary;
+
+    return (bin != NULL) ? hp_atomic_load(&bin->header->dropped) : 0;
+}
@@ -0,0 +1,146 @@
+/**
+ * Copyright(C) 2018, Juniper Networks, Inc.
+ * All rights reserved
+ *
+ * This SOFTWARE is licensed under the license provided in the LICENSE.txt
+ * file.  By downloading, installing, copying, or otherwise using the
+ * SOFTWARE, you agree to be bound by the terms of that license.  This
+ * SOFTWARE is not an official Juniper product.
+ *
+ * Third-Party Code: This SOFTWARE may depend on other components under
+ * separate copyright notice and license terms.  Your use of the source
+ * code for those components is subject to the term and conditions of
+ * the respective license as noted in the Third-Party source code.
+ */
+
+/**
+ * @author Anoop Saldanha
+ */
+
+/* Binary logging.  Rather than formatting a line, a call site logs the id
+ * it was given the first time it logged, a timestamp and its raw
+ * arguments, appended to a memory mapped file.  The first time a site
+ * logs, its format, file, line and the kinds of its arguments are
+ * appended as a definition, so that the file describes itself, and
+ * logdec renders it as text or JSON offline.
+ *
+ * The file is a header, then records, each a hp_log_bin_record_t padded
+ * to 8 bytes, all in the byte order of the host that wrote it.  A log
+ * record's payload is its arguments in order - integers, doubles and
+ * pointers as 8 bytes, strings as a uint32_t length and the bytes, padded
+ * to 8.  A definition's payload is a hp_log_bin_site_t, followed by
+ * arg_count hp_log_arg_kind_t bytes and the file, function and format,
+ * each NUL terminated.  Once the file is full, records are dropped and
+ * counted in the header. */
+
+#ifndef __UTIL_LOG_BINARY__H__
+#define __UTIL_LOG_BINARY__H__
+
+#include "honeyprocs-common.h"
+#include "status.h"
+#include "util-atomic.h"
+#include "util-log.h"
+
+#define HP_LOG_BIN_MAGIC "HPLOGBIN"
+#define HP_LOG_BIN_VERSION 1
+#define HP_LOG_BIN_SIZE_DEFAULT (64 * 1024 * 1024)
+
+typedef struct hp_log_bin_header_t {
+    char magic[8];
+    uint32_t version;
+    /* Where the first record starts */
+    uint32_t header_size;
+    uint64_t size;
+    /* Where the next record goes, which is past size once the file is
+     * full */
+    hp_atomic64_t tail;
+    hp_atomic64_t dropped;
+} hp_log_bin_header_t;
+
+/* Site of a definition record */
+#define HP_LOG_BIN_SITE_DEFINE UINT32_MAX
+
+typedef struct hp_log_bin_record_t {
+    /* Of the whole record, a multiple of 8 */
+    uint32_t len;
+    /* The id of the site logging, or HP_LOG_BIN_SITE_DEFINE.  Stored
+     * last, so a record is skipped while it's 0, as when the writer died
+     * half way. */
+    hp_atomic32_t site;
+    /* Nanoseconds since the epoch */
+    uint64_t time;
+} hp_log_bin_record_t;
+
+typedef struct hp_log_bin_site_t {
+    uint32_t id;
+    int32_t level;
+    uint32_t line;
+    uint32_t arg_count;
+} hp_log_bin_site_t;
+
+/* How an argument is taken off the argument list.  Integers are stored
+ * converted to 64 bits as printf would print them, so hh and h are cut
+ * down when logged. */
+typedef enum hp_log_arg_kind_t {
+    HP_LOG_ARG_NONE = 0,
+    HP_LOG_ARG_INT,
+    HP_LOG_ARG_UINT,
+    HP_LOG_ARG_CHAR,
+    HP_LOG_ARG_UCHAR,
+    HP_LOG_ARG_SHORT,
+    HP_LOG_ARG_USHORT,
+    HP_LOG_ARG_LONG,
+    HP_LOG_ARG_ULONG,
+    HP_LOG_ARG_LLONG,
+    HP_LOG_ARG_ULLONG,
+    HP_LOG_ARG_SIZE,
+    /* %zd, taken as the ptrdiff_t of the same size, as not every
+     * platform has ssize_t */
+    HP_LOG_ARG_SSIZE,
+    HP_LOG_ARG_PTRDIFF,
+    HP_LOG_ARG_INTMAX,
+    HP_LOG_ARG_UINTMAX,
+    HP_LOG_ARG_DOUBLE,
+    HP_LOG_ARG_LDOUBLE,
+    HP_LOG_ARG_STRING,
+    HP_LOG_ARG_POINTER,
+} hp_log_arg_kind_t;
+
+/* A printf conversion, and the literal text before it */
+typedef struct hp_log_conv_t {
+    const char *text;
+    size_t text_len;
+    char flags[8];
+    /* -1 if not given.  Taken from an int argument before the value's
+     * if *_arg. */
+    int width;
+    bool width_arg;
+    int precision;
+    bool precision_arg;
+    /* The conversion character, '%' for %%, or '\0' at the end of the
+     * format */
+    char conv;
+    hp_log_arg_kind_t kind;
+} hp_log_conv_t;
+
+/**
+ * Parse the next conversion of a format, both to log and to decode.
+ *
+ * @format Advanced past the conversion.
+ *
+ * @retval HP_STATUS_ERROR On a conversion that can't be logged, like %n.
+ */
+hp_status_t hp_log_conv_next(const char **format, hp_log_conv_t *conv);
+
+/**
+ * Log in binary to a file, in place of text, till hp_log_deinit().  The
+ * file is created at size, or HP_LOG_BIN_SIZE_DEFAULT if 0, and cut down
+ * to what was logged when closed.
+ */
+hp_status_t hp_log_binary_open(const char *path, uint64_t size);
+void hp_log_binary_close(void);
+
+/* No of records dropped for the file being full */
+uint64_t hp_log_binary_dropped(void);
+
+#endif /* __UTIL_LOG_BINARY__H__ */
@@ -19,12 +19,54 @@
 
 #define _CRT_SECURE_NO_WARNINGS
 
+#include <ctype.h>
+#include <stdarg.h>
+
 #include "honeyprocs-common.h"
 #include "status.h"
+#include "util-atomic.h"
 #include "util-log.h"
+#include "util-log-binary.h"
+#include "util-thread.h"
+
+/* Lines are copied together into a buffer of this size, which is written
+ * and flushed as one */
+#define HP_LOG_BATCH_SIZE (64 * 1024)
+
+typedef struct hp_log_record_t {
+    /* The ring position the slot can next be claimed at, or one past the
+     * position it was claimed at once its line is in */
+    hp_atomic64_t seq;
+    uint32_t len;
+    char text[HP_LOG_RECORD_SIZE];
+} hp_log_record_t;
+
+/* A bounded multi producer, single consumer ring of formatted lines.
+ * Loggers claim a position by a CAS on head, and the slot at it is theirs
+ * once its seq says it has been written out from the lap before. */
+typedef struct hp_log_ring_t {
+    hp_log_record_t *records;
+    uint64_t mask;
+    hp_log_overflow_t overflow;
+    uint32_t flush_interval_ms;
+    /* Apart from the writer's fields, which the loggers never touch */
+    uint8_t pad0[64];
+    hp_atomic64_t head;
+    hp_atomic64_t dropped;
+    uint8_t pad1[64];
+    uint64_t tail;
+    uint64_t dropped_reported;
+    char *batch;
+    hp_thread_t thread;
+    hp_mutex_t lock;
+    hp_cond_t cond;
+    bool stop;
+} hp_log_ring_t;
 
 FILE * g_hp_log_fp;
-hp_log_level_t g_hp_log_level;
+hp_log_level_t g_hp_log_levels[HP_LOG_MODULE_MAX];
+/* NULL while logging is synchronous */
+static hp_log_ring_t *g_hp_log_ring;
 
 const char *hp_log_level_to_string(hp_log_level_t log_level)
 {
@@ -50,17 +92,415 @@ const char *hp_log_level_to_string(hp_log_level_t log_level)
     }
 }
 
-hp_status_t hp_log_init(hp_log_level_t log_level, const char *path)
+/* Format a line into buf, returning its length, cut off to fit.  Both the
+ * prefix and the message are cut off at size, so neither can run over. */
+static uint32_t hp_log_format(char *buf, size_t size,
+                              hp_log_level_t log_level, const char *file,
+                              int line, const char *function,
+                              const char *format, va_list ap)
+{
+    size_t len;
+
+    /* Room for the line ending */
+    size -= 2;
+
+    _snprintf_s(buf, size, _TRUNCATE, "(%s:%d)(%s) <%s> - ",
+                file, line, function, hp_log_level_to_string(log_level));
+    len = strlen(buf);
+    _vsnprintf_s(buf + len, size - len, _TRUNCATE, format, ap);
+    len += strlen(buf + len);
+    buf[len++] = '\r';
+    buf[len++] = '\n';
+
+    return (uint32_t)len;
+}
+
+static void hp_log_write(const char *buf, size_t len)
+{
+    fwrite(buf, 1, len, stdout);
+    fflush(stdout);
+    if (g_hp_log_fp != NULL) {
+        fwrite(buf, 1, len, g_hp_log_fp);
+        fflush(g_hp_log_fp);
+    }
+
+    return;
+}
+
+/**
+ * Claim the slot for a line, or NULL if the ring is full and lines are
+ * dropped.
+ *
+ * @pos Set to the position claimed.
+ */
+static hp_log_record_t *hp_log_ring_claim(hp_log_ring_t *ring, uint64_t *pos)
+{
+    hp_log_record_t *record;
+    uint64_t head;
+    uint64_t seq;
+
+    head = hp_atomic_load(&ring->head);
+    for (;;) {
+        record = &ring->records[head & ring->mask];
+        seq = hp_atomic_load(&record->seq);
+        if (seq == head) {
+            if (hp_atomic_cas(&ring->head, head, head + 1)) {
+                *pos = head;
+                return record;
+            }
+        } else if (seq == head - ring->mask) {
+            /* Still holds the line from a lap ago */
+            if (ring->overflow == HP_LOG_OVERFLOW_DROP) {
+                hp_atomic_add(&ring->dropped, 1);
+                return NULL;
+            }
+            hp_cond_signal(&ring->cond);
+            hp_sleep_ms(1);
+        }
+        /* Else another logger got there first */
+        head = hp_atomic_load(&ring->head);
+    }
+}
+
+/* Write out the lines in the ring, up to the first one that isn't in yet. */
+static void hp_log_ring_drain(hp_log_ring_t *ring)
+{
+    hp_log_record_t *record;
+    uint64_t dropped;
+    size_t len = 0;
+    int r;
+
+    for (;;) {
+        record = &ring->records[ring->tail & ring->mask];
+        if (hp_atomic_load(&record->seq) != ring->tail + 1)
+            break;
+        if (len + record->len > HP_LOG_BATCH_SIZE) {
+            hp_log_write(ring->batch, len);
+            len = 0;
+        }
+        memcpy(ring->batch + len, record->text, record->len);
+        len += record->len;
+        hp_atomic_store(&record->seq, ring->tail + ring->mask + 1);
+        ring->tail++;
+    }
+
+    dropped = hp_atomic_load(&ring->dropped);
+    if (dropped != ring->dropped_reported &&
+        len + HP_LOG_RECORD_SIZE <= HP_LOG_BATCH_SIZE)
+    {
+        r = _snprintf_s(ring->batch + len, HP_LOG_RECORD_SIZE, _TRUNCATE,
+                        "(%s) <%s> - %" PRIu64 " log line(s) dropped, "
+                        "the ring being full.\r\n",
+                        __FILENAME__,
+                        hp_log_level_to_string(HP_LOG_LEVEL_WARNING),
+                        dropped - ring->dropped_reported);
+        if (r > 0 && r < HP_LOG_RECORD_SIZE)
+            len += r;
+        ring->dropped_reported = dropped;
+    }
+
+    if (len > 0)
+        hp_log_write(ring->batch, len);
+
+    return;
+}
+
+static void hp_log_writer(void *ring_)
 {
+    hp_log_ring_t *ring = (hp_log_ring_t *)ring_;
+    bool stop;
+
+    hp_mutex_lock(&ring->lock);
+    for (;;) {
+        stop = ring->stop;
+        hp_mutex_unlock(&ring->lock);
+        hp_log_ring_drain(ring);
+        hp_mutex_lock(&ring->lock);
+        if (stop)
+            break;
+        if (!ring->stop) {
+            hp_cond_timedwait(&ring->cond, &ring->lock,
+                              ring->flush_interval_ms);
+        }
+    }
+    hp_mutex_unlock(&ring->lock);
+
+    return;
+}
+
+void hp_log_message(hp_log_level_t log_level, const char *file, int line,
+                    const char *function, const char *format, ...)
+{
+    hp_log_ring_t *ring = g_hp_log_ring;
+    hp_log_record_t *record;
+    char buf[HP_LOG_RECORD_SIZE];
+    uint64_t pos;
+    uint32_t len;
+    va_list ap;
+
+    va_start(ap, format);
+
+    if (ring == NULL) {
+        len = hp_log_format(buf, sizeof(buf), log_level, file, line,
+                            function, format, ap);
+        hp_log_write(buf, len);
+        goto return_status;
+    }
+
+    if ((record = hp_log_ring_claim(ring, &pos)) == NULL)
+        goto return_status;
+    record->len = hp_log_format(record->text, sizeof(record->text),
+                                log_level, file, line, function, format, ap);
+    hp_atomic_store(&record->seq, pos + 1);
+
+    /* The writer is woken without its lock, so as not to hold up the
+     * loggers on it.  A wakeup that comes just before it waits is missed,
+     * which only puts the line off till the flush interval. */
+    if (log_level <= HP_LOG_LEVEL_ERROR ||
+        (pos & (ring->mask >> 1)) == (ring->mask >> 1))
+    {
+        hp_cond_signal(&ring->cond);
+    }
+
+ return_status:
+    va_end(ap);
+    return;
+}
+
+/* Have the writer write out the ring, and wait for it to stop. */
+static void hp_log_writer_stop(hp_log_ring_t *ring)
+{
+    hp_mutex_lock(&ring->lock);
+    ring->stop = true;
+    hp_cond_signal(&ring->cond);
+    hp_mutex_unlock(&ring->lock);
+    hp_thread_join(&ring->thread);
+
+    return;
+}
+
+/* At exit(), other threads can still be logging, so the ring is left
+ * for them to fill, or drop lines from. */
+static void hp_log_async_exit(void)
+{
+    hp_log_ring_t *ring = g_hp_log_ring;
+
+    if (ring == NULL || ring->stop)
+        return;
+
+    hp_log_writer_stop(ring);
+
+    return;
+}
+
+static void hp_log_async_stop(void)
+{
+    hp_log_ring_t *ring = g_hp_log_ring;
+
+    if (ring == NULL)
+        return;
+
+    if (!ring->stop)
+        hp_log_writer_stop(ring);
+
+    g_hp_log_ring = NULL;
+    hp_cond_destroy(&ring->cond);
+    hp_mutex_destroy(&ring->lock);
+    free(ring->batch);
+    free(ring->records);
+    free(ring);
+
+    return;
+}
+
+hp_status_t hp_log_async_start(const hp_log_async_config_t *config)
+{
+    static bool registered;
+    hp_log_async_config_t defaults;
+    hp_log_ring_t *ring = NULL;
+    uint64_t i;
     hp_status_t status;
 
-    if (log_level == HP_LOG_LEVEL_NONE) {
-        status = HP_STATUS_OK;
+    BUG_ON(g_hp_log_ring != NULL);
+
+    if (config == NULL) {
+        defaults.ring_size = HP_LOG_RING_SIZE_DEFAULT;
+        defaults.flush_interval_ms = HP_LOG_FLUSH_INTERVAL_MS_DEFAULT;
+        defaults.overflow = HP_LOG_OVERFLOW_DROP;
+        config = &defaults;
+    }
+    if (config->ring_size < 2 ||
+        (config->ring_size & (config->ring_size - 1)) != 0)
+    {
+        hp_log_error("Log ring size %u isn't a power of 2.",
+                     config->ring_size);
+        status = HP_STATUS_ERROR;
+        goto return_status;
+    }
+
+    if ((ring = (hp_log_ring_t *)malloc(sizeof(*ring))) == NULL) {
+        hp_log_error("malloc() failure.");
+        status = HP_STATUS_ERROR;
+        goto return_status;
+    }
+    memset(ring, 0, sizeof(*ring));
+    ring->records = (hp_log_record_t *)
+        malloc(sizeof(*ring->records) * config->ring_size);
+    ring->batch = (char *)malloc(HP_LOG_BATCH_SIZE);
+    if (ring->records == NULL || ring->batch == NULL) {
+        hp_log_error("malloc() failure.");
+        status = HP_STATUS_ERROR;
+        goto return_status;
+    }
+    for (i = 0; i < config->ring_size; i++)
+        ring->records[i].seq = i;
+    ring->mask = config->ring_size - 1;
+    ring->overflow = config->overflow;
+    ring->flush_interval_ms = config->flush_interval_ms;
+    hp_mutex_init(&ring->lock);
+    hp_cond_init(&ring->cond);
+
+    if (hp_thread_create(&ring->thread, hp_log_writer,
+                         ring) != HP_STATUS_OK)
+    {
+        hp_log_error("Unable to start the log writer.");
+        hp_cond_destroy(&ring->cond);
+        hp_mutex_destroy(&ring->lock);
+        status = HP_STATUS_ERROR;
         goto return_status;
     }
+    g_hp_log_ring = ring;
+    ring = NULL;
+
+    if (!registered) {
+        atexit(hp_log_async_exit);
+        registered = true;
+    }
+
+    status = HP_STATUS_OK;
+ return_status:
+    if (ring != NULL) {
+        free(ring->batch);
+        free(ring->records);
+        free(ring);
+    }
+    return status;
+}
+
+uint64_t hp_log_dropped(void)
+{
+    hp_log_ring_t *ring = g_hp_log_ring;
+
+    return (ring != NULL) ? hp_atomic_load(&ring->dropped) : 0;
+}
+
+const char *hp_log_module_to_string(hp_log_module_t module)
+{
+    switch (module) {
+        case HP_LOG_MODULE_DEFAULT:
+            return "default";
+        case HP_LOG_MODULE_AVL:
+            return "avl";
+        case HP_LOG_MODULE_MMAP:
+            return "mmap";
+        case HP_LOG_MODULE_SCANNER:
+            return "scanner";
+        case HP_LOG_MODULE_SCAN_ENGINE:
+            return "scan-engine";
+        default:
+            exit(EXIT_FAILURE);
+    }
+}
+
+/* Whether the len bytes at s are name, in any case */
+static bool hp_log_name_is(const char *s, size_t len, const char *name)
+{
+    size_t i;
+
+    for (i = 0; i < len; i++) {
+        if (name[i] == '\0' ||
+            tolower((uint8_t)s[i]) != tolower((uint8_t)name[i]))
+        {
+            return false;
+        }
+    }
+
+    return name[len] == '\0';
+}
+
+void hp_log_set_level(hp_log_module_t module, hp_log_level_t log_level)
+{
+    g_hp_log_levels[module] = log_level;
+
+    return;
+}
+
+hp_status_t hp_log_set_levels(const char *spec)
+{
+    const char *level_name;
+    const char *eq;
+    int module = HP_LOG_MODULE_MAX;
+    int level;
+    hp_status_t status;
+
+    if ((eq = strchr(spec, '=')) != NULL) {
+        for (module = 0; module < HP_LOG_MODULE_MAX; module++) {
+            if (hp_log_name_is(spec, eq - spec,
+                               hp_log_module_to_string(
+                                   (hp_log_module_t)module)))
+            {
+                break;
+            }
+        }
+        if (module == HP_LOG_MODULE_MAX) {
+            hp_log_error("Unknown log module in \"%s\".", spec);
+            status = HP_STATUS_ERROR;
+            goto return_status;
+        }
+        level_name = eq + 1;
+    } else {
+        level_name = spec;
+    }
+
+    if (hp_log_name_is(level_name, strlen(level_name), "none")) {
+        level = HP_LOG_LEVEL_NONE;
+    } else {
+        for (level = HP_LOG_LEVEL_EMERGENCY; level < HP_LOG_LEVEL_MAX;
+             level++)
+        {
+            if (hp_log_name_is(level_name, strlen(level_name),
+                               hp_log_level_to_string((hp_log_level_t)level)))
+            {
+                break;
+            }
+        }
+        if (level == HP_LOG_LEVEL_MAX) {
+            hp_log_error("Unknown log level in \"%s\".", spec);
+            status = HP_STATUS_ERROR;
+            goto return_status;
+        }
+    }
+
+    if (module != HP_LOG_MODULE_MAX) {
+        hp_log_set_level((hp_log_module_t)module, (hp_log_level_t)level);
+    } else {
+        for (module = 0; module < HP_LOG_MODULE_MAX; module++)
+            hp_log_set_level((hp_log_module_t)module, (hp_log_level_t)level);
+    }
+
+    status = HP_STATUS_OK;
+ return_status:
+    return status;
+}
+
+hp_status_t hp_log_init(hp_log_level_t log_level, const char *path)
+{
+    uint32_t i;
+    hp_status_t status;
 
     g_hp_log_fp = NULL;
-    g_hp_log_level = log_level;
+    for (i = 0; i < HP_LOG_MODULE_MAX; i++)
+        g_hp_log_levels[i] = log_level;
 
     if (path != NULL) {
         g_hp_log_fp = fopen(path, "w");
@@ -81,6 +521,9 @@ hp_status_t hp_log_deinit()
 {
     hp_status_t status;
 
+    hp_log_async_stop();
+    hp_log_binary_close();
+
     if (g_hp_log_fp != NULL) {
         fclose(g_hp_log_fp);
         g_hp_log_fp = NULL;
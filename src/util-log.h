@@ -24,11 +24,16 @@
 
 #include "honeyprocs-common.h"
 #include "status.h"
+#include "util-atomic.h"
 
 #ifdef WIN32
 #define __FILENAME__ (strrchr(__FILE__, '\\') ? \
                       strrchr(__FILE__, '\\') + 1 : \
                       __FILE__)
+#else
+#define __FILENAME__ (strrchr(__FILE__, '/') ? \
+                      strrchr(__FILE__, '/') + 1 : \
+                      __FILE__)
 #endif
 
 /**
@@ -49,33 +54,101 @@ typedef enum hp_log_level_t {
     HP_LOG_LEVEL_MAX,
 } hp_log_level_t;
 
+/* Parts of the code whose levels can be set apart from the rest */
+typedef enum hp_log_module_t {
+    HP_LOG_MODULE_DEFAULT = 0,
+    HP_LOG_MODULE_AVL,
+    HP_LOG_MODULE_MMAP,
+    HP_LOG_MODULE_SCANNER,
+    HP_LOG_MODULE_SCAN_ENGINE,
+    HP_LOG_MODULE_MAX,
+} hp_log_module_t;
+
+/* The module a file logs as.  A file in one of them defines it ahead of
+ * its includes. */
+#ifndef HP_LOG_MODULE
+#define HP_LOG_MODULE HP_LOG_MODULE_DEFAULT
+#endif
+
+/* Lines above this level are compiled out, along with their arguments.
+ * Debug builds keep them all. */
+#ifndef HP_LOG_COMPILE_LEVEL
+#ifdef DEBUG
+#define HP_LOG_COMPILE_LEVEL HP_LOG_LEVEL_DEBUG
+#else
+#define HP_LOG_COMPILE_LEVEL HP_LOG_LEVEL_INFO
+#endif
+#endif
+
 extern FILE *g_hp_log_fp;
-extern hp_log_level_t g_hp_log_level;
+/* The level each module logs at */
+extern hp_log_level_t g_hp_log_levels[HP_LOG_MODULE_MAX];
+
+/* Longest a log line gets, the rest of it being cut off */
+#define HP_LOG_RECORD_SIZE 1024
+
+/* Most arguments a site can log in binary.  A site with more isn't
+ * logged. */
+#define HP_LOG_BIN_ARGS_MAX 32
+
+/* A call site, as logged in binary.  Registered the first time it logs,
+ * by parsing its format for the kinds of its arguments. */
+typedef struct hp_log_site_t {
+    /* The binary log's generation in the upper half, and the site's id in
+     * it in the lower, or 0 before the site is registered with the file
+     * being logged to */
+    hp_atomic64_t id;
+    hp_log_level_t level;
+    const char *file;
+    int line;
+    const char *function;
+    const char *format;
+    uint32_t arg_count;
+    uint8_t arg_kinds[HP_LOG_BIN_ARGS_MAX];
+} hp_log_site_t;
+
+typedef struct hp_log_binary_t hp_log_binary_t;
+/* Non NULL while logging in binary */
+extern hp_log_binary_t *g_hp_log_binary;
+
+#define HP_LOG_EXPAND(x) x
+#define HP_LOG_FORMAT_(format, ...) format
+/* The format out of hp_log()'s arguments */
+#define HP_LOG_FORMAT(...) HP_LOG_EXPAND(HP_LOG_FORMAT_(__VA_ARGS__, 0))
 
 #define hp_log(log_level, ...)                                          \
     do {                                                                \
-        if (log_level <= g_hp_log_level) {                              \
-            char buf1[1024];                                            \
-            char buf2[1024];                                            \
-            _snprintf_s(buf1, sizeof(buf1), _TRUNCATE, __VA_ARGS__);    \
-            _snprintf_s(buf2, sizeof(buf2), _TRUNCATE,                  \
-                        "(%s:%d)(%s) <%s> - %s\r\n",                    \
-                        __FILENAME__, __LINE__,                         \
-                        __FUNCTION__,                                   \
-                        hp_log_level_to_string(log_level), buf1);       \
-            fprintf(stdout, "%s", buf2);                                \
-            fflush(stdout);                                             \
-            if (g_hp_log_fp != NULL) {                                  \
-                fprintf(g_hp_log_fp, "%s", buf2, strlen(buf2));         \
-                fflush(g_hp_log_fp);                                   \
+        if ((log_level) <= HP_LOG_COMPILE_LEVEL &&                      \
+            (log_level) <= g_hp_log_levels[HP_LOG_MODULE]) {            \
+            if (g_hp_log_binary != NULL) {                              \
+                static hp_log_site_t hp_log_site_ = {                   \
+                    0, log_level, __FILE__, __LINE__, __FUNCTION__,     \
+                    HP_LOG_FORMAT(__VA_ARGS__)                          \
+                };                                                      \
+                hp_log_binary(&hp_log_site_, __VA_ARGS__);              \
+            } else {                                                    \
+                hp_log_message(log_level, __FILENAME__, __LINE__,       \
+                               __FUNCTION__, __VA_ARGS__);              \
             }                                                           \
         }                                                               \
     } while (0)
 
+#ifdef WINDOWS
+#define HP_LOG_FORMAT_CHECK(format_arg)
+#else
+#define HP_LOG_FORMAT_CHECK(format_arg) \
+    __attribute__((format(printf, format_arg, format_arg + 1)))
+#endif
+
 /**
  * Private API.
  */
 const char *hp_log_level_to_string(hp_log_level_t log_level);
+void hp_log_message(hp_log_level_t log_level, const char *file, int line,
+                    const char *function, const char *format, ...)
+    HP_LOG_FORMAT_CHECK(5);
+void hp_log_binary(hp_log_site_t *site, const char *format, ...)
+    HP_LOG_FORMAT_CHECK(2);
 
 /**
  * Various logging APIs.
@@ -92,7 +165,7 @@ const char *hp_log_level_to_string(hp_log_level_t log_level);
 /**
  * Initialize the logging API.
  *
- * @log_level The log level to be used as offered by EyLogLevel_t.
+ * @log_level The log level of every module, as offered by hp_log_level_t.
  * @path Path to a log file to write to.  It can also be NULL in which
  *       case logging to a file is disabled and only console logging is used.
  *
@@ -101,8 +174,65 @@ const char *hp_log_level_to_string(hp_log_level_t log_level);
  */
 hp_status_t hp_log_init(hp_log_level_t log_level, const char *path);
 
+/* Set the level a module logs at. */
+void hp_log_set_level(hp_log_module_t module, hp_log_level_t log_level);
+
+/**
+ * Set levels as given on a command line - "<level>" for every module, or
+ * "<module>=<level>" for one, by the names hp_log_level_to_string() and
+ * hp_log_module_to_string() give, in any case, or "none".
+ *
+ * @retval HP_STATUS_ERROR On an unknown module or level.
+ */
+hp_status_t hp_log_set_levels(const char *spec);
+
+const char *hp_log_module_to_string(hp_log_module_t module);
+
+/* What logging does when the writer has fallen a whole ring behind */
+typedef enum hp_log_overflow_t {
+    /* Drop the line, and count it */
+    HP_LOG_OVERFLOW_DROP = 0,
+    /* Wait for the writer to make room */
+    HP_LOG_OVERFLOW_BLOCK,
+} hp_log_overflow_t;
+
+typedef struct hp_log_async_config_t {
+    /* No of lines the ring holds, a power of 2 */
+    uint32_t ring_size;
+    /* Longest a line waits in the ring before being written, unless the
+     * ring fills up first */
+    uint32_t flush_interval_ms;
+    hp_log_overflow_t overflow;
+} hp_log_async_config_t;
+
+#define HP_LOG_RING_SIZE_DEFAULT            1024
+#define HP_LOG_FLUSH_INTERVAL_MS_DEFAULT    100
+
+/**
+ * Hand logging over to a writer thread.  A line is formatted straight into
+ * a slot of a lock-free ring, which any no of threads can log to, and the
+ * writer writes out whatever the ring holds in a batch, then flushes once.
+ * Lines at HP_LOG_LEVEL_ERROR and above wake the writer right away.
+ * Until this is called, and after hp_log_deinit(), lines are written and
+ * flushed by the thread logging them.  The writer is also stopped, and
+ * the ring written out, at exit().
+ *
+ * @config NULL for the defaults - HP_LOG_RING_SIZE_DEFAULT,
+ *         HP_LOG_FLUSH_INTERVAL_MS_DEFAULT and HP_LOG_OVERFLOW_DROP.
+ *
+ * @retval HP_STATUS_OK On success.
+ * @retval HP_STATUS_ERROR On failure, in which case logging stays
+ *         synchronous.
+ */
+hp_status_t hp_log_async_start(const hp_log_async_config_t *config);
+
+/* No of lines dropped for a full ring so far.  The writer logs a count of
+ * them too, as it catches up. */
+uint64_t hp_log_dropped(void);
+
 /**
- * DeInitialize the logging API.
+ * DeInitialize the logging API.  Lines still in the ring are written out
+ * first, so nothing may be logging by now but the caller.
  *
  * @retval HP_STATUS_OK On successful de-init.
  * @retval HP_STATUS_ERROR On an un-successful de-init.
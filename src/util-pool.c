@@ -0,0 +1,185 @@
+/**
+ * Copyright(C) 2018, Juniper Networks, Inc.
+ * All rights reserved
+ *
+ * This SOFTWARE is licensed under the license provided in the LICENSE.txt
+ * file.  By downloading, installing, copying, or otherwise using the
+ * SOFTWARE, you agree to be bound by the terms of that license.  This
+ * SOFTWARE is not an official Juniper product.
+ *
+ * Third-Party Code: This SOFTWARE may depend on other components under
+ * separate copyright notice and license terms.  Your use of the source
+ * code for those components is subject to the term and conditions of
+ * the respective license as noted in the Third-Party source code.
+ */
+
+/**
+ * @author Anoop Saldanha
+ */
+
+#include "honeyprocs-common.h"
+#include "util-pool.h"
+#include "util-thread.h"
+#include "util-log.h"
+#include "status.h"
+
+typedef struct hp_pool_job_list_t {
+    hp_pool_job_t *head;
+    hp_pool_job_t *tail;
+} hp_pool_job_list_t;
+
+typedef struct hp_pool_worker_t {
+    hp_thread_t thread;
+    struct hp_pool_t *pool;
+    void *data;
+} hp_pool_worker_t;
+
+typedef struct hp_pool_t {
+    hp_mutex_t lock;
+    /* Signalled when a job is queued or the pool is stopping */
+    hp_cond_t cond;
+    hp_pool_job_list_t todo;
+    hp_pool_job_list_t done;
+    bool stop;
+    hp_pool_job_func_t job_func;
+    uint32_t worker_count;
+    hp_pool_worker_t workers[];
+} hp_pool_t;
+
+static void hp_pool_job_list_push(hp_pool_job_list_t *list,
+                                  hp_pool_job_t *job)
+{
+    job->next = NULL;
+    if (list->tail == NULL)
+        list->head = job;
+    else
+        list->tail->next = job;
+    list->tail = job;
+
+    return;
+}
+
+static hp_pool_job_t *hp_pool_job_list_pop(hp_pool_job_list_t *list)
+{
+    hp_pool_job_t *job = list->head;
+
+    if (job != NULL) {
+        list->head = job->next;
+        if (list->head == NULL)
+            list->tail = NULL;
+        job->next = NULL;
+    }
+
+    return job;
+}
+
+static void hp_pool_worker_run(void *worker_)
+{
+    hp_pool_worker_t *worker = (hp_pool_worker_t *)worker_;
+    hp_pool_t *pool = worker->pool;
+    hp_pool_job_t *job;
+
+    hp_mutex_lock(&pool->lock);
+    while (1) {
+        while (pool->todo.head == NULL && !pool->stop)
+            hp_cond_wait(&pool->cond, &pool->lock);
+        if ((job = hp_pool_job_list_pop(&pool->todo)) == NULL)
+            break;
+        hp_mutex_unlock(&pool->lock);
+
+        pool->job_func(job->data, worker->data);
+
+        hp_mutex_lock(&pool->lock);
+        hp_pool_job_list_push(&pool->done, job);
+    }
+    hp_mutex_unlock(&pool->lock);
+
+    return;
+}
+
+hp_status_t hp_pool_init(hp_pool_t **pool_,
+                         uint32_t worker_count,
+                         hp_pool_job_func_t job_func,
+                         void **worker_data)
+{
+    hp_pool_t *pool;
+    uint32_t alloc_size;
+    uint32_t i;
+    hp_status_t status;
+
+    *pool_ = NULL;
+
+    BUG_ON(worker_count == 0);
+
+    alloc_size = sizeof(*pool) + (sizeof(hp_pool_worker_t) * worker_count);
+    if ((pool = (hp_pool_t *)malloc(alloc_size)) == NULL) {
+        hp_log_error("malloc() failure.");
+        status = HP_STATUS_ERROR;
+        goto return_status;
+    }
+    memset(pool, 0, alloc_size);
+    hp_mutex_init(&pool->lock);
+    hp_cond_init(&pool->cond);
+    pool->job_func = job_func;
+
+    for (i = 0; i < worker_count; i++) {
+        pool->workers[i].pool = pool;
+        pool->workers[i].data = worker_data[i];
+        if (hp_thread_create(&pool->workers[i].thread,
+                             hp_pool_worker_run,
+                             &pool->workers[i]) != HP_STATUS_OK)
+        {
+            hp_log_error("Failed to start pool worker %u.", i);
+            hp_pool_deinit(pool);
+            status = HP_STATUS_ERROR;
+            goto return_status;
+        }
+        pool->worker_count++;
+    }
+
+    *pool_ = pool;
+
+    status = HP_STATUS_OK;
+ return_status:
+    return status;
+}
+
+void hp_pool_deinit(hp_pool_t *pool)
+{
+    uint32_t i;
+
+    hp_mutex_lock(&pool->lock);
+    pool->stop = true;
+    hp_cond_broadcast(&pool->cond);
+    hp_mutex_unlock(&pool->lock);
+
+    for (i = 0; i < pool->worker_count; i++)
+        hp_thread_join(&pool->workers[i].thread);
+
+    hp_cond_destroy(&pool->cond);
+    hp_mutex_destroy(&pool->lock);
+    free(pool);
+
+    return;
+}
+
+void hp_pool_submit(hp_pool_t *pool, hp_pool_job_t *job)
+{
+    hp_mutex_lock(&pool->lock);
+    hp_pool_job_list_push(&pool->todo, job);
+    hp_cond_signal(&pool->cond);
+    hp_mutex_unlock(&pool->lock);
+
+    return;
+}
+
+hp_pool_job_t *hp_pool_get_done(hp_pool_t *pool)
+{
+    hp_pool_job_t *job;
+
+    hp_mutex_lock(&pool->lock);
+    job = hp_pool_job_list_pop(&pool->done);
+    hp_mutex_unlock(&pool->lock);
+
+    return job;
+}
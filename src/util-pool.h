@@ -0,0 +1,66 @@
+/**
+ * Copyright(C) 2018, Juniper Networks, Inc.
+ * All rights reserved
+ *
+ * This SOFTWARE is licensed under the license provided in the LICENSE.txt
+ * file.  By downloading, installing, copying, or otherwise using the
+ * SOFTWARE, you agree to be bound by the terms of that license.  This
+ * SOFTWARE is not an official Juniper product.
+ *
+ * Third-Party Code: This SOFTWARE may depend on other components under
+ * separate copyright notice and license terms.  Your use of the source
+ * code for those components is subject to the term and conditions of
+ * the respective license as noted in the Third-Party source code.
+ */
+
+/**
+ * @author Anoop Saldanha
+ */
+
+/* Fixed size pool of worker threads.  Jobs are embedded in the caller's
+ * structures and handed back once run, so the submitter decides when a
+ * job may be queued again. */
+
+#ifndef __UTIL_POOL__H__
+#define __UTIL_POOL__H__
+
+#include "honeyprocs-common.h"
+#include "status.h"
+
+typedef struct hp_pool_t hp_pool_t;
+
+typedef struct hp_pool_job_t {
+    struct hp_pool_job_t *next;
+    /* The user data handed to the job function */
+    void *data;
+} hp_pool_job_t;
+
+/**
+ * Runs a job on a worker.
+ *
+ * @data The job's user data.
+ * @worker_data The running worker's private data, as given to
+ *              hp_pool_init().  Only ever used by that worker.
+ */
+typedef void (*hp_pool_job_func_t)(void *data, void *worker_data);
+
+/**
+ * Start the workers.
+ *
+ * @worker_count No of worker threads.  Has to be at least 1.
+ * @worker_data An array of worker_count pointers, one per worker.
+ */
+hp_status_t hp_pool_init(hp_pool_t **pool,
+                         uint32_t worker_count,
+                         hp_pool_job_func_t job_func,
+                         void **worker_data);
+
+/* Stop the workers once the queued jobs have run. */
+void hp_pool_deinit(hp_pool_t *pool);
+
+void hp_pool_submit(hp_pool_t *pool, hp_pool_job_t *job);
+
+/* Pop a job that has run, in the order they finished.  NULL if none. */
+hp_pool_job_t *hp_pool_get_done(hp_pool_t *pool);
+
+#endif /* __UTIL_POOL__H__ */
@@ -0,0 +1,62 @@
+/**
+ * Copyright(C) 2018, Juniper Networks, Inc.
+ * All rights reserved
+ *
+ * This SOFTWARE is licensed under the license provided in the LICENSE.txt
+ * file.  By downloading, installing, copying, or otherwise using the
+ * SOFTWARE, you agree to be bound by the terms of that license.  This
+ * SOFTWARE is not an official Juniper product.
+ *
+ * Third-Party Code: This SOFTWARE may depend on other components under
+ * separate copyright notice and license terms.  Your use of the source
+ * code for those components is subject to the term and conditions of
+ * the respective license as noted in the Third-Party source code.
+ */
+
+/**
+ * @author Anoop Saldanha
+ */
+
+#include "honeyprocs-common.h"
+#include "util-scratch.h"
+#include "util-log.h"
+#include "status.h"
+
+#define HP_SCRATCH_SIZE_MIN (64 * 1024)
+
+hp_status_t hp_scratch_reserve(hp_scratch_t *scratch, size_t size)
+{
+    uint8_t *buf;
+    size_t size_new;
+    hp_status_t status;
+
+    if (size <= scratch->size) {
+        status = HP_STATUS_OK;
+        goto return_status;
+    }
+
+    size_new = (scratch->size != 0) ? scratch->size : HP_SCRATCH_SIZE_MIN;
+    while (size_new < size)
+        size_new *= 2;
+
+    if ((buf = (uint8_t *)realloc(scratch->buf, size_new)) == NULL) {
+        hp_log_error("realloc() failure.");
+        status = HP_STATUS_ERROR;
+        goto return_status;
+    }
+    scratch->buf = buf;
+    scratch->size = size_new;
+
+    status = HP_STATUS_OK;
+ return_status:
+    return status;
+}
+
+void hp_scratch_free(hp_scratch_t *scratch)
+{
+    free(scratch->buf);
+    scratch->buf = NULL;
+    scratch->size = 0;
+
+    return;
+}
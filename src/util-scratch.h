@@ -0,0 +1,40 @@
+/**
+ * Copyright(C) 2018, Juniper Networks, Inc.
+ * All rights reserved
+ *
+ * This SOFTWARE is licensed under the license provided in the LICENSE.txt
+ * file.  By downloading, installing, copying, or otherwise using the
+ * SOFTWARE, you agree to be bound by the terms of that license.  This
+ * SOFTWARE is not an official Juniper product.
+ *
+ * Third-Party Code: This SOFTWARE may depend on other components under
+ * separate copyright notice and license terms.  Your use of the source
+ * code for those components is subject to the term and conditions of
+ * the respective license as noted in the Third-Party source code.
+ */
+
+/**
+ * @author Anoop Saldanha
+ */
+
+/* A growable buffer reused across calls, one per thread needing it. */
+
+#ifndef __UTIL_SCRATCH__H__
+#define __UTIL_SCRATCH__H__
+
+#include "honeyprocs-common.h"
+#include "status.h"
+
+typedef struct hp_scratch_t {
+    uint8_t *buf;
+    size_t size;
+} hp_scratch_t;
+
+/**
+ * Make sure the buffer holds at least size bytes.  The contents are kept
+ * when the buffer has to grow.
+ */
+hp_status_t hp_scratch_reserve(hp_scratch_t *scratch, size_t size);
+void hp_scratch_free(hp_scratch_t *scratch);
+
+#endif /* __UTIL_SCRATCH__H__ */
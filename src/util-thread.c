@@ -0,0 +1,207 @@
+/**
+ * Copyright(C) 2018, Juniper Networks, Inc.
+ * All rights reserved
+ *
+ * This SOFTWARE is licensed under the license provided in the LICENSE.txt
+ * file.  By downloading, installing, copying, or otherwise using the
+ * SOFTWARE, you agree to be bound by the terms of that license.  This
+ * SOFTWARE is not an official Juniper product.
+ *
+ * Third-Party Code: This SOFTWARE may depend on other components under
+ * separate copyright notice and license terms.  Your use of the source
+ * code for those components is subject to the term and conditions of
+ * the respective license as noted in the Third-Party source code.
+ */
+
+/**
+ * @author Anoop Saldanha
+ */
+
+#include "honeyprocs-common.h"
+#include "util-thread.h"
+#include "status.h"
+
+#ifdef WINDOWS
+
+static DWORD WINAPI hp_thread_start(LPVOID thread_)
+{
+    hp_thread_t *thread = (hp_thread_t *)thread_;
+
+    thread->func(thread->arg);
+
+    return 0;
+}
+
+hp_status_t hp_thread_create(hp_thread_t *thread,
+                             hp_thread_func_t func, void *arg)
+{
+    thread->func = func;
+    thread->arg = arg;
+    thread->handle = CreateThread(NULL, 0, hp_thread_start, thread, 0, NULL);
+
+    return (thread->handle != NULL) ? HP_STATUS_OK : HP_STATUS_ERROR;
+}
+
+void hp_thread_join(hp_thread_t *thread)
+{
+    WaitForSingleObject(thread->handle, INFINITE);
+    CloseHandle(thread->handle);
+
+    return;
+}
+
+void hp_mutex_init(hp_mutex_t *mutex)
+{
+    InitializeCriticalSection(mutex);
+}
+
+void hp_mutex_destroy(hp_mutex_t *mutex)
+{
+    DeleteCriticalSection(mutex);
+}
+
+void hp_mutex_lock(hp_mutex_t *mutex)
+{
+    EnterCriticalSection(mutex);
+}
+
+void hp_mutex_unlock(hp_mutex_t *mutex)
+{
+    LeaveCriticalSection(mutex);
+}
+
+void hp_cond_init(hp_cond_t *cond)
+{
+    InitializeConditionVariable(cond);
+}
+
+void hp_cond_destroy(hp_cond_t *cond)
+{
+    /* Nothing to release on Windows */
+}
+
+void hp_cond_wait(hp_cond_t *cond, hp_mutex_t *mutex)
+{
+    SleepConditionVariableCS(cond, mutex, INFINITE);
+}
+
+void hp_cond_timedwait(hp_cond_t *cond, hp_mutex_t *mutex, uint32_t ms)
+{
+    SleepConditionVariableCS(cond, mutex, ms);
+}
+
+void hp_cond_signal(hp_cond_t *cond)
+{
+    WakeConditionVariable(cond);
+}
+
+void hp_cond_broadcast(hp_cond_t *cond)
+{
+    WakeAllConditionVariable(cond);
+}
+
+uint32_t hp_cpu_count(void)
+{
+    SYSTEM_INFO si;
+
+    GetSystemInfo(&si);
+
+    return si.dwNumberOfProcessors;
+}
+
+#else /* !WINDOWS */
+
+static void *hp_thread_start(void *thread_)
+{
+    hp_thread_t *thread = (hp_thread_t *)thread_;
+
+    thread->func(thread->arg);
+
+    return NULL;
+}
+
+hp_status_t hp_thread_create(hp_thread_t *thread,
+                             hp_thread_func_t func, void *arg)
+{
+    thread->func = func;
+    thread->arg = arg;
+
+    return (pthread_create(&thread->handle, NULL,
+                           hp_thread_start, thread) == 0) ?
+        HP_STATUS_OK : HP_STATUS_ERROR;
+}
+
+void hp_thread_join(hp_thread_t *thread)
+{
+    pthread_join(thread->handle, NULL);
+
+    return;
+}
+
+void hp_mutex_init(hp_mutex_t *mutex)
+{
+    pthread_mutex_init(mutex, NULL);
+}
+
+void hp_mutex_destroy(hp_mutex_t *mutex)
+{
+    pthread_mutex_destroy(mutex);
+}
+
+void hp_mutex_lock(hp_mutex_t *mutex)
+{
+    pthread_mutex_lock(mutex);
+}
+
+void hp_mutex_unlock(hp_mutex_t *mutex)
+{
+    pthread_mutex_unlock(mutex);
+}
+
+void hp_cond_init(hp_cond_t *cond)
+{
+    pthread_cond_init(cond, NULL);
+}
+
+void hp_cond_destroy(hp_cond_t *cond)
+{
+    pthread_cond_destroy(cond);
+}
+
+void hp_cond_wait(hp_cond_t *cond, hp_mutex_t *mutex)
+{
+    pthread_cond_wait(cond, mutex);
+}
+
+void hp_cond_timedwait(hp_cond_t *cond, hp_mutex_t *mutex, uint32_t ms)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_sec += ms / 1000;
+    ts.tv_nsec += (long)(ms % 1000) * 1000000;
+    if (ts.tv_nsec >= 1000000000) {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000;
+    }
+    pthread_cond_timedwait(cond, mutex, &ts);
+}
+
+void hp_cond_signal(hp_cond_t *cond)
+{
+    pthread_cond_signal(cond);
+}
+
+void hp_cond_broadcast(hp_cond_t *cond)
+{
+    pthread_cond_broadcast(cond);
+}
+
+uint32_t hp_cpu_count(void)
+{
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+
+    return (n > 0) ? (uint32_t)n : 1;
+}
+
+#endif /* WINDOWS */
@@ -0,0 +1,78 @@
+/**
+ * Copyright(C) 2018, Juniper Networks, Inc.
+ * All rights reserved
+ *
+ * This SOFTWARE is licensed under the license provided in the LICENSE.txt
+ * file.  By downloading, installing, copying, or otherwise using the
+ * SOFTWARE, you agree to be bound by the terms of that license.  This
+ * SOFTWARE is not an official Juniper product.
+ *
+ * Third-Party Code: This SOFTWARE may depend on other components under
+ * separate copyright notice and license terms.  Your use of the source
+ * code for those components is subject to the term and conditions of
+ * the respective license as noted in the Third-Party source code.
+ */
+
+/**
+ * @author Anoop Saldanha
+ */
+
+/* Threads, mutexes and condition variables over the Windows and pthreads
+ * primitives. */
+
+#ifndef __UTIL_THREAD__H__
+#define __UTIL_THREAD__H__
+
+#include "honeyprocs-common.h"
+#include "status.h"
+
+#ifndef WINDOWS
+#include <pthread.h>
+#include <time.h>
+#endif
+
+typedef void (*hp_thread_func_t)(void *arg);
+
+typedef struct hp_thread_t {
+#ifdef WINDOWS
+    HANDLE handle;
+#else
+    pthread_t handle;
+#endif
+    hp_thread_func_t func;
+    void *arg;
+} hp_thread_t;
+
+#ifdef WINDOWS
+typedef CRITICAL_SECTION hp_mutex_t;
+typedef CONDITION_VARIABLE hp_cond_t;
+#else
+typedef pthread_mutex_t hp_mutex_t;
+typedef pthread_cond_t hp_cond_t;
+#endif
+
+/**
+ * Start a thread running func(arg).  The hp_thread_t has to stay valid
+ * till hp_thread_join().
+ */
+hp_status_t hp_thread_create(hp_thread_t *thread,
+                             hp_thread_func_t func, void *arg);
+void hp_thread_join(hp_thread_t *thread);
+
+void hp_mutex_init(hp_mutex_t *mutex);
+void hp_mutex_destroy(hp_mutex_t *mutex);
+void hp_mutex_lock(hp_mutex_t *mutex);
+void hp_mutex_unlock(hp_mutex_t *mutex);
+
+void hp_cond_init(hp_cond_t *cond);
+void hp_cond_destroy(hp_cond_t *cond);
+void hp_cond_wait(hp_cond_t *cond, hp_mutex_t *mutex);
+/* Wait for at most ms, as woken early by a signal */
+void hp_cond_timedwait(hp_cond_t *cond, hp_mutex_t *mutex, uint32_t ms);
+void hp_cond_signal(hp_cond_t *cond);
+void hp_cond_broadcast(hp_cond_t *cond);
+
+/* No of online processors */
+uint32_t hp_cpu_count(void);
+
+#endif /* __UTIL_THREAD__H__ */
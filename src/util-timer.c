@@ -0,0 +1,122 @@
+/**
+ * Copyright(C) 2018, Juniper Networks, Inc.
+ * All rights reserved
+ *
+ * This SOFTWARE is licensed under the license provided in the LICENSE.txt
+ * file.  By downloading, installing, copying, or otherwise using the
+ * SOFTWARE, you agree to be bound by the terms of that license.  This
+ * SOFTWARE is not an official Juniper product.
+ *
+ * Third-Party Code: This SOFTWARE may depend on other components under
+ * separate copyright notice and license terms.  Your use of the source
+ * code for those components is subject to the term and conditions of
+ * the respective license as noted in the Third-Party source code.
+ */
+
+/**
+ * @author Anoop Saldanha
+ */
+
+#include "honeyprocs-common.h"
+#include "util-timer.h"
+#include "status.h"
+
+void hp_timer_wheel_init(hp_timer_wheel_t *wheel, uint32_t tick_ms)
+{
+    uint32_t i;
+
+    memset(wheel, 0, sizeof(*wheel));
+    wheel->tick_ms = tick_ms;
+    for (i = 0; i < HP_TIMER_WHEEL_SLOTS; i++) {
+        wheel->slots[i].next = &wheel->slots[i];
+        wheel->slots[i].prev = &wheel->slots[i];
+    }
+
+    return;
+}
+
+void hp_timer_init(hp_timer_t *timer, void *data)
+{
+    memset(timer, 0, sizeof(*timer));
+    timer->data = data;
+
+    return;
+}
+
+bool hp_timer_is_armed(hp_timer_t *timer)
+{
+    return (timer->next != NULL);
+}
+
+void hp_timer_del(hp_timer_t *timer)
+{
+    if (!hp_timer_is_armed(timer))
+        return;
+
+    timer->prev->next = timer->next;
+    timer->next->prev = timer->prev;
+    timer->next = NULL;
+    timer->prev = NULL;
+
+    return;
+}
+
+void hp_timer_add(hp_timer_wheel_t *wheel, hp_timer_t *timer,
+                  uint32_t delay_ms)
+{
+    hp_timer_t *head;
+    uint64_t ticks;
+
+    hp_timer_del(timer);
+
+    ticks = (delay_ms + wheel->tick_ms - 1) / wheel->tick_ms;
+    if (ticks == 0)
+        ticks = 1;
+    timer->expire_tick = wheel->tick + ticks;
+
+    head = &wheel->slots[timer->expire_tick % HP_TIMER_WHEEL_SLOTS];
+    timer->next = head;
+    timer->prev = head->prev;
+    head->prev->next = timer;
+    head->prev = timer;
+
+    return;
+}
+
+void hp_timer_wheel_advance(hp_timer_wheel_t *wheel,
+                            hp_timer_expire_func_t expire_func,
+                            void *arg)
+{
+    hp_timer_t *head;
+    hp_timer_t *timer;
+    hp_timer_t *timer_next;
+    hp_timer_t expired;
+
+    wheel->tick++;
+    head = &wheel->slots[wheel->tick % HP_TIMER_WHEEL_SLOTS];
+
+    /* Pull the due timers off the slot first, so that timers re-armed by
+     * expire_func for a full revolution later aren't seen again now. */
+    expired.next = &expired;
+    expired.prev = &expired;
+    for (timer = head->next; timer != head; timer = timer_next) {
+        timer_next = timer->next;
+        if (timer->expire_tick > wheel->tick)
+            continue;
+
+        timer->prev->next = timer->next;
+        timer->next->prev = timer->prev;
+        timer->next = &expired;
+        timer->prev = expired.prev;
+        expired.prev->next = timer;
+        expired.prev = timer;
+    }
+
+    while (expired.next != &expired) {
+        timer = expired.next;
+        hp_timer_del(timer);
+        expire_func(timer->data, arg);
+    }
+
+    return;
+}
@@ -0,0 +1,72 @@
+/**
+ * Copyright(C) 2018, Juniper Networks, Inc.
+ * All rights reserved
+ *
+ * This SOFTWARE is licensed under the license provided in the LICENSE.txt
+ * file.  By downloading, installing, copying, or otherwise using the
+ * SOFTWARE, you agree to be bound by the terms of that license.  This
+ * SOFTWARE is not an official Juniper product.
+ *
+ * Third-Party Code: This SOFTWARE may depend on other components under
+ * separate copyright notice and license terms.  Your use of the source
+ * code for those components is subject to the term and conditions of
+ * the respective license as noted in the Third-Party source code.
+ */
+
+/**
+ * @author Anoop Saldanha
+ */
+
+/* Hashed timer wheel.  Timers are embedded in the caller's structures, so
+ * arming and disarming never allocates. */
+
+#ifndef __UTIL_TIMER__H__
+#define __UTIL_TIMER__H__
+
+#include "honeyprocs-common.h"
+#include "status.h"
+
+#define HP_TIMER_WHEEL_SLOTS 256
+
+typedef struct hp_timer_t {
+    struct hp_timer_t *next;
+    struct hp_timer_t *prev;
+    uint64_t expire_tick;
+    /* The user data handed back on expiry */
+    void *data;
+} hp_timer_t;
+
+typedef struct hp_timer_wheel_t {
+    uint32_t tick_ms;
+    uint64_t tick;
+    /* Circular list heads, one per slot */
+    hp_timer_t slots[HP_TIMER_WHEEL_SLOTS];
+} hp_timer_wheel_t;
+
+typedef void (*hp_timer_expire_func_t)(void *data, void *arg);
+
+void hp_timer_wheel_init(hp_timer_wheel_t *wheel, uint32_t tick_ms);
+
+void hp_timer_init(hp_timer_t *timer, void *data);
+
+/**
+ * Arm a timer to expire delay_ms from the current tick.  An armed timer is
+ * re-armed.  Delays are rounded up to whole ticks, with a minimum of one.
+ */
+void hp_timer_add(hp_timer_wheel_t *wheel, hp_timer_t *timer,
+                  uint32_t delay_ms);
+
+void hp_timer_del(hp_timer_t *timer);
+
+bool hp_timer_is_armed(hp_timer_t *timer);
+
+/**
+ * Move the wheel forward by one tick and call expire_func for every timer
+ * that is due.  Expired timers are disarmed before the call, so
+ * expire_func is free to re-arm or delete them.
+ */
+void hp_timer_wheel_advance(hp_timer_wheel_t *wheel,
+                            hp_timer_expire_func_t expire_func,
+                            void *arg);
+
+#endif /* __UTIL_TIMER__H__ */